@@ -53,29 +53,27 @@
 
 #include "main.h"
 
-// #include "PicoStdioLog.h"
-// #include "PicoAsyncLog.h"
-// #include "PicoUARTEndpoint.h"
-// #include "PicoCDCEndpoint.h"
+#include "DockServer.h"
 #include "PosixScheduler.h"
-// #include "PicoSDCard.h"
-// #include "PicoSystem.h"
+#include "Posix/Endpoints/PosixSocketEndpoint.h"
+#include "Posix/Endpoints/PosixUARTEndpoint.h"
 
 #include "common/Scheduler.h"
 #include "common/SystemTask.h"
-// #include "common/Endpoints/Dock.h"
-// #include "common/Endpoints/StdioLog.h"
-// #include "common/Endpoints/TestEventGenerator.h"
-// #include "common/Filters/HayesFilter.h"
-// #include "common/Filters/MNPFilter.h"
-// #include "common/Pipes/BufferedPipe.h"
-// #include "common/Pipes/MNPThrottle.h"
-// #include "common/Pipes/Tee.h"
+#include "common/Endpoints/Dock.h"
+#include "common/Filters/HayesFilter.h"
+#include "common/Filters/MNPFilter.h"
+#include "common/Pipes/BridgePipe.h"
+#include "common/Pipes/MNPThrottle.h"
+#include "common/Pipes/StaticPipeline.h"
 
 #include <FL/Fl_Window.H>
 #include <FL/Fl.H>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
 
 using namespace nd;
 
@@ -85,60 +83,41 @@ UserSettings user_settings;
 // Log to debugging probe on uart1.
 Logger Log;
 
-// Distributes times slices to all tasks.
+// Distributes times slices to the serial ports, in the FLTK idle loop.
 PosixScheduler scheduler;
 
+// Distributes times slices to MNP, the Dock, and the SD Card, in its own thread.
+PosixScheduler dock_scheduler;
+std::atomic<bool> dock_quit { false };
+
 // One task to manage the overall system.
 SystemTask system_task(scheduler);
 
 // Task that updates the status display.
-StatusDisplay app_status(scheduler);
+StatusDisplay app_status(dock_scheduler);
 
 // Endpoints for data exchange.
-//UARTEndpoint uart_endpoint { scheduler };
-//CDCEndpoint cdc_endpoint { scheduler, 0 };
-PosixSDCardEndpoint sdcard_endpoint { scheduler };
-//Dock dock_endpoint(scheduler);
-
-// Filters and loggers.
-//HayesFilter uart_hayes(scheduler, 0);
-//HayesFilter cdc_hayes(scheduler, 1);
-//MNPFilter mnp_filter(scheduler);
-//DTRSwitch dtr_switch;
-
-// Pipes to connect everything.
-//MNPThrottle mnp_throttle(scheduler);
-//BufferedPipe buffer_to_cdc(scheduler);
-//BufferedPipe buffer_to_uart(scheduler);
-
+PosixUARTEndpoint uart_endpoint { scheduler };
+PosixSocketEndpoint socket_endpoint { scheduler };
+PosixSDCardEndpoint sdcard_endpoint { dock_scheduler };
 
-#if 0
+// What the tasks of the pipe graph share.
+Context context { dock_scheduler, user_settings, sdcard_endpoint, app_status };
 
-// -- The scheduler spins while the dongle is powered and delivers time slices to its spokes.
-PicoScheduler scheduler;
-PicoSystemTask system_task(scheduler);
-
-// -- Instantiate all the endpoints we need.
-PicoUARTEndpoint uart_endpoint { scheduler };
-PicoCDCEndpoint cdc_endpoint { scheduler, 0 };
-PicoSDCardEndpoint sdcard_endpoint { scheduler };
-Dock dock_endpoint(scheduler);
-
-// -- Instantiate filters and loggers.
-HayesFilter uart_hayes(scheduler, 0);
-HayesFilter cdc_hayes(scheduler, 1);
-// -- Experimental MNP Filter
-MNPFilter mnp_filter(scheduler);
-
-// -- Instantiate pipes to connect everything.
-MNPThrottle mnp_throttle(scheduler);
-BufferedPipe buffer_to_cdc(scheduler);
-BufferedPipe buffer_to_uart(scheduler);
+// Dock emulator, talking to the Newton through MNP.
+Dock dock_endpoint(context);
 
+// Filters and loggers.
+HayesFilter uart_hayes(context, 0);
+MNPFilter mnp_filter(dock_scheduler);
 
-void nsof_test();
+// Pipes to connect everything.
+MNPThrottle mnp_throttle(context);
+StaticPipeline<StaticBuffer<11>> buffer_to_uart(scheduler);
 
-#endif
+// The edges between the two partitions.
+BridgePipe uart_to_dock { scheduler, dock_scheduler };
+BridgePipe dock_to_uart { dock_scheduler, scheduler };
 
 // -- Everything is already allocated. Now link the endpoints and run the scheduler.
 int main(int argc, char *argv[])
@@ -150,59 +129,60 @@ int main(int argc, char *argv[])
     // user_settings.mess_up_flash();
     user_settings.read();
     scheduler.signal_all( Event {Event::Type::SIGNAL, Event::Subtype::USER_SETTINGS_CHANGED} );
-
-#if 0
-    //Log.log("Starting...\n");
-    //test_sd_card();
+    dock_scheduler.signal_all( Event {Event::Type::SIGNAL, Event::Subtype::USER_SETTINGS_CHANGED} );
+
+    // -- The Newton is on a pseudo-terminal, or the tty in ND_UART_DEVICE, or
+    //    an emulator connects to the socket in ND_SOCKET. The endpoint that is
+    //    not connected stays closed.
+    const char *socket_address = getenv("ND_SOCKET");
+    UARTEndpoint &newton_port = (socket_address && *socket_address)
+        ? static_cast<UARTEndpoint&>(socket_endpoint) : uart_endpoint;
+
+    // -- ND_SESSIONS=n serves n Newtons on n consecutive sockets, starting at
+    //    ND_SOCKET, with one worker thread per core.
+    const char *sessions = getenv("ND_SESSIONS");
+    if (sessions && atoi(sessions) > 0 && socket_address && *socket_address) {
+        DockServer server(atoi(sessions), std::thread::hardware_concurrency(), socket_address, "");
+        server.start();
+        Fl::run();
+        return 0;
+    }
 
     // -- Connect the Endpoints inside the dongle with pipes.
-    // UART ---------------> UART_Hayes --------------------> CDC Hayes ---> buffer ---> CDC
-    // UART <--- buffer <--- UART_Hayes <--- MNPThrottle <--- CDC Hayes <--------------- CDC
-
-    // -- Goal:
-    // UART ---------------> UART_Hayes --------------------> Matrix ---> CDC Hayes ---> buffer ---> CDC
-    // UART <--- buffer <--- UART_Hayes <--- MNPThrottle <--- Matrix <--- CDC Hayes <--------------- CDC
-    //                                                          ↑↓
-    //                                                          MNP
-    //                                                          ↑↓
-    //                                                         Dock
-    //                                                          ↑↓
-    //                                                        SDCard
-
-#if 0
-    // Connect the UART to USB
-    /**/  uart_endpoint >> uart_hayes.downstream;
-    /**/    uart_hayes.upstream >> cdc_hayes.upstream;
-    /**/      cdc_hayes.downstream >> buffer_to_cdc >> cdc_endpoint;
-    // Connect USB to the UART
-    /**/  cdc_endpoint >> cdc_hayes.downstream;
-    /**/    cdc_hayes.upstream >> mnp_throttle >> uart_hayes.upstream;
-    /**/      uart_hayes.downstream >> buffer_to_uart >> uart_endpoint;
-#else
-    // Connect the UART to Dock
-    /**/  uart_endpoint >> uart_hayes.downstream;
-    /**/    uart_hayes.upstream >> cdc_hayes.upstream;
-    /**/      cdc_hayes.downstream >> buffer_to_cdc >> mnp_filter.newt;
-    /**/        mnp_filter.newt >> dock_endpoint;
-    // Connect USB to the UART
+    // UART ---------------> UART_Hayes --------------------> MNP ---> Dock
+    // UART <--- buffer <--- UART_Hayes <--- MNPThrottle <--- MNP <--- Dock
+    //                                                                  ↑↓
+    //                                                                SDCard
+    // The UART runs in the FLTK idle loop, everything from UART_Hayes on
+    // runs in the dock thread. The two edges in between are bridges.
+
+    /**/  newton_port >> uart_to_dock >> uart_hayes.downstream;
+    /**/    uart_hayes.upstream >> mnp_filter.newt;
+    /**/      mnp_filter.newt >> dock_endpoint;
     /**/  dock_endpoint >> mnp_filter.dock;
-    /**/    mnp_filter.dock >> cdc_hayes.downstream;
-    /**/      cdc_hayes.upstream >> mnp_throttle >> uart_hayes.upstream;
-    /**/        uart_hayes.downstream >> buffer_to_uart >> uart_endpoint;
-#endif
+    /**/    mnp_filter.dock >> mnp_throttle >> uart_hayes.upstream;
+    /**/      uart_hayes.downstream >> dock_to_uart >> buffer_to_uart >> newton_port;
 
-    // -- Give both serial ports access to the SD Card (currently for debugging only)
+    // -- Give the serial port access to the SD Card (currently for debugging only)
     uart_hayes.link(&sdcard_endpoint);
-    cdc_hayes.link(&sdcard_endpoint);
 
     // -- The scheduler will call all instances of classes that are derived from Task.
     scheduler.init();
+    dock_scheduler.init();
 
-    // -- Now we can start the scheduler. It will call all spokes in a loop.
-    scheduler.run();
+    // -- Run the dock partition on its own core.
+    std::thread dock_thread([]() {
+        while (!dock_quit) {
+            dock_scheduler.run(64);
+            std::this_thread::yield();
+        }
+    });
 
-#endif
+    // -- Run the scheduler whenever FLTK has no events to handle.
+    Fl::add_idle([](void*) { scheduler.run(64); });
 
     Fl::run();
+    dock_quit = true;
+    dock_thread.join();
     return 0;
 }
@@ -15,7 +15,7 @@ using namespace nd;
  */
 bool TestStdioLog::would_block() {
     fd_set write_fds;
-    struct timeval timeout { .tv_sec = 0, .tv_usec = 0 };
+    struct timeval timeout { 0, 0 };
     FD_ZERO(&write_fds);
     FD_SET(fileno(stdout), &write_fds);
     int result = select(fileno(stdout) + 1, NULL, &write_fds, NULL, &timeout);
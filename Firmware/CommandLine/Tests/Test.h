@@ -0,0 +1,79 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_TESTS_TEST_H
+#define ND_TESTS_TEST_H
+
+#include "common/Endpoint.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nd {
+namespace test {
+
+/// Number of failed checks in the current run.
+extern int failures;
+
+/// Count and print a failed check.
+void check(bool ok, const char *expr, const char *file, int line);
+
+/// Write a file of `size` bytes that starts like a package, and return its content.
+std::vector<uint8_t> write_package(const std::string &path, uint32_t size);
+
+/// Counts what was rushed back.
+struct Source : Pipe {
+    uint32_t rushed_back = 0;
+    Result rush_back(Event /*event*/) override { rushed_back++; return Result::OK; }
+};
+
+/// Collects data bytes while it is open.
+struct Sink : Pipe {
+    bool open = true;
+    std::vector<uint8_t> data;
+    Result send(Event event) override {
+        if (!open) return Result::REJECTED;
+        if (event.type() == Event::Type::DATA) data.push_back(event.data());
+        return Result::OK;
+    }
+};
+
+/// A Sink at the end of a pipeline, which also remembers the last flow control change.
+struct SinkEndpoint : Endpoint {
+    using Endpoint::Endpoint;
+    bool open = true;
+    int high_water = -1;
+    std::vector<uint8_t> data;
+    Result send(Event event) override {
+        if (!open) return Result::REJECTED;
+        if (event.type() == Event::Type::DATA) data.push_back(event.data());
+        return Result::OK;
+    }
+    void set_high_water(bool on) override { high_water = on; }
+};
+
+} // namespace test
+} // namespace nd
+
+/// Check a condition and keep going if it fails.
+#define ND_CHECK(expr) nd::test::check((expr), #expr, __FILE__, __LINE__)
+
+// -- Test suites, one per file in Tests/, listed in main.cpp
+void test_backup_reader();
+void test_bridge_pipe();
+void test_des();
+void test_dock();
+void test_fan_out();
+void test_nsof();
+void test_nsof_view();
+void test_pipe_splice();
+void test_sdcard();
+void test_sdcard_index();
+void test_static_pipeline();
+void test_switch_matrix();
+void test_timer_wheel();
+
+#endif // ND_TESTS_TEST_H
@@ -0,0 +1,149 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Reading soup backups with records that are too large to restore.
+
+#include "Test.h"
+
+#include "main.h"
+#include "PosixScheduler.h"
+#include "common/Endpoints/BackupReader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+using namespace nd;
+
+extern PosixScheduler scheduler;
+
+namespace {
+
+void put_u32(std::vector<uint8_t> &v, uint32_t x) {
+    v.push_back(x >> 24); v.push_back(x >> 16); v.push_back(x >> 8); v.push_back(x);
+}
+
+/// NSOF frame {_uniqueID: id, data: <binary of `size` bytes>}
+std::vector<uint8_t> entry(uint32_t id, uint32_t size) {
+    std::vector<uint8_t> v = { 2, 6, 2, 7, 9 };
+    for (char c: std::string("_uniqueID")) v.push_back(c);
+    v.push_back(7); v.push_back(4);
+    for (char c: std::string("data")) v.push_back(c);
+    v.push_back(0); v.push_back(255); put_u32(v, id << 2);
+    v.push_back(3); v.push_back(255); put_u32(v, size); v.push_back(0);
+    for (uint32_t i = 0; i < size; ++i) v.push_back((uint8_t)(i * 13 + id));
+    return v;
+}
+
+void add_record(std::vector<uint8_t> &log, const std::vector<uint8_t> &data) {
+    log.insert(log.end(), { 'e', 'n', 't', 'r' });
+    put_u32(log, data.size());
+    log.insert(log.end(), data.begin(), data.end());
+    while (log.size() % 4) log.push_back(0);
+}
+
+/// Index of the live entries, sorted by ID, as Dock writes it.
+std::vector<uint8_t> index_of(const std::vector<std::pair<uint32_t, std::vector<uint8_t>>> &entries) {
+    std::vector<uint8_t> v = { 'n', 'd', 'b', 'x' };
+    put_u32(v, 16 + 12 * entries.size());
+    put_u32(v, BackupReader::kIndexVersion);
+    put_u32(v, 1234); // store signature
+    put_u32(v, 1000); // time
+    put_u32(v, entries.size());
+    for (auto &e: entries) {
+        put_u32(v, e.first);
+        put_u32(v, BackupReader::hash(e.second.data(), e.second.size()));
+        put_u32(v, e.second.size());
+    }
+    return v;
+}
+
+void write_file(const std::string &path, const std::vector<uint8_t> &data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+/// Read all entries of a backup. Returns false if the reader does not finish.
+bool read_all(BackupReader &reader, const std::u16string &path, std::vector<std::vector<uint8_t>*> &out) {
+    reader.open(path);
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!reader.done() || !reader.index_read()) {
+        if (std::chrono::steady_clock::now() > end) return false;
+        reader.task();
+        scheduler.run(1);
+        while (auto e = reader.next()) out.push_back(e);
+    }
+    return true;
+}
+
+bool is_entry(const std::vector<uint8_t> *record, const std::vector<uint8_t> &data) {
+    return record->size() == 8 + ((data.size() + 3) & ~3u)
+        && std::equal(data.begin(), data.end(), record->begin() + 8);
+}
+
+} // namespace
+
+void test_backup_reader() {
+    char root[] = "/tmp/nd_backup_XXXXXX";
+    ND_CHECK(mkdtemp(root) != nullptr);
+    sdcard_endpoint.set_root(root);
+    scheduler.init();
+
+    auto small1 = entry(1, 100);
+    auto small2 = entry(2, 300);
+    auto huge_old = entry(2, kRestoreEntrySize + 100); // an older version of entry 2
+    auto huge = entry(3, kRestoreEntrySize + 100);
+
+    // An old version that is too large is skipped, the soup is read to the end
+    {
+        std::vector<uint8_t> log;
+        add_record(log, small1);
+        add_record(log, huge_old);
+        add_record(log, small2);
+        write_file(std::string(root) + "/A.sbk", log);
+        write_file(std::string(root) + "/A.sbx", index_of({ { 1, small1 }, { 2, small2 } }));
+        BackupReader reader(sdcard_endpoint, 4, 0);
+        std::vector<std::vector<uint8_t>*> got;
+        ND_CHECK(read_all(reader, u"/A", got));
+        ND_CHECK(reader.size() == 2 && reader.too_large() == 0);
+        ND_CHECK(reader.error() == 0);
+        ND_CHECK(got.size() == 2);
+        if (got.size() == 2) {
+            ND_CHECK(is_entry(got[0], small1));
+            ND_CHECK(is_entry(got[1], small2));
+        }
+        for (auto e: got) delete e;
+    }
+
+    // A live entry that is too large is reported before anything is sent
+    {
+        std::vector<uint8_t> log;
+        add_record(log, small1);
+        add_record(log, huge);
+        write_file(std::string(root) + "/B.sbk", log);
+        write_file(std::string(root) + "/B.sbx", index_of({ { 1, small1 }, { 3, huge } }));
+        BackupReader reader(sdcard_endpoint, 4, 0);
+        reader.open(u"/B");
+        for (int i = 0; i < 100000 && !reader.index_read(); ++i) {
+            reader.task();
+            scheduler.run(1);
+        }
+        ND_CHECK(reader.index_read());
+        ND_CHECK(reader.size() == 2 && reader.too_large() == 1);
+        reader.cancel();
+        for (int i = 0; i < 100000 && !reader.done(); ++i) {
+            reader.task();
+            scheduler.run(1);
+        }
+        ND_CHECK(reader.done());
+    }
+
+    for (auto name: { "/A.sbk", "/A.sbx", "/B.sbk", "/B.sbx" })
+        remove((std::string(root) + name).c_str());
+    rmdir(root);
+}
@@ -0,0 +1,96 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Bytes from a serial port crossing into another partition, with flow control.
+
+#include "Test.h"
+
+#include "main.h"
+#include "PosixScheduler.h"
+#include "Posix/Endpoints/PosixUARTEndpoint.h"
+#include "common/Pipes/BridgePipe.h"
+
+#include <chrono>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+using namespace nd;
+
+namespace {
+
+/// Remembers the last flow control change.
+struct UART : PosixUARTEndpoint {
+    using PosixUARTEndpoint::PosixUARTEndpoint;
+    int high_water = -1;
+    void set_high_water(bool on) override {
+        high_water = on;
+        PosixUARTEndpoint::set_high_water(on);
+    }
+};
+
+/// Collects bytes, and events that were rushed to it.
+struct RushSink : test::Sink {
+    std::vector<uint32_t> rushed;
+    Result rush(Event event) override { rushed.push_back(event.raw()); return Result::OK; }
+};
+
+template<typename Pred>
+bool run_until(Scheduler &a, Scheduler &b, Pred done) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > end) return false;
+        a.run(1);
+        b.run(1);
+    }
+    return true;
+}
+
+} // namespace
+
+void test_bridge_pipe() {
+    PosixScheduler io, dock;
+    UART uart(io);
+    BridgePipe bridge(io, dock, 6); // 64 slots, so the ring fills up quickly
+    test::Sink sink;
+    sink.open = false;
+    uart >> bridge >> sink;
+    Pipe dtr;
+    BridgePipe dtr_bridge(io, dock);
+    RushSink dtr_sink;
+    dtr >> dtr_bridge >> dtr_sink;
+    io.init();
+    dock.init();
+    ND_CHECK(!uart.pty_name().empty());
+
+    int fd = ::open(uart.pty_name().c_str(), O_RDWR | O_NOCTTY);
+    ND_CHECK(fd >= 0);
+    if (fd < 0) return;
+    termios tio;
+    ::tcgetattr(fd, &tio);
+    ::cfmakeraw(&tio);
+    ::tcsetattr(fd, TCSANOW, &tio);
+    uint8_t bytes[200];
+    for (uint32_t i = 0; i < sizeof(bytes); i++) bytes[i] = (uint8_t)(i * 7);
+    ND_CHECK(::write(fd, bytes, sizeof(bytes)) == (ssize_t)sizeof(bytes));
+
+    // The ring fills up while nothing drains it, and the UART stops reading
+    ND_CHECK(run_until(io, dock, [&]{ return uart.high_water == 1; }));
+
+    // Draining the ring clears the flag, and every byte arrives in order
+    sink.open = true;
+    ND_CHECK(run_until(io, dock, [&]{ return sink.data.size() == sizeof(bytes) && uart.high_water == 0; }));
+    ND_CHECK(sink.data == std::vector<uint8_t>(bytes, bytes + sizeof(bytes)));
+    ::close(fd);
+
+    // A rushed DTR change waits behind the bytes before it, and is rushed on
+    // by the other side
+    Event dtr_on { Event::Type::UART, Event::Subtype::UART_DTR, 1 };
+    ND_CHECK(dtr.send(Event { (uint8_t)'A' }).ok());
+    ND_CHECK(dtr.rush(dtr_on).ok());
+    ND_CHECK(run_until(io, dock, [&]{ return !dtr_sink.rushed.empty(); }));
+    ND_CHECK(dtr_sink.data == std::vector<uint8_t>({ 'A' }));
+    ND_CHECK(dtr_sink.rushed == std::vector<uint32_t>({ dtr_on.raw() }));
+}
@@ -0,0 +1,91 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Known answers for the Newton DES variant. The expected values were
+// computed with the bit-by-bit implementation from newton-framework that
+// the table driven engine in DESKey.cpp replaced.
+
+#include "Test.h"
+
+#include "common/Newton/DESKey.h"
+
+static bool equal(const SNewtNonce &a, uint32_t hi, uint32_t lo) {
+    return a.hi == hi && a.lo == lo;
+}
+
+static void to_unichar(const char *text, UniChar *out) {
+    while (*text)
+        *out++ = (UniChar)*text++;
+    *out = 0;
+}
+
+void test_des() {
+    // Passwords to keys, and a nonce encoded with that key
+    static const struct {
+        const char *password;
+        uint32_t key_hi, key_lo;
+        uint32_t nonce_hi, nonce_lo; // 0x12345678 0x9abcdef0 encoded
+    } passwords[] = {
+        { "", 0xf207bf4fu, 0x851b167du, 0x5882e2a6u, 0x69279a2au },
+        { "secret!", 0x25525e61u, 0xcf9f7afdu, 0xad67b80cu, 0xda13a9b5u },
+        { "Newton", 0x573861c2u, 0x92c18998u, 0xed07a841u, 0x709efd0fu },
+        { "ABCDEFGHIJKLMNOP", 0xcb9494b1u, 0x978943c8u, 0x2581aab3u, 0x37532862u },
+    };
+    DESPasswordKey cache;
+    for (auto &p: passwords) {
+        UniChar password[32];
+        to_unichar(p.password, password);
+        SNewtNonce key;
+        DESCharToKey(password, &key);
+        ND_CHECK(equal(key, p.key_hi, p.key_lo));
+
+        SNewtNonce nonce { 0x12345678, 0x9abcdef0 };
+        DESEncodeNonce(&key, &nonce);
+        ND_CHECK(equal(nonce, p.nonce_hi, p.nonce_lo));
+        // The Newton decodes a nonce with the same direction as it encodes
+        SNewtNonce decoded { 0x12345678, 0x9abcdef0 };
+        DESDecodeNonce(&key, &decoded);
+        ND_CHECK(equal(decoded, p.nonce_hi, p.nonce_lo));
+
+        // The cached schedule must give the same answer
+        SNewtNonce block { 0x12345678, 0x9abcdef0 };
+        const DESKeySchedule *schedule = DESPasswordSchedule(&cache, password);
+        DESFastEncode(schedule, &block, 1);
+        ND_CHECK(equal(block, p.nonce_hi, p.nonce_lo));
+    }
+
+    // A single block with the DES textbook key and plaintext
+    SNewtNonce key { 0x13345779, 0x9bbcdff1 };
+    SNewtNonce block { 0x01234567, 0x89abcdef };
+    DESEncodeNonce(&key, &block);
+    ND_CHECK(equal(block, 0xb1a43e32, 0xd37048e8));
+
+    // CBC decoding with the expanded key schedule, as the Dock uses it
+    SNewtNonce cbc_key { 0x0123a567, 0x89abcdef };
+    SNewtNonce keys[16];
+    DESKeySched(&cbc_key, keys);
+    SNewtNonce blocks[3] = {
+        { 0xfdff204d, 0x44c99aba }, { 0xa2ff0cd8, 0x8aed77d9 }, { 0xbdab9bf0, 0x069c0a45 }
+    };
+    SNewtNonce vector { 0xdeadbeef, 0xcafef00d };
+    SNewtNonce *ptr = blocks;
+    for (int i = 0; i < 3; i++)
+        DESCBCDecode(keys, 8, &ptr, &vector);
+    ND_CHECK(ptr == blocks + 3);
+    ND_CHECK(equal(blocks[0], 0x401e7095, 0x7a7b14cd));
+    ND_CHECK(equal(blocks[1], 0x47a5dd13, 0x3f4f0ca0));
+    ND_CHECK(equal(blocks[2], 0x538d3077, 0x5f5a0e97));
+    ND_CHECK(equal(vector, 0xbdab9bf0, 0x069c0a45));
+
+    // The table driven CBC encoder against the same key
+    DESKeySchedule schedule;
+    DESFastKeySched(&cbc_key, &schedule);
+    SNewtNonce plain[3] = { { 1, 2 }, { 3, 4 }, { 5, 6 } };
+    SNewtNonce encode_vector { 0xdeadbeef, 0xcafef00d };
+    DESFastCBCEncode(&schedule, plain, 3, &encode_vector);
+    ND_CHECK(equal(plain[0], 0xfdff204d, 0x44c99aba));
+    ND_CHECK(equal(plain[1], 0xa2ff0cd8, 0x8aed77d9));
+    ND_CHECK(equal(plain[2], 0xbdab9bf0, 0x069c0a45));
+}
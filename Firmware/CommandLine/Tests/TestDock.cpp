@@ -0,0 +1,212 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Dock commands that go to the SD Card, on a host directory as the card.
+
+#include "Test.h"
+
+#include "main.h"
+#include "PosixScheduler.h"
+#include "common/Context.h"
+#include "common/Endpoints/Dock.h"
+#include "common/Newton/NSOF.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace nd;
+
+extern PosixScheduler scheduler;
+
+namespace {
+
+void feed(Dock &dock, const char *cmd, const std::vector<uint8_t> &payload) {
+    std::vector<uint8_t> b = { 'n', 'e', 'w', 't', 'd', 'o', 'c', 'k' };
+    b.insert(b.end(), cmd, cmd + 4);
+    uint32_t n = payload.size();
+    b.push_back(n >> 24); b.push_back(n >> 16); b.push_back(n >> 8); b.push_back(n);
+    b.insert(b.end(), payload.begin(), payload.end());
+    while (b.size() % 4) b.push_back(0);
+    for (uint8_t c: b) dock.send(Event(c));
+}
+
+/// The card runs in a worker thread, so give it real time.
+template<typename Pred>
+bool run_until(Pred done) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > end) return false;
+        scheduler.run(1);
+    }
+    return true;
+}
+
+void run_for(uint32_t msec) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(msec);
+    while (std::chrono::steady_clock::now() < end) scheduler.run(1);
+}
+
+/// Check that the Dock sent all of the command `cmd`, or at least `size` bytes of it.
+bool reply_is(const test::Sink &sink, const char *cmd, uint32_t size = 0xffffffff) {
+    const auto &b = sink.data;
+    if (b.size() < 16 || memcmp(b.data() + 8, cmd, 4) != 0) return false;
+    uint32_t n = ((uint32_t)b[12] << 24) | (b[13] << 16) | (b[14] << 8) | b[15];
+    return b.size() >= 16 + std::min((n + 3) & ~3u, size); // commands are padded to 4 bytes
+}
+
+std::vector<uint8_t> nsof(Ref ref) {
+    NSOF out;
+    out.to_nsof(ref);
+    return out.data();
+}
+
+/// A card with too little RAM to index a directory, that loses a file between counting and listing.
+struct ShrinkingCard : PosixSDCardEndpoint {
+    std::string doomed;
+    uint32_t opened = 0;
+    ShrinkingCard(Scheduler &scheduler) : PosixSDCardEndpoint(scheduler, 64) { }
+    bool prewarmed() const { return prewarm_ == Prewarm::DONE; }
+    uint32_t opendir() override {
+        if (!doomed.empty() && ++opened == 2) remove(doomed.c_str());
+        return PosixSDCardEndpoint::opendir();
+    }
+};
+
+/// Compare the package data of an `lpkg` reply, without the header and padding.
+bool lpkg_data(const test::Sink &sink, const std::vector<uint8_t> &expected) {
+    return reply_is(sink, "lpkg")
+        && memcmp(sink.data.data() + 16, expected.data(), expected.size()) == 0;
+}
+
+} // namespace
+
+/// A file of `size` bytes that starts like a package, so PKGINFO accepts it.
+std::vector<uint8_t> nd::test::write_package(const std::string &path, uint32_t size) {
+    std::vector<uint8_t> v(size);
+    for (uint32_t i = 0; i < size; ++i) v[i] = (uint8_t)(i * 7 + 3);
+    auto put32 = [&](uint32_t at, uint32_t x) { v[at] = x >> 24; v[at+1] = x >> 16; v[at+2] = x >> 8; v[at+3] = x; };
+    memcpy(v.data(), "package0", 8);
+    put32(12, 0x10000000); put32(16, 1);
+    put32(24, 4); put32(28, size); put32(32, 3000000000u);
+    put32(44, 52 + 32 + 4); put32(48, 1); // one part, the name "A"
+    v[84] = 0; v[85] = 'A'; v[86] = 0; v[87] = 0;
+    FILE *f = fopen(path.c_str(), "wb");
+    fwrite(v.data(), 1, v.size(), f);
+    fclose(f);
+    return v;
+}
+
+namespace {
+
+/// The file list must keep the count and size promised in its header, even if a file vanished.
+void test_shrinking_file_list(const std::string &root) {
+    std::string dir = root + "/Shrink";
+    ::mkdir(dir.c_str(), 0755);
+    const char *names[] = { "B.pkg", "Cat.pkg", "Dodo.pkg" };
+    for (auto name: names) test::write_package(dir + "/" + name, 600);
+
+    PosixScheduler local;
+    ShrinkingCard card(local);
+    card.set_root(root);
+    Context context { local, user_settings, card, app_status };
+    Dock dock(context);
+    test::Sink sink;
+    dock >> sink;
+    local.init();
+    auto run_local = [&](auto done) {
+        auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!done()) {
+            if (std::chrono::steady_clock::now() > end) return false;
+            local.run(1);
+        }
+        return true;
+    };
+    ND_CHECK(run_local([&]{ return card.prewarmed(); }));
+    card.doomed = dir + "/Cat.pkg";
+
+    Array path;
+    path.add(Ref(String::New(u"Desktop")));
+    path.add(Ref(String::New(u"Card")));
+    path.add(Ref(String::New(u"Shrink")));
+    feed(dock, "spth", nsof(Ref(path)));
+    ND_CHECK(run_local([&]{ return reply_is(sink, "file"); }));
+    ND_CHECK(card.opened >= 2);
+    for (int i = 0; i < 10; ++i) local.run(1); // the Dock frees the last chunk after sending it
+
+    // Three frames were promised, so three frames arrive
+    const auto &b = sink.data;
+    uint32_t n = ((uint32_t)b[12] << 24) | (b[13] << 16) | (b[14] << 8) | b[15];
+    int32_t error = 0;
+    NSOF decoder(std::vector<uint8_t>(b.begin() + 16, b.begin() + 16 + n));
+    Ref list = decoder.to_ref(error);
+    ND_CHECK(error == 0);
+    Array *entries = list.as_array();
+    ND_CHECK(entries && entries->size() == 3);
+    for (uint32_t i = 0; entries && i < entries->size(); ++i) {
+        Frame *entry = entries->at(i).as_frame();
+        ND_CHECK(entry && entry->size() == 2);
+    }
+
+    for (auto name: names) remove((dir + "/" + name).c_str());
+    rmdir(dir.c_str());
+}
+
+} // namespace
+
+void test_dock() {
+    char root[] = "/tmp/nd_dock_XXXXXX";
+    ND_CHECK(mkdtemp(root) != nullptr);
+    std::string sub = std::string(root) + "/Sub";
+    ::mkdir(sub.c_str(), 0755);
+    auto pkg = test::write_package(sub + "/A.pkg", 1500);
+    test::write_package(std::string(root) + "/Top.pkg", 600);
+    sdcard_endpoint.set_root(root);
+
+    Context context { scheduler, user_settings, sdcard_endpoint, app_status };
+    Dock dock(context);
+    test::Sink sink;
+    dock >> sink;
+    scheduler.init();
+
+    // 'spth' changes the directory in the background and then replies with 'file'
+    Array path;
+    path.add(Ref(String::New(u"Desktop")));
+    path.add(Ref(String::New(u"Card")));
+    path.add(Ref(String::New(u"Sub")));
+    feed(dock, "spth", nsof(Ref(path)));
+    ND_CHECK(run_until([&]{ return reply_is(sink, "file"); }));
+
+    // Packages are sent from where the card lends them, or read into a block
+    Ref name(String::New(u"A.pkg"));
+    sink.data.clear();
+    feed(dock, "lpfl", nsof(name));
+    ND_CHECK(run_until([&]{ return lpkg_data(sink, pkg); }));
+
+    // A disconnect in the middle of a transfer must not keep the Dock from sending the next one
+    run_for(100); // let the Dock close the file of the first transfer
+    sink.data.clear();
+    feed(dock, "lpfl", nsof(name));
+    ND_CHECK(run_until([&]{ return reply_is(sink, "lpkg", 100); }));
+    dock.send(Event(Event::Type::MNP, Event::Subtype::MNP_DISCONNECTED));
+    sink.data.clear();
+    feed(dock, "spth", nsof(Ref(path)));
+    ND_CHECK(run_until([&]{ return reply_is(sink, "file"); }));
+    sink.data.clear();
+    feed(dock, "lpfl", nsof(name));
+    ND_CHECK(run_until([&]{ return lpkg_data(sink, pkg); }));
+
+    test_shrinking_file_list(root);
+
+    remove((sub + "/A.pkg").c_str());
+    remove((std::string(root) + "/Top.pkg").c_str());
+    rmdir(sub.c_str());
+    rmdir(root);
+}
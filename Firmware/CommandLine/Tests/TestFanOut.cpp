@@ -0,0 +1,62 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// One stream to several outputs: lossless branches hold it back, best-effort branches drop.
+
+#include "Test.h"
+
+#include "main.h"
+#include "PosixScheduler.h"
+#include "common/Pipes/FanOut.h"
+
+using namespace nd;
+
+void test_fan_out() {
+    PosixScheduler scheduler;
+    test::Source source;
+    FanOut fan_out(scheduler);
+    test::Sink primary, lossless, best_effort;
+
+    // Without branches, the FanOut is spliced out
+    source >> fan_out >> primary;
+    ND_CHECK(source.out() == &primary);
+    fan_out.branch(0) >> lossless;
+    fan_out.branch(1) >> best_effort;
+    fan_out.set_mode(1, FanOut::Mode::BEST_EFFORT);
+    ND_CHECK(source.out() == &fan_out);
+
+    // A lossless branch that rejects holds back the stream until it takes
+    // the event, and every output gets every event once
+    lossless.open = false;
+    ND_CHECK(source.send(Event { (uint8_t)1 }).ok());
+    ND_CHECK(source.send(Event { (uint8_t)2 }).rejected());
+    lossless.open = true;
+    ND_CHECK(source.send(Event { (uint8_t)2 }).ok());
+    lossless.open = false;
+    ND_CHECK(source.send(Event { (uint8_t)3 }).ok());
+    lossless.open = true;
+    scheduler.run(1);
+    const std::vector<uint8_t> all = { 1, 2, 3 };
+    ND_CHECK(primary.data == all);
+    ND_CHECK(lossless.data == all);
+    ND_CHECK(best_effort.data == all);
+
+    // A best-effort branch never holds back the stream, and drops the
+    // oldest events when its ring is full
+    best_effort.open = false;
+    for (int i = 0; i < 100; i++)
+        ND_CHECK(source.send(Event { (uint8_t)(i + 10) }).ok());
+    ND_CHECK(primary.data.size() == 103 && lossless.data.size() == 103);
+    ND_CHECK(fan_out.dropped(1) == 100 - 63);
+    best_effort.open = true;
+    scheduler.run(1);
+    ND_CHECK(best_effort.data.size() == 3 + 63);
+    ND_CHECK(best_effort.data[3] == 10 + 37 && best_effort.data.back() == 10 + 99);
+
+    // Only lossless branches rush back upstream
+    lossless.rush_back(Event { Event::Type::HIGH_WATER, Event::Subtype::ON });
+    best_effort.rush_back(Event { Event::Type::HIGH_WATER, Event::Subtype::ON });
+    ND_CHECK(source.rushed_back == 1);
+}
@@ -0,0 +1,52 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Value hashing and the deduplicating encoder.
+
+#include "Test.h"
+
+#include "common/Newton/NSOF.h"
+
+#include <limits>
+
+using namespace nd;
+
+void test_nsof() {
+    // Equal Reals hash equal, including values that do not fit an integer
+    const real values[] = {
+        0.0f, 1.5f, -2.25f, 32768.0f, -1.0e30f, 3.0e38f,
+        std::numeric_limits<real>::infinity(),
+        -std::numeric_limits<real>::infinity(),
+        std::numeric_limits<real>::quiet_NaN(),
+    };
+    for (real v: values) {
+        Ref a(v), b(v);
+        ND_CHECK(a.hash() == b.hash());
+    }
+    ND_CHECK(Ref(0.0f).hash() == Ref(-0.0f).hash());
+    ND_CHECK(Ref(0.0f).equals(Ref(-0.0f)));
+    ND_CHECK(Ref(32768.0f).hash() != Ref(32769.0f).hash());
+    ND_CHECK(Ref(1.0e30f).hash() != Ref(-1.0e30f).hash());
+
+    // Deduplicated streams decode to the same value and are smaller
+    Array list;
+    const char16_t *names[] = { u"Apps", u"Games", u"Apps", u"Books", u"Games" };
+    for (auto name: names) {
+        Frame *f = Frame::New();
+        f->add(symName, Ref(String::New(name)));
+        f->add(symSize, Ref(4096));
+        list.add(Ref(f));
+    }
+    NSOF plain, dedup;
+    plain.to_nsof(Ref(list));
+    dedup.dedup_values(true);
+    dedup.to_nsof(Ref(list));
+    ND_CHECK(dedup.size() < plain.size());
+    int32_t error = 0;
+    NSOF decoder(dedup.data());
+    Ref decoded = decoder.to_ref(error);
+    ND_CHECK(error == 0);
+    ND_CHECK(decoded.equals(Ref(list)));
+}
@@ -0,0 +1,92 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// NSOFView must reject streams that are cut short or that contain lengths
+// larger than the stream, without reading past the end of the buffer.
+
+#include "Test.h"
+
+#include "common/Newton/NSOFView.h"
+
+#include <vector>
+
+using namespace nd;
+
+// The bytes go into a vector of their own size, so that AddressSanitizer
+// catches any read past the end.
+static std::vector<uint8_t> stream(std::initializer_list<uint8_t> bytes) {
+    return std::vector<uint8_t>(bytes);
+}
+
+void test_nsof_view() {
+    // A valid String "Hi"
+    {
+        auto data = stream({ 2, 8, 6, 0, 'H', 0, 'i', 0, 0 });
+        NSOFView view(data);
+        NSOFStringView str;
+        ND_CHECK(view.begin());
+        ND_CHECK(view.string(str));
+        ND_CHECK(str == u"Hi");
+        ND_CHECK(view.error_code() == 0);
+    }
+    // A String whose long length field is cut short
+    {
+        auto data = stream({ 2, 8, 0xff, 0x00, 0x00 });
+        NSOFView view(data);
+        NSOFStringView str;
+        ND_CHECK(view.begin());
+        ND_CHECK(!view.string(str));
+        ND_CHECK(view.error_code() == -54002);
+    }
+    // A String with a length that wraps the cursor around
+    {
+        auto data = stream({ 2, 8, 0xff, 0xff, 0xff, 0xff, 0xfe, 'H', 0 });
+        NSOFView view(data);
+        NSOFStringView str;
+        ND_CHECK(view.begin());
+        ND_CHECK(!view.string(str));
+        ND_CHECK(view.error_code() == -54002);
+    }
+    // Skipping a Binary and a Symbol with huge lengths
+    {
+        auto data = stream({ 2, 3, 0xff, 0xff, 0xff, 0xff, 0xf0, 10, 0 });
+        NSOFView view(data);
+        ND_CHECK(view.begin());
+        ND_CHECK(!view.skip());
+        ND_CHECK(view.error_code() == -54002);
+    }
+    {
+        auto data = stream({ 2, 7, 0xff, 0x80, 0x00, 0x00, 0x00, 'a' });
+        NSOFView view(data);
+        ND_CHECK(view.begin());
+        ND_CHECK(!view.skip());
+        ND_CHECK(view.error_code() == -54002);
+    }
+    // A Frame with a slot Symbol that claims to be longer than the stream
+    {
+        auto data = stream({ 2, 6, 1, 7, 0xff, 0xff, 0xff, 0xff, 0xfc, 'i', 'd', 0, 4 });
+        NSOFView view(data);
+        int32_t value = 0;
+        ND_CHECK(view.begin());
+        ND_CHECK(!view.frame_int("id", value));
+        ND_CHECK(view.error_code() == -54002);
+    }
+    // The same Frame when it is valid
+    {
+        auto data = stream({ 2, 6, 1, 7, 2, 'i', 'd', 0, 20 });
+        NSOFView view(data);
+        int32_t value = 0;
+        ND_CHECK(view.begin());
+        ND_CHECK(view.frame_int("id", value));
+        ND_CHECK(value == 5);
+    }
+    // A cursor past the end of the data
+    {
+        auto data = stream({ 2 });
+        NSOFView view(data, 100);
+        ND_CHECK(!view.begin());
+        ND_CHECK(view.error_code() == -54002);
+    }
+}
@@ -0,0 +1,94 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Pipes that take themselves out of the event flow, and reconnecting around them.
+
+#include "Test.h"
+
+#include "main.h"
+#include "PosixScheduler.h"
+#include "common/Context.h"
+#include "common/Filters/HayesFilter.h"
+#include "common/Pipes/Tee.h"
+
+using namespace nd;
+
+namespace {
+
+/// Counts what passes, and can be spliced out from the outside.
+struct Counter : Pipe {
+    uint32_t sent = 0, rushed_back = 0;
+    Result send(Event event) override { sent++; return Pipe::send(event); }
+    Result rush_back(Event event) override { rushed_back++; return Pipe::rush_back(event); }
+};
+
+} // namespace
+
+void test_pipe_splice() {
+    // A spliced out pipe is skipped on the way out, but not on the way back
+    {
+        Pipe source;
+        Counter counter;
+        test::Sink sink;
+        source >> counter >> sink;
+        counter.splice_out(&sink);
+        ND_CHECK(counter.spliced_out());
+        ND_CHECK(source.out() == &sink && source.wired_out() == &counter);
+        source.send(Event { (uint8_t)1 });
+        ND_CHECK(counter.sent == 0 && sink.data.size() == 1);
+        sink.rush_back(Event { Event::Type::HIGH_WATER, Event::Subtype::ON });
+        ND_CHECK(counter.rushed_back == 1);
+
+        // Connecting a new input skips the pipe as well
+        Pipe other;
+        other >> counter;
+        ND_CHECK(other.out() == &sink);
+
+        counter.splice_in();
+        ND_CHECK(!counter.spliced_out());
+        ND_CHECK(other.out() == &counter);
+        other.send(Event { (uint8_t)2 });
+        ND_CHECK(counter.sent == 1 && sink.data.size() == 2);
+    }
+
+    // A Tee is spliced out while nothing is connected to 'b', and follows
+    // its output when it is reconnected
+    {
+        Pipe source;
+        Tee tee;
+        test::Sink a, b, c;
+        source >> tee >> a;
+        ND_CHECK(source.out() == &a);
+        tee >> c;
+        ND_CHECK(source.out() == &c);
+        tee.b >> b;
+        ND_CHECK(source.out() == &tee);
+        source.send(Event { (uint8_t)3 });
+        ND_CHECK(c.data.size() == 1 && b.data.size() == 1 && a.data.size() == 0);
+    }
+
+    // The upstream side of a HayesFilter is spliced out in data mode only
+    {
+        PosixScheduler scheduler;
+        Context context { scheduler, user_settings, sdcard_endpoint, app_status };
+        HayesFilter hayes(context, 0);
+        Pipe newton, dock;
+        test::Sink to_newton, to_dock;
+        newton >> hayes.downstream >> to_newton;
+        dock >> hayes.upstream >> to_dock;
+        ND_CHECK(dock.out() == &to_newton);
+        dock.send(Event { (uint8_t)4 });
+        ND_CHECK(to_newton.data.size() == 1);
+
+        hayes.switch_to_command_mode();
+        ND_CHECK(dock.out() == &hayes.upstream);
+        uint32_t received = to_newton.data.size(); // includes the "OK" reply
+        dock.send(Event { (uint8_t)5 });
+        ND_CHECK(to_newton.data.size() == received);
+
+        hayes.switch_to_data_mode();
+        ND_CHECK(dock.out() == &to_newton);
+    }
+}
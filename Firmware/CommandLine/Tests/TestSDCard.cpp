@@ -0,0 +1,98 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Indexing the root directory at power up while a client changes the directory.
+
+#include "Test.h"
+
+#include "main.h"
+#include "PosixScheduler.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace nd;
+
+namespace {
+
+/// A card on its own scheduler, so the test can look into the index.
+struct Card : PosixSDCardEndpoint {
+    using PosixSDCardEndpoint::PosixSDCardEndpoint;
+    bool prewarmed() const { return prewarm_ == Prewarm::DONE; }
+    std::shared_ptr<const SDCardIndex::Dir> listing(const std::u16string &path) { return index_.find(path); }
+    bool package_known(const std::u16string &dir_path, const std::u16string &name) {
+        auto dir = index_.find(dir_path);
+        int32_t ix = dir ? dir->find(name) : -1;
+        if (ix < 0) return false;
+        std::u16string path = dir_path + (dir_path == u"/" ? u"" : u"/") + name;
+        return index_.find_package(path, dir->mtime(ix), dir->file_size(ix)) != nullptr;
+    }
+};
+
+template<typename Pred>
+bool run_until(Scheduler &scheduler, Pred done) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > end) return false;
+        scheduler.run(1);
+    }
+    return true;
+}
+
+} // namespace
+
+void test_sdcard() {
+    char root[] = "/tmp/nd_card_XXXXXX";
+    ND_CHECK(mkdtemp(root) != nullptr);
+    std::string sub = std::string(root) + "/Sub";
+    ::mkdir(sub.c_str(), 0755);
+    test::write_package(std::string(root) + "/Top.pkg", 600);
+    test::write_package(sub + "/A.pkg", 600);
+
+    PosixScheduler scheduler;
+    {
+        Card card(scheduler);
+        card.set_root(root);
+
+        // A client moves to another directory before the root is indexed
+        SDCardRequest chdir;
+        chdir.op_ = SDCardRequest::Op::CHDIR;
+        chdir.name_ = u"/Sub";
+        ND_CHECK(card.submit(chdir).ok());
+        scheduler.init();
+        ND_CHECK(run_until(scheduler, [&]{ return card.prewarmed() && chdir.done(); }));
+
+        // The prewarm still indexed the root and its packages
+        auto top = card.listing(u"/");
+        ND_CHECK(top && top->complete() && top->find(u"Top.pkg") >= 0);
+        ND_CHECK(card.package_known(u"/", u"Top.pkg"));
+        ND_CHECK(!card.listing(u"/Sub"));
+
+        // ... and left the client in its directory
+        SDCardRequest getcwd;
+        getcwd.op_ = SDCardRequest::Op::GETCWD;
+        ND_CHECK(card.submit(getcwd).ok());
+        ND_CHECK(run_until(scheduler, [&]{ return getcwd.done(); }));
+        ND_CHECK(getcwd.name_ == u"/Sub");
+
+        // Packages in other directories can be asked for by their absolute path
+        PackageInfo info;
+        SDCardRequest pkginfo;
+        pkginfo.op_ = SDCardRequest::Op::PKGINFO;
+        pkginfo.name_ = u"/Top.pkg";
+        pkginfo.info_ = &info;
+        ND_CHECK(card.submit(pkginfo).ok());
+        ND_CHECK(run_until(scheduler, [&]{ return pkginfo.done(); }));
+        ND_CHECK(pkginfo.result_ == FR_OK && info.valid_);
+    }
+
+    remove((sub + "/A.pkg").c_str());
+    remove((std::string(root) + "/Top.pkg").c_str());
+    rmdir(sub.c_str());
+    rmdir(root);
+}
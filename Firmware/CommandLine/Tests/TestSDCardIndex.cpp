@@ -0,0 +1,83 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Least recently used order of the directory index, and listings that outlive it.
+
+#include "Test.h"
+
+#include "main.h" // FR_* codes of the card
+#include "common/Endpoints/SDCardIndex.h"
+
+using namespace nd;
+
+namespace {
+
+std::shared_ptr<const SDCardIndex::Dir> list(SDCardIndex &index, const std::u16string &path, uint32_t n) {
+    index.begin(path);
+    for (uint32_t i = 0; i < n; ++i) {
+        SDCardDirEntry entry;
+        entry.name_ = u"P" + std::u16string(1, (char16_t)(u'a' + i)) + u".pkg";
+        entry.type_ = FR_IS_PACKAGE;
+        entry.size_ = 1000 + i;
+        index.add(entry);
+    }
+    return index.commit();
+}
+
+} // namespace
+
+void test_sdcard_index() {
+    // The least recently used directory is dropped first
+    {
+        SDCardIndex index(3, 1024 * 1024, 0);
+        list(index, u"/a", 2);
+        list(index, u"/b", 2);
+        list(index, u"/c", 2);
+        ND_CHECK(index.find(u"/a") != nullptr); // now /b is the oldest
+        list(index, u"/d", 2);
+        ND_CHECK(index.find(u"/a") != nullptr);
+        ND_CHECK(index.find(u"/b") == nullptr);
+        ND_CHECK(index.find(u"/c") != nullptr);
+        ND_CHECK(index.find(u"/d") != nullptr);
+    }
+
+    // The memory budget drops old directories, and replacing a listing frees its memory
+    {
+        SDCardIndex index(8, 600, 0); // room for two of these listings
+        auto a = list(index, u"/a", 8);
+        ND_CHECK(a && a->complete() && a->size() == 8);
+        list(index, u"/b", 8);
+        list(index, u"/c", 8);
+        ND_CHECK(index.find(u"/a") == nullptr);
+        ND_CHECK(index.find(u"/c") != nullptr);
+        for (int i = 0; i < 50; ++i) list(index, u"/c", 8); // replacing a listing gives its memory back
+        ND_CHECK(index.find(u"/b") != nullptr);
+
+        // A listing that was handed out stays usable after the index dropped it
+        ND_CHECK(a->size() == 8 && a->name(0) == u"Pa.pkg" && a->file_size(7) == 1007);
+        index.invalidate();
+        ND_CHECK(index.find(u"/c") == nullptr);
+        ND_CHECK(a->find(u"ph.PKG") == 7);
+    }
+
+    // Package headers are dropped in least recently used order, too
+    {
+        SDCardIndex index(0, 0, 2);
+        PackageInfo info;
+        index.add_package(u"/a.pkg", 1, info);
+        index.add_package(u"/b.pkg", 1, info);
+        ND_CHECK(index.find_package(u"/a.pkg", 1, 0) != nullptr);
+        index.add_package(u"/c.pkg", 1, info);
+        ND_CHECK(index.find_package(u"/a.pkg", 1, 0) != nullptr);
+        ND_CHECK(index.find_package(u"/b.pkg", 1, 0) == nullptr);
+        ND_CHECK(index.find_package(u"/c.pkg", 1, 0) != nullptr);
+        ND_CHECK(index.find_package(u"/c.pkg", 2, 0) == nullptr); // modified since
+        index.add_package(u"/c.pkg", 2, info);
+        ND_CHECK(index.find_package(u"/c.pkg", 2, 0) != nullptr);
+        ND_CHECK(index.find_package(u"/a.pkg", 1, 0) != nullptr);
+        index.invalidate(u"/a.pkg");
+        ND_CHECK(index.find_package(u"/a.pkg", 1, 0) == nullptr);
+    }
+}
@@ -0,0 +1,74 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Compile-time pipelines: stages in order, buffering, and flow control.
+
+#include "Test.h"
+
+#include "main.h"
+#include "PosixScheduler.h"
+#include "common/Pipes/StaticPipeline.h"
+
+using namespace nd;
+
+namespace {
+
+/// Counts the events that pass, and adds `kAdd` to each one.
+template<uint8_t kAdd>
+struct Add : PipeStage {
+    uint32_t count = 0;
+    template<class Next>
+    Result send(Event event, Next &next) {
+        count++;
+        return next.send(Event { (uint8_t)(event.data() + kAdd) });
+    }
+};
+
+/// Doubles every event.
+struct Twice : PipeStage {
+    template<class Next>
+    Result send(Event event, Next &next) { return next.send(Event { (uint8_t)(event.data() * 2) }); }
+};
+
+} // namespace
+
+void test_static_pipeline() {
+    // Stages run in the order they are listed
+    {
+        PosixScheduler scheduler;
+        test::SinkEndpoint sink(scheduler);
+        Pipe source;
+        StaticPipeline<Add<1>, Twice, Add<10>> pipeline(scheduler);
+        source >> pipeline >> sink;
+        ND_CHECK(source.send(Event { (uint8_t)5 }).ok());
+        ND_CHECK(sink.data == std::vector<uint8_t>({ 22 }));
+        ND_CHECK(pipeline.stage<0>().count == 1 && pipeline.stage<2>().count == 1);
+    }
+
+    // A buffer holds 2^n - 1 events, raises HIGH_WATER when it is almost
+    // full, and clears it after draining
+    {
+        PosixScheduler scheduler;
+        test::SinkEndpoint sink(scheduler);
+        sink.open = false;
+        Pipe source;
+        StaticPipeline<Add<0>, StaticBuffer<6>> pipeline(scheduler);
+        source >> pipeline >> sink;
+        uint32_t sent = 0;
+        while (source.send(Event { (uint8_t)sent }).ok())
+            sent++;
+        ND_CHECK(sent == 63);
+        ND_CHECK(sink.high_water == 1);
+        sink.open = true;
+        for (int i = 0; i < 100 && sink.data.size() < sent; i++)
+            scheduler.run(1);
+        ND_CHECK(sink.data.size() == sent);
+        ND_CHECK(sink.high_water == 0);
+        bool in_order = true;
+        for (uint32_t i = 0; i < sink.data.size(); i++)
+            if (sink.data[i] != (uint8_t)i) in_order = false;
+        ND_CHECK(in_order);
+    }
+}
@@ -0,0 +1,103 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Routing between the sides of the dongle, and giving the Newton to a terminal while DTR is set.
+
+#include "Test.h"
+
+#include "main.h"
+#include "PosixScheduler.h"
+#include "common/Context.h"
+#include "common/Filters/SwitchMatrix.h"
+
+using namespace nd;
+
+namespace {
+
+/// One side of the dongle, sending into a port and receiving from it.
+struct Side {
+    test::Source source;
+    test::Sink sink;
+};
+
+constexpr uint8_t kUART = 0, kDock = 1, kSDCard = 2, kCDC = 3;
+
+} // namespace
+
+void test_switch_matrix() {
+    PosixScheduler scheduler;
+    Context context { scheduler, user_settings, sdcard_endpoint, app_status };
+    SwitchMatrix matrix(context);
+    Side side[SwitchMatrix::kPorts];
+    for (uint8_t i = 0; i < SwitchMatrix::kPorts; i++) {
+        side[i].source >> matrix.port(i);
+        matrix.port(i) >> side[i].sink;
+    }
+
+    // Connected ports talk both ways, everything else is dropped
+    matrix.connect(kUART, kDock);
+    ND_CHECK(matrix.route_of(kUART) == kDock && matrix.route_of(kDock) == kUART);
+    side[kUART].source.send(Event { (uint8_t)1 });
+    side[kDock].source.send(Event { (uint8_t)2 });
+    ND_CHECK(side[kSDCard].source.send(Event { (uint8_t)3 }).subtype() == Result::Subtype::NOT_CONNECTED);
+    ND_CHECK(side[kDock].sink.data == std::vector<uint8_t>({ 1 }));
+    ND_CHECK(side[kUART].sink.data == std::vector<uint8_t>({ 2 }));
+    side[kDock].sink.rush_back(Event { Event::Type::HIGH_WATER, Event::Subtype::ON });
+    ND_CHECK(side[kUART].source.rushed_back == 1);
+
+    // A buffered route keeps what the destination rejects, in order
+    side[kDock].sink.open = false;
+    for (uint8_t i = 10; i < 20; i++)
+        ND_CHECK(side[kUART].source.send(Event { i }).ok());
+    side[kDock].sink.open = true;
+    scheduler.run(1);
+    ND_CHECK(side[kDock].sink.data == std::vector<uint8_t>({ 1, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19 }));
+
+    // Events buffered for an old route are not sent on the new one
+    side[kDock].sink.open = false;
+    side[kUART].source.send(Event { (uint8_t)30 });
+    matrix.connect(kUART, kSDCard);
+    side[kDock].sink.open = true;
+    scheduler.run(1);
+    ND_CHECK(side[kDock].sink.data.size() == 11);
+    ND_CHECK(side[kSDCard].sink.data.empty());
+
+    // An unbuffered route splices its port out and passes rejections back
+    matrix.disconnect(kSDCard);
+    ND_CHECK(matrix.route_of(kUART) == SwitchMatrix::kNone);
+    matrix.connect(kUART, kDock, false);
+    ND_CHECK(side[kUART].source.out() == &side[kDock].sink);
+    side[kDock].sink.open = false;
+    ND_CHECK(side[kUART].source.send(Event { (uint8_t)40 }).rejected());
+    side[kDock].sink.open = true;
+
+    // While DTR is set on the CDC port, the Newton talks to the terminal.
+    // Clearing it restores the old routes, including the unbuffered one.
+    matrix.follow_dtr(kCDC, kUART);
+    side[kCDC].source.rush(Event { Event::Type::UART, Event::Subtype::UART_DTR, 1 });
+    ND_CHECK(matrix.route_of(kUART) == kCDC && matrix.route_of(kCDC) == kUART);
+    ND_CHECK(matrix.route_of(kDock) == SwitchMatrix::kNone);
+    side[kUART].source.send(Event { (uint8_t)50 });
+    side[kCDC].source.send(Event { (uint8_t)51 });
+    ND_CHECK(side[kCDC].sink.data == std::vector<uint8_t>({ 50 }));
+    ND_CHECK(side[kUART].sink.data.back() == 51);
+    // The DTR port stays in the flow, but its unbuffered route still passes
+    // rejections back instead of keeping the event
+    side[kUART].sink.open = false;
+    ND_CHECK(side[kCDC].source.out() == &matrix.port(kCDC));
+    ND_CHECK(side[kCDC].source.send(Event { (uint8_t)52 }).rejected());
+    side[kUART].sink.open = true;
+    scheduler.run(1);
+    ND_CHECK(side[kUART].sink.data.back() == 51);
+    side[kCDC].source.rush(Event { Event::Type::UART, Event::Subtype::UART_DTR, 0 });
+    ND_CHECK(matrix.route_of(kUART) == kDock && matrix.route_of(kDock) == kUART);
+    ND_CHECK(matrix.route_of(kCDC) == SwitchMatrix::kNone);
+    ND_CHECK(side[kUART].source.out() == &side[kDock].sink);
+
+    // The Hayes command ATS310 connects two ports with the SWITCH_ROUTE signal
+    matrix.signal(Event { Event::Type::SIGNAL, Event::Subtype::SWITCH_ROUTE, kCDC << 8 | kSDCard });
+    ND_CHECK(matrix.route_of(kCDC) == kSDCard && matrix.route_of(kSDCard) == kCDC);
+    ND_CHECK(matrix.route_of(kUART) == kDock);
+}
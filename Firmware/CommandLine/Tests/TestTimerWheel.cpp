@@ -0,0 +1,131 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+// Timers on the higher levels of the wheel, and slots that wrap around.
+
+#include "Test.h"
+
+#include "main.h"
+#include "PosixScheduler.h"
+#include "common/Timer.h"
+
+#include <memory>
+#include <random>
+
+using namespace nd;
+
+namespace {
+
+/// Remembers when each of its timers fired.
+struct Owner : Task {
+    TimerWheel &wheel_;
+    std::vector<std::unique_ptr<Timer>> timers;
+    std::vector<uint64_t> fired_at;
+    Owner(Scheduler &scheduler, TimerWheel &wheel, int n) : Task(scheduler, 0), wheel_ { wheel } {
+        for (int i = 0; i < n; i++) {
+            timers.emplace_back(new Timer(*this, i));
+            fired_at.push_back(0);
+        }
+    }
+    ~Owner() override {
+        // The timers live on this wheel, not on the one of the scheduler
+        for (auto &timer: timers)
+            if (timer->armed()) wheel_.cancel(*timer);
+    }
+    Result signal(Event event) override {
+        if (event.subtype() == Event::Subtype::TIMER)
+            fired_at[event.data()] = wheel_.now();
+        return Result::OK;
+    }
+};
+
+/// Arm a timer at `deadline`, then move the time in `step` increments, and
+/// return when the timer fired.
+uint64_t fire_time(Owner &owner, TimerWheel &wheel, uint64_t deadline, uint64_t step) {
+    owner.fired_at[0] = 0;
+    wheel.arm(*owner.timers[0], deadline);
+    for (uint64_t t = wheel.now() + step; owner.fired_at[0] == 0 && t < deadline + 2 * step; t += step)
+        wheel.advance(t);
+    return owner.fired_at[0];
+}
+
+} // namespace
+
+void test_timer_wheel() {
+    PosixScheduler scheduler;
+
+    // Deadlines on every level cascade down and fire on time, whether the
+    // wheel ticks or jumps
+    {
+        TimerWheel wheel;
+        Owner owner(scheduler, wheel, 1);
+        ND_CHECK(fire_time(owner, wheel, 64 * 64 + 5, 1) == 64 * 64 + 5);
+        const uint64_t deadlines[] = { 64 * 64 * 64 + 64 * 3 + 7, (1ULL << 31) + 12345 };
+        const uint64_t steps[] = { 13, 1000003 };
+        for (int i = 0; i < 2; i++) {
+            uint64_t start = wheel.now(), step = steps[i];
+            uint64_t first_tick = start + (deadlines[i] + step - 1) / step * step;
+            ND_CHECK(fire_time(owner, wheel, start + deadlines[i], step) == first_tick);
+        }
+        uint64_t deadline = wheel.now() + 64 * 64 * 64 * 64 + 1;
+        wheel.arm(*owner.timers[0], deadline);
+        owner.fired_at[0] = 0;
+        ND_CHECK(!wheel.advance(deadline - 1));
+        ND_CHECK(owner.timers[0]->armed());
+        ND_CHECK(wheel.advance(deadline));
+        ND_CHECK(owner.fired_at[0] == deadline);
+    }
+
+    // Slots wrap around at the end of a level
+    {
+        TimerWheel wheel;
+        Owner owner(scheduler, wheel, 2);
+        wheel.advance(60);
+        wheel.arm(*owner.timers[0], 70); // level 0, past slot 63
+        wheel.arm(*owner.timers[1], 63 * 64 + 200); // level 1, past slot 63
+        ND_CHECK(wheel.next_in() == 10);
+        ND_CHECK(wheel.advance(75) && owner.fired_at[0] == 75);
+        ND_CHECK(!wheel.advance(63 * 64 + 199));
+        ND_CHECK(wheel.advance(63 * 64 + 200) && owner.fired_at[1] == 63 * 64 + 200);
+        ND_CHECK(wheel.next_in() == Scheduler::kNever);
+    }
+
+    // Random arming, canceling, and time jumps against a list of deadlines
+    {
+        TimerWheel wheel;
+        const int n = 64;
+        Owner owner(scheduler, wheel, n);
+        std::vector<uint64_t> due(n, 0);
+        std::mt19937 rng(1);
+        int early = 0, missed = 0;
+        for (int round = 0; round < 20000; round++) {
+            int i = rng() % n;
+            uint32_t usec = (rng() % 4 == 0) ? rng() % 100'000'000 : rng() % 5000;
+            switch (rng() % 8) {
+                case 0: case 1: case 2:
+                    wheel.arm(*owner.timers[i], wheel.now() + usec);
+                    due[i] = (usec > 0) ? wheel.now() + usec : wheel.now() + 1;
+                    break;
+                case 3:
+                    if (owner.timers[i]->armed()) wheel.cancel(*owner.timers[i]);
+                    due[i] = 0;
+                    break;
+                default: {
+                    uint64_t now = wheel.now() + ((rng() % 8 == 0) ? rng() % 50'000'000 : rng() % 300);
+                    for (int k = 0; k < n; k++) owner.fired_at[k] = 0;
+                    wheel.advance(now);
+                    for (int k = 0; k < n; k++) {
+                        if (owner.fired_at[k] && (due[k] == 0 || due[k] > now)) early++;
+                        if (owner.fired_at[k]) due[k] = 0;
+                        if (due[k] && due[k] <= now) missed++;
+                        if (owner.timers[k]->armed() != (due[k] != 0)) missed++;
+                    }
+                }
+            }
+        }
+        ND_CHECK(early == 0);
+        ND_CHECK(missed == 0);
+    }
+}
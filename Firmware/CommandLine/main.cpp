@@ -22,38 +22,69 @@
   SOFTWARE.
 */
 
-#include "TestStdioLog.h"
-#include "TestScheduler.h"
-#include "common/Endpoints/StdioLog.h"
-#include "common/Pipes/BufferedPipe.h"
-#include "common/Endpoints/TestEventGenerator.h"
+// -- Command line test suite for the platform agnostic part of the Dongle.
+//  newt_dongle          run all test suites
+//  newt_dongle des      run the suite "des"
 
-#include <cstdio>
+#include "main.h"
 
-// -- The scheduler spins while the dongle is powered and deliver time slices to its spokes.
-nd::TestScheduler scheduler;
+#include "PosixScheduler.h"
+#include "Tests/Test.h"
 
-// -- Allocate all the endpoints we need.
-nd::TestStdioLog log_device(scheduler);
-nd::TestEventGenerator test_data_generator(scheduler);
+#include <cstdio>
+#include <cstring>
 
-// -- Allocate the pipes and filters that connect the endpoints.
-nd::BufferedPipe gen_to_log(scheduler);
-nd::Pipe log_to_gen;
+using namespace nd;
 
-// -- Everything is already allocated. Now link the endpoints and run the scheduler.
-int main(int argc, char *argv[])
-{
-    // -- Connect the Endpoints inside the dongle with pipes.
-    test_data_generator >> gen_to_log >> log_device;
-    log_device >> log_to_gen >> test_data_generator;
+// -- Globals that the common code expects from main.
+PosixScheduler scheduler;
+nd::Logger Log;
+nd::UserSettings user_settings;
+nd::PosixSDCardEndpoint sdcard_endpoint { scheduler };
+nd::StatusDisplay app_status { scheduler };
 
-    // -- The scheduler will call all instances of classes that are derived from Task.
-    scheduler.init();
+int nd::test::failures = 0;
 
-    // -- Now we can start the scheduler. It will call all spokes in a loop.
-    scheduler.run(32);
+void nd::test::check(bool ok, const char *expr, const char *file, int line) {
+    if (ok)
+        return;
+    failures++;
+    printf("%s:%d: check failed: %s\n", file, line, expr);
+}
 
-    return 0;
-} 
+static const struct {
+    const char *name;
+    void (*run)();
+} suites[] = {
+    { "backup_reader", test_backup_reader },
+    { "bridge_pipe", test_bridge_pipe },
+    { "des", test_des },
+    { "dock", test_dock },
+    { "fan_out", test_fan_out },
+    { "nsof", test_nsof },
+    { "nsof_view", test_nsof_view },
+    { "pipe_splice", test_pipe_splice },
+    { "sdcard", test_sdcard },
+    { "sdcard_index", test_sdcard_index },
+    { "static_pipeline", test_static_pipeline },
+    { "switch_matrix", test_switch_matrix },
+    { "timer_wheel", test_timer_wheel },
+};
 
+int main(int argc, char *argv[])
+{
+    int ran = 0;
+    for (auto &suite: suites) {
+        if (argc > 1 && strcmp(argv[1], suite.name) != 0)
+            continue;
+        int failures = test::failures;
+        suite.run();
+        printf("%-16s %s\n", suite.name, (test::failures == failures) ? "ok" : "FAILED");
+        ran++;
+    }
+    if (ran == 0) {
+        printf("No test suite named \"%s\"\n", argv[1]);
+        return 2;
+    }
+    return (test::failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_MAIN_H
+#define ND_MAIN_H
+
+#include <cstdint>
+
+#include "common/Logger.h"
+#include "common/UserSettings.h"
+#include "Posix/Endpoints/PosixSDCardEndpoint.h"
+#include "common/StatusDisplay.h"
+
+extern nd::Logger Log;
+extern nd::UserSettings user_settings;
+extern nd::PosixSDCardEndpoint sdcard_endpoint;
+extern nd::StatusDisplay app_status;
+
+namespace nd {
+
+// Debugger settings
+constexpr bool kDebugErrors = true; // Print errors to the console
+constexpr bool kDebugHayes = false;
+constexpr bool kDebugMNPThrottle = false;
+constexpr bool kDebugCDC = false;
+constexpr bool kDebugFlash = false;
+#define ND_DEBUG_DOCK 0
+
+// Log settings
+constexpr bool kLogTime = false;
+constexpr bool kLogUART = false;
+constexpr bool kLogCDC = false;
+constexpr bool kLogMNPErrors = false;
+constexpr bool kLogMNPWarnings = false;
+constexpr bool kLogMNPState = false;
+constexpr bool kLogMNPFlow = false;
+constexpr bool kLogDock = false;
+constexpr bool kLogDockProgress = false;
+constexpr bool kLogDockErrors = false;
+constexpr bool kLogNSOF = false;
+constexpr bool kLogSDCard = false;
+constexpr bool kLogSwitchMatrix = false;
+
+// SD Card directory index
+constexpr uint32_t kSDCardIndexDirs = 32; // Number of directory listings kept in RAM
+constexpr uint32_t kSDCardIndexBytes = 4 * 1024 * 1024; // RAM for all listings together
+constexpr uint32_t kSDCardPackageInfos = 1024; // Number of package headers kept in RAM
+
+// SD Card writing
+constexpr uint32_t kSDCardWriteBlock = 32 * 1024; // Write-behind buffer, one of two; a multiple of the cluster size
+constexpr uint32_t kBackupReserve = 1024 * 1024; // Preallocate this much for every backup file
+constexpr uint32_t kBackupIndexSize = 1024 * 1024; // Largest soup index that we read, 12 bytes per entry
+constexpr uint32_t kRestoreAhead = 8; // Soup entries that are read from the card while the previous one is sent
+constexpr uint32_t kRestoreEntrySize = 1024 * 1024; // Largest soup entry that can be restored
+
+// Host serial port
+constexpr uint kUART_BaudRate = 38400;
+constexpr uint32_t kUARTBatch = 4096; // Bytes read from or written to the port in one system call
+
+} // namespace nd
+
+#endif // ND_MAIN_H
@@ -74,11 +74,11 @@ Hardware Version 4.0
 
 #include "common/Endpoints/Dock.h"
 #include "common/Endpoints/StdioLog.h"
-#include "common/Filters/DTRSwitch.h"
 #include "common/Filters/HayesFilter.h"
 #include "common/Filters/MNPFilter.h"
-#include "common/Pipes/BufferedPipe.h"
+#include "common/Filters/SwitchMatrix.h"
 #include "common/Pipes/MNPThrottle.h"
+#include "common/Pipes/StaticPipeline.h"
 #include "common/Pipes/Tee.h"
 
 #include <pico/stdlib.h>
@@ -107,18 +107,28 @@ PicoStatusDisplay app_status(scheduler);
 PicoUARTEndpoint uart_endpoint { scheduler };
 PicoCDCEndpoint cdc_endpoint { scheduler, 0 };
 PicoSDCardEndpoint sdcard_endpoint { scheduler };
-Dock dock_endpoint(scheduler);
+
+// What the tasks of the pipe graph share.
+Context context { scheduler, user_settings, sdcard_endpoint, app_status };
+
+// Dock emulator, talking to the Newton through MNP.
+Dock dock_endpoint(context);
 
 // Filters and loggers.
-HayesFilter uart_hayes(scheduler, 0);
-HayesFilter cdc_hayes(scheduler, 1);
+HayesFilter uart_hayes(context, 0);
+HayesFilter cdc_hayes(context, 1);
 MNPFilter mnp_filter(scheduler);
-DTRSwitch dtr_switch;
+
+// Routes between the sides of the dongle. ATS310 uses these port numbers.
+constexpr uint8_t kPortUART = 0;
+constexpr uint8_t kPortDock = 1;
+constexpr uint8_t kPortCDC = 2;
+SwitchMatrix switch_matrix(context);
 
 // Pipes to connect everything.
-MNPThrottle mnp_throttle(scheduler);
-BufferedPipe buffer_to_cdc(scheduler);
-BufferedPipe buffer_to_uart(scheduler);
+MNPThrottle mnp_throttle(context);
+StaticPipeline<StaticBuffer<11>> buffer_to_cdc(scheduler);
+StaticPipeline<StaticBuffer<11>> buffer_to_uart(scheduler);
 
 
 // -- Everything is already allocated. Now link the endpoints and run the scheduler.
@@ -136,8 +146,8 @@ int main(int argc, char *argv[])
     scheduler.signal_all( Event {Event::Type::SIGNAL, Event::Subtype::USER_SETTINGS_CHANGED} );
 
     // -- Connect the Endpoints inside the dongle with pipes.
-    // UART ---------------> UART_Hayes --------------------> DTRSwitch ---> CDC Hayes ---> buffer ---> CDC
-    // UART <--- buffer <--- UART_Hayes <--- MNPThrottle <--- DTRSwitch <--- CDC Hayes <--------------- CDC
+    // UART ---------------> UART_Hayes --------------------> Matrix ------> CDC Hayes ---> buffer ---> CDC
+    // UART <--- buffer <--- UART_Hayes <--- MNPThrottle <--- Matrix <------ CDC Hayes <--------------- CDC
     //                                                           ↑↓
     //                                                           MNP
     //                                                           ↑↓
@@ -145,21 +155,26 @@ int main(int argc, char *argv[])
     //                                                           ↑↓
     //                                                         SDCard    
 
-    // Connect the UART to the Dock or the CDC, depending on the CDC DTR pin.
+    // Connect the UART, the Dock, and the CDC to the matrix.
     /**/  uart_endpoint >> uart_hayes.downstream;
-    /**/    uart_hayes.upstream >> dtr_switch;
-    /**/      dtr_switch.dock >> mnp_filter.newt;
+    /**/    uart_hayes.upstream >> switch_matrix.port(kPortUART);
+    /**/      switch_matrix.port(kPortDock) >> mnp_filter.newt;
     /**/        mnp_filter.newt >> dock_endpoint;
-    /**/      dtr_switch.cdc >> cdc_hayes.upstream;
+    /**/      switch_matrix.port(kPortCDC) >> cdc_hayes.upstream;
     /**/        cdc_hayes.downstream >> buffer_to_cdc >> cdc_endpoint;
     // Connect the USB CDC and the Dock back to the UART.
     /**/  dock_endpoint >> mnp_filter.dock;
-    /**/    mnp_filter.dock >> dtr_switch.dock;
+    /**/    mnp_filter.dock >> switch_matrix.port(kPortDock);
     /**/  cdc_endpoint >> cdc_hayes.downstream;
-    /**/    cdc_hayes.upstream >> dtr_switch.cdc;
-    /**/      dtr_switch >> mnp_throttle >> uart_hayes.upstream;
+    /**/    cdc_hayes.upstream >> switch_matrix.port(kPortCDC);
+    /**/      switch_matrix.port(kPortUART) >> mnp_throttle >> uart_hayes.upstream;
     /**/        uart_hayes.downstream >> buffer_to_uart >> uart_endpoint;
 
+    // The UART talks to the Dock, or to the CDC while its DTR pin is set.
+    // The routes need no buffers, the pipes behind them have their own.
+    switch_matrix.connect(kPortUART, kPortDock, false);
+    switch_matrix.follow_dtr(kPortCDC, kPortUART);
+
     // -- Give both serial ports access to the SD Card (currently for debugging only)
     uart_hayes.link(&sdcard_endpoint);
     cdc_hayes.link(&sdcard_endpoint);
@@ -41,7 +41,19 @@ constexpr bool kLogDockProgress = false;
 constexpr bool kLogDockErrors = false;
 constexpr bool kLogNSOF = false;
 constexpr bool kLogSDCard = false;
-constexpr bool kLogDTRSwitch = false;
+constexpr bool kLogSwitchMatrix = false;
+
+// SD Card directory index
+constexpr uint32_t kSDCardIndexDirs = 4; // Number of directory listings kept in RAM
+constexpr uint32_t kSDCardIndexBytes = 32 * 1024; // RAM for all listings together
+constexpr uint32_t kSDCardPackageInfos = 64; // Number of package headers kept in RAM
+
+// SD Card writing
+constexpr uint32_t kSDCardWriteBlock = 4 * 1024; // Write-behind buffer, one of two; a multiple of the cluster size
+constexpr uint32_t kBackupReserve = 64 * 1024; // Preallocate this much for every backup file
+constexpr uint32_t kBackupIndexSize = 48 * 1024; // Largest soup index that we read, 12 bytes per entry
+constexpr uint32_t kRestoreAhead = 4; // Soup entries that are read from the card while the previous one is sent
+constexpr uint32_t kRestoreEntrySize = 32 * 1024; // Largest soup entry that can be restored
 
 // PiPico developer board settings
 
@@ -0,0 +1,144 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "DockServer.h"
+
+#include "main.h"
+
+#include <chrono>
+#include <cstdlib>
+
+using namespace nd;
+
+/*
+ The dock server runs many Newtons in one process, for example a farm of
+ emulators, or a test rig that replays sessions. Every session has the same
+ pipe graph as the App, with its own settings, status, and SD Card root:
+
+  Socket ---------------> Hayes ------------------> MNP ---> Dock
+  Socket <--- buffer <--- Hayes <--- MNPThrottle <--- MNP <--- Dock
+
+ Sessions are spread round robin over a pool of worker threads. Every worker
+ has its own Scheduler, and a session only ever runs on the scheduler that it
+ was created with, so the pipe graphs need no locking. The tasks of one
+ worker take turns, just like on the dongle.
+
+ Session `i` listens on session_address(address, i): a TCP port is counted
+ up, a Unix socket path gets ".i" appended.
+ */
+
+/**
+ * \brief Create the pipe graph of one session on the given scheduler.
+ *
+ * \param scheduler The scheduler of the worker that runs this session.
+ * \param address The socket address, see PosixSocketEndpoint::set_address().
+ * \param root The directory that the Dock sees as its SD Card.
+ */
+DockSession::DockSession(Scheduler &scheduler, const std::string &address, const std::string &root)
+:   status_(scheduler)
+,   sdcard_(scheduler)
+,   context_ { scheduler, settings_, sdcard_, status_ }
+,   port_(scheduler)
+,   hayes_(context_, 0)
+,   mnp_filter_(scheduler)
+,   dock_(context_)
+,   mnp_throttle_(context_)
+,   buffer_to_port_(scheduler)
+{
+    port_.set_address(address);
+    if (!root.empty()) sdcard_.set_root(root);
+
+    /**/  port_ >> hayes_.downstream;
+    /**/    hayes_.upstream >> mnp_filter_.newt;
+    /**/      mnp_filter_.newt >> dock_;
+    /**/  dock_ >> mnp_filter_.dock;
+    /**/    mnp_filter_.dock >> mnp_throttle_ >> hayes_.upstream;
+    /**/      hayes_.downstream >> buffer_to_port_ >> port_;
+
+    hayes_.link(&sdcard_);
+}
+
+/**
+ * \brief Create all sessions. Nothing runs until start() is called.
+ *
+ * \param num_sessions Number of Newtons that can connect at the same time.
+ * \param num_workers Number of threads, at least one, at most one per session.
+ * \param address Address of the first session.
+ * \param root Directory that all sessions use as their SD Card.
+ */
+DockServer::DockServer(uint32_t num_sessions, uint32_t num_workers, const std::string &address, const std::string &root)
+{
+    if (num_workers > num_sessions) num_workers = num_sessions;
+    if (num_workers == 0) num_workers = 1;
+    for (uint32_t i = 0; i < num_workers; i++)
+        workers_.push_back(new Worker());
+    for (uint32_t i = 0; i < num_sessions; i++) {
+        Worker *worker = workers_[i % num_workers];
+        DockSession *session = new DockSession(worker->scheduler_, session_address(address, i), root);
+        worker->sessions_.push_back(session);
+        sessions_.push_back(session);
+    }
+}
+
+DockServer::~DockServer() {
+    stop();
+    // Tasks can't leave their scheduler, so sessions go before the workers.
+    for (auto session : sessions_) delete session;
+    for (auto worker : workers_) delete worker;
+}
+
+/**
+ * \brief Start all workers and return when every session is listening.
+ */
+void DockServer::start() {
+    quit_ = false;
+    ready_ = 0;
+    for (auto worker : workers_) {
+        if (!worker->thread_.joinable())
+            worker->thread_ = std::thread(&DockServer::run_, this, std::ref(*worker));
+    }
+    while (ready_ < workers_.size())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+/**
+ * \brief Stop all workers. Connected Newtons stay connected until the server is deleted.
+ */
+void DockServer::stop() {
+    quit_ = true;
+    for (auto worker : workers_) {
+        if (worker->thread_.joinable()) worker->thread_.join();
+    }
+}
+
+/**
+ * \brief The address of session `index`, counting up from `address`.
+ */
+std::string DockServer::session_address(const std::string &address, uint32_t index) {
+    if (address.find('/') != std::string::npos)
+        return address + "." + std::to_string(index);
+    std::string host;
+    std::string port = address;
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+        host = address.substr(0, colon + 1);
+        port = address.substr(colon + 1);
+    }
+    return host + std::to_string(strtoul(port.c_str(), nullptr, 10) + index);
+}
+
+/**
+ * \brief Thread function of a worker: run the scheduler until stop() is called.
+ */
+void DockServer::run_(Worker &worker) {
+    worker.scheduler_.init();
+    worker.scheduler_.signal_all( Event {Event::Type::SIGNAL, Event::Subtype::USER_SETTINGS_CHANGED} );
+    ready_++;
+    while (!quit_) {
+        worker.scheduler_.run(64);
+        // Workers never block, so let the other workers and the kernel have the core.
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,87 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_POSIX_DOCK_SERVER_H
+#define ND_POSIX_DOCK_SERVER_H
+
+#include "PosixScheduler.h"
+#include "Posix/Endpoints/PosixSDCardEndpoint.h"
+#include "Posix/Endpoints/PosixSocketEndpoint.h"
+
+#include "common/Context.h"
+#include "common/StatusDisplay.h"
+#include "common/UserSettings.h"
+#include "common/Endpoints/Dock.h"
+#include "common/Filters/HayesFilter.h"
+#include "common/Filters/MNPFilter.h"
+#include "common/Pipes/MNPThrottle.h"
+#include "common/Pipes/StaticPipeline.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nd {
+
+/**
+ * \brief One Newton on a socket, with its own pipe graph, settings, and SD Card.
+ */
+class DockSession {
+    UserSettings settings_;
+    StatusDisplay status_;
+    PosixSDCardEndpoint sdcard_;
+    Context context_;
+    PosixSocketEndpoint port_;
+    HayesFilter hayes_;
+    MNPFilter mnp_filter_;
+    Dock dock_;
+    MNPThrottle mnp_throttle_;
+    StaticPipeline<StaticBuffer<11>> buffer_to_port_;
+public:
+    DockSession(Scheduler &scheduler, const std::string &address, const std::string &root);
+    ~DockSession() = default;
+    DockSession(const DockSession&) = delete;
+    DockSession& operator=(const DockSession&) = delete;
+    DockSession(DockSession&&) = delete;
+    DockSession& operator=(DockSession&&) = delete;
+
+    PosixSocketEndpoint &port() { return port_; }
+    Dock &dock() { return dock_; }
+};
+
+/**
+ * \brief Serve many Newtons from one process, spread over a pool of threads.
+ */
+class DockServer {
+    struct Worker {
+        PosixScheduler scheduler_;
+        std::vector<DockSession*> sessions_;
+        std::thread thread_;
+    };
+    std::vector<Worker*> workers_;
+    std::vector<DockSession*> sessions_;
+    std::atomic<bool> quit_ { false };
+    std::atomic<uint32_t> ready_ { 0 };
+    void run_(Worker &worker);
+public:
+    DockServer(uint32_t num_sessions, uint32_t num_workers, const std::string &address, const std::string &root);
+    ~DockServer();
+    DockServer(const DockServer&) = delete;
+    DockServer& operator=(const DockServer&) = delete;
+    DockServer(DockServer&&) = delete;
+    DockServer& operator=(DockServer&&) = delete;
+
+    void start();
+    void stop();
+    static std::string session_address(const std::string &address, uint32_t index);
+
+    uint32_t size() const { return sessions_.size(); }
+    DockSession &session(uint32_t index) { return *sessions_[index]; }
+};
+
+} // namespace nd
+
+#endif // ND_POSIX_DOCK_SERVER_H
@@ -10,10 +10,110 @@
 #include "common/Scheduler.h"
 
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace nd;
 
+/*
+ The Posix SD Card is a directory on the host. It is set with set_root(), or
+ with the environment variable ND_SDCARD_ROOT. Paths on the card are UTF-16
+ just like with FatFS and are converted to UTF-8 for the host.
+
+ The current directory is kept here and never changes the directory of the
+ process. Files are mapped into memory when opened, so viewfile() can hand out
+ slices of the file without copying them.
+
+ Files that are created for writing are preallocated with posix_fallocate(),
+ which is what f_expand() does on the Pico.
+
+ Requests are run by a worker thread, one at a time and in order. The worker
+ is started with the first request. Finished requests are handed back to the
+ scheduler thread, which marks them done in task().
+ */
+
+static std::string utf16_to_utf8(const std::u16string &src)
+{
+    std::string dst;
+    dst.reserve(src.size());
+    for (size_t i = 0; i < src.size(); ++i) {
+        uint32_t c = src[i];
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < src.size() && src[i+1] >= 0xDC00 && src[i+1] < 0xE000) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (src[i+1] - 0xDC00);
+            ++i;
+        }
+        if (c < 0x80) {
+            dst.push_back((char)c);
+        } else if (c < 0x800) {
+            dst.push_back((char)(0xC0 | (c >> 6)));
+            dst.push_back((char)(0x80 | (c & 0x3F)));
+        } else if (c < 0x10000) {
+            dst.push_back((char)(0xE0 | (c >> 12)));
+            dst.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+            dst.push_back((char)(0x80 | (c & 0x3F)));
+        } else {
+            dst.push_back((char)(0xF0 | (c >> 18)));
+            dst.push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+            dst.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+            dst.push_back((char)(0x80 | (c & 0x3F)));
+        }
+    }
+    return dst;
+}
+
+static std::u16string utf8_to_utf16(const char *src)
+{
+    std::u16string dst;
+    const uint8_t *s = (const uint8_t*)src;
+    while (*s) {
+        uint32_t c = *s++;
+        int n = 0;
+        if (c >= 0xF0) { c &= 0x07; n = 3; }
+        else if (c >= 0xE0) { c &= 0x0F; n = 2; }
+        else if (c >= 0xC0) { c &= 0x1F; n = 1; }
+        else if (c >= 0x80) { c = 0xFFFD; } // stray continuation byte
+        for ( ; n > 0; --n) {
+            if ((*s & 0xC0) != 0x80) { c = 0xFFFD; break; }
+            c = (c << 6) | (*s++ & 0x3F);
+        }
+        if (c >= 0x10000) {
+            c -= 0x10000;
+            dst.push_back((char16_t)(0xD800 + (c >> 10)));
+            dst.push_back((char16_t)(0xDC00 + (c & 0x3FF)));
+        } else {
+            dst.push_back((char16_t)c);
+        }
+    }
+    return dst;
+}
+
+/**
+ * \brief Convert errno into the closest FatFS error code.
+ */
+static uint32_t fr_from_errno(int err, uint32_t not_found)
+{
+    switch (err) {
+        case ENOENT: return not_found;
+        case EEXIST: return FR_EXIST;
+        case EROFS: return FR_DENIED;
+        case ENOTDIR: return FR_NO_PATH;
+        case EACCES:
+        case EPERM: return FR_DENIED;
+        case ENAMETOOLONG: return FR_INVALID_NAME;
+        case EMFILE:
+        case ENFILE: return FR_TOO_MANY_OPEN_FILES;
+        case ENOMEM: return FR_NOT_ENOUGH_CORE;
+    }
+    return FR_DISK_ERR;
+}
+
 void PosixSDCardEndpoint::early_init()
 {
 }
@@ -23,17 +123,92 @@ PosixSDCardEndpoint::PosixSDCardEndpoint(Scheduler &scheduler)
 {
 }
 
+PosixSDCardEndpoint::PosixSDCardEndpoint(Scheduler &scheduler, uint32_t index_bytes)
+:   SDCardEndpoint(scheduler, index_bytes)
+{
+}
+
 PosixSDCardEndpoint::~PosixSDCardEndpoint() {
+    if (worker_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+    closefile();
+    closedir();
 }
 
 Result PosixSDCardEndpoint::init()
 {
     SDCardEndpoint::init();
+    if (root_.empty()) {
+        const char *root = getenv("ND_SDCARD_ROOT");
+        if (root && *root) set_root(root);
+    }
     return Result::OK;
 }
 
+/**
+ * \brief Complete all requests that the worker finished.
+ */
 Result PosixSDCardEndpoint::task() {
-    return SDCardEndpoint::task();
+    prewarm_task_();
+    std::deque<SDCardRequest*> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done.swap(done_);
+        // Keep the clock from skipping ahead while the worker is on it
+        if (running_ || !requests_.empty() || !done.empty())
+            scheduler().busy();
+    }
+    for (auto req: done) complete_(*req);
+    return Endpoint::task();
+}
+
+Result PosixSDCardEndpoint::submit(SDCardRequest &req) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (req.pending() || requests_.size() >= kMaxRequests) return Result::REJECTED;
+        req.state_ = SDCardRequest::State::PENDING;
+        req.pos_ = 0;
+        requests_.push_back(&req);
+        if (!worker_.joinable()) worker_ = std::thread(&PosixSDCardEndpoint::worker_main_, this);
+    }
+    cv_.notify_all();
+    return Result::OK;
+}
+
+/**
+ * \brief Remove a request. If the worker is running it right now, wait for it.
+ */
+void PosixSDCardEndpoint::cancel(SDCardRequest &req) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]{ return running_ != &req; });
+    auto it = std::find(requests_.begin(), requests_.end(), &req);
+    if (it != requests_.end()) requests_.erase(it);
+    it = std::find(done_.begin(), done_.end(), &req);
+    if (it != done_.end()) done_.erase(it);
+    req.reset();
+}
+
+void PosixSDCardEndpoint::worker_main_() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cv_.wait(lock, [this]{ return quit_ || !requests_.empty(); });
+        if (quit_) return;
+        SDCardRequest *req = requests_.front();
+        requests_.pop_front();
+        running_ = req;
+        lock.unlock();
+        while (!step_(*req)) { }
+        lock.lock();
+        running_ = nullptr;
+        done_.push_back(req);
+        cv_.notify_all();
+    }
 }
 
 Result PosixSDCardEndpoint::send(Event event) {
@@ -41,19 +216,81 @@ Result PosixSDCardEndpoint::send(Event event) {
     return SDCardEndpoint::send(event);
 }
 
+/**
+ * \brief Use a host directory as the SD Card.
+ * The label of the card is the name of the directory.
+ */
+uint32_t PosixSDCardEndpoint::set_root(const std::string &path)
+{
+    closefile();
+    closedir();
+    index_.invalidate();
+    cwd_ = u"/";
+    root_ = path;
+    while (root_.size() > 1 && root_.back() == '/') root_.pop_back();
+    struct stat st;
+    if (::stat(root_.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        if (kLogSDCard) Log.logf("set_root: not a directory: %s\n", root_.c_str());
+        root_.clear();
+        label_ = u"ERROR";
+        status_ = FR_NOT_READY;
+        return status_;
+    }
+    auto sep = root_.find_last_of('/');
+    label_ = utf8_to_utf16((sep == std::string::npos) ? root_.c_str() : root_.c_str() + sep + 1);
+    status_ = FR_OK;
+    return status_;
+}
+
+/**
+ * \brief Make a path on the card absolute and remove `.` and `..`.
+ * A FatFS drive number like `0:` is ignored. Returns false if the path would
+ * leave the card.
+ */
+bool PosixSDCardEndpoint::resolve_(const std::u16string &path, std::u16string &card_path)
+{
+    size_t i = 0;
+    if (path.size() >= 2 && path[1] == ':') i = 2;
+    if (i < path.size() && path[i] == '/') {
+        card_path = u"/";
+    } else {
+        card_path = cwd_;
+    }
+    while (i < path.size()) {
+        size_t end = path.find('/', i);
+        if (end == std::u16string::npos) end = path.size();
+        std::u16string item = path.substr(i, end - i);
+        i = end + 1;
+        if (item.empty() || item == u".") continue;
+        if (item == u"..") {
+            if (card_path.size() <= 1) return false;
+            card_path.erase(card_path.find_last_of('/'));
+            if (card_path.empty()) card_path = u"/";
+            continue;
+        }
+        if (card_path.back() != '/') card_path.push_back('/');
+        card_path.append(item);
+    }
+    return true;
+}
+
+std::string PosixSDCardEndpoint::host_path_(const std::u16string &card_path)
+{
+    return root_ + utf16_to_utf8(card_path);
+}
 
 const char *PosixSDCardEndpoint::strerr(uint32_t err) {
     switch (err) {
         case FR_OK: return "OK";
-        // case FR_DISK_ERR: return "DISK_ERR";
-        // case FR_INT_ERR: return "INT_ERR";
-        // case FR_NOT_READY: return "NOT_READY";
-        // case FR_NO_FILE: return "NO_FILE";
-        // case FR_NO_PATH: return "NO_PATH";
-        // case FR_INVALID_NAME: return "INVALID_NAME";
-        // case FR_DENIED: return "DENIED";
-        // case FR_EXIST: return "EXIST";
-        // case FR_INVALID_OBJECT: return "INVALID_OBJECT";
+        case FR_DISK_ERR: return "DISK_ERR";
+        case FR_INT_ERR: return "INT_ERR";
+        case FR_NOT_READY: return "NOT_READY";
+        case FR_NO_FILE: return "NO_FILE";
+        case FR_NO_PATH: return "NO_PATH";
+        case FR_INVALID_NAME: return "INVALID_NAME";
+        case FR_DENIED: return "DENIED";
+        case FR_EXIST: return "EXIST";
+        case FR_INVALID_OBJECT: return "INVALID_OBJECT";
         // case FR_WRITE_PROTECTED: return "WRITE_PROTECTED";
         // case FR_INVALID_DRIVE: return "INVALID_DRIVE";
         // case FR_NOT_ENABLED: return "NOT_ENABLED";
@@ -61,8 +298,8 @@ const char *PosixSDCardEndpoint::strerr(uint32_t err) {
         // case FR_MKFS_ABORTED: return "MKFS_ABORTED";
         // case FR_TIMEOUT: return "TIMEOUT";
         // case FR_LOCKED: return "LOCKED";
-        // case FR_NOT_ENOUGH_CORE: return "NOT_ENOUGH_CORE";
-        // case FR_TOO_MANY_OPEN_FILES: return "TOO_MANY_OPEN_FILES";
+        case FR_NOT_ENOUGH_CORE: return "NOT_ENOUGH_CORE";
+        case FR_TOO_MANY_OPEN_FILES: return "TOO_MANY_OPEN_FILES";
         case FR_INVALID_PARAMETER: return "INVALID_PARAMETER";
         case FR_IS_DIRECTORY: return "IS_DIRECTORY";
         case FR_IS_PACKAGE: return "IS_PACKAGE"; // Custom error for package files
@@ -76,44 +313,273 @@ const std::u16string &PosixSDCardEndpoint::get_label() {
 
 uint32_t PosixSDCardEndpoint::opendir()
 {
+    if (status_ != FR_OK) return status_;
+    closedir();
+    std::string path = host_path_(cwd_);
+    dir_ = ::opendir(path.c_str());
+    if (!dir_) {
+        uint32_t err = fr_from_errno(errno, FR_NO_PATH);
+        if (kLogSDCard) Log.logf("opendir: %s error: %s (%d)\n", path.c_str(), strerr(err), err);
+        return err;
+    }
     return FR_OK;
 }
 
 uint32_t PosixSDCardEndpoint::readdir(std::u16string &name)
 {
-    return FR_OK;
+    SDCardDirEntry entry;
+    uint32_t ret = readentry(entry);
+    name.swap(entry.name_);
+    return ret;
+}
+
+/**
+ * \brief Return the next directory or package file, just like on the Pico.
+ * Hidden files are skipped.
+ */
+uint32_t PosixSDCardEndpoint::readentry(SDCardDirEntry &entry)
+{
+    if (!dir_) return FR_INVALID_OBJECT;
+    for (;;) {
+        errno = 0;
+        struct dirent *de = ::readdir(dir_);
+        if (!de) {
+            if (errno != 0) return fr_from_errno(errno, FR_NO_FILE);
+            // No more files in the directory
+            if (kLogSDCard) Log.log("readdir: no more files\n");
+            return FR_NO_FILE;
+        }
+        const char *n = de->d_name;
+        if (n[0] == '.') {
+            // Skip hidden files, and also '.' and '..'
+            if (kLogSDCard) Log.logf("readdir: skipping hidden file: %s\n", n);
+            continue;
+        }
+        struct stat st;
+        if (::fstatat(dirfd(dir_), n, &st, 0) != 0) {
+            // Skip dangling links and files that vanished
+            if (kLogSDCard) Log.logf("readdir: can't stat: %s\n", n);
+            continue;
+        }
+        entry.mtime_ = (uint32_t)st.st_mtime;
+        if (S_ISDIR(st.st_mode)) {
+            entry.name_ = utf8_to_utf16(n);
+            entry.type_ = FR_IS_DIRECTORY;
+            entry.size_ = 0;
+            if (kLogSDCard) Log.logf("readdir: returning a directory: %s\n", n);
+            return FR_IS_DIRECTORY;
+        }
+        auto len = strlen(n);
+        if (S_ISREG(st.st_mode) && len>=4 && n[len-4]=='.' && (n[len-3]=='p' || n[len-3]=='P') && (n[len-2]=='k' || n[len-2]=='K') && (n[len-1]=='g' || n[len-1]=='G')) {
+            entry.name_ = utf8_to_utf16(n);
+            entry.type_ = FR_IS_PACKAGE;
+            entry.size_ = (st.st_size > 0xffffffff) ? 0xffffffff : (uint32_t)st.st_size;
+            if (kLogSDCard) Log.logf("readdir: returning a package file: %s\n", n);
+            return FR_IS_PACKAGE;
+        }
+        if (kLogSDCard) Log.logf("readdir: skipping file: %s\n", n);
+    }
 }
 
 uint32_t PosixSDCardEndpoint::closedir() {
+    if (dir_) {
+        ::closedir(dir_);
+        dir_ = nullptr;
+    }
     return FR_OK;
 }
 
 uint32_t PosixSDCardEndpoint::chdir(const std::u16string &path)
 {
+    if (status_ != FR_OK) return status_;
+    std::u16string card_path;
+    if (!resolve_(path, card_path)) return FR_NO_PATH;
+    struct stat st;
+    std::string host_path = host_path_(card_path);
+    if (::stat(host_path.c_str(), &st) != 0) {
+        uint32_t err = fr_from_errno(errno, FR_NO_PATH);
+        if (kLogSDCard) Log.logf("chdir: %s error: %s (%d)\n", host_path.c_str(), strerr(err), err);
+        return err;
+    }
+    if (!S_ISDIR(st.st_mode)) return FR_NO_PATH;
+    cwd_ = card_path;
     return FR_OK;
 }
 
 uint32_t PosixSDCardEndpoint::getcwd(std::u16string &path)
 {
+    path.clear();
+    if (status_ != FR_OK) return status_;
+    path = cwd_;
     return FR_OK;
 }
 
 uint32_t PosixSDCardEndpoint::openfile(const std::u16string &name)
 {
+    if (status_ != FR_OK) return status_;
+    closefile();
+    std::u16string card_path;
+    if (!resolve_(name, card_path)) return FR_NO_PATH;
+    std::string host_path = host_path_(card_path);
+    int fd = ::open(host_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        uint32_t err = fr_from_errno(errno, FR_NO_FILE);
+        if (kLogSDCard) Log.logf("openfile: %s error: %s (%d)\n", host_path.c_str(), strerr(err), err);
+        return err;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > 0xffffffff) {
+        ::close(fd);
+        return FR_NO_FILE; // FatFS can't open directories either
+    }
+    file_ = fd;
+    file_size_ = (uint32_t)st.st_size;
+    file_pos_ = 0;
+    if (file_size_ > 0) {
+        void *map = ::mmap(nullptr, file_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            ::madvise(map, file_size_, MADV_SEQUENTIAL);
+            file_map_ = (const uint8_t*)map;
+        } else {
+            // Some file systems can't be mapped; readfile() still works.
+            if (kLogSDCard) Log.logf("openfile: can't map %s\n", host_path.c_str());
+        }
+    }
     return FR_OK;
 }
 
 uint32_t PosixSDCardEndpoint::filesize()
 {
-    return 0;
+    return file_size_;
 }
 
 uint32_t PosixSDCardEndpoint::readfile(uint8_t *buffer, uint32_t size)
 {
-    return 0;
+    if (file_ < 0) return 0xffffffff;
+    if (file_map_) {
+        const uint8_t *data = nullptr;
+        uint32_t n = viewfile(data, size);
+        if (n) memcpy(buffer, data, n);
+        return n;
+    }
+    ssize_t n = ::pread(file_, buffer, size, file_pos_);
+    if (n < 0) {
+        if (kLogSDCard) Log.logf("readfile: pread error: %s\n", strerror(errno));
+        return 0xffffffff;
+    }
+    file_pos_ += (uint32_t)n;
+    return (uint32_t)n;
+}
+
+uint32_t PosixSDCardEndpoint::viewfile(const uint8_t *&data, uint32_t size)
+{
+    data = nullptr;
+    if (!file_map_) return 0;
+    uint32_t n = file_size_ - file_pos_;
+    if (n > size) n = size;
+    data = file_map_ + file_pos_;
+    file_pos_ += n;
+    return n;
 }
 
 uint32_t PosixSDCardEndpoint::closefile()
 {
+    if (file_map_) {
+        ::munmap((void*)file_map_, file_size_);
+        file_map_ = nullptr;
+    }
+    uint32_t ret = FR_OK;
+    if (file_ >= 0) {
+        if (file_reserved_ && ::ftruncate(file_, file_pos_) != 0) {
+            if (kLogSDCard) Log.logf("closefile: ftruncate error: %s\n", strerror(errno));
+            ret = FR_DISK_ERR;
+        }
+        ::close(file_);
+        file_ = -1;
+    }
+    file_reserved_ = false;
+    file_size_ = 0;
+    file_pos_ = 0;
+    return ret;
+}
+
+uint32_t PosixSDCardEndpoint::createfile(const std::u16string &name, uint32_t reserve)
+{
+    if (status_ != FR_OK) return status_;
+    closefile();
+    std::u16string card_path;
+    if (!resolve_(name, card_path)) return FR_NO_PATH;
+    std::string host_path = host_path_(card_path);
+    int fd = ::open(host_path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) {
+        uint32_t err = fr_from_errno(errno, FR_NO_PATH);
+        if (kLogSDCard) Log.logf("createfile: %s error: %s (%d)\n", host_path.c_str(), strerr(err), err);
+        return err;
+    }
+    file_ = fd;
+    file_size_ = 0;
+    file_pos_ = 0;
+    if (reserve > 0) {
+        // Not all file systems can do this. Writing still works without it.
+        int err = ::posix_fallocate(fd, 0, reserve);
+        if (err == 0) {
+            file_reserved_ = true;
+        } else if (kLogSDCard) {
+            Log.logf("createfile: can't reserve %u bytes: %s\n", reserve, strerror(err));
+        }
+    }
+    return FR_OK;
+}
+
+uint32_t PosixSDCardEndpoint::appendfile(const std::u16string &name, uint32_t reserve)
+{
+    if (status_ != FR_OK) return status_;
+    closefile();
+    std::u16string card_path;
+    if (!resolve_(name, card_path)) return FR_NO_PATH;
+    std::string host_path = host_path_(card_path);
+    int fd = ::open(host_path.c_str(), O_WRONLY|O_CREAT, 0644);
+    if (fd < 0) {
+        uint32_t err = fr_from_errno(errno, FR_NO_PATH);
+        if (kLogSDCard) Log.logf("appendfile: %s error: %s (%d)\n", host_path.c_str(), strerr(err), err);
+        return err;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return FR_DISK_ERR;
+    }
+    file_ = fd;
+    file_size_ = (uint32_t)st.st_size;
+    file_pos_ = file_size_;
+    if (reserve > 0 && ::posix_fallocate(fd, file_pos_, reserve) == 0)
+        file_reserved_ = true;
+    return FR_OK;
+}
+
+uint32_t PosixSDCardEndpoint::writefile(const uint8_t *buffer, uint32_t size)
+{
+    if (file_ < 0 || file_map_) return 0xffffffff;
+    ssize_t n = ::pwrite(file_, buffer, size, file_pos_);
+    if (n < 0) {
+        if (kLogSDCard) Log.logf("writefile: pwrite error: %s\n", strerror(errno));
+        return 0xffffffff;
+    }
+    file_pos_ += (uint32_t)n;
+    file_size_ = std::max(file_size_, file_pos_);
+    return (uint32_t)n;
+}
+
+uint32_t PosixSDCardEndpoint::mkdir(const std::u16string &name)
+{
+    if (status_ != FR_OK) return status_;
+    std::u16string card_path;
+    if (!resolve_(name, card_path)) return FR_NO_PATH;
+    std::string host_path = host_path_(card_path);
+    if (::mkdir(host_path.c_str(), 0755) != 0) {
+        uint32_t err = fr_from_errno(errno, FR_NO_PATH);
+        if (kLogSDCard && err != FR_EXIST) Log.logf("mkdir: %s error: %s (%d)\n", host_path.c_str(), strerr(err), err);
+        return err;
+    }
     return FR_OK;
 }
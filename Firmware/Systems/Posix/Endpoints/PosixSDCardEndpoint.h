@@ -10,24 +10,69 @@ extern void test_sd_card();
 
 #include "common/Endpoints/SDCardEndpoint.h"
 
+#include <dirent.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 namespace nd {
 
+// Same values as the FatFS FRESULT codes, so the Dock sees the same errors on all platforms.
 constexpr uint32_t FR_OK = 0;
-constexpr uint32_t FR_INVALID_PARAMETER = 37; // Arbitrary
+constexpr uint32_t FR_DISK_ERR = 1;
+constexpr uint32_t FR_INT_ERR = 2;
+constexpr uint32_t FR_NOT_READY = 3;
+constexpr uint32_t FR_NO_FILE = 4;
+constexpr uint32_t FR_NO_PATH = 5;
+constexpr uint32_t FR_INVALID_NAME = 6;
+constexpr uint32_t FR_DENIED = 7;
+constexpr uint32_t FR_EXIST = 8;
+constexpr uint32_t FR_INVALID_OBJECT = 9;
+constexpr uint32_t FR_NOT_ENOUGH_CORE = 17;
+constexpr uint32_t FR_TOO_MANY_OPEN_FILES = 18;
+constexpr uint32_t FR_INVALID_PARAMETER = 19;
 constexpr uint32_t FR_IS_DIRECTORY = FR_INVALID_PARAMETER + 1;
 constexpr uint32_t FR_IS_PACKAGE = FR_INVALID_PARAMETER + 2;
 
+/**
+ * \brief Serve a directory on the host as if it was the SD Card.
+ */
 class PosixSDCardEndpoint : public SDCardEndpoint {
+    std::string root_; // Host directory that is the root of the emulated card
     std::u16string label_ { u"ERROR" }; // Label of the SD card
     uint32_t status_ = FR_INVALID_PARAMETER; // Status of the disk
+    std::u16string cwd_ { u"/" }; // Current directory on the card, always absolute
+    ::DIR *dir_ = nullptr;
+    int file_ = -1; // File descriptor of the open file
+    const uint8_t *file_map_ = nullptr; // The entire open file, mapped into memory
+    uint32_t file_size_ = 0;
+    uint32_t file_pos_ = 0;
+    bool file_reserved_ = false; // closefile() must cut the file to `file_pos_`
+    bool resolve_(const std::u16string &path, std::u16string &card_path);
+    std::string host_path_(const std::u16string &card_path);
+
+    // Requests run in a worker thread. `requests_` is guarded by `mutex_` here.
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<SDCardRequest*> done_; // finished by the worker, completed in task()
+    SDCardRequest *running_ = nullptr;
+    bool quit_ = false;
+    void worker_main_();
 public:
     PosixSDCardEndpoint(Scheduler &scheduler);
+    PosixSDCardEndpoint(Scheduler &scheduler, uint32_t index_bytes);
     ~PosixSDCardEndpoint() override;
     Result init() override;
     Result task() override;
     Result send(Event event) override;
 
     void early_init();
+    uint32_t set_root(const std::string &path);
+
+    Result submit(SDCardRequest &req) override;
+    void cancel(SDCardRequest &req) override;
 
     const char *strerr(uint32_t err) override;
     uint32_t status() override { return status_; }
@@ -35,13 +80,20 @@ public:
 
     uint32_t opendir() override;
     uint32_t readdir(std::u16string &name) override;
+    uint32_t readentry(SDCardDirEntry &entry) override;
     uint32_t closedir() override;
 
     uint32_t openfile(const std::u16string &name) override;
     uint32_t filesize() override;
     uint32_t readfile(uint8_t *buffer, uint32_t size) override;
+    uint32_t viewfile(const uint8_t *&data, uint32_t size) override;
     uint32_t closefile() override;
 
+    uint32_t createfile(const std::u16string &name, uint32_t reserve) override;
+    uint32_t appendfile(const std::u16string &name, uint32_t reserve) override;
+    uint32_t writefile(const uint8_t *buffer, uint32_t size) override;
+    uint32_t mkdir(const std::u16string &name) override;
+
     uint32_t chdir(const std::u16string &path) override;
     uint32_t getcwd(std::u16string &path) override;
 };
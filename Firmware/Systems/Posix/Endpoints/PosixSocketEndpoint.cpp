@@ -0,0 +1,171 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "PosixSocketEndpoint.h"
+
+#include "main.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace nd;
+
+/*
+ The socket endpoint listens for one client at a time, which is an emulated
+ Newton or a host tool that expects a serial port. The address is set with
+ set_address(), or with the environment variable ND_SOCKET:
+
+  - "3679" listens on that TCP port on the loopback interface,
+  - "host:3679" listens on the given interface, "0.0.0.0:3679" on all of them,
+  - anything with a '/' in it is the path of a Unix domain socket.
+
+ Reading, writing, delays, and high water work just like in the base class.
+ When the client disconnects, unsent data is dropped and the endpoint waits
+ for the next client.
+
+ All data is collected into batches of up to kUARTBatch bytes already, so
+ Nagle's algorithm only adds latency. It is off by default. set_nodelay(false)
+ turns it back on, so the kernel coalesces small writes further.
+ */
+
+PosixSocketEndpoint::PosixSocketEndpoint(Scheduler &scheduler)
+:   PosixUARTEndpoint(scheduler)
+{
+}
+
+PosixSocketEndpoint::~PosixSocketEndpoint() {
+    if (listen_ >= 0) {
+        ::close(listen_);
+        if (unix_) ::unlink(address_.c_str());
+    }
+}
+
+/**
+ * \brief Set the address to listen on. Call this before init().
+ */
+void PosixSocketEndpoint::set_address(const std::string &address) {
+    address_ = address;
+}
+
+/**
+ * \brief Enable or disable TCP_NODELAY, also for the current connection.
+ */
+void PosixSocketEndpoint::set_nodelay(bool on) {
+    nodelay_ = on;
+    if (fd_ >= 0 && !unix_) {
+        int flag = nodelay_ ? 1 : 0;
+        ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+}
+
+Result PosixSocketEndpoint::init()
+{
+    if (address_.empty()) {
+        const char *address = getenv("ND_SOCKET");
+        if (address && *address) address_ = address;
+    }
+    if (out() && !address_.empty() && !open_()) {
+        if (kDebugErrors) Log.logf("Socket: can't listen on %s: %s\n", address_.c_str(), strerror(errno));
+    }
+    return UARTEndpoint::init();
+}
+
+/**
+ * \brief Create the socket that clients connect to.
+ */
+bool PosixSocketEndpoint::open_() {
+    // A client that leaves while we write must not end the process.
+    ::signal(SIGPIPE, SIG_IGN);
+    if (address_.find('/') != std::string::npos) {
+        struct sockaddr_un addr = { };
+        if (address_.size() >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        unix_ = true;
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, address_.c_str());
+        ::unlink(addr.sun_path);
+        listen_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_ < 0) return false;
+        if (::bind(listen_, (struct sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(listen_, 1) < 0) {
+            ::close(listen_);
+            listen_ = -1;
+            return false;
+        }
+    } else {
+        std::string host = "127.0.0.1";
+        std::string port = address_;
+        size_t colon = address_.rfind(':');
+        if (colon != std::string::npos) {
+            host = address_.substr(0, colon);
+            port = address_.substr(colon + 1);
+        }
+        struct addrinfo hints = { };
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        struct addrinfo *list = nullptr;
+        if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &list) != 0) {
+            errno = EINVAL;
+            return false;
+        }
+        for (struct addrinfo *ai = list; ai && listen_ < 0; ai = ai->ai_next) {
+            listen_ = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (listen_ < 0) continue;
+            int flag = 1;
+            ::setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+            if (::bind(listen_, ai->ai_addr, ai->ai_addrlen) < 0 || ::listen(listen_, 1) < 0) {
+                ::close(listen_);
+                listen_ = -1;
+            }
+        }
+        ::freeaddrinfo(list);
+        if (listen_ < 0) return false;
+    }
+    ::fcntl(listen_, F_SETFL, ::fcntl(listen_, F_GETFL) | O_NONBLOCK);
+    Log.logf("Socket: listening on %s\n", address_.c_str());
+    return true;
+}
+
+/**
+ * \brief Take the next client if one is waiting.
+ */
+void PosixSocketEndpoint::accept_() {
+    int fd = ::accept(listen_, nullptr, nullptr);
+    if (fd < 0) return;
+    if (!unix_ && nodelay_) {
+        int flag = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+    if (!watch_(fd)) {
+        unwatch_();
+        return;
+    }
+    connections_++;
+    if (kLogUART) Log.logf("Socket: client connected\n");
+}
+
+void PosixSocketEndpoint::hangup_() {
+    if (kLogUART) Log.logf("Socket: client disconnected\n");
+    unwatch_();
+}
+
+/**
+ * \brief Accept a client while there is none, then run the port like a UART.
+ */
+Result PosixSocketEndpoint::task() {
+    if (fd_ < 0 && listen_ >= 0) accept_();
+    return PosixUARTEndpoint::task();
+}
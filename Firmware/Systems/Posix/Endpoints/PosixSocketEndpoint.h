@@ -0,0 +1,45 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_POSIX_SOCKET_ENDPOINT_H
+#define ND_POSIX_SOCKET_ENDPOINT_H
+
+#include "Posix/Endpoints/PosixUARTEndpoint.h"
+
+#include <string>
+
+namespace nd {
+
+/**
+ * \brief Serial port that an emulator or a host tool connects to over TCP or a Unix socket.
+ */
+class PosixSocketEndpoint : public PosixUARTEndpoint {
+    std::string address_; // "port", "host:port", or a path for a Unix socket
+    bool nodelay_ = true; // disable Nagle's algorithm on TCP connections
+    bool unix_ = false;
+    int listen_ = -1;
+    uint32_t connections_ = 0;
+    void accept_();
+protected:
+    bool open_() override;
+    void hangup_() override;
+public:
+    PosixSocketEndpoint(Scheduler &scheduler);
+    ~PosixSocketEndpoint() override;
+    Result init() override;
+    Result task() override;
+
+    void set_address(const std::string &address);
+    const std::string &address() const { return address_; }
+    void set_nodelay(bool on);
+    /// True while a client is connected.
+    bool connected() const { return fd_ >= 0; }
+    /// Number of clients that connected so far.
+    uint32_t connections() const { return connections_; }
+};
+
+} // namespace nd
+
+#endif // ND_POSIX_SOCKET_ENDPOINT_H
@@ -0,0 +1,332 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "PosixUARTEndpoint.h"
+
+#include "main.h"
+#include "common/Pipe.h"
+#include "common/Scheduler.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#  include <sys/epoll.h>
+#else
+#  include <poll.h>
+#endif
+
+using namespace nd;
+
+/*
+ The Posix UART is either a tty device, set with set_device() or with the
+ environment variable ND_UART_DEVICE, or a new pseudo-terminal. The name of
+ the pseudo-terminal is logged at startup and returned by pty_name(). An
+ emulator or a terminal program can connect to it like to a serial port.
+
+ The port is non-blocking. On Linux, epoll tells us when it becomes readable
+ or writable, so an idle port costs one epoll_wait() per cycle. Data is read
+ and written in batches of up to kUARTBatch bytes per system call.
+
+ A tty is opened with hardware flow control. The kernel then holds back our
+ output while CTS is low, and lowers RTS when its input buffer fills up. At
+ high water we simply stop reading, which fills that buffer.
+
+ Delays run on a Timer of the scheduler, so they also work with a
+ VirtualClock.
+ */
+
+PosixUARTEndpoint::PosixUARTEndpoint(Scheduler &scheduler)
+:   UARTEndpoint(scheduler)
+{
+    rx_.resize(kUARTBatch);
+    tx_.reserve(kUARTBatch);
+}
+
+PosixUARTEndpoint::~PosixUARTEndpoint() {
+    if (poll_ >= 0) ::close(poll_);
+    if (pty_client_ >= 0) ::close(pty_client_);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+/**
+ * \brief Use a tty device instead of a pseudo-terminal. Call this before init().
+ */
+void PosixUARTEndpoint::set_device(const std::string &path) {
+    device_ = path;
+}
+
+Result PosixUARTEndpoint::init()
+{
+    if (!out()) return UARTEndpoint::init(); // not part of the graph, stay closed
+    if (device_.empty()) {
+        const char *device = getenv("ND_UART_DEVICE");
+        if (device && *device) device_ = device;
+    }
+    if (!open_()) {
+        if (kDebugErrors) Log.logf("UART: can't open %s: %s\n",
+            device_.empty() ? "a pseudo-terminal" : device_.c_str(), strerror(errno));
+    }
+    return UARTEndpoint::init();
+}
+
+/**
+ * \brief Open the tty or create the pseudo-terminal, and register it for events.
+ */
+bool PosixUARTEndpoint::open_() {
+    if (device_.empty()) {
+        fd_ = ::posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd_ < 0) return false;
+        if (::grantpt(fd_) < 0 || ::unlockpt(fd_) < 0) return false;
+        const char *name = ::ptsname(fd_);
+        if (!name) return false;
+        pty_name_ = name;
+        // Without a client, reading the pseudo-terminal fails with EIO.
+        pty_client_ = ::open(name, O_RDWR | O_NOCTTY);
+        if (pty_client_ >= 0) {
+            struct termios tio;
+            if (::tcgetattr(pty_client_, &tio) == 0) {
+                ::cfmakeraw(&tio);
+                ::tcsetattr(pty_client_, TCSANOW, &tio);
+            }
+        }
+        Log.logf("UART: connect to %s\n", name);
+    } else {
+        fd_ = ::open(device_.c_str(), O_RDWR | O_NOCTTY);
+        if (fd_ < 0) return false;
+    }
+    apply_settings_();
+    return watch_(fd_);
+}
+
+/**
+ * \brief Make `fd` the port, non-blocking, and register it for events.
+ */
+bool PosixUARTEndpoint::watch_(int fd) {
+    fd_ = fd;
+    ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) | O_NONBLOCK);
+#ifdef __linux__
+    if (poll_ < 0) poll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (poll_ < 0) return false;
+    struct epoll_event ev = { };
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    if (::epoll_ctl(poll_, EPOLL_CTL_ADD, fd_, &ev) < 0) return false;
+#endif
+    readable_ = true; // edge triggered, so look once before waiting for events
+    writable_ = true;
+    return true;
+}
+
+/**
+ * \brief Close the port and drop all data that was not sent or forwarded yet.
+ */
+void PosixUARTEndpoint::unwatch_() {
+    if (fd_ < 0) return;
+#ifdef __linux__
+    if (poll_ >= 0) ::epoll_ctl(poll_, EPOLL_CTL_DEL, fd_, nullptr);
+#endif
+    ::close(fd_);
+    fd_ = -1;
+    readable_ = false;
+    rx_head_ = rx_tail_ = 0;
+    tx_.clear();
+    tx_wait_for_drain_ = false;
+    tx_delay_ = 0;
+    tx_timer_.cancel();
+}
+
+/**
+ * \brief Set raw mode, 8N1, and the current bitrate.
+ */
+void PosixUARTEndpoint::apply_settings_() {
+    struct termios tio;
+    if (::tcgetattr(fd_, &tio) < 0) return;
+    ::cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+#ifdef CRTSCTS
+    if (!device_.empty()) tio.c_cflag |= CRTSCTS;
+#endif
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    speed_t speed = B0;
+    switch (bitrate()) {
+        case 2400: speed = B2400; break;
+        case 4800: speed = B4800; break;
+        case 9600: speed = B9600; break;
+        case 19200: speed = B19200; break;
+        case 38400: speed = B38400; break;
+        case 57600: speed = B57600; break;
+        case 115200: speed = B115200; break;
+        case 230400: speed = B230400; break;
+        default:
+            if (kDebugErrors) Log.logf("UART: bitrate %d not supported\n", bitrate());
+            break;
+    }
+    if (speed != B0) {
+        ::cfsetispeed(&tio, speed);
+        ::cfsetospeed(&tio, speed);
+    }
+    ::tcsetattr(fd_, TCSANOW, &tio);
+}
+
+/**
+ * \brief Update `readable_` and `writable_` without waiting.
+ */
+void PosixUARTEndpoint::poll_events_() {
+#ifdef __linux__
+    struct epoll_event ev;
+    if (::epoll_wait(poll_, &ev, 1, 0) == 1) {
+        if (ev.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) readable_ = true;
+        if (ev.events & EPOLLOUT) writable_ = true;
+    }
+#else
+    struct pollfd p = { fd_, (short)(POLLIN | (tx_.empty() ? 0 : POLLOUT)), 0 };
+    if (::poll(&p, 1, 0) == 1) {
+        if (p.revents & (POLLIN | POLLHUP | POLLERR)) readable_ = true;
+        if (p.revents & POLLOUT) writable_ = true;
+    }
+#endif
+}
+
+/**
+ * \brief Read the next batch. `readable_` is cleared once the port is empty.
+ */
+void PosixUARTEndpoint::read_() {
+    ssize_t n = ::read(fd_, rx_.data(), rx_.size());
+    if (n > 0) {
+        rx_head_ = 0;
+        rx_tail_ = (uint32_t)n;
+        scheduler().busy();
+    } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        if (n < 0 && kDebugErrors) Log.logf("UART: read error: %s\n", strerror(errno));
+        readable_ = false;
+        hangup_();
+    } else {
+        readable_ = false;
+    }
+}
+
+/**
+ * \brief Write as much of `tx_` as the port takes.
+ */
+void PosixUARTEndpoint::write_() {
+    ssize_t n = ::write(fd_, tx_.data(), tx_.size());
+    if (n > 0) {
+        tx_.erase(tx_.begin(), tx_.begin() + n);
+        if (!tx_.empty()) writable_ = false; // the port is full
+        scheduler().busy();
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        writable_ = false;
+    } else if (n < 0 && errno != EINTR) {
+        if (kDebugErrors) Log.logf("UART: write error: %s\n", strerror(errno));
+        tx_.clear();
+        hangup_();
+    }
+}
+
+/**
+ * \brief Called regularly by the scheduler to take care of the port.
+ *
+ * Forward what was read to the out pipe until it rejects a byte, then write
+ * what we collected in send().
+ */
+Result PosixUARTEndpoint::task() {
+    if (fd_ < 0) return Result::OK;
+    if (!readable_ || (!tx_.empty() && !writable_)) poll_events_();
+    if (rx_head_ == rx_tail_ && readable_ && !high_water_) read_();
+    while (rx_head_ < rx_tail_) {
+        Event event { rx_[rx_head_] };
+        if (out()->send(event).rejected()) break;
+        if (kLogUART) Log.log(event, 0);
+        rx_head_++;
+        scheduler().busy();
+    }
+    if (fd_ >= 0 && !tx_.empty() && writable_) write_();
+    return Result::OK;
+}
+
+/**
+ * \brief Called whenever the in pipe has sent us an Event.
+ *
+ * Data is collected and written in task(). Known other events are handled.
+ *
+ * \return Result::REJECTED if the buffer is full or a delay is running.
+ */
+Result PosixUARTEndpoint::send(Event event) {
+    switch (event.type()) {
+        case Event::Type::DATA:
+            if ((tx_wait_for_drain_ || tx_timer_.armed()) && !tx_delay_over_())
+                return Result::REJECTED;
+            if (fd_ < 0 || tx_.size() >= kUARTBatch)
+                return Result::REJECTED;
+            tx_.push_back(event.data());
+            if (kLogUART) Log.log(event, 1);
+            return Result::OK;
+    }
+    if (kLogUART) Log.log(event, 1);
+    return UARTEndpoint::send(event);
+}
+
+/**
+ * \brief Check if the data before a delay was sent and the delay has passed.
+ */
+bool PosixUARTEndpoint::tx_delay_over_() {
+    if (tx_wait_for_drain_) {
+        if (!tx_.empty()) return false;
+#ifdef TIOCOUTQ
+        int queued = 0;
+        if (::ioctl(fd_, TIOCOUTQ, &queued) == 0 && queued > 0) return false;
+#endif
+        tx_wait_for_drain_ = false;
+        tx_timer_.arm(tx_delay_);
+        tx_delay_ = 0;
+    }
+    return !tx_timer_.armed();
+}
+
+/**
+ * \brief Delay the transmission of data for the given time.
+ *
+ * \param usec The delay in microseconds.
+ * \param chars The delay in characters at the current bitrate.
+ */
+void PosixUARTEndpoint::delay(uint32_t usec, uint32_t chars) {
+    if (chars > 0) {
+        // bits per second time ten (start bit, 8 data bits, stop bit)
+        usec += (uint32_t)(((uint64_t)chars * 10'000'000) / bitrate());
+    }
+    if (usec > 0) {
+        if (tx_timer_.armed()) {
+            tx_timer_.extend(usec);
+        } else if (tx_wait_for_drain_) {
+            tx_delay_ += usec;
+        } else {
+            tx_wait_for_drain_ = true;
+            tx_delay_ = usec;
+        }
+    }
+}
+
+/**
+ * \brief Stop reading while a pipe on the output side is filling up.
+ */
+void PosixUARTEndpoint::set_high_water(bool on) {
+    high_water_ = on;
+}
+
+/**
+ * \brief Set the new bitrate for the port.
+ *
+ * \param new_bitrate The new bitrate to set.
+ */
+void PosixUARTEndpoint::set_bitrate(uint32_t new_bitrate) {
+    UARTEndpoint::set_bitrate(new_bitrate);
+    if (fd_ >= 0) apply_settings_();
+}
@@ -0,0 +1,65 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_POSIX_UART_ENDPOINT_H
+#define ND_POSIX_UART_ENDPOINT_H
+
+#include "common/Endpoints/UARTEndpoint.h"
+#include "common/Timer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nd {
+
+/**
+ * \brief Serial port on the host, either a pseudo-terminal or a tty device.
+ */
+class PosixUARTEndpoint : public UARTEndpoint {
+    std::string device_; // tty to open, or empty for a new pseudo-terminal
+    std::string pty_name_; // name of the client side of the pseudo-terminal
+    int pty_client_ = -1; // keeps the pseudo-terminal alive while no client is connected
+    int poll_ = -1; // epoll instance, Linux only
+    bool readable_ = false;
+    bool writable_ = true;
+    bool high_water_ = false;
+    std::vector<uint8_t> rx_; // one batch read from the port
+    uint32_t rx_head_ = 0;
+    uint32_t rx_tail_ = 0;
+    std::vector<uint8_t> tx_; // collected for the next write to the port
+    uint32_t tx_delay_ = 0; // in microseconds, starts when the port drained
+    bool tx_wait_for_drain_ = false;
+    Timer tx_timer_ { *this }; // armed while the delay runs
+    void apply_settings_();
+    void poll_events_();
+    void read_();
+    void write_();
+    bool tx_delay_over_();
+protected:
+    int fd_ = -1; // the open port, or -1
+    virtual bool open_();
+    virtual void hangup_() { }
+    bool watch_(int fd);
+    void unwatch_();
+public:
+    PosixUARTEndpoint(Scheduler &scheduler);
+    ~PosixUARTEndpoint() override;
+    Result init() override;
+    Result task() override;
+    Result send(Event event) override;
+
+    void set_device(const std::string &path);
+    /// The device that clients open if we created a pseudo-terminal.
+    const std::string &pty_name() const { return pty_name_; }
+
+    void delay(uint32_t usec, uint32_t chars) override;
+    void set_high_water(bool) override;
+    void set_bitrate(uint32_t new_bitrate) override;
+};
+
+} // namespace nd
+
+#endif // ND_POSIX_UART_ENDPOINT_H
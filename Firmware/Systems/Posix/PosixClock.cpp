@@ -0,0 +1,18 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "PosixClock.h"
+
+#include <chrono>
+
+using namespace nd;
+
+/**
+ * \brief Microseconds of the host's monotonic clock.
+ */
+uint64_t PosixClock::now() {
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(t).count();
+}
@@ -0,0 +1,25 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_POSIX_CLOCK_H
+#define ND_POSIX_CLOCK_H
+
+#include "common/Clock.h"
+
+namespace nd {
+
+/**
+ * \brief Real monotonic time of the host.
+ */
+class PosixClock : public Clock {
+public:
+    PosixClock() = default;
+    ~PosixClock() override = default;
+    uint64_t now() override;
+};
+
+} // namespace nd
+
+#endif // ND_POSIX_CLOCK_H
@@ -13,15 +13,30 @@ PosixScheduler::~PosixScheduler() {
     // Destructor implementation if needed
 }
 
+/**
+ * \brief Use another clock, for example a VirtualClock. Call this before run().
+ *
+ * The clock must outlive the scheduler. The default is the real time of the host.
+ */
+void PosixScheduler::set_clock(Clock &clock) {
+    clock_ = &clock;
+    started_ = false;
+}
 
 void PosixScheduler::update_time() {
-    // if (pico_start_time_ == nil_time) {
-    //     pico_start_time_ = get_absolute_time();
-    //     pico_prev_cycle_ = pico_start_time_;
-    // }
-    // absolute_time_t now = get_absolute_time();
-    // cycle_time_ = absolute_time_diff_us(pico_prev_cycle_, now);
-    // if (cycle_time_ == 0)
-    //     cycle_time_ = 1;
-    // pico_prev_cycle_ = now;
+    uint64_t now = clock_->now();
+    if (!started_) {
+        start_time_ = now;
+        prev_cycle_ = now;
+        started_ = true;
+    }
+    cycle_time_ = (uint32_t)(now - prev_cycle_);
+    if (cycle_time_ == 0)
+        cycle_time_ = 1;
+    prev_cycle_ = now;
+    now_ = now - start_time_;
+}
+
+void PosixScheduler::idle(uint32_t usec) {
+    clock_->idle(usec);
 }
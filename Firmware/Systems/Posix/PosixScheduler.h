@@ -6,20 +6,27 @@
 #ifndef ND_POSIX_SCHEDULER_H
 #define ND_POSIX_SCHEDULER_H
 
+#include "PosixClock.h"
+
 #include "common/Scheduler.h"
 
 namespace nd {
 
 class PosixScheduler : public Scheduler{
-    // absolute_time_t pico_start_time_ = nil_time;
-    // absolute_time_t pico_prev_cycle_ = nil_time;
+    PosixClock real_clock_;
+    Clock *clock_ = &real_clock_;
+    uint64_t start_time_ = 0;
+    uint64_t prev_cycle_ = 0;
+    bool started_ = false;
 protected:
     void update_time() override;
+    void idle(uint32_t usec) override;
 public:
     PosixScheduler() = default;
     ~PosixScheduler() override;
+    void set_clock(Clock &clock);
 };
 
 } // namespace nd
 
-#endif // ND_POSIX_SCHEDULER_H
\ No newline at end of file
+#endif // ND_POSIX_SCHEDULER_H
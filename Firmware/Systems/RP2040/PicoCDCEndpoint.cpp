@@ -87,21 +87,6 @@ Result PicoCDCEndpoint::task() {
             tud_cdc_n_read_char(index_);
     }
 
-    // Check here if we need to flush data to the USB.
-    // The USB port may already have self-flushed (buffer size is typically 
-    // 64 bytes), but we can't verify that, and there is no harm in 
-    // flushing again, just to be sure
-    if (tx_num_pending_ > 0) {
-        uint32_t cycle_time = scheduler().cycle_time();
-        if (tx_timeout_ < cycle_time) {
-            tud_cdc_n_write_flush(index_);
-            tx_num_pending_ = 0;
-            tx_timeout_ = 0;
-        } else {
-            tx_timeout_ -= cycle_time;
-        }
-    }
-
     // Everything went fine.
     return Result::OK;
 }
@@ -121,7 +106,7 @@ Result PicoCDCEndpoint::send(Event event) {
         if (tud_cdc_n_write_available(index_) > 0) {
             tud_cdc_n_write_char(index_, event.data());
             if (tx_num_pending_ == 0)
-                tx_timeout_ = 1000; // microseconds
+                tx_flush_timer_.arm(1000); // microseconds
             tx_num_pending_++;
             return Result::OK;
         } else {
@@ -132,6 +117,23 @@ Result PicoCDCEndpoint::send(Event event) {
     }
 }
 
+/**
+ * \brief Flush data to the USB when the flush timer expires.
+ *
+ * The USB port may already have self-flushed (buffer size is typically
+ * 64 bytes), but we can't verify that, and there is no harm in
+ * flushing again, just to be sure
+ */
+Result PicoCDCEndpoint::signal(Event event) {
+    if (event.type() == Event::Type::SIGNAL && event.subtype() == Event::Subtype::TIMER) {
+        if (tx_num_pending_ > 0) {
+            tud_cdc_n_write_flush(index_);
+            tx_num_pending_ = 0;
+        }
+    }
+    return UARTEndpoint::signal(event);
+}
+
 void PicoCDCEndpoint::set_bitrate(uint32_t new_bitrate) {
     UARTEndpoint::set_bitrate(new_bitrate);
 }
@@ -7,6 +7,7 @@
 #define ND_PICO_CDC_ENDPOINT_H  
 
 #include "common/Endpoints/UARTEndpoint.h"
+#include "common/Timer.h"
 
 #include <cstdint>
 
@@ -16,7 +17,7 @@ class PicoCDCEndpoint : public UARTEndpoint {
     static PicoCDCEndpoint *list_[4];
     uint32_t index_ = 0;
     uint32_t tx_num_pending_ = 0;   // Used to ensure a buffer flush at least ever 1 ms.
-    uint32_t tx_timeout_ = 0;       // Used to ensure a buffer flush at least ever 1 ms.
+    Timer tx_flush_timer_ { *this }; // Used to ensure a buffer flush at least ever 1 ms.
 
 public:
     static PicoCDCEndpoint *instance(uint32_t index);
@@ -25,6 +26,7 @@ public:
     Result init() override;
     Result task() override;
     Result send(Event event) override;
+    Result signal(Event event) override;
 
     void set_bitrate(uint32_t new_bitrate) override;
 
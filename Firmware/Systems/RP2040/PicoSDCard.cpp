@@ -173,6 +173,9 @@ uint32_t PicoSDCardEndpoint::mount_() {
             return fr;
         }
         mounted_ = true;
+        label_read_ = false;
+        index_.invalidate(); // This may be a different card
+
     }
     return status_;
 }
@@ -230,8 +233,25 @@ const char *PicoSDCardEndpoint::strerr(uint32_t err) {
     return "UNKNOWN";
 }
 
+/**
+ * \brief Power up the card and switch it into SPI mode.
+ * f_mount() would do this as well, but it takes long enough to deserve a
+ * time slice of its own.
+ */
+uint32_t PicoSDCardEndpoint::init_card() {
+    if (mounted_) return FR_OK;
+    app_status.repeat(AppStatus::SDCARD_ACTIVE, 1); // Flash blue
+    DSTATUS ds = disk_initialize(0);
+    if (ds & STA_NOINIT) {
+        if (kLogSDCard) Log.logf("init_card: disk_initialize error: %02x\n", ds);
+        return FR_NOT_READY;
+    }
+    return FR_OK;
+}
+
 const std::u16string &PicoSDCardEndpoint::get_label() {
-    if (!mounted_) {
+    // The label is read once per mount, no matter who mounted the card
+    if (!mounted_ || !label_read_) {
         label_.clear();
         uint32_t err = mount_();
         if (err != FR_OK) {
@@ -239,13 +259,13 @@ const std::u16string &PicoSDCardEndpoint::get_label() {
             label_ = u"ERROR";
             return label_;
         }
-        sd_card_t *pSD = sd_get_by_num(0);  // Get the first SD card
         TCHAR label_buffer[14];  // FF_LFN_UNICODE=1
         label_buffer[0] = 0; // Initialize the buffer to empty
         app_status.repeat(AppStatus::SDCARD_ACTIVE, 1); // Flash blue
         FRESULT fr = f_getlabel(Drive0, label_buffer, NULL);
         if (fr == FR_OK) {
             label_.assign((char16_t*)label_buffer); // Convert the label to std::u16string
+            label_read_ = true;
         } else {
             label_ = u"ERROR";
         }
@@ -284,6 +304,13 @@ static int strlen16(const TCHAR* strarg)
 }
 
 uint32_t PicoSDCardEndpoint::readdir(std::u16string &name) {
+    SDCardDirEntry entry;
+    uint32_t ret = readentry(entry);
+    name.swap(entry.name_);
+    return ret;
+}
+
+uint32_t PicoSDCardEndpoint::readentry(SDCardDirEntry &entry) {
     for (;;) {
         FILINFO fno;
         app_status.repeat(AppStatus::SDCARD_ACTIVE, 1); // Flash blue
@@ -307,9 +334,12 @@ uint32_t PicoSDCardEndpoint::readdir(std::u16string &name) {
             if (kLogSDCard) Log.logf("readdir: skipping system file: %s\n", fno.fname);
             continue;
         }
+        entry.mtime_ = ((uint32_t)fno.fdate << 16) | fno.ftime;
         if (fno.fattrib & AM_DIR) {
             // Send directories
-            name = (const char16_t*)fno.fname; // Convert the TCHAR name to std::u16string
+            entry.name_ = (const char16_t*)fno.fname; // Convert the TCHAR name to std::u16string
+            entry.type_ = FR_IS_DIRECTORY;
+            entry.size_ = 0;
             if (kLogSDCard) Log.logf("readdir: returning a directory: %s\n", fno.fname);
             return FR_IS_DIRECTORY; // Indicates a directory
         }
@@ -317,7 +347,9 @@ uint32_t PicoSDCardEndpoint::readdir(std::u16string &name) {
         auto len = strlen16(n);
         if (len>=4 && n[len-4]=='.' && (n[len-3]=='p' || n[len-3]=='P') && (n[len-2]=='k' || n[len-2]=='K') && (n[len-1]=='g' || n[len-1]=='G')) {
             // Do return package files
-            name = (const char16_t*)fno.fname; // Convert the TCHAR name to std::u16string
+            entry.name_ = (const char16_t*)fno.fname; // Convert the TCHAR name to std::u16string
+            entry.type_ = FR_IS_PACKAGE;
+            entry.size_ = (uint32_t)fno.fsize;
             if (kLogSDCard) Log.logf("readdir: returning a package file: %s\n", fno.fname);
             return FR_IS_PACKAGE;
         }
@@ -407,6 +439,14 @@ uint32_t PicoSDCardEndpoint::readfile(uint8_t *buffer, uint32_t size)
 uint32_t PicoSDCardEndpoint::closefile() 
 {
     app_status.repeat(AppStatus::SDCARD_ACTIVE, 1); // Flash blue
+    if (file_reserved_) {
+        // Give back the clusters that f_expand() reserved, but that were not written
+        file_reserved_ = false;
+        FRESULT fr = f_truncate(&file_);
+        if (fr != FR_OK) {
+            if (kLogSDCard) Log.logf("closefile: f_truncate error: %s (%d)\n", strerr(fr), fr);
+        }
+    }
     FRESULT fr = f_close(&file_);
     if (fr != FR_OK) {
         if (kLogSDCard) Log.logf("closefile: f_close error: %s (%d)\n", strerr(fr), fr);
@@ -414,3 +454,84 @@ uint32_t PicoSDCardEndpoint::closefile()
     }
     return FR_OK;
 }
+
+uint32_t PicoSDCardEndpoint::createfile(const std::u16string &name, uint32_t reserve)
+{
+    if (!mounted_) {
+        uint32_t err = mount_();
+        if (err != FR_OK) {
+            if (kLogSDCard) Log.logf("createfile: mount error: %s (%d)\n", strerr(err), err);
+            return err;
+        }
+    }
+    app_status.repeat(AppStatus::SDCARD_ACTIVE, 1); // Flash blue
+    file_reserved_ = false;
+    FRESULT fr = f_open(&file_, (const TCHAR*)name.c_str(), FA_WRITE|FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        if (kLogSDCard) Log.logf("createfile: f_open error: %s (%d)\n", strerr(fr), fr);
+        return fr;
+    }
+#if FF_USE_EXPAND
+    if (reserve > 0) {
+        // Allocate contiguous clusters now, so f_write() never has to search
+        // the FAT for free space. If the card is too fragmented, we simply
+        // write without it.
+        fr = f_expand(&file_, reserve, 1);
+        if (fr == FR_OK) {
+            file_reserved_ = true;
+        } else if (kLogSDCard) {
+            Log.logf("createfile: f_expand error: %s (%d)\n", strerr(fr), fr);
+        }
+    }
+#endif
+    return FR_OK;
+}
+
+uint32_t PicoSDCardEndpoint::appendfile(const std::u16string &name, uint32_t reserve)
+{
+    if (!mounted_) {
+        uint32_t err = mount_();
+        if (err != FR_OK) {
+            if (kLogSDCard) Log.logf("appendfile: mount error: %s (%d)\n", strerr(err), err);
+            return err;
+        }
+    }
+    app_status.repeat(AppStatus::SDCARD_ACTIVE, 1); // Flash blue
+    // f_expand() only works on empty files, so appending searches the FAT as usual
+    file_reserved_ = false;
+    FRESULT fr = f_open(&file_, (const TCHAR*)name.c_str(), FA_WRITE|FA_OPEN_APPEND);
+    if (fr != FR_OK) {
+        if (kLogSDCard) Log.logf("appendfile: f_open error: %s (%d)\n", strerr(fr), fr);
+        return fr;
+    }
+    return FR_OK;
+}
+
+uint32_t PicoSDCardEndpoint::writefile(const uint8_t *buffer, uint32_t size)
+{
+    app_status.repeat(AppStatus::SDCARD_ACTIVE, 1); // Flash blue
+    UINT bytes_written = 0;
+    FRESULT fr = f_write(&file_, buffer, size, &bytes_written);
+    if (fr != FR_OK) {
+        if (kLogSDCard) Log.logf("writefile: f_write error: %s (%d)\n", strerr(fr), fr);
+        return 0xffffffff;
+    }
+    return bytes_written;
+}
+
+uint32_t PicoSDCardEndpoint::mkdir(const std::u16string &name)
+{
+    if (!mounted_) {
+        uint32_t err = mount_();
+        if (err != FR_OK) {
+            if (kLogSDCard) Log.logf("mkdir: mount error: %s (%d)\n", strerr(err), err);
+            return err;
+        }
+    }
+    app_status.repeat(AppStatus::SDCARD_ACTIVE, 1); // Flash blue
+    FRESULT fr = f_mkdir((const TCHAR*)name.c_str());
+    if (fr != FR_OK && fr != FR_EXIST) {
+        if (kLogSDCard) Log.logf("mkdir: f_mkdir error: %s (%d)\n", strerr(fr), fr);
+    }
+    return fr;
+}
@@ -31,9 +31,11 @@ class PicoSDCardEndpoint : public SDCardEndpoint {
     bool initialized_ = false; // true if the SD card is initialized
     bool mounted_ = false; // true if the SD card is mounted
     std::u16string label_; // Volume label
+    bool label_read_ = false; // `label_` belongs to the mounted card
     uint32_t mount_();
     DIR dir_;
     FIL file_;
+    bool file_reserved_ = false; // closefile() must cut the file at the current position
 public:
     PicoSDCardEndpoint(Scheduler &scheduler);
     ~PicoSDCardEndpoint() override;
@@ -46,9 +48,12 @@ public:
     const char *strerr(uint32_t err) override;
     uint32_t status() override { return status_; }
     const std::u16string &get_label() override;
+    uint32_t init_card() override;
+    uint32_t mount() override { return mount_(); }
 
     uint32_t opendir() override;
     uint32_t readdir(std::u16string &name) override;
+    uint32_t readentry(SDCardDirEntry &entry) override;
     uint32_t closedir() override;
 
     uint32_t openfile(const std::u16string &name) override;
@@ -56,6 +61,11 @@ public:
     uint32_t readfile(uint8_t *buffer, uint32_t size) override;
     uint32_t closefile() override;
 
+    uint32_t createfile(const std::u16string &name, uint32_t reserve) override;
+    uint32_t appendfile(const std::u16string &name, uint32_t reserve) override;
+    uint32_t writefile(const uint8_t *buffer, uint32_t size) override;
+    uint32_t mkdir(const std::u16string &name) override;
+
     uint32_t chdir(const std::u16string &path) override;
     uint32_t getcwd(std::u16string &path) override;
 
@@ -21,4 +21,5 @@ void PicoScheduler::update_time() {
     if (cycle_time_ == 0)
         cycle_time_ = 1;
     pico_prev_cycle_ = now;
+    now_ = absolute_time_diff_us(pico_start_time_, now);
 }
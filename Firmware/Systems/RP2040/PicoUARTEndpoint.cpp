@@ -105,17 +105,13 @@ Result PicoUARTEndpoint::send(Event event) {
                     return Result::REJECTED;
                 } else {
                     tx_wait_for_fifo_empty_ = false;
-                }
-            }
-            if (tx_delay_ > 0) {
-                uint32_t cycle_time = scheduler().cycle_time();
-                if (tx_delay_ >= cycle_time) {
-                    tx_delay_ -= cycle_time;
-                    return Result::REJECTED;
-                } else {
+                    tx_timer_.arm(tx_delay_);
                     tx_delay_ = 0;
                 }
             }
+            if (tx_timer_.armed()) {
+                return Result::REJECTED;
+            }
             bool cts = gpio_get(kUART_HSKO_Pin);
             if (cts && uart_is_writable(kUART)) {
                 uart_putc_raw(kUART, event.data());
@@ -142,7 +138,9 @@ void PicoUARTEndpoint::delay(uint32_t usec, uint32_t chars) {
         usec += ((chars * 1'000'000) / bitrate()) * 10;  
     }
     if (usec > 0) {
-        if (tx_delay_ > 0) {
+        if (tx_timer_.armed()) {
+            tx_timer_.extend(usec);
+        } else if (tx_wait_for_fifo_empty_) {
             tx_delay_ += usec;
         } else {
             tx_wait_for_fifo_empty_ = true;
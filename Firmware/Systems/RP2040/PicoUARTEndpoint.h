@@ -7,6 +7,7 @@
 #define ND_PICO_UART_ENDPOINT_H  
 
 #include "common/Endpoints/UARTEndpoint.h"
+#include "common/Timer.h"
 
 #include <pico/time.h>
 #include <cstdint>
@@ -18,8 +19,9 @@ class CtrlBlock;
 class PicoUARTEndpoint : public UARTEndpoint {
     bool event_pending_ = false;
     Event pending_event_ { Event::Type::NIL};
-    uint32_t tx_delay_ = 0;
+    uint32_t tx_delay_ = 0;         // starts when the FIFO is empty
     bool tx_wait_for_fifo_empty_ = false;
+    Timer tx_timer_ { *this };      // armed while the delay runs
 public:
     PicoUARTEndpoint(Scheduler &scheduler);
     ~PicoUARTEndpoint() override;
@@ -0,0 +1,47 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "Clock.h"
+
+using namespace nd;
+
+/**
+ * @class VirtualClock
+ * @brief A clock for simulations, tests, and benchmarks.
+ *
+ * Every scheduler cycle takes `step` microseconds of virtual time, no matter
+ * how long it took on the host. When no task did any work in a cycle, the
+ * clock jumps straight to the earliest time that a task asked to be woken
+ * up at (see Scheduler::busy() and Scheduler::wake_in()). Delays, guard
+ * times, and serial lines at low bitrates then cost no wall clock time.
+ *
+ * A virtual clock belongs to a single scheduler. Partitions on other
+ * threads would see time jump under their feet.
+ */
+
+/**
+ * \brief Create a virtual clock that starts at 0.
+ * \param step Virtual microseconds per scheduler cycle, at least 1.
+ */
+VirtualClock::VirtualClock(uint32_t step)
+:   step_ { step ? step : 1 }
+{
+}
+
+/**
+ * \brief Advance by one cycle and return the new time.
+ */
+uint64_t VirtualClock::now() {
+    now_ += step_;
+    return now_;
+}
+
+/**
+ * \brief Skip ahead, so that the next cycle starts exactly `usec` from now.
+ */
+void VirtualClock::idle(uint32_t usec) {
+    if (usec > step_)
+        now_ += usec - step_;
+}
@@ -0,0 +1,45 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_CLOCK_H
+#define ND_CLOCK_H
+
+#include <cstdint>
+
+namespace nd {
+
+/**
+ * \brief Time source of a Scheduler, in microseconds.
+ */
+class Clock {
+public:
+    Clock() = default;
+    virtual ~Clock() = default;
+    Clock(const Clock&) = delete;
+    Clock& operator=(const Clock&) = delete;
+    Clock(Clock&&) = delete;
+    Clock& operator=(Clock&&) = delete;
+
+    /// Monotonic time in microseconds, called once per scheduler cycle.
+    virtual uint64_t now() = 0;
+    /// All tasks are idle, and the next one wants to run in `usec` microseconds.
+    virtual void idle(uint32_t /*usec*/) { }
+};
+
+/**
+ * \brief Simulated time that runs as fast as the host can go.
+ */
+class VirtualClock : public Clock {
+    uint64_t now_ = 0;
+    uint32_t step_ = 1;
+public:
+    VirtualClock(uint32_t step = 1);
+    uint64_t now() override;
+    void idle(uint32_t usec) override;
+};
+
+} // namespace nd
+
+#endif // ND_CLOCK_H
@@ -0,0 +1,32 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_CONTEXT_H
+#define ND_CONTEXT_H
+
+namespace nd {
+
+class Scheduler;
+class UserSettings;
+class SDCardEndpoint;
+class StatusDisplay;
+
+/**
+ * \brief The parts of the dongle that the tasks of one pipe graph share.
+ *
+ * The firmware has one Context, made from its global objects. A host
+ * process can create a Context per session and run many pipe graphs side
+ * by side, as long as every graph stays on its own Scheduler.
+ */
+struct Context {
+    Scheduler &scheduler_;
+    UserSettings &settings_;
+    SDCardEndpoint &sdcard_;
+    StatusDisplay &status_;
+};
+
+} // namespace nd
+
+#endif // ND_CONTEXT_H
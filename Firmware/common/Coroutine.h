@@ -0,0 +1,78 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_COROUTINE_H
+#define ND_COROUTINE_H
+
+#include <cstdint>
+
+namespace nd {
+
+/**
+ * \brief Resume point of a protocol flow that is written as sequential code.
+ *
+ * Protocol flows like "check the package, open it, send it block by block,
+ * close it" are usually spread over a state enum and a switch, because a
+ * task must return to the scheduler whenever it waits for something. A
+ * Coroutine lets the flow be written top to bottom instead, and suspend
+ * wherever it waits:
+ *
+ * \code
+ *   void Dock::send_package_task() {
+ *       ND_CO_BEGIN(send_package_co_);
+ *       sdcard_.submit(sd_request_);
+ *       ND_CO_AWAIT(send_package_co_, !sd_request_.pending());   // await the card
+ *       ...
+ *       ND_CO_AWAIT(send_package_co_, data_queue_.empty());      // await send credit
+ *       ...
+ *       ND_CO_AWAIT(send_package_co_, !timer_.armed());          // await a Timer
+ *       ND_CO_END(send_package_co_);
+ *   }
+ * \endcode
+ *
+ * The coroutine is stackless and needs no heap. It is a `switch` on the
+ * line number of the last suspension, so resuming costs the same as a
+ * hand-written state machine. The price is that local variables are lost
+ * when the flow suspends. Everything that must survive an ND_CO_AWAIT
+ * belongs into members of the owner, and locals with an initializer must
+ * be in a block that ends before the next ND_CO_AWAIT (the compiler
+ * complains otherwise). The function that holds the flow must return void,
+ * and a flow can't suspend in a function that it calls.
+ */
+class Coroutine {
+public:
+    uint16_t resume_ = 0; // used by the ND_CO_ macros only
+    Coroutine() = default;
+    Coroutine(const Coroutine&) = delete;
+    Coroutine& operator=(const Coroutine&) = delete;
+    Coroutine(Coroutine&&) = delete;
+    Coroutine& operator=(Coroutine&&) = delete;
+
+    /// Abandon the flow, the next call starts it from the top.
+    void reset() { resume_ = 0; }
+    /// The flow was started and did not end yet.
+    bool running() const { return resume_ != 0; }
+};
+
+} // namespace nd
+
+/// Start the body of a flow. Every call resumes where the flow suspended last.
+#define ND_CO_BEGIN(co) switch ((co).resume_) { case 0:
+
+/// Suspend until `cond` is true. `cond` is checked right away and on every following call.
+#define ND_CO_AWAIT(co, cond) \
+    do { (co).resume_ = __LINE__; [[fallthrough]]; case __LINE__: if (!(cond)) return; } while (0)
+
+/// Suspend once, and continue with the next call.
+#define ND_CO_YIELD(co) \
+    do { (co).resume_ = __LINE__; return; case __LINE__: ; } while (0)
+
+/// Leave the flow. The next call starts it from the top.
+#define ND_CO_EXIT(co) do { (co).resume_ = 0; return; } while (0)
+
+/// End the body of a flow. The next call starts it from the top.
+#define ND_CO_END(co) } (co).resume_ = 0
+
+#endif // ND_COROUTINE_H
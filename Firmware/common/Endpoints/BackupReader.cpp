@@ -0,0 +1,299 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "BackupReader.h"
+
+#include "common/Newton/NSOFView.h"
+
+#include "main.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace nd;
+
+/**
+ * \class nd::BackupReader
+ * \brief Read the entries of a soup backup from the SD Card ahead of time.
+ *
+ * A soup backup is the log `<Soup>.sbk` and the index `<Soup>.sbx` that
+ * Dock::handle_RequestToSync() writes. The log may hold older versions of
+ * an entry and `dele` records. The index lists the ID, hash, and size of
+ * every entry that was in the soup at the time of the last backup.
+ *
+ * open() reads the index first. Then task() reads the log front to back
+ * and keeps the records whose ID, hash, and size match the index. Up to
+ * `ahead` of them wait in memory, so the caller finds the next entry ready
+ * while the previous one is still on the wire.
+ *
+ * Entries larger than kRestoreEntrySize can't be held in memory. The
+ * caller checks too_large() before it changes the soup. Older versions
+ * of an entry that are too large are skipped in the log.
+ *
+ * next() hands out an entry as a vector that starts with `headroom` unused
+ * bytes, followed by the record `entr`, size, NSOF data, and padding to four
+ * bytes. The caller can write its own command header into the headroom and
+ * send the vector as it is.
+ */
+
+BackupReader::BackupReader(SDCardEndpoint &sdcard, uint32_t ahead, uint32_t headroom)
+:   sdcard_(sdcard),
+    ahead_(ahead),
+    headroom_(headroom)
+{
+}
+
+BackupReader::~BackupReader() {
+    sdcard_.cancel(req_);
+    delete record_;
+    for (auto entry: ready_) delete entry;
+}
+
+/**
+ * \brief FNV-1a, good enough to tell if an entry changed.
+ */
+uint32_t BackupReader::hash(const uint8_t *data, uint32_t size) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < size; ++i) h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * \brief Start reading the backup of a soup. `path` is the file name without the extension.
+ */
+void BackupReader::open(const std::u16string &path) {
+    path_ = path;
+    index_.clear();
+    too_large_ = 0;
+    error_ = 0;
+    canceled_ = false;
+    state_ = State::OPEN_INDEX;
+}
+
+/**
+ * \brief Drop all entries. An open file is still closed, so wait for done().
+ */
+void BackupReader::cancel() {
+    canceled_ = true;
+    for (auto entry: ready_) delete entry;
+    ready_.clear();
+    if (req_.pending() || req_.done()) return; // finish_() moves on to closing the file
+    switch (state_) {
+        case State::READ_INDEX: state_ = State::CLOSE_INDEX; break;
+        case State::READ_HEADER:
+        case State::READ_RECORD:
+        case State::SKIP_RECORD: state_ = State::CLOSE_LOG; break;
+        case State::CLOSE_INDEX:
+        case State::CLOSE_LOG: break;
+        default: state_ = State::DONE; break;
+    }
+}
+
+/**
+ * \brief Take the next entry. The caller owns it.
+ * \return nullptr if no entry was read yet, or if all were handed out.
+ */
+std::vector<uint8_t> *BackupReader::next() {
+    if (ready_.empty()) return nullptr;
+    std::vector<uint8_t> *entry = ready_.front();
+    ready_.pop_front();
+    return entry;
+}
+
+/**
+ * \brief Collect the result of the last request and submit the next one.
+ */
+void BackupReader::task() {
+    if (req_.pending()) return;
+    if (req_.done()) finish_();
+    if (!req_.pending() && !req_.done()) start_();
+}
+
+/**
+ * \brief Submit the request that the current state needs.
+ */
+void BackupReader::start_() {
+    switch (state_) {
+        case State::OPEN_INDEX:
+            req_.op_ = SDCardRequest::Op::OPENFILE;
+            req_.name_ = path_ + u".sbx";
+            break;
+        case State::READ_INDEX:
+            req_.op_ = SDCardRequest::Op::READFILE;
+            req_.buffer_ = index_data_.data();
+            req_.size_ = index_data_.size();
+            break;
+        case State::OPEN_LOG:
+            req_.op_ = SDCardRequest::Op::OPENFILE;
+            req_.name_ = path_ + u".sbk";
+            break;
+        case State::READ_HEADER:
+            if (ready_.size() >= ahead_) return; // wait until the caller took an entry
+            req_.op_ = SDCardRequest::Op::READFILE;
+            req_.buffer_ = header_;
+            req_.size_ = 8;
+            break;
+        case State::READ_RECORD:
+            req_.op_ = SDCardRequest::Op::READFILE;
+            req_.buffer_ = record_->data() + headroom_ + 8;
+            req_.size_ = record_->size() - headroom_ - 8;
+            break;
+        case State::SKIP_RECORD:
+            req_.op_ = SDCardRequest::Op::READFILE;
+            req_.buffer_ = skip_buffer_.data();
+            req_.size_ = std::min<uint32_t>(skip_, skip_buffer_.size());
+            break;
+        case State::CLOSE_INDEX:
+        case State::CLOSE_LOG:
+            req_.op_ = SDCardRequest::Op::CLOSEFILE;
+            break;
+        default:
+            return;
+    }
+    if (sdcard_.submit(req_).rejected()) req_.reset(); // try again later
+}
+
+/**
+ * \brief Handle the result of the last request and go to the next state.
+ */
+void BackupReader::finish_() {
+    uint32_t ret = req_.result_;
+    uint32_t size = req_.size_;
+    req_.reset();
+    switch (state_) {
+        case State::OPEN_INDEX:
+            if (ret != FR_OK) {
+                state_ = State::DONE; // no backup of this soup
+            } else if (size < 24 || size > kBackupIndexSize) {
+                if (kLogSDCard) Log.logf("BackupReader: index has %d bytes, ignored\n", size);
+                state_ = State::CLOSE_INDEX;
+            } else {
+                index_data_.resize(size);
+                state_ = State::READ_INDEX;
+            }
+            break;
+        case State::READ_INDEX:
+            if (ret == index_data_.size()) parse_index_();
+            index_data_.clear();
+            index_data_.shrink_to_fit();
+            state_ = State::CLOSE_INDEX;
+            break;
+        case State::CLOSE_INDEX:
+            state_ = (index_.empty() || canceled_) ? State::DONE : State::OPEN_LOG;
+            break;
+        case State::OPEN_LOG:
+            if (ret != FR_OK) {
+                error_ = ret;
+                state_ = State::DONE;
+            } else {
+                state_ = canceled_ ? State::CLOSE_LOG : State::READ_HEADER;
+            }
+            break;
+        case State::READ_HEADER: {
+            if (ret != 8 || canceled_) {
+                if (ret != 0 && ret != 8) error_ = FR_DISK_ERR; // 0 is the end of the file
+                state_ = State::CLOSE_LOG;
+                break;
+            }
+            record_size_ = get_u32(header_ + 4);
+            uint32_t aligned_size = (record_size_ + 3) & ~3;
+            if (aligned_size < record_size_) {
+                error_ = FR_INT_ERR; // not a backup log
+                state_ = State::CLOSE_LOG;
+                break;
+            }
+            if (aligned_size > kRestoreEntrySize) {
+                // The index has no entry this large, so this is an older version. Read past it.
+                if (kLogSDCard) Log.logf("BackupReader: skipping a record of %u bytes\n", record_size_);
+                skip_ = aligned_size;
+                skip_buffer_.resize(4096);
+                state_ = State::SKIP_RECORD;
+                break;
+            }
+            record_ = new std::vector<uint8_t>(headroom_ + 8 + aligned_size);
+            memcpy(record_->data() + headroom_, header_, 8);
+            state_ = State::READ_RECORD;
+            break; }
+        case State::READ_RECORD:
+            if (ret != record_->size() - headroom_ - 8 || canceled_) {
+                if (!canceled_) error_ = FR_DISK_ERR;
+                delete record_;
+                record_ = nullptr;
+                state_ = State::CLOSE_LOG;
+                break;
+            }
+            check_record_();
+            state_ = canceled_ ? State::CLOSE_LOG : State::READ_HEADER;
+            break;
+        case State::SKIP_RECORD:
+            if (ret == 0 || ret > skip_ || canceled_) {
+                if (!canceled_) error_ = FR_DISK_ERR; // the file ends in the middle of the record
+                state_ = State::CLOSE_LOG;
+            } else {
+                skip_ -= ret;
+                if (skip_ == 0) state_ = State::READ_HEADER;
+            }
+            if (state_ != State::SKIP_RECORD) std::vector<uint8_t>().swap(skip_buffer_);
+            break;
+        case State::CLOSE_LOG:
+            state_ = State::DONE;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * \brief Keep the index entries in `index_data_` if they are valid and sorted.
+ */
+void BackupReader::parse_index_() {
+    // Record: 'ndbx', size, version, store signature, time, count, {id, hash, size}...
+    const uint8_t *p = index_data_.data();
+    uint32_t n = index_data_.size();
+    if (memcmp(p, &kIndexTag, 4) != 0 || get_u32(p + 4) != n - 8
+        || get_u32(p + 8) != kIndexVersion || (n - 24) % 12 != 0 || get_u32(p + 20) != (n - 24) / 12)
+        return;
+    for (p += 24; p < index_data_.data() + n; p += 12) {
+        index_.push_back(Entry { get_u32(p), get_u32(p + 4), get_u32(p + 8), false });
+        if (index_.back().size_ > kRestoreEntrySize) too_large_++;
+    }
+    if (!std::is_sorted(index_.begin(), index_.end(), [](const Entry &a, const Entry &b) { return a.id_ < b.id_; })) {
+        index_.clear();
+        too_large_ = 0;
+    }
+}
+
+/**
+ * \brief Queue the record in `record_` if it is the live version of an entry.
+ */
+void BackupReader::check_record_() {
+    std::vector<uint8_t> *record = record_;
+    record_ = nullptr;
+    const uint8_t *data = record->data() + headroom_ + 8;
+    int32_t id = 0;
+    bool keep = false;
+    if (memcmp(record->data() + headroom_, &kEntryTag, 4) == 0) {
+        NSOFView view(data, record_size_);
+        if (view.begin() && view.frame_int("_uniqueID", id)) {
+            auto it = std::lower_bound(index_.begin(), index_.end(), (uint32_t)id,
+                [](const Entry &a, uint32_t b) { return a.id_ < b; });
+            if (it != index_.end() && it->id_ == (uint32_t)id && !it->sent_
+                && it->size_ == record_size_ && it->hash_ == hash(data, record_size_))
+            {
+                it->sent_ = true;
+                keep = true;
+            }
+        }
+    }
+    if (keep) {
+        ready_.push_back(record);
+    } else {
+        delete record; // an older version, or a list of deleted entries
+    }
+}
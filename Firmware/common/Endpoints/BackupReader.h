@@ -0,0 +1,94 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_ENDPOINTS_BACKUP_READER_H
+#define ND_ENDPOINTS_BACKUP_READER_H
+
+#include "common/Endpoints/SDCardEndpoint.h"
+
+#include <string>
+#include <deque>
+#include <vector>
+
+#ifndef ND_FOURCC
+#  if __BYTE_ORDER == __LITTLE_ENDIAN 
+#    define ND_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#  elif __BYTE_ORDER == __BIG_ENDIAN
+#    define ND_FOURCC(a, b, c, d) ((uint32_t)(d) | ((uint32_t)(c) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(a) << 24))
+#  else
+#    error "Can't determine endianess"
+#  endif
+#endif
+
+namespace nd {
+
+/**
+ * \brief Read the entries of a soup backup from the SD Card ahead of time.
+ */
+class BackupReader {
+public:
+    constexpr static uint32_t kIndexTag = ND_FOURCC('n', 'd', 'b', 'x'); // record in the `.sbx` file
+    constexpr static uint32_t kIndexVersion = 1;
+    constexpr static uint32_t kEntryTag = ND_FOURCC('e', 'n', 't', 'r'); // record in the `.sbk` file
+    static uint32_t hash(const uint8_t *data, uint32_t size);
+private:
+    enum class State : uint8_t {
+        IDLE, OPEN_INDEX, READ_INDEX, CLOSE_INDEX,
+        OPEN_LOG, READ_HEADER, READ_RECORD, SKIP_RECORD, CLOSE_LOG, DONE
+    };
+    struct Entry {
+        uint32_t id_;
+        uint32_t hash_;
+        uint32_t size_;
+        bool sent_;
+    };
+    SDCardEndpoint &sdcard_;
+    uint32_t ahead_; // number of entries to read ahead
+    uint32_t headroom_; // free bytes in front of every entry for the caller
+    State state_ = State::IDLE;
+    std::u16string path_; // soup file without the extension
+    SDCardRequest req_;
+    std::vector<Entry> index_; // live entries, sorted by ID
+    std::vector<uint8_t> index_data_;
+    uint8_t header_[8] = { };
+    std::vector<uint8_t> *record_ = nullptr; // the record that is being read
+    uint32_t record_size_ = 0;
+    uint32_t skip_ = 0; // bytes left of a record that is too large to hold
+    std::vector<uint8_t> skip_buffer_;
+    uint32_t too_large_ = 0; // index entries that are larger than kRestoreEntrySize
+    std::deque<std::vector<uint8_t>*> ready_; // entries that were read ahead
+    uint32_t error_ = 0; // the first error, FR_* code
+    bool canceled_ = false;
+    void start_();
+    void finish_();
+    void parse_index_();
+    void check_record_();
+public:
+    BackupReader(SDCardEndpoint &sdcard, uint32_t ahead, uint32_t headroom);
+    ~BackupReader();
+    BackupReader(const BackupReader&) = delete;
+    BackupReader& operator=(const BackupReader&) = delete;
+    BackupReader(BackupReader&&) = delete;
+    BackupReader& operator=(BackupReader&&) = delete;
+
+    void open(const std::u16string &path);
+    void cancel();
+    void task();
+    std::vector<uint8_t> *next();
+
+    /// True as soon as the index was read, or found to be missing.
+    bool index_read() const { return state_ >= State::OPEN_LOG; }
+    /// Number of entries that the index lists.
+    uint32_t size() const { return index_.size(); }
+    /// Number of entries in the index that are too large to restore.
+    uint32_t too_large() const { return too_large_; }
+    /// True if all entries were handed out and the file is closed.
+    bool done() const { return (state_ == State::DONE || state_ == State::IDLE) && ready_.empty() && !req_.pending(); }
+    uint32_t error() const { return error_; }
+};
+
+} // namespace nd
+
+#endif // ND_ENDPOINTS_BACKUP_READER_H
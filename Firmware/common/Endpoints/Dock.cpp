@@ -50,6 +50,45 @@
  * 
  *        < disc		kDDisconnect	'disc'	// no data
  *     LD >
+ *
+ * Backup to the SD Card (see Dock::handle_RequestToSync)
+ *   ssyn >             kDRequestToSync		'ssyn'
+ *        < gsyn        kDGetSyncOptions		'gsyn'
+ *   sopt >             kDSyncOptions			'sopt'	// NSOF frame, ignored
+ *        < gsto        kDGetStoreNames		'gsto'
+ *   stor >             NSOF array of store frames
+ *        < dsnc        kDDesktopControl
+ *        < ssto        kDSetCurrentStore		'ssto'	// NSOF {name, kind, signature}
+ *   dres >
+ *        < gets        kDGetSoupNames		'gets'
+ *   soup >             kDSoupNames			'soup'	// NSOF array of names
+ *        < ssou        kDSetCurrentSoup		'ssou'	// NSOF string
+ *   dres >
+ *        < stme        kDLastSyncTime		'stme'	// time of the last backup of the soup, or 0
+ *   time >             kDCurrentTime			'time'
+ *      Without an index of the soup on the card:
+ *        < snds        kDSendSoup			'snds'
+ *   entr >             kDEntry				'entr'	// NSOF frame, repeated for every entry
+ *   bsdn >             kDBackupSoupDone		'bsdn'
+ *      With an index:
+ *        < gids        kDGetSoupIDs			'gids'
+ *   sids >             kDSoupIDs				'sids'	// count, IDs of all entries
+ *        < gcid        kDGetChangedIDs		'gcid'
+ *   cids >             kDChangedIDs			'cids'	// count, IDs of entries changed since 'stme'
+ *        < rete        kDReturnEntry			'rete'	// ID, repeated for every new or changed entry
+ *   entr >             kDEntry				'entr'
+ *                      ... ssou for the next soup, ssto for the next store
+ *        < opdn        kDOperationDone		'opdn'
+ *
+ * Restore from the SD Card (see Dock::handle_RequestToRestore)
+ *   rrst >             kDRequestToRestore		'rrst'
+ *        < gsto        kDGetStoreNames		'gsto'
+ *                      ... stores and soups as above, soups without a backup are skipped
+ *        < esou        kDEmptySoup			'esou'
+ *   dres >
+ *        < adde        kDAddEntry			'adde'	// NSOF frame
+ *   adid >             kDAddedID				'adid'	// repeated for every entry
+ *        < opdn        kDOperationDone		'opdn'
  */
 
 
@@ -57,11 +96,13 @@
 
 #include "common/Newton/DESKey.h"
 #include "common/Newton/NSOF.h"
+#include "common/Newton/NSOFView.h"
 
 #include "main.h"
 
 #include <stdio.h>
 #include <cstring>
+#include <algorithm>
 
 
 using namespace nd; 
@@ -104,6 +145,19 @@ void Dock::clear_data_queue_()
 void Dock::reset_()
 {
 	clear_data_queue_();
+    sdcard_.cancel(sd_request_);
+    sd_retry_ = false;
+    if (sd_file_open_) {
+        // A transfer was cut off, don't leave its file open on the card
+        sd_close_request_.op_ = SDCardRequest::Op::CLOSEFILE;
+        sdcard_.submit(sd_close_request_);
+        sd_file_open_ = false;
+    }
+    delete pkg_block_;
+    pkg_block_ = nullptr;
+    delete list_chunk_;
+    list_chunk_ = nullptr;
+    list_dir_ = nullptr;
     in_data_.clear();
 	in_data_.reserve(400);
     size = 0;
@@ -115,18 +169,62 @@ void Dock::reset_()
     hello_timer_ = 0;
     newt_challenge_hi = 0;
     newt_challenge_lo = 0;
+    newton_info_ = { };
+    newton_name_.clear();
     package_sent = false;
     path_is_desktop_ = false;
     current_task_ = Task::NONE;
+    send_package_co_.reset();
     pkg_size_ = 0; // size of the package to be loaded
     pkg_size_aligned_ = 0; // size of the package to be loaded, aligned to 4 bytes
     pkg_crsr_ = 0; // current offset in the package
     pkg_filename_.clear(); // filename of the package to be loaded
+    pkg_info_.clear();
+    batch_.clear();
+    batch_pos_ = 0;
+    batch_go_ = false;
+    batch_sent_ = 0;
+	if (backup_ && !backup_done_) {
+		// Let the writer finish in the background, so the file is closed properly
+		if (backup_open_) backup_->close();
+		backup_done_ = true;
+	}
+	backup_open_ = false;
+	backup_hold_ = false;
+	backup_index_queued_ = false;
+	backup_record_ = nullptr;
+	backup_crsr_ = 0;
+	backup_stores_.clear();
+	backup_soups_.clear();
+	backup_index_.clear();
+	backup_changed_.clear();
+	backup_scratch_.clear();
+	if (restore_ && !restore_done_) {
+		restore_->cancel(); // the reader closes its file in the background
+		restore_done_ = true;
+	}
+	restore_state_ = RestoreState::NONE;
 	cwd_ = u"/";
 }
 
+/**
+ * \brief Queue `sd_request_`, or try again in the next time slice if the SD Card queue is full.
+ */
+void Dock::submit_sd_request_()
+{
+	if (sd_request_.op_ == SDCardRequest::Op::OPENFILE) sd_file_open_ = true;
+	if (sd_request_.op_ == SDCardRequest::Op::CLOSEFILE) sd_file_open_ = false;
+	sd_retry_ = sdcard_.submit(sd_request_).rejected();
+}
+
 
 Result Dock::task() {
+	// Try again if the SD Card queue was full
+	if (sd_retry_ && !sdcard_.submit(sd_request_).rejected()) sd_retry_ = false;
+	// The backup writes to the card no matter what we send to the Newton
+	if (backup_) backup_task();
+	// The restore reads ahead while the previous entry is still on the wire
+	if (restore_) restore_task();
 	if (!data_queue_.empty()) {
 		// hello_timer_ = 0; // reset the hello timer if we have data to send
 		Data &data = data_queue_.front();
@@ -136,15 +234,17 @@ Result Dock::task() {
 				return Result::REJECTED;
 			} else {
 				data.start_frame_ = false; // we sent the start frame, no need to send it again
+				scheduler().busy();
 				return Result::OK;
 			}
 		}
-		if (data.pos_ < data.bytes_->size()) {
+		if (data.pos_ < data.size()) {
 			// If we have data to send, we send it.
-			if (out()->send(Event(Event::Type::DATA, Event::Subtype::NIL, (*data.bytes_)[data.pos_])).rejected()) {
+			if (out()->send(Event(Event::Type::DATA, Event::Subtype::NIL, data.at(data.pos_))).rejected()) {
 				return Result::REJECTED;
 			} else {
 				data.pos_++; // we sent the next byte
+				scheduler().busy();
 				return Result::OK;
 			}
 		}
@@ -156,12 +256,12 @@ Result Dock::task() {
 				data.end_frame_ = false; // we sent the end frame, no need to send it again
 			}
 		}
-		data_queue_.pop();
 		if (data.free_after_send_ && data.bytes_) {
 			delete data.bytes_; 
 			data.bytes_ = nullptr; // free the data if we are done with it
 		}
-		// TODO: delete *data; ????
+		data_queue_.pop(); // `data` is gone after this
+		scheduler().busy();
 	} else if (connected_) {
 		// If we are conected, but have not sent any data for more than 5 seconds, 
 		// we remind the Newton that we are still alive.
@@ -172,6 +272,7 @@ Result Dock::task() {
 		// }
 	}
 	if (data_queue_.size() == 0) { // TOOD: alternate blocks with '<= 2'?
+		auto task = current_task_;
 		switch (current_task_) {
 			case Task::SEND_PACKAGE:
 			case Task::CONTINUE_SEND_PACKAGE:
@@ -180,9 +281,39 @@ Result Dock::task() {
 			case Task::PACKAGE_CANCELED:
 				send_package_task();
 				break;
+			case Task::LIST_FILES:
+				list_files_task();
+				break;
+			case Task::SEND_FILE_LIST:
+				send_file_list_task();
+				break;
+			case Task::GET_FILE_INFO:
+				file_info_task();
+				break;
+			case Task::SET_PATH:
+				set_path_task();
+				break;
+			case Task::START_BATCH:
+				start_batch_task();
+				break;
+			case Task::PREFETCH_PACKAGE:
+				prefetch_package_task();
+				break;
+			case Task::PACKAGE_READY:
+				if (batch_go_) send_prefetched_package_();
+				break;
+			case Task::READ_BACKUP_INDEX:
+				if (backup_) read_backup_index_task();
+				break;
+			case Task::WRITE_BACKUP_INDEX:
+				if (backup_) write_backup_index_task();
+				break;
 			default:
 				break;
 		}
+		// Moving on, or queuing a reply, is progress
+		if (task != current_task_ || !data_queue_.empty())
+			scheduler().busy();
 	}
 	return super::task();
 }
@@ -193,13 +324,13 @@ Result Dock::send(Event event)
 		switch (event.subtype()) {
 			case Event::Subtype::MNP_CONNECTED: // data() is index in out_pool
 				if (kLogDockProgress) Log.log("Dock::send: MNP_CONNECTED\r\n");
-				app_status.set(AppStatus::DOCK_CONNECTED);
+				status_.set(AppStatus::DOCK_CONNECTED);
 				connected_ = true;
 				break;
 			case Event::Subtype::MNP_DISCONNECTED: // data() is index in out_pool
 				if (kLogDockProgress) Log.log("Dock::send: MNP_DISCONNECTED\r\n");
 				reset_();
-				app_status.set(AppStatus::IDLE);
+				status_.set(AppStatus::IDLE);
 				connected_ = false;
 				break;
 			case Event::Subtype::MNP_FRAME_START: // data() is index in out_pool
@@ -217,6 +348,7 @@ Result Dock::send(Event event)
 		}
 	} else if (event.type() == Event::Type::DATA) {
 		// if (kLogDock) Log.logf("#%02x ", event.data());
+		if (backup_hold_) return Result::REJECTED; // the SD Card is behind, let the Newton wait
 		uint8_t c = event.data();
 		switch (in_stream_state_) {
 			case  0: 
@@ -290,6 +422,7 @@ void Dock::process_command()
 		case kDRequestToDock: 
 			send_cmd_dock(kSettingUpSession); break;
 		case kDNewtonName: // name, and lots of other data
+			handle_NewtonName();
 			dres_next_ = kDSetTimeout;
 			send_cmd_dinf(); 
 			break;
@@ -297,8 +430,9 @@ void Dock::process_command()
 			dres_next_ = kDSetTimeout; // next command to send
 			newt_challenge_hi = in_data_[4] << 24 | in_data_[5] << 16 | in_data_[6] << 8 | in_data_[7];
 			newt_challenge_lo = in_data_[8] << 24 | in_data_[9] << 16 | in_data_[10] << 8 | in_data_[11];
-			send_cmd_wicn(kInstallIcon); break;
-		case kDResult:
+			send_cmd_wicn(kInstallIcon | kBackupIcon | kRestoreIcon); break;
+		case kDResult: {
+			int32_t error_code = (in_data_.size() >= 4) ? (int32_t)(in_data_[0] << 24 | in_data_[1] << 16 | in_data_[2] << 8 | in_data_[3]) : 0;
 			if (kLogDockProgress) Log.logf("Dock::process_command: kDResult %d, next command is %08x\r\n", in_data_[3], dres_next_);
 			if (kLogDock) Log.log("\r\nDRES: ");
 			for (int i=0; i<in_data_.size(); i++) {
@@ -309,8 +443,45 @@ void Dock::process_command()
 			if (dres_next_ == kDSetTimeout) {
 				dres_next_ = 0;
 				send_cmd_stim();
+			} else if (dres_next_ == kDLoadPackage) {
+				// The Newton installed a package of the batch and is ready for the next one
+				dres_next_ = 0;
+				batch_go_ = true;
+			} else if (dres_next_ == kDGetSoupNames) {
+				// The Newton switched to the next store
+				dres_next_ = 0;
+				if (error_code != 0) {
+					next_backup_store_(); // skip stores that the Newton refuses
+				} else {
+					send_cmd_(kDGetSoupNames);
+				}
+			} else if (dres_next_ == kDSendSoup) {
+				// The Newton switched to the next soup
+				dres_next_ = 0;
+				if (error_code != 0) {
+					next_backup_soup_();
+				} else if (restore_) {
+					start_restore_soup_();
+				} else {
+					start_backup_soup_();
+				}
+			} else if (dres_next_ == kDEmptySoup) {
+				// The Newton emptied the soup, and is ready for the entries
+				dres_next_ = 0;
+				if (error_code != 0) {
+					restore_state_ = RestoreState::NONE;
+					restore_->cancel();
+					next_backup_soup_();
+				} else {
+					restore_state_ = RestoreState::SEND_ENTRY;
+				}
+			} else if (dres_next_ == kDAddEntry) {
+				// The Newton refused the entry, go on with the next one
+				dres_next_ = 0;
+				if (kLogDockErrors) Log.logf("Dock: restore: entry refused (%d)\r\n", error_code);
+				if (restore_state_ == RestoreState::WAIT_FOR_ID) restore_state_ = RestoreState::SEND_ENTRY;
 			}
-			break;
+			break; }
 		case kDPassword:
 			send_cmd_pass(); 
 			break;
@@ -332,11 +503,50 @@ void Dock::process_command()
 		case kDSetPath:
 			handle_SetPath();
 			break;
+		case kDRequestToSync:
+			handle_RequestToSync();
+			break;
+		case kDSyncOptions:
+			send_cmd_(kDGetStoreNames);
+			break;
+		case kDStoreNames:
+			handle_StoreNames();
+			break;
+		case kDSoupNames:
+			handle_SoupNames();
+			break;
+		case kDCurrentTime:
+			handle_CurrentTime();
+			break;
+		case kDSoupIDs:
+			handle_SoupIDs();
+			break;
+		case kDChangedIDs:
+			handle_ChangedIDs();
+			break;
+		case kDEntry:
+			handle_Entry();
+			break;
+		case kDBackupSoupDone:
+			handle_BackupSoupDone();
+			break;
+		case kDRequestToRestore:
+			handle_RequestToRestore();
+			break;
+		case kDAddedID:
+			dres_next_ = 0;
+			if (restore_state_ == RestoreState::WAIT_FOR_ID) restore_state_ = RestoreState::SEND_ENTRY;
+			break;
 		case kDOperationCanceled:
 			if (kLogDockProgress) Log.log("Dock::process_command: kDOperationCanceled\r\n");
+			batch_.clear(); // don't install any more packages
+			if (backup_ && !backup_done_) end_backup_();
+			if (restore_ && !restore_done_) end_restore_();
 			if (current_task_ == Task::CONTINUE_SEND_PACKAGE) {
 				if (kLogDockProgress) Log.log("Dock::process_command: Mode = PACKAGE_CANCELED\r\n");
 				current_task_ = Task::CANCEL_SEND_PACKAGE; // stop sending the package
+			} else if (current_task_ == Task::PREFETCH_PACKAGE || current_task_ == Task::PACKAGE_READY) {
+				current_task_ = Task::PACKAGE_CANCELED; // close the next package
 			} else {
 				send_cmd_ocaa(); // Confirm operation canceled
 			}
@@ -357,24 +567,21 @@ void Dock::process_command()
 
 void Dock::send_cmd_dock(uint32_t session_type) {
 	if (kLogDockProgress) Log.log("Dock: send_cmd_dock\r\n");
-	static std::vector<uint8_t> cmd = {
+	static const std::vector<uint8_t> cmd_template = {
 		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
 		0x64, 0x6f, 0x63, 0x6b, 0x00, 0x00, 0x00, 0x04,
 		0x00, 0x00, 0x00, 0x04
 	};
-	cmd[19] = session_type;
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = false,
-	});
+	// Every Dock queues its own copy, so that Docks in other sessions, or a
+	// second reply still in the queue, never share a buffer.
+	std::vector<uint8_t> *cmd = new std::vector<uint8_t>(cmd_template);
+	(*cmd)[19] = session_type;
+	data_queue_.push(Dock::Data(cmd, true, true, true));
 }
 
 void Dock::send_cmd_stim() {
 	if (kLogDockProgress) Log.log("Dock: send_cmd_stim\r\n");
-	static std::vector<uint8_t> cmd = {
+	static const std::vector<uint8_t> cmd = {
 		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
 		 's',  't',  'i',  'm', 0x00, 0x00, 0x00, 0x04,
 #if ND_DEBUG_DOCK
@@ -384,78 +591,49 @@ void Dock::send_cmd_stim() {
 		// 0x00, 0x00, 0x00, 0x5A /// 90 seconds is the original time, but too long
 #endif
 	};
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = false,
-	});
+	data_queue_.push(Dock::Data(&cmd, true, true, false));
 }
 
 void Dock::send_cmd_opca() {
 	if (kLogDockProgress) Log.log("Dock: send_cmd_opca\r\n");
-	static std::vector<uint8_t> cmd = {
+	static const std::vector<uint8_t> cmd = {
 		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
 		 'o',  'p',  'c',  'a', 0x00, 0x00, 0x00, 0x00,
 	};
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = false,
-	});
+	data_queue_.push(Dock::Data(&cmd, true, true, false));
 }
 
 void Dock::send_cmd_ocaa() {
 	if (kLogDockProgress) Log.log("Dock: send_cmd_ocaa\r\n");
-	static std::vector<uint8_t> cmd = {
+	static const std::vector<uint8_t> cmd = {
 		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
 		 'o',  'c',  'a',  'a', 0x00, 0x00, 0x00, 0x00,
 	};
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = false,
-	});
+	data_queue_.push(Dock::Data(&cmd, true, true, false));
 }
 
 void Dock::send_cmd_helo() {
 	if (kLogDockProgress) Log.log("Dock: send_cmd_helo\r\n");
-	static std::vector<uint8_t> cmd = {
+	static const std::vector<uint8_t> cmd = {
 		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
 		 'h',  'e',  'l',  'o', 0x00, 0x00, 0x00, 0x00,
 	};
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = false,
-	});
+	data_queue_.push(Dock::Data(&cmd, true, true, false));
 }
 
 void Dock::send_cmd_dres(uint32_t error_code) {
 	if (kLogDockProgress) Log.log("Dock: send_cmd_dres\r\n");
-	static std::vector<uint8_t> cmd = {
+	static const std::vector<uint8_t> cmd_template = {
 		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
 		 'd',  'r',  'e',  's', 0x00, 0x00, 0x00, 0x04,
 		0x00, 0x00, 0x00, 0x00
 	};
-	cmd[16] = (error_code >> 24) & 0xFF;
-	cmd[17] = (error_code >> 16) & 0xFF;
-	cmd[18] = (error_code >> 8) & 0xFF;
-	cmd[19] = error_code & 0xFF;
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = false,
-	});
+	std::vector<uint8_t> *cmd = new std::vector<uint8_t>(cmd_template);
+	(*cmd)[16] = (error_code >> 24) & 0xFF;
+	(*cmd)[17] = (error_code >> 16) & 0xFF;
+	(*cmd)[18] = (error_code >> 8) & 0xFF;
+	(*cmd)[19] = error_code & 0xFF;
+	data_queue_.push(Dock::Data(cmd, true, true, true));
 }
 
 void Dock::send_cmd_dinf() {
@@ -484,30 +662,19 @@ void Dock::send_cmd_dinf() {
 		// ]
 
 	};
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = false,
-	});
+	data_queue_.push(Dock::Data(&cmd, true, true, false));
 }
 
 void Dock::send_cmd_wicn(uint32_t icon_map) {
 	if (kLogDockProgress) Log.log("Dock: send_cmd_wicn\r\n");
-	static std::vector<uint8_t> cmd = {
+	static const std::vector<uint8_t> cmd_template = {
 		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
 		0x77, 0x69, 0x63, 0x6e, 0x00, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x04
 	};
-	cmd[19] = icon_map;
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = false,
-	});
+	std::vector<uint8_t> *cmd = new std::vector<uint8_t>(cmd_template);
+	(*cmd)[19] = icon_map;
+	data_queue_.push(Dock::Data(cmd, true, true, true));
 
 }
 
@@ -531,7 +698,7 @@ void Dock::send_cmd_path()
 	path.add(Ref(desktop));
 
 	if (!path_is_desktop_) {
-		std::u16string sd_label = sdcard_endpoint.get_label();
+		std::u16string sd_label = sdcard_.get_label();
 		if (sd_label.empty()) {
 			sd_label = u"SD Card"; // Default label if not set
 		}
@@ -556,6 +723,7 @@ void Dock::send_cmd_path()
 	}
 
 	NSOF nsof;
+	nsof.dedup_values(true);
 	nsof.to_nsof(path);
 	if (kLogDock) nsof.log();
 
@@ -574,29 +742,17 @@ void Dock::send_cmd_path()
 	(*cmd)[14] = (nsof_size >> 8) & 0xff;
 	(*cmd)[15] = nsof_size & 0xff;
 
-	data_queue_.push(Dock::Data {
-		.bytes_ = cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = true,
-	});
+	data_queue_.push(Dock::Data(cmd, true, true, true));
 	if (kLogDock) Log.logf("Dock: send_cmd_path: size = %d (NSOF: %d, aligned: %d)\r\n", cmd->size(), nsof_size, aligned_size);
 }
 
 void Dock::send_cmd_file() { //[{name: "important info", type: kDesktopFile}]
 	if (kLogDockProgress) Log.log("Dock: send_cmd_file\r\n");
 
-	static const std::vector<uint8_t> cmd_header = {
-		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
-		 'f',  'i',  'l',  'e', 0x00, 0x00, 0x00, 0x00,
-	};
-
-	Array file_list;
-
 	if (path_is_desktop_) {
 	
-		std::u16string sd_label = sdcard_endpoint.get_label();
+		Array file_list;
+		std::u16string sd_label = sdcard_.get_label();
 		if (sd_label.empty()) {
 			sd_label = u"SD Card"; // Default label if not set
 		}
@@ -604,36 +760,255 @@ void Dock::send_cmd_file() { //[{name: "important info", type: kDesktopFile}]
 		f->add(nd::symName, Ref(String::New(sd_label)));
 		f->add(nd::symType, Ref(kDesktopDisk));
 		file_list.add(Ref(*f));
+		send_file_list_(file_list);
 
 	} else {
 
-		sdcard_endpoint.opendir();
-		std::u16string name;
-		for (int i=100; i>0; --i) {
-		// for (int i=8; i>0; --i) {
-			uint32_t ret = sdcard_endpoint.readdir(name);
-			if (ret == FR_IS_DIRECTORY) {
-				Frame *f = Frame::New();
-				f->add(nd::symName, Ref(String::New(name)));
-				f->add(nd::symType, Ref(kDesktopFolder));
-				file_list.add(Ref(*f));
-			} else if (ret == FR_IS_PACKAGE) {
-				Frame *f = Frame::New();
-				f->add(nd::symName, Ref(String::New(name)));
-				f->add(nd::symType, Ref(kDesktopFile));
-				file_list.add(Ref(*f));
+		// Reading the directory can take a while, so let list_files_task() do it.
+		current_task_ = Task::LIST_FILES;
+
+	}
+}
+
+/**
+ * \brief Size of one `{name: "...", type: ...}` frame in the NSOF file list.
+ * The first frame writes the slot symbols, all others refer to them.
+ */
+static uint32_t file_list_entry_size(uint32_t index, uint32_t name_size)
+{
+	uint32_t str_size = name_size * 2 + 2;
+	return 2 // frame tag and number of slots
+		+ ((index == 0) ? 12 : 4) // 'name and 'type, as symbols or as precedents
+		+ 1 + xlong_size(str_size) + str_size // the name string
+		+ 2; // the type integer
+}
+
+/**
+ * \brief Number of UTF-16 units in a name that makes a file list frame exactly `size` bytes long.
+ * \return false if no frame has that size.
+ */
+static bool file_list_name_units(uint32_t index, uint32_t size, uint32_t &units)
+{
+	uint32_t empty = file_list_entry_size(index, 0);
+	for (uint32_t extra: { 0, 4 }) { // the string size takes 1 or 5 bytes
+		if (size < empty + extra || ((size - empty - extra) & 1)) continue;
+		units = (size - empty - extra) / 2;
+		if (file_list_entry_size(index, units) == size) return true;
+	}
+	return false;
+}
+
+/**
+ * \brief Find names for `count` frames, starting at `index`, that fill exactly `size` bytes.
+ * All frames but the last two have empty names. `units_a` and `units_b`
+ * return the name sizes of the last two frames.
+ * \return false if that is not possible.
+ */
+static bool file_list_filler(uint32_t index, uint32_t count, uint32_t size, uint32_t &units_a, uint32_t &units_b)
+{
+	units_a = units_b = 0;
+	if (count == 0) return (size == 0);
+	if (count == 1) return file_list_name_units(index, size, units_b);
+	uint32_t last_two = index + count - 2;
+	uint32_t used = (count - 2) * file_list_entry_size(1, 0);
+	if (index == 0 && count > 2) used += file_list_entry_size(0, 0) - file_list_entry_size(1, 0);
+	// A few different sizes for the first of the two get around the sizes that no single frame has
+	for (units_a = 0; units_a < 8; ++units_a) {
+		uint32_t both = used + file_list_entry_size(last_two, units_a);
+		if (both <= size && file_list_name_units(last_two + 1, size - both, units_b)) return true;
+	}
+	return false;
+}
+
+/**
+ * \brief Get the listing of the current directory from the SD Card index.
+ *
+ * The file list is not built as an Array. We calculate its size from the
+ * entry count and name lengths, send the command header, and let
+ * send_file_list_task() encode the entries a few at a time.
+ */
+void Dock::list_files_task()
+{
+	static const std::vector<uint8_t> cmd_header = {
+		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
+		 'f',  'i',  'l',  'e', 0x00, 0x00, 0x00, 0x00,
+	};
+
+	if (sd_busy_()) return; // wait for the SD Card
+	if (!sd_request_.done() || sd_request_.op_ != SDCardRequest::Op::LISTDIR) {
+		sd_request_.op_ = SDCardRequest::Op::LISTDIR;
+		sd_request_.name_.clear(); // the current directory
+		submit_sd_request_();
+		return;
+	}
+	std::shared_ptr<const SDCardIndex::Dir> dir;
+	if (sd_request_.result_ == FR_OK) dir = sd_request_.dir_;
+	sd_request_.reset();
+
+	list_dir_ = (dir && dir->complete()) ? dir : nullptr;
+	// Offer to install all packages at once if there is more than one
+	list_extra_ = 0;
+	if (list_dir_) {
+		uint32_t packages = 0;
+		for (uint32_t i = 0; i < list_dir_->size(); ++i) {
+			if (!list_dir_->is_dir(i)) packages++;
+		}
+		if (packages > 1) list_extra_ = 1;
+	}
+
+	list_count_ = (dir ? dir->count() : 0) + list_extra_;
+	list_pos_ = 0;
+	list_size_ = 2 + xlong_size(list_count_); // NSOF version, array tag, array size
+	if (list_count_) {
+		list_size_ += file_list_entry_size(0, 0) - file_list_entry_size(1, 0); // symbols in the first frame
+		list_size_ += list_count_ * file_list_entry_size(1, 0) + dir->name_units() * 2 + dir->long_names() * 4;
+		list_size_ += list_extra_ * (sizeof(kInstallAllName) - sizeof(char16_t));
+	}
+	if (kLogDock) Log.logf("Dock: list_files_task: %d entries, NSOF: %d\r\n", list_count_, list_size_);
+
+	std::vector<uint8_t> *cmd = new std::vector<uint8_t>(cmd_header);
+	// The size of the NSOF data is stored at offset 12 in the command data
+	(*cmd)[12] = (list_size_ >> 24) & 0xff;
+	(*cmd)[13] = (list_size_ >> 16) & 0xff;
+	(*cmd)[14] = (list_size_ >> 8) & 0xff;
+	(*cmd)[15] = list_size_ & 0xff;
+	cmd->push_back(0x02); // NSOF version
+	cmd->push_back(5); // plain array
+	push_xlong(*cmd, list_count_);
+	list_sent_ = 2 + xlong_size(list_count_);
+	data_queue_.push(Dock::Data(cmd, true, false, true));
+	current_task_ = Task::SEND_FILE_LIST;
+}
+
+/**
+ * \brief Encode the next few entries of the file list.
+ *
+ * Sorted listings come from the index. Directories that were too large for
+ * the index are read from the card a second time, in directory order.
+ */
+void Dock::send_file_list_task()
+{
+	if (!list_chunk_) {
+		list_chunk_ = new std::vector<uint8_t>();
+		list_chunk_->reserve(kFileListChunkSize + 64);
+	}
+	if (list_dir_) {
+		while (list_pos_ < list_count_ && list_chunk_->size() < kFileListChunkSize) {
+			if (list_pos_ < list_extra_) {
+				add_file_list_entry_(kInstallAllName, false);
 			} else {
-				break;
+				uint32_t i = list_pos_ - list_extra_;
+				add_file_list_entry_(list_dir_->name(i), list_dir_->is_dir(i));
 			}
 		}
-		sdcard_endpoint.closedir();
+		queue_file_list_chunk_(list_pos_ == list_count_);
+		return;
+	}
+	if (sd_busy_()) return; // wait for the SD Card
+	SDCardRequest::Op op = sd_request_.op_;
+	if (!sd_request_.done()) {
+		if (list_count_ == 0) {
+			queue_file_list_chunk_(true);
+			return;
+		}
+		sd_request_.op_ = SDCardRequest::Op::OPENDIR;
+		submit_sd_request_();
+		return;
+	}
+	uint32_t ret = sd_request_.result_;
+	sd_request_.reset();
+	if (op == SDCardRequest::Op::CLOSEDIR) {
+		queue_file_list_chunk_(true);
+		return;
+	}
+	bool more = (op == SDCardRequest::Op::OPENDIR) && (ret == FR_OK);
+	if (op == SDCardRequest::Op::READDIR && (ret == FR_IS_DIRECTORY || ret == FR_IS_PACKAGE)) {
+		// Skip entries that would not leave room for the rest, if the directory
+		// changed since we counted the entries
+		uint32_t size = file_list_entry_size(list_pos_, sd_request_.name_.size());
+		uint32_t units_a, units_b;
+		if (list_sent_ + size <= list_size_
+			&& file_list_filler(list_pos_ + 1, list_count_ - list_pos_ - 1, list_size_ - list_sent_ - size, units_a, units_b))
+		{
+			add_file_list_entry_(sd_request_.name_, ret == FR_IS_DIRECTORY);
+			more = (list_pos_ < list_count_);
+		}
+	}
+	sd_request_.op_ = more ? SDCardRequest::Op::READDIR : SDCardRequest::Op::CLOSEDIR;
+	submit_sd_request_();
+	if (list_chunk_->size() >= kFileListChunkSize) queue_file_list_chunk_(false);
+}
+
+void Dock::add_file_list_entry_(const std::u16string &name, bool is_dir)
+{
+	static const uint8_t slot_symbols[] = { 7, 4, 'n', 'a', 'm', 'e', 7, 4, 't', 'y', 'p', 'e' };
+	std::vector<uint8_t> &out = *list_chunk_;
+	uint32_t start = out.size();
+	out.push_back(6); // frame
+	push_xlong(out, 2);
+	if (list_pos_ == 0) {
+		out.insert(out.end(), std::begin(slot_symbols), std::end(slot_symbols));
+	} else {
+		out.push_back(9); push_xlong(out, 2); // precedent: 'name
+		out.push_back(9); push_xlong(out, 3); // precedent: 'type
+	}
+	out.push_back(8); // string
+	push_xlong(out, name.size() * 2 + 2);
+	for (auto c: name) {
+		out.push_back(c >> 8);
+		out.push_back(c & 0xff);
+	}
+	out.push_back(0);
+	out.push_back(0);
+	out.push_back(0); // integer
+	push_xlong(out, (is_dir ? kDesktopFolder : kDesktopFile) << 2);
+	list_sent_ += out.size() - start;
+	list_pos_++;
+}
 
+/**
+ * \brief Queue the encoded entries. The last chunk is completed to the promised size.
+ *
+ * If the directory lost entries since we counted them, the array still
+ * needs the number of frames and bytes that the header promised. They are
+ * filled up with placeholder entries.
+ */
+void Dock::queue_file_list_chunk_(bool last)
+{
+	if (last && list_sent_ != list_size_) {
+		if (kLogDockErrors) Log.logf("Dock: file list is %d bytes short\r\n", list_size_ - list_sent_);
+		uint32_t units_a, units_b;
+		if (file_list_filler(list_pos_, list_count_ - list_pos_, list_size_ - list_sent_, units_a, units_b)) {
+			while (list_pos_ < list_count_) {
+				uint32_t left = list_count_ - list_pos_;
+				uint32_t units = (left == 2) ? units_a : (left == 1) ? units_b : 0;
+				add_file_list_entry_(std::u16string(units, u'-'), false);
+			}
+		}
+	}
+	std::vector<uint8_t> *chunk = list_chunk_;
+	list_chunk_ = nullptr;
+	if (last) {
+		uint32_t aligned_size = (list_size_ + 3) & 0xfffffffc; // align to 4 bytes
+		chunk->resize(chunk->size() + aligned_size - list_sent_, 0);
+		list_dir_ = nullptr;
+		current_task_ = Task::NONE;
 	}
+	data_queue_.push(Dock::Data(chunk, false, last, true));
+}
+
+void Dock::send_file_list_(const Array &file_list)
+{
+	static const std::vector<uint8_t> cmd_header = {
+		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
+		 'f',  'i',  'l',  'e', 0x00, 0x00, 0x00, 0x00,
+	};
 
-	if (kLogDock) Ref(file_list).logln();
+	if (kLogDock) Ref::Retain(&file_list).logln();
 
 	NSOF nsof;
-	nsof.to_nsof(file_list);
+	nsof.dedup_values(true);
+	nsof.to_nsof(Ref::Retain(&file_list));
 	//if (kLogDock) nsof.log();
 
 	std::vector<uint8_t> *cmd = new std::vector<uint8_t>(cmd_header);
@@ -651,132 +1026,251 @@ void Dock::send_cmd_file() { //[{name: "important info", type: kDesktopFile}]
 	(*cmd)[14] = (nsof_size >> 8) & 0xff;
 	(*cmd)[15] = nsof_size & 0xff;
 
-	data_queue_.push(Dock::Data {
-		.bytes_ = cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = true,
-	});
+	data_queue_.push(Dock::Data(cmd, true, true, true));
 	if (kLogDock) Log.logf("Dock: send_cmd_file: size = %d (NSOF: %d, aligned: %d)\r\n", cmd->size(), nsof_size, aligned_size);
 }
 
 void Dock::send_cmd_pass() {
 	if (kLogDockProgress) Log.log("Dock: send_cmd_pass\r\n");
-	static std::vector<uint8_t> cmd = {
+	static const std::vector<uint8_t> cmd_template = {
 		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
 		0x70, 0x61, 0x73, 0x73, 0x00, 0x00, 0x00, 0x08,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 	};
+	std::vector<uint8_t> *cmd = new std::vector<uint8_t>(cmd_template);
 
-	SNewtNonce key;
-	SNewtNonce newtNonce = { newt_challenge_hi, newt_challenge_lo };
-	SNewtNonce response = newtNonce;
-	UniChar password[] = { 0x0000 };
+	SNewtNonce response = { newt_challenge_hi, newt_challenge_lo };
+	static const UniChar password[] = { 0x0000 };
 
 	if (kLogDock) Log.logf("Dock: send_cmd_pass: pass = %08lx'%08lx\r\n", newt_challenge_hi, newt_challenge_lo);
-	DESCharToKey(password, &key); // hi = 4060593999, lo = 2233144957
-	DESEncodeNonce(&key, &response);
+	// The key schedule is only calculated once per password.
+	DESFastEncode(DESPasswordSchedule(&password_key_, password), &response, 1); // key hi = 4060593999, lo = 2233144957
 	if (kLogDock) Log.logf("Dock: send_cmd_pass: pass = %08lx'%08lx\r\n", response.hi, response.lo);
 
-	cmd[16] = (response.hi >> 24) & 0xff;
-	cmd[17] = (response.hi >> 16) & 0xff;
-	cmd[18] = (response.hi >> 8) & 0xff;
-	cmd[19] = response.hi & 0xff;
-	cmd[20] = (response.lo >> 24) & 0xff;
-	cmd[21] = (response.lo >> 16) & 0xff;
-	cmd[22] = (response.lo >> 8) & 0xff;
-	cmd[23] = response.lo & 0xff;
+	(*cmd)[16] = (response.hi >> 24) & 0xff;
+	(*cmd)[17] = (response.hi >> 16) & 0xff;
+	(*cmd)[18] = (response.hi >> 8) & 0xff;
+	(*cmd)[19] = response.hi & 0xff;
+	(*cmd)[20] = (response.lo >> 24) & 0xff;
+	(*cmd)[21] = (response.lo >> 16) & 0xff;
+	(*cmd)[22] = (response.lo >> 8) & 0xff;
+	(*cmd)[23] = response.lo & 0xff;
 
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true, // we want to start with a start frame marker
-		.end_frame_ = true, // we want to end with an end frame marker
-		.free_after_send_ = false, // we don't want to free the data after sending
-	});
+	data_queue_.push(Dock::Data(cmd, true, true, true));
 }
 
 void Dock::send_disc() {
 	if (kLogDockProgress) Log.log("Dock: send_disc\r\n");
-	static std::vector<uint8_t> cmd = {
+	static const std::vector<uint8_t> cmd = {
 		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
 		0x64, 0x69, 0x73, 0x63, 0x00, 0x00, 0x00, 0x00
 	};
-	data_queue_.push(Dock::Data {
-		.bytes_ = &cmd,
-		.pos_ = 0,
-		.start_frame_ = true, // we want to start with a start frame marker
-		.end_frame_ = true, // we want to end with an end frame marker
-		.free_after_send_ = false, // we don't want to free the data after sending
-	});
+	data_queue_.push(Dock::Data(&cmd, true, true, false));
 }
 
-void Dock::handle_SetPath() 
+/**
+ * \brief Decode the NewtonInfo structure and the name of the Newton in place.
+ * The `name` payload starts with the size of the NewtonInfo, followed by
+ * the NewtonInfo as big endian ULongs, and the name of the Newton as a
+ * nul terminated UniChar string. Older Newtons send a shorter NewtonInfo,
+ * missing fields remain 0.
+ */
+void Dock::handle_NewtonName()
 {
+	auto get_ulong = [this](uint32_t pos) -> uint32_t {
+		return (in_data_[pos] << 24) | (in_data_[pos+1] << 16) | (in_data_[pos+2] << 8) | in_data_[pos+3];
+	};
+	newton_info_ = { };
+	newton_name_.clear();
+	if (in_data_.size() < 4) return;
+	uint32_t info_size = get_ulong(0);
+	if (info_size > in_data_.size() - 4) info_size = in_data_.size() - 4;
+	uint32_t *field = reinterpret_cast<uint32_t*>(&newton_info_);
+	uint32_t num_fields = std::min<uint32_t>(info_size, sizeof(NewtonInfo)) / 4;
+	for (uint32_t i = 0; i < num_fields; ++i) {
+		field[i] = get_ulong(4 + 4*i);
+	}
+	NSOFStringView name(in_data_.data() + 4 + info_size, (in_data_.size() - 4 - info_size) / 2);
+	for (uint32_t i = 0; i < name.size() && name[i] != 0; ++i) {
+		newton_name_.push_back(name[i]);
+	}
+	if (kLogDockProgress) Log.logf("Dock: Newton ID %08lx, internal store %08lx\r\n", 
+		(unsigned long)newton_info_.fNewtonID, (unsigned long)newton_info_.fInternalStoreSig);
+}
+
+/**
+ * \brief Decode a payload that is a single NSOF String.
+ * The string is copied straight out of the command buffer. Only unusual
+ * encodings fall back to the full NSOF decoder.
+ * \return 0 or a Dock error code
+ */
+int32_t Dock::get_string_arg_(std::u16string &str)
+{
+	NSOFView view(in_data_);
+	NSOFStringView str_view;
+	if (view.begin() && view.string(str_view)) {
+		str_view.copy_to(str);
+		return 0;
+	}
+	if (!view.unsupported()) {
+		if (kLogDockErrors) Log.logf("Dock: get_string_arg_: NSOF error %d\r\n", view.error_code());
+		return view.error_code();
+	}
 	NSOF nsof(in_data_);
 	int32_t error_code = 0;
-	Ref path_ref = nsof.to_ref(error_code);
+	Ref reply = nsof.to_ref(error_code);
 	if (error_code != 0) {
-		if (kLogDockErrors) Log.logf("Dock: handle_SetPath: NSOF error %d\r\n", error_code);
-		send_cmd_dres(error_code);
-		return;
+		if (kLogDockErrors) Log.logf("Dock: get_string_arg_: NSOF error %d\r\n", error_code);
+		return error_code;
 	}
-	cwd_.clear();
-	Array *arr = path_ref.as_array();
-	if (!arr) {
-		if (kLogDockErrors) Log.log("Dock: handle_SetPath: reply is not an Array\r\n");
-		send_cmd_dres(-48402); // expected an array
-		return;
+	String *str_obj = reply.as_string();
+	if (!str_obj) {
+		if (kLogDockErrors) Log.log("Dock: get_string_arg_: reply is not a String\r\n");
+		return -48402; // expected a string
 	}
-	uint32_t n = arr->size();
-	if (n < 1) {
-		if (kLogDockErrors) Log.log("Dock: handle_SetPath: array too short\r\n");
-		send_cmd_dres(-48401); // Expected an array with at least 2 elements
-		return;
+	str = str_obj->str();
+	return 0;
+}
+
+/**
+ * \brief Set the current path from an `spth` payload without creating Objects.
+ * The path is an Array. The first two entries describe the desktop and the
+ * disk, followed by a String for every folder.
+ * \return false if the payload has a shape that requires the full decoder
+ */
+bool Dock::set_path_from_view_(int32_t &error_code)
+{
+	NSOFView view(in_data_);
+	uint32_t n = 0;
+	if (view.begin() && view.array(n) && (n > 0)) {
+		cwd_.clear();
+		if (n == 1) {
+			path_is_desktop_ = true;
+			cwd_ = u"/";
+			return true;
+		}
+		NSOFStringView name;
+		if (view.skip() && view.skip()) {
+			uint32_t i = 2;
+			for ( ; i < n; ++i) {
+				if (!view.string(name)) break;
+				cwd_.push_back('/');
+				name.append_to(cwd_);
+			}
+			if (i == n) {
+				path_is_desktop_ = false;
+				return true;
+			}
+		}
 	}
-	if (n == 1) {
-		path_is_desktop_ = true;
-		cwd_ = u"/";
+	if (view.unsupported() || (n == 0)) return false;
+	error_code = view.error_code();
+	return true;
+}
+
+void Dock::handle_SetPath() 
+{
+	int32_t error_code = 0;
+	if (set_path_from_view_(error_code)) {
+		if (error_code != 0) {
+			if (kLogDockErrors) Log.logf("Dock: handle_SetPath: NSOF error %d\r\n", error_code);
+			send_cmd_dres(error_code);
+			return;
+		}
 	} else {
-		path_is_desktop_ = false;
-		for (int i = 2; i < n; ++i) {
-			String *name = arr->at(i).as_string();
-			if (!name) {
-				if (kLogDockErrors) Log.logf("Dock: handle_SetPath: item %d is not a String\r\n", i);
-				send_cmd_dres(-48401); // Expected a string
-				return;
+		NSOF nsof(in_data_);
+		Ref path_ref = nsof.to_ref(error_code);
+		if (error_code != 0) {
+			if (kLogDockErrors) Log.logf("Dock: handle_SetPath: NSOF error %d\r\n", error_code);
+			send_cmd_dres(error_code);
+			return;
+		}
+		cwd_.clear();
+		Array *arr = path_ref.as_array();
+		if (!arr) {
+			if (kLogDockErrors) Log.log("Dock: handle_SetPath: reply is not an Array\r\n");
+			send_cmd_dres(-48402); // expected an array
+			return;
+		}
+		uint32_t n = arr->size();
+		if (n < 1) {
+			if (kLogDockErrors) Log.log("Dock: handle_SetPath: array too short\r\n");
+			send_cmd_dres(-48401); // Expected an array with at least 2 elements
+			return;
+		}
+		if (n == 1) {
+			path_is_desktop_ = true;
+			cwd_ = u"/";
+		} else {
+			path_is_desktop_ = false;
+			for (uint32_t i = 2; i < n; ++i) {
+				String *name = arr->at(i).as_string();
+				if (!name) {
+					if (kLogDockErrors) Log.logf("Dock: handle_SetPath: item %d is not a String\r\n", i);
+					send_cmd_dres(-48401); // Expected a string
+					return;
+				}
+				cwd_.push_back('/');
+				cwd_.append(name->str());
 			}
-			cwd_.push_back('/');
-			cwd_.append(name->str());
 		}
 	}
 	if (cwd_.empty()) cwd_.push_back('/');
-	sdcard_endpoint.chdir(cwd_);
+	// The card may be busy with other requests, so let set_path_task() change the directory.
+	current_task_ = Task::SET_PATH;
+}
 
+/**
+ * \brief Change to the directory in `cwd_` and reply to `spth` with 'file'.
+ */
+void Dock::set_path_task()
+{
+	if (sd_busy_()) return; // wait for the SD Card
+	if (!sd_request_.done() || sd_request_.op_ != SDCardRequest::Op::CHDIR) {
+		sd_request_.op_ = SDCardRequest::Op::CHDIR;
+		sd_request_.name_ = cwd_;
+		submit_sd_request_();
+		return;
+	}
+	if (sd_request_.result_ != FR_OK) {
+		if (kLogDockErrors) Log.logf("Dock: set_path_task: chdir error %d\r\n", sd_request_.result_);
+	}
+	sd_request_.reset();
+	current_task_ = Task::NONE;
 	send_cmd_file();
 }
 
 void Dock::handle_GetFileInfo()
 {
-	NSOF nsof_in(in_data_);
-	int32_t error_code = 0;
-	Ref reply = nsof_in.to_ref(error_code);
+	// payload must be a String containing the file name
+	int32_t error_code = get_string_arg_(file_info_name_);
 	if (error_code != 0) {
-		if (kLogDockErrors) Log.logf("Dock: handle_GetFileInfo: NSOF error %d\r\n", error_code);
 		send_cmd_dres(error_code);
 		return;
 	}
-	// reply must be a String containing the file name
-	String *filename = reply.as_string();
-	if (!filename) {
-		if (kLogDockErrors) Log.log("Dock: handle_GetFileInfo: reply is not a String\r\n");
-		error_code = -48402; // expected a string
-		send_cmd_dres(error_code);
+	// The package header may have to be read from the card, so let file_info_task() do it.
+	current_task_ = Task::GET_FILE_INFO;
+}
+
+/**
+ * \brief Reply to `gfin` with the file size and the package creation date.
+ */
+void Dock::file_info_task()
+{
+	if (sd_busy_()) return; // wait for the SD Card
+	if (!sd_request_.done() || sd_request_.op_ != SDCardRequest::Op::PKGINFO) {
+		sd_request_.op_ = SDCardRequest::Op::PKGINFO;
+		sd_request_.name_ = file_info_name_;
+		sd_request_.info_ = &pkg_info_;
+		submit_sd_request_();
 		return;
 	}
+	if (sd_request_.result_ != FR_OK) pkg_info_.clear();
+	sd_request_.reset();
+	current_task_ = Task::NONE;
+
 	if (kLogDockProgress) Log.log("Dock: send file info 'finf'\r\n");
-	static std::vector<uint8_t> cmd_header = {
+	static const std::vector<uint8_t> cmd_header = {
 		'n', 'e', 'w', 't', 'd', 'o', 'c', 'k',
 		'f', 'i', 'n', 'f', 0x00, 0x00, 0x00, 0x85,
 
@@ -808,19 +1302,17 @@ void Dock::handle_GetFileInfo()
 
 	};
 
-	sdcard_endpoint.openfile(filename->str());
-	uint32_t file_size = sdcard_endpoint.filesize();
-	sdcard_endpoint.closefile();
-
 	Frame info;
-	info.add(nd::symKind, Ref(String::New( { 'P', 'a', 'c', 'k', 'a', 'g', 'e' } ))); // kind
-	info.add(nd::symSize, Ref((int32_t)file_size)); // size
-	info.add(nd::symCreated, Ref(0)); // created
+	info.add(nd::symKind, Ref(String::New(pkg_info_.valid_ ? u"Package" : u"File"))); // kind
+	info.add(nd::symSize, Ref((int32_t)pkg_info_.file_size_)); // size
+	info.add(nd::symCreated, Ref((int32_t)(pkg_info_.creation_date_ / 60))); // created, in minutes since 1904
 	info.add(nd::symModified, Ref(0)); // modified
-	info.add(nd::symPath, reply); // path
+	String path(file_info_name_);
+	info.add(nd::symPath, Ref(path)); // path
 	info.add(nd::symIcon, Ref(false)); // icon
 
 	NSOF nsof;
+	nsof.dedup_values(true);
 	nsof.to_nsof(info);
 	if (kLogDock) nsof.log();
 
@@ -839,13 +1331,7 @@ void Dock::handle_GetFileInfo()
 	(*cmd)[14] = (nsof_size >> 8) & 0xff;
 	(*cmd)[15] = nsof_size & 0xff;
 
-	data_queue_.push(Dock::Data {
-		.bytes_ = cmd,
-		.pos_ = 0,
-		.start_frame_ = true,
-		.end_frame_ = true,
-		.free_after_send_ = true,
-	});
+	data_queue_.push(Dock::Data(cmd, true, true, true));
 }
 
 void Dock::handle_LoadPackageFile()
@@ -855,101 +1341,954 @@ void Dock::handle_LoadPackageFile()
 	//		ULong 'lpfl'
 	//		ULong length
 	//		NSOF filename
-	NSOF nsof(in_data_);
-	int32_t error_code = 0;
-	Ref reply = nsof.to_ref(error_code);
-	if (error_code != 0) {
-		if (kLogDockErrors) Log.logf("Dock: handle_LoadPackageFile: NSOF error %d\r\n", error_code);
-		send_cmd_dres(error_code);
-		return;
-	}
-	// reply must be a String containing the file name
-	String *filename = reply.as_string();
-	if (filename) {
+	int32_t error_code = get_string_arg_(pkg_filename_);
+	batch_.clear();
+	if (error_code == 0 && pkg_filename_ == kInstallAllName) {
+		if (kLogDockProgress) Log.log("Dock: start to install all packages\r\n");
+		current_task_ = Task::START_BATCH;
+	} else if (error_code == 0) {
 		if (kLogDockProgress) Log.log("Dock: start to send package file\r\n");
-		pkg_filename_ = filename->str();
 		current_task_ = Task::SEND_PACKAGE;
 	} else {
-		if (kLogDockErrors) Log.log("Dock: handle_LoadPackageFile: reply is not a String\r\n");
-		error_code = -48402; // expected a string
 		// error_code = -10006; // bad parameter
 		// error_code = -28004; // kErrorInvalidParameter
 		send_cmd_dres(error_code);
 	}
 }
 
+/**
+ * \brief Send a package file to the Newton, written as one sequential flow.
+ *
+ * The flow starts at the phase in `current_task_`: SEND_PACKAGE checks and
+ * opens the file, CONTINUE_SEND_PACKAGE is where a prefetched package of a
+ * batch joins in, and PACKAGE_CANCELED just closes the file. task() calls
+ * this only when the data queue is empty.
+ */
 void Dock::send_package_task() 
 {
+	ND_CO_BEGIN(send_package_co_);
+	ND_CO_AWAIT(send_package_co_, !sd_busy_()); // wait for the SD Card
+
 	if (current_task_ == Task::SEND_PACKAGE) {
+		// Check the package header first. This is usually answered from the index.
 		if (kLogDockProgress) Log.log("Dock: start SEND_PACKAGE\r\n");
-		uint32_t err = sdcard_endpoint.openfile(pkg_filename_);
-		if (err != FR_OK) {
-			if (kLogDockErrors) Log.logf("Dock: send_package_task: openfile error %d\r\n", err);
-			send_cmd_dres(-48403); // file not found
-			current_task_ = Task::NONE;
-			return;
+		sd_request_.op_ = SDCardRequest::Op::PKGINFO;
+		sd_request_.name_ = pkg_filename_;
+		sd_request_.info_ = &pkg_info_;
+		submit_sd_request_();
+		ND_CO_AWAIT(send_package_co_, !sd_busy_());
+		{
+			uint32_t err = sd_request_.result_;
+			sd_request_.reset();
+			if (err != FR_OK || !pkg_info_.valid_) {
+				if (kLogDockErrors) Log.logf("Dock: send_package_task: not a valid package (%d)\r\n", err);
+				send_cmd_dres((err != FR_OK) ? -48403 : -28019); // file not found, or package can't load
+				current_task_ = Task::NONE;
+				ND_CO_EXIT(send_package_co_);
+			}
+		}
+		sd_request_.op_ = SDCardRequest::Op::OPENFILE;
+		sd_request_.name_ = pkg_filename_;
+		submit_sd_request_();
+		ND_CO_AWAIT(send_package_co_, !sd_busy_());
+		{
+			uint32_t err = sd_request_.result_;
+			pkg_size_ = sd_request_.size_;
+			sd_request_.reset();
+			if (err != FR_OK) {
+				sd_file_open_ = false;
+				if (kLogDockErrors) Log.logf("Dock: send_package_task: openfile error %d\r\n", err);
+				send_cmd_dres(-48403); // file not found
+				current_task_ = Task::NONE;
+				ND_CO_EXIT(send_package_co_);
+			}
 		}
-		pkg_size_ = sdcard_endpoint.filesize();
 		pkg_size_aligned_ = (pkg_size_ + 3) & 0xfffffffc; // align to 4 bytes
 		pkg_crsr_ = 0;
-
-		static std::vector<uint8_t> cmd = {
-			0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b, 
-			 'l',  'p',  'k',  'g', 0x00, 0x00, 0x08, 0x00, // lpkg
-		};
-		cmd[12] = (pkg_size_ >> 24) & 0xff; // size of the package
-		cmd[13] = (pkg_size_ >> 16) & 0xff;
-		cmd[14] = (pkg_size_ >> 8) & 0xff;
-		cmd[15] = pkg_size_ & 0xff;
-		data_queue_.push(Dock::Data {
-			.bytes_ = &cmd,
-			.pos_ = 0,
-			.start_frame_ = true, // we want to start with a start frame marker
-			.end_frame_ = false, // we want to end with an end frame marker
-			.free_after_send_ = false, // we don't want to free the data after sending
-		});
+		queue_lpkg_header_();
 		current_task_ = Task::CONTINUE_SEND_PACKAGE;
-	} else if (current_task_ == Task::CONTINUE_SEND_PACKAGE || current_task_ == Task::CANCEL_SEND_PACKAGE) {
+	}
+
+	// queue_package_block_() moves on to PACKAGE_SENT or PACKAGE_CANCELED with the last block
+	while (current_task_ == Task::CONTINUE_SEND_PACKAGE || current_task_ == Task::CANCEL_SEND_PACKAGE) {
+		ND_CO_AWAIT(send_package_co_, data_queue_.empty()); // one block at a time
 		if (kLogDockProgress) Log.log("Dock: continue SEND_PACKAGE\r\n");
-		uint32_t read_size = pkg_size_ - pkg_crsr_;
-		if (read_size > 512) {
-			read_size = 512; // read at most 512 bytes
+		{
+			uint32_t read_size = pkg_size_ - pkg_crsr_;
+			if (read_size > 512) {
+				read_size = 512; // read at most 512 bytes
+			}
+			uint32_t package_size = read_size;
+			pkg_crsr_ += read_size;
+			bool last_package = (pkg_crsr_ >= pkg_size_);
+			if (last_package) {
+				package_size += (pkg_size_aligned_ - pkg_size_); // add padding to align to 4 bytes
+			}
+			if (current_task_ == Task::CANCEL_SEND_PACKAGE) last_package = true; // we want to cancel the package
+			if (kLogDock) Log.logf("Dock: send_package_task: read_size = %d, pkg_crsr_ = %d, pkg_size_ = %d\r\n", read_size, pkg_crsr_, pkg_size_);
+			// Read the block in the background and send it when it's complete. If the
+			// card can lend us the file data, we send it from there without copying.
+			// The last block may need padding, so it is always read into the buffer.
+			pkg_block_ = new std::vector<uint8_t>(package_size);
+			pkg_block_last_ = last_package;
+			sd_request_.op_ = (package_size == read_size) ? SDCardRequest::Op::VIEWFILE : SDCardRequest::Op::READFILE;
+			sd_request_.buffer_ = pkg_block_->data();
+			sd_request_.data_ = nullptr;
+			sd_request_.size_ = read_size;
+			submit_sd_request_();
 		}
-		uint32_t package_size = read_size;
-		pkg_crsr_ += read_size;
-		bool last_package = (pkg_crsr_ >= pkg_size_);
-		if (last_package) {
-			package_size += (pkg_size_aligned_ - pkg_size_); // add padding to align to 4 bytes
+		ND_CO_AWAIT(send_package_co_, !sd_busy_());
+		if (sd_request_.result_ != sd_request_.size_) {
+			if (kLogDockErrors) Log.logf("Dock: send_package_task: readfile error %d\r\n", sd_request_.result_);
 		}
-		if (current_task_ == Task::CANCEL_SEND_PACKAGE) last_package = true; // we want to cancel the package
-		if (kLogDock) Log.logf("Dock: send_package_task: read_size = %d, pkg_crsr_ = %d, pkg_size_ = %d\r\n", read_size, pkg_crsr_, pkg_size_);
-		auto data = new std::vector<uint8_t>(package_size); 
-		uint32_t bytes_read = sdcard_endpoint.readfile(data->data(), read_size);
-		if (bytes_read != read_size) {
-			if (kLogDockErrors) Log.logf("Dock: send_package_task: readfile error %d\r\n", bytes_read);
+		if (sd_request_.data_ && sd_request_.data_ != pkg_block_->data() && sd_request_.result_ == sd_request_.size_) {
+			delete pkg_block_;
+			queue_package_block_(nullptr, sd_request_.data_, sd_request_.size_, pkg_block_last_);
+		} else {
+			queue_package_block_(pkg_block_, nullptr, 0, pkg_block_last_);
 		}
-		data_queue_.push(Dock::Data {
-			.bytes_ = data,
-			.pos_ = 0,
-			.start_frame_ = false, // we want to start with a start frame marker
-			.end_frame_ = last_package, // we want to end with an end frame marker
-			.free_after_send_ = true, // we don't want to free the data after sending
-		});
-		if (last_package) {
-			if (current_task_ == Task::CANCEL_SEND_PACKAGE) {
-				current_task_ = Task::PACKAGE_CANCELED;
-			} else {
-				current_task_ = Task::PACKAGE_SENT; // we are done sending the package
-			}
+		sd_request_.reset();
+		pkg_block_ = nullptr;
+	}
+
+	// PACKAGE_SENT or PACKAGE_CANCELED: the last block may be a view into the file, so send it before closing
+	ND_CO_AWAIT(send_package_co_, data_queue_.empty());
+	sd_request_.op_ = SDCardRequest::Op::CLOSEFILE;
+	submit_sd_request_();
+	ND_CO_AWAIT(send_package_co_, !sd_busy_());
+	sd_request_.reset();
+	// clean up
+	if (kLogDockProgress) Log.log("Dock: PACKAGE_SENT\r\n");
+	delete pkg_block_; // a prefetched block of a canceled batch
+	pkg_block_ = nullptr;
+	if (current_task_ == Task::PACKAGE_CANCELED) {
+		send_cmd_ocaa();
+		batch_.clear();
+	}
+	current_task_ = Task::NONE;
+	ND_CO_END(send_package_co_);
+	if (!batch_.empty()) next_batch_package_();
+}
+
+void Dock::queue_lpkg_header_()
+{
+	static const std::vector<uint8_t> cmd_template = {
+		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b, 
+		 'l',  'p',  'k',  'g', 0x00, 0x00, 0x08, 0x00, // lpkg
+	};
+	std::vector<uint8_t> *cmd = new std::vector<uint8_t>(cmd_template);
+	(*cmd)[12] = (pkg_size_ >> 24) & 0xff; // size of the package
+	(*cmd)[13] = (pkg_size_ >> 16) & 0xff;
+	(*cmd)[14] = (pkg_size_ >> 8) & 0xff;
+	(*cmd)[15] = pkg_size_ & 0xff;
+	data_queue_.push(Dock::Data(cmd, true, false, true));
+}
+
+/**
+ * \brief Install all packages in the current folder in one go.
+ *
+ * The Newton asks for kInstallAllName with 'lpfl'. We send the first
+ * package as an answer, and every following package when the Newton
+ * replies with 'dres' to the previous one. While the Newton is busy
+ * installing, prefetch_package_task() already checks and opens the next
+ * file and reads its first block.
+ */
+void Dock::start_batch_task()
+{
+	if (sd_busy_()) return; // wait for the SD Card
+	if (!sd_request_.done() || sd_request_.op_ != SDCardRequest::Op::LISTDIR) {
+		sd_request_.op_ = SDCardRequest::Op::LISTDIR;
+		sd_request_.name_.clear(); // the current directory
+		submit_sd_request_();
+		return;
+	}
+	std::shared_ptr<const SDCardIndex::Dir> dir;
+	if (sd_request_.result_ == FR_OK) dir = sd_request_.dir_;
+	sd_request_.reset();
+	batch_.clear();
+	if (dir && dir->complete()) {
+		for (uint32_t i = 0; i < dir->size(); ++i) {
+			if (!dir->is_dir(i)) batch_.push_back(dir->name(i));
 		}
-	} else if (current_task_ == Task::PACKAGE_SENT || current_task_ == Task::PACKAGE_CANCELED) {
-		// clean up
-		if (kLogDockProgress) Log.log("Dock: PACKAGE_SENT\r\n");
-		sdcard_endpoint.closefile();
-		if (current_task_ == Task::PACKAGE_CANCELED) {
-			send_cmd_ocaa();
+	}
+	if (kLogDockProgress) Log.logf("Dock: installing %d packages\r\n", batch_.size());
+	batch_pos_ = 0;
+	batch_go_ = true; // the Newton is waiting for the first package
+	batch_sent_ = 0;
+	next_batch_package_();
+}
+
+void Dock::next_batch_package_()
+{
+	if (batch_pos_ < batch_.size()) {
+		pkg_filename_ = batch_[batch_pos_++];
+		current_task_ = Task::PREFETCH_PACKAGE;
+		return;
+	}
+	if (kLogDockProgress) Log.logf("Dock: installed %d packages\r\n", batch_sent_);
+	if (batch_sent_ == 0) send_cmd_dres(-28019); // no valid package, the Newton is still waiting for an answer
+	batch_.clear();
+	current_task_ = Task::NONE;
+}
+
+/**
+ * \brief Check and open the next package of the batch and read its first block.
+ * Files that are not valid packages are skipped.
+ */
+void Dock::prefetch_package_task()
+{
+	if (sd_busy_()) return; // wait for the SD Card
+	SDCardRequest::Op op = sd_request_.op_;
+	if (!sd_request_.done() || (op != SDCardRequest::Op::PKGINFO && op != SDCardRequest::Op::OPENFILE && op != SDCardRequest::Op::READFILE)) {
+		sd_request_.op_ = SDCardRequest::Op::PKGINFO;
+		sd_request_.name_ = pkg_filename_;
+		sd_request_.info_ = &pkg_info_;
+		submit_sd_request_();
+		return;
+	}
+	uint32_t ret = sd_request_.result_;
+	uint32_t size = sd_request_.size_;
+	sd_request_.reset();
+	if (op == SDCardRequest::Op::PKGINFO) {
+		if (ret != FR_OK || !pkg_info_.valid_) {
+			if (kLogDockErrors) Log.logf("Dock: prefetch_package_task: skipping, not a valid package (%d)\r\n", ret);
+			next_batch_package_();
+			return;
+		}
+		sd_request_.op_ = SDCardRequest::Op::OPENFILE;
+		sd_request_.name_ = pkg_filename_;
+		submit_sd_request_();
+		return;
+	}
+	if (op == SDCardRequest::Op::OPENFILE) {
+		if (ret != FR_OK) {
+			sd_file_open_ = false;
+			if (kLogDockErrors) Log.logf("Dock: prefetch_package_task: skipping, openfile error %d\r\n", ret);
+			next_batch_package_();
+			return;
+		}
+		pkg_size_ = size;
+		pkg_size_aligned_ = (pkg_size_ + 3) & 0xfffffffc; // align to 4 bytes
+		uint32_t read_size = std::min(pkg_size_, (uint32_t)512);
+		pkg_block_last_ = (read_size == pkg_size_);
+		pkg_block_ = new std::vector<uint8_t>(pkg_block_last_ ? pkg_size_aligned_ : read_size);
+		sd_request_.op_ = SDCardRequest::Op::READFILE;
+		sd_request_.buffer_ = pkg_block_->data();
+		sd_request_.size_ = read_size;
+		submit_sd_request_();
+		return;
+	}
+	if (ret != size) {
+		if (kLogDockErrors) Log.logf("Dock: prefetch_package_task: readfile error %d\r\n", ret);
+	}
+	current_task_ = Task::PACKAGE_READY;
+}
+
+/**
+ * \brief Send the package that prefetch_package_task() prepared.
+ */
+void Dock::send_prefetched_package_()
+{
+	if (kLogDockProgress) Log.log("Dock: send next package of the batch\r\n");
+	batch_go_ = false;
+	batch_sent_++;
+	dres_next_ = kDLoadPackage; // wait for the Newton to install it
+	queue_lpkg_header_();
+	pkg_crsr_ = std::min(pkg_size_, (uint32_t)512);
+	current_task_ = Task::CONTINUE_SEND_PACKAGE;
+	std::vector<uint8_t> *block = pkg_block_;
+	pkg_block_ = nullptr;
+	queue_package_block_(block, nullptr, 0, pkg_block_last_);
+}
+
+/**
+ * \brief Queue one block of package data, either from a buffer or from an SD Card view.
+ */
+void Dock::queue_package_block_(std::vector<uint8_t> *block, const uint8_t *view, uint32_t size, bool last)
+{
+	data_queue_.push(Dock::Data(block, false, last, (block != nullptr), view, size)); // views belong to the SD Card
+	if (last) {
+		if (current_task_ == Task::CANCEL_SEND_PACKAGE) {
+			current_task_ = Task::PACKAGE_CANCELED;
+		} else {
+			current_task_ = Task::PACKAGE_SENT; // we are done sending the package
 		}
+	}
+}
+
+/**
+ * \brief Queue a command with an optional NSOF payload.
+ */
+void Dock::send_cmd_(uint32_t cmd, const std::vector<uint8_t> *payload)
+{
+	uint32_t size = payload ? payload->size() : 0;
+	std::vector<uint8_t> *data = new std::vector<uint8_t> {
+		0x6e, 0x65, 0x77, 0x74, 0x64, 0x6f, 0x63, 0x6b,
+		0x00, 0x00, 0x00, 0x00, 
+		(uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size
+	};
+	memcpy(data->data() + 8, &cmd, 4); // ND_FOURCC keeps the characters in memory order
+	if (payload) data->insert(data->end(), payload->begin(), payload->end());
+	while (data->size() & 3) data->push_back(0); // align to 4 bytes
+	data_queue_.push(Dock::Data(data, true, true, true));
+}
+
+/**
+ * \brief Make a Newton name usable as a file name on a FAT card.
+ */
+static std::u16string fat_name(const std::u16string &name)
+{
+	std::u16string ret;
+	for (char16_t c: name) {
+		if (c < 0x20 || std::u16string(u"\"*/:<>?\\|").find(c) != std::u16string::npos) c = u'_';
+		ret.push_back(c);
+	}
+	while (!ret.empty() && (ret.back() == u'.' || ret.back() == u' ')) ret.pop_back();
+	if (ret.empty()) ret = u"_";
+	return ret;
+}
+
+/**
+ * \brief The folder that holds all backups of a Newton.
+ */
+static std::u16string backup_root(uint32_t internal_store_sig)
+{
+	char path[20];
+	snprintf(path, sizeof(path), "/Backup/%08X", (unsigned)internal_store_sig);
+	return std::u16string(path, path + strlen(path));
+}
+
+/**
+ * \brief Back up all soups of all stores to the SD Card.
+ *
+ * The backup of a Newton goes into `/Backup/<fInternalStoreSig>/`, so two
+ * Newtons with the same name don't mix. Every soup is written into
+ * `<Store>/<Soup>.sbk`. The file holds one record per entry, which is the
+ * `entr` command as the Newton sent it, without the leading `newtdock`: the
+ * command, the size, the NSOF data, and padding to four bytes.
+ *
+ * Next to it, `<Soup>.sbx` holds the index of the soup: the ID, hash, and
+ * size of every entry, and the Newton time of the backup. If the index is
+ * there and belongs to the same store, only entries that changed since then
+ * are requested and appended to the `.sbk` file, and a `dele` record lists
+ * the IDs of entries that are gone. Reading the file front to back and
+ * keeping the last record of every ID gives the current soup. Without an
+ * index, the whole soup is requested and the `.sbk` file starts over.
+ *
+ * Entries are handed to an SDCardWriter, which collects them in blocks of
+ * kSDCardWriteBlock bytes and writes them while the Newton keeps sending.
+ * If the card falls behind, Dock::send() rejects data until the writer has
+ * room again, so the MNP layer stops acknowledging and the Newton waits.
+ */
+void Dock::handle_RequestToSync()
+{
+	if (kLogDockProgress) Log.log("Dock: backup requested\r\n");
+	if (backup_ || restore_) {
+		send_cmd_dres(-28027); // kDockErrAlreadyBusy, the previous session is still using the card
+		return;
+	}
+	backup_ = new SDCardWriter(sdcard_, kSDCardWriteBlock);
+	backup_done_ = false;
+	backup_open_ = false;
+	backup_hold_ = false;
+	backup_index_queued_ = false;
+	backup_record_ = nullptr;
+	backup_crsr_ = 0;
+	backup_stats_ = { };
+	backup_stores_.clear();
+	backup_soups_.clear();
+	backup_->mkdir(u"/Backup");
+	backup_root_ = backup_root(newton_info_.fInternalStoreSig);
+	backup_->mkdir(backup_root_);
+	send_cmd_(kDGetSyncOptions);
+}
+
+/**
+ * \brief Remember the name, kind, and signature of every store.
+ */
+void Dock::handle_StoreNames()
+{
+	if (!syncing_()) return;
+	NSOF nsof(in_data_);
+	int32_t error_code = 0;
+	Ref stores = nsof.to_ref(error_code);
+	Array *array = stores.as_array();
+	if (error_code == 0 && array) {
+		for (uint32_t i = 0; i < array->size(); ++i) {
+			Frame *frame = array->at(i).as_frame();
+			if (!frame) continue;
+			String *name = frame->at(symName).as_string();
+			if (!name) continue;
+			BackupStore store;
+			store.name_ = name->str();
+			String *kind = frame->at(symKind).as_string();
+			if (kind) store.kind_ = kind->str();
+			const Ref &signature = frame->at(symSignature);
+			if (signature.is_int()) store.signature_ = signature.as_int();
+			backup_stores_.push_back(store);
+		}
+	} else {
+		if (kLogDockErrors) Log.logf("Dock: handle_StoreNames: NSOF error %d\r\n", error_code);
+	}
+	send_cmd_(kDDesktopControl);
+	backup_store_pos_ = 0;
+	next_backup_store_();
+}
+
+/**
+ * \brief Make the next store current, or end the backup or restore.
+ */
+void Dock::next_backup_store_()
+{
+	if (backup_store_pos_ >= backup_stores_.size()) {
+		if (restore_) {
+			end_restore_();
+		} else {
+			end_backup_();
+		}
+		send_cmd_(kDOperationDone);
+		return;
+	}
+	const BackupStore &store = backup_stores_[backup_store_pos_++];
+	backup_path_ = backup_root_;
+	backup_path_.append(u"/");
+	backup_path_.append(fat_name(store.name_));
+	if (!restore_) backup_->mkdir(backup_path_);
+
+	Frame frame;
+	frame.add(symName, Ref(String::New(store.name_)));
+	frame.add(symKind, Ref(String::New(store.kind_)));
+	frame.add(symSignature, Ref(store.signature_));
+	NSOF nsof;
+	nsof.to_nsof(Ref(frame));
+	dres_next_ = kDGetSoupNames;
+	send_cmd_(kDSetCurrentStore, &nsof.data());
+}
+
+/**
+ * \brief Remember the names of all soups in the current store.
+ */
+void Dock::handle_SoupNames()
+{
+	if (!syncing_()) return;
+	backup_soups_.clear();
+	NSOF nsof(in_data_);
+	int32_t error_code = 0;
+	Ref soups = nsof.to_ref(error_code);
+	Array *array = soups.as_array();
+	if (error_code == 0 && array) {
+		for (uint32_t i = 0; i < array->size(); ++i) {
+			String *name = array->at(i).as_string();
+			if (name) backup_soups_.push_back(name->str());
+		}
+	} else {
+		if (kLogDockErrors) Log.logf("Dock: handle_SoupNames: NSOF error %d\r\n", error_code);
+	}
+	backup_soup_pos_ = 0;
+	next_backup_soup_();
+}
+
+/**
+ * \brief Make the next soup current, or go on with the next store.
+ */
+void Dock::next_backup_soup_()
+{
+	if (backup_soup_pos_ >= backup_soups_.size()) {
+		next_backup_store_();
+		return;
+	}
+	NSOF nsof;
+	nsof.to_nsof(Ref(String::New(backup_soups_[backup_soup_pos_++])));
+	dres_next_ = kDSendSoup;
+	send_cmd_(kDSetCurrentSoup, &nsof.data());
+}
+
+/**
+ * \brief The Newton switched to the soup, find out what we know about it.
+ */
+void Dock::start_backup_soup_()
+{
+	backup_soup_path_ = backup_path_;
+	backup_soup_path_.append(u"/");
+	backup_soup_path_.append(fat_name(backup_soups_[backup_soup_pos_ - 1]));
+	backup_index_.clear();
+	backup_changed_.clear();
+	backup_changed_pos_ = 0;
+	backup_incremental_ = false;
+	backup_last_time_ = 0;
+	current_task_ = Task::READ_BACKUP_INDEX;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put_u32(std::vector<uint8_t> &v, uint32_t x)
+{
+	v.push_back(x >> 24); v.push_back(x >> 16); v.push_back(x >> 8); v.push_back(x);
+}
+
+/**
+ * \brief Read the `.sbx` file of the current soup, then ask the Newton for the time.
+ * A missing or unusable index means that the whole soup is backed up.
+ */
+void Dock::read_backup_index_task()
+{
+	// The card has only one open file, so wait until the writer is done with it
+	if (!backup_->idle()) return;
+	if (sd_busy_()) return; // wait for the SD Card
+	SDCardRequest::Op op = sd_request_.op_;
+	if (!sd_request_.done() || (op != SDCardRequest::Op::OPENFILE && op != SDCardRequest::Op::READFILE && op != SDCardRequest::Op::CLOSEFILE)) {
+		sd_request_.op_ = SDCardRequest::Op::OPENFILE;
+		sd_request_.name_ = backup_soup_path_ + u".sbx";
+		submit_sd_request_();
+		return;
+	}
+	uint32_t ret = sd_request_.result_;
+	uint32_t size = sd_request_.size_;
+	sd_request_.reset();
+	if (op == SDCardRequest::Op::OPENFILE) {
+		backup_scratch_.clear();
+		if (ret == FR_OK && size >= 24 && size <= kBackupIndexSize) {
+			backup_scratch_.resize(size);
+			sd_request_.op_ = SDCardRequest::Op::READFILE;
+			sd_request_.buffer_ = backup_scratch_.data();
+			sd_request_.size_ = size;
+			submit_sd_request_();
+			return;
+		}
+		if (ret == FR_OK) {
+			if (kLogDockErrors) Log.logf("Dock: read_backup_index_task: index has %d bytes, ignored\r\n", size);
+			sd_request_.op_ = SDCardRequest::Op::CLOSEFILE;
+			submit_sd_request_();
+			return;
+		}
+	} else if (op == SDCardRequest::Op::READFILE) {
+		if (ret != backup_scratch_.size()) backup_scratch_.clear();
+		sd_request_.op_ = SDCardRequest::Op::CLOSEFILE;
+		submit_sd_request_();
+		return;
+	}
+	// Record: 'ndbx', size, version, store signature, time, count, {id, hash, size}...
+	const BackupStore &store = backup_stores_[backup_store_pos_ - 1];
+	const uint8_t *p = backup_scratch_.data();
+	uint32_t n = backup_scratch_.size();
+	if (n >= 24 && memcmp(p, &BackupReader::kIndexTag, 4) == 0 && get_u32(p + 4) == n - 8
+	    && get_u32(p + 8) == BackupReader::kIndexVersion && get_u32(p + 12) == (uint32_t)store.signature_
+	    && get_u32(p + 20) == (n - 24) / 12 && (n - 24) % 12 == 0)
+	{
+		backup_last_time_ = get_u32(p + 16);
+		for (p += 24; p < backup_scratch_.data() + n; p += 12)
+			backup_index_.push_back(BackupEntry { get_u32(p), get_u32(p + 4), get_u32(p + 8) });
+		backup_incremental_ = std::is_sorted(backup_index_.begin(), backup_index_.end(),
+			[](const BackupEntry &a, const BackupEntry &b) { return a.id_ < b.id_; });
+		if (!backup_incremental_) backup_index_.clear();
+	}
+	backup_scratch_.clear();
+	if (kLogDockProgress) Log.logf("Dock: %s backup, %d entries known\r\n", backup_incremental_ ? "incremental" : "full", (int)backup_index_.size());
+	current_task_ = Task::NONE;
+	std::vector<uint8_t> time;
+	put_u32(time, backup_incremental_ ? backup_last_time_ : 0);
+	send_cmd_(kDLastSyncTime, &time);
+}
+
+/**
+ * \brief The Newton tells the current time, which becomes the time of this backup.
+ */
+void Dock::handle_CurrentTime()
+{
+	if (!backup_ || backup_done_) return;
+	backup_time_ = (in_data_.size() >= 4) ? get_u32(in_data_.data()) : 0;
+	if (backup_incremental_) {
+		send_cmd_(kDGetSoupIDs);
+	} else {
+		open_backup_soup_(false);
+		send_cmd_(kDSendSoup);
+	}
+}
+
+/**
+ * \brief Remove entries from the index that are no longer in the soup.
+ * Entries that the index does not know yet are requested later.
+ */
+void Dock::handle_SoupIDs()
+{
+	if (!backup_ || backup_done_) return;
+	uint32_t count = (in_data_.size() >= 4) ? get_u32(in_data_.data()) : 0;
+	count = std::min(count, (uint32_t)(in_data_.size() / 4) - 1);
+	std::vector<uint32_t> ids(count);
+	for (uint32_t i = 0; i < count; ++i) ids[i] = get_u32(in_data_.data() + 4 + 4*i);
+	std::sort(ids.begin(), ids.end());
+	std::vector<BackupEntry> kept;
+	kept.reserve(backup_index_.size());
+	backup_scratch_.clear();
+	put_u32(backup_scratch_, 0);
+	for (const BackupEntry &entry: backup_index_) {
+		if (std::binary_search(ids.begin(), ids.end(), entry.id_)) {
+			kept.push_back(entry);
+		} else {
+			put_u32(backup_scratch_, entry.id_);
+		}
+	}
+	uint32_t deleted = backup_index_.size() - kept.size();
+	backup_index_.swap(kept);
+	backup_changed_.clear();
+	for (uint32_t id: ids) {
+		auto it = std::lower_bound(backup_index_.begin(), backup_index_.end(), id,
+			[](const BackupEntry &a, uint32_t b) { return a.id_ < b; });
+		if (it == backup_index_.end() || it->id_ != id) backup_changed_.push_back(id);
+	}
+	open_backup_soup_(true);
+	if (deleted > 0) {
+		backup_stats_.deleted_ += deleted;
+		backup_scratch_[0] = deleted >> 24; backup_scratch_[1] = deleted >> 16;
+		backup_scratch_[2] = deleted >> 8; backup_scratch_[3] = deleted;
+		queue_backup_record_(kDDeleteEntries, backup_scratch_);
+	}
+	send_cmd_(kDGetChangedIDs);
+}
+
+/**
+ * \brief Add the entries that changed since the last backup, and request them one by one.
+ */
+void Dock::handle_ChangedIDs()
+{
+	if (!backup_ || backup_done_) return;
+	uint32_t count = (in_data_.size() >= 4) ? get_u32(in_data_.data()) : 0;
+	count = std::min(count, (uint32_t)(in_data_.size() / 4) - 1);
+	for (uint32_t i = 0; i < count; ++i) backup_changed_.push_back(get_u32(in_data_.data() + 4 + 4*i));
+	std::sort(backup_changed_.begin(), backup_changed_.end());
+	backup_changed_.erase(std::unique(backup_changed_.begin(), backup_changed_.end()), backup_changed_.end());
+	backup_changed_pos_ = 0;
+	next_changed_entry_();
+}
+
+/**
+ * \brief Ask for the next changed entry, or finish the soup.
+ */
+void Dock::next_changed_entry_()
+{
+	if (backup_changed_pos_ >= backup_changed_.size()) {
+		current_task_ = Task::WRITE_BACKUP_INDEX;
+		return;
+	}
+	std::vector<uint8_t> id;
+	put_u32(id, backup_changed_[backup_changed_pos_++]);
+	send_cmd_(kDReturnEntry, &id);
+}
+
+/**
+ * \brief Create or extend the `.sbk` file of the current soup.
+ */
+void Dock::open_backup_soup_(bool append)
+{
+	std::u16string path = backup_soup_path_ + u".sbk";
+	if (append) {
+		backup_->append(path, kBackupReserve);
+	} else {
+		backup_->create(path, kBackupReserve);
+	}
+	backup_open_ = true;
+}
+
+void Dock::handle_Entry()
+{
+	if (!backup_ || backup_done_ || !backup_open_) return;
+	backup_stats_.entries_++;
+	backup_stats_.bytes_ += in_data_.size();
+	int32_t id = 0;
+	NSOFView view(in_data_);
+	bool has_id = view.begin() && view.frame_int("_uniqueID", id);
+	if (!has_id && backup_incremental_ && backup_changed_pos_ > 0) {
+		id = backup_changed_[backup_changed_pos_ - 1]; // the entry that we asked for
+		has_id = true;
+	}
+	if (in_data_.size() > kRestoreEntrySize) {
+		// The restore can't hold this entry, so don't keep it, nor an older version of it.
+		if (kLogDockErrors) Log.logf("Dock: backup: entry of %d bytes is too large, skipped\r\n", in_data_.size());
+		backup_stats_.too_large_++;
+		if (has_id) {
+			auto it = std::lower_bound(backup_index_.begin(), backup_index_.end(), (uint32_t)id,
+				[](const BackupEntry &a, uint32_t b) { return a.id_ < b; });
+			if (it != backup_index_.end() && it->id_ == (uint32_t)id) backup_index_.erase(it);
+		}
+		if (backup_incremental_) next_changed_entry_();
+		return;
+	}
+	bool changed = true;
+	if (has_id) {
+		BackupEntry entry { (uint32_t)id, BackupReader::hash(in_data_.data(), in_data_.size()), (uint32_t)in_data_.size() };
+		auto it = std::lower_bound(backup_index_.begin(), backup_index_.end(), entry.id_,
+			[](const BackupEntry &a, uint32_t b) { return a.id_ < b; });
+		if (it != backup_index_.end() && it->id_ == entry.id_) {
+			changed = (it->hash_ != entry.hash_ || it->size_ != entry.size_);
+			*it = entry;
+		} else {
+			backup_index_.insert(it, entry);
+		}
+	}
+	if (changed) {
+		queue_backup_record_(kDEntry, in_data_);
+	} else {
+		backup_stats_.unchanged_++;
+	}
+	if (backup_incremental_) next_changed_entry_();
+}
+
+/**
+ * \brief Start writing a record with the given tag and data.
+ * `data` must not change until the record is written, see write_backup_record_().
+ */
+void Dock::queue_backup_record_(uint32_t tag, const std::vector<uint8_t> &data)
+{
+	backup_record_tag_ = tag;
+	backup_record_ = &data;
+	backup_crsr_ = 0;
+	write_backup_record_();
+}
+
+/**
+ * \brief Hand the current record to the writer, as much as it takes.
+ * If the writer is full, `backup_hold_` is set, which keeps `in_data_` as
+ * it is, and backup_task() continues here later.
+ */
+void Dock::write_backup_record_()
+{
+	static const uint8_t pad[3] = { 0, 0, 0 };
+	if (!backup_record_) return;
+	uint32_t size = backup_record_->size();
+	uint8_t header[8] = { 0, 0, 0, 0, (uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size };
+	memcpy(header, &backup_record_tag_, 4); // ND_FOURCC keeps the characters in memory order
+	uint32_t record_size = 8 + ((size + 3) & ~3);
+	while (backup_crsr_ < record_size) {
+		uint32_t n;
+		if (backup_crsr_ < 8) {
+			n = backup_->write(header + backup_crsr_, 8 - backup_crsr_);
+		} else if (backup_crsr_ < 8 + size) {
+			n = backup_->write(backup_record_->data() + backup_crsr_ - 8, 8 + size - backup_crsr_);
+		} else {
+			n = backup_->write(pad, record_size - backup_crsr_);
+		}
+		if (n == 0) {
+			backup_hold_ = true;
+			return;
+		}
+		backup_crsr_ += n;
+	}
+	backup_record_ = nullptr;
+	backup_hold_ = false;
+}
+
+void Dock::handle_BackupSoupDone()
+{
+	if (!backup_ || backup_done_) return;
+	current_task_ = Task::WRITE_BACKUP_INDEX;
+}
+
+/**
+ * \brief Close the `.sbk` file and replace the `.sbx` file, then go on with the next soup.
+ */
+void Dock::write_backup_index_task()
+{
+	if (backup_hold_) return; // the last record is still going to the writer
+	if (!backup_index_queued_) {
+		if (backup_open_) backup_->close();
+		const BackupStore &store = backup_stores_[backup_store_pos_ - 1];
+		backup_scratch_.clear();
+		backup_scratch_.reserve(16 + 12 * backup_index_.size());
+		put_u32(backup_scratch_, BackupReader::kIndexVersion);
+		put_u32(backup_scratch_, store.signature_);
+		put_u32(backup_scratch_, backup_time_);
+		put_u32(backup_scratch_, backup_index_.size());
+		for (const BackupEntry &entry: backup_index_) {
+			put_u32(backup_scratch_, entry.id_);
+			put_u32(backup_scratch_, entry.hash_);
+			put_u32(backup_scratch_, entry.size_);
+			backup_stats_.full_bytes_ += entry.size_;
+		}
+		backup_->create(backup_soup_path_ + u".sbx", backup_scratch_.size() + 8);
+		backup_open_ = true;
+		backup_index_queued_ = true;
+		queue_backup_record_(BackupReader::kIndexTag, backup_scratch_);
+		return;
+	}
+	backup_->close();
+	backup_open_ = false;
+	backup_index_queued_ = false;
+	backup_index_.clear();
+	current_task_ = Task::NONE;
+	next_backup_soup_();
+}
+
+/**
+ * \brief Stop asking the Newton for data, and let the writer finish.
+ */
+void Dock::end_backup_()
+{
+	if (kLogDockProgress) Log.logf("Dock: backup done, %d entries, %d unchanged, %d deleted, %d of %d bytes, %d us\r\n",
+		backup_stats_.entries_, backup_stats_.unchanged_, backup_stats_.deleted_,
+		backup_stats_.bytes_, backup_stats_.full_bytes_, backup_stats_.time_);
+	if (backup_open_) backup_->close();
+	backup_open_ = false;
+	backup_hold_ = false;
+	backup_record_ = nullptr;
+	backup_index_queued_ = false;
+	backup_done_ = true;
+	dres_next_ = 0;
+	if (current_task_ == Task::READ_BACKUP_INDEX || current_task_ == Task::WRITE_BACKUP_INDEX)
 		current_task_ = Task::NONE;
+	backup_stores_.clear();
+	backup_soups_.clear();
+	backup_index_.clear();
+	backup_changed_.clear();
+	backup_scratch_.clear();
+}
+
+/**
+ * \brief Keep the writer going, and stop the backup if the card fails.
+ */
+void Dock::backup_task()
+{
+	backup_->task();
+	if (!backup_done_) backup_stats_.time_ += scheduler().cycle_time();
+	if (backup_hold_) write_backup_record_();
+	if (backup_->error() && !backup_done_) {
+		if (kLogDockErrors) Log.logf("Dock: backup_task: SD Card error %d\r\n", backup_->error());
+		end_backup_();
+		send_cmd_opca(); // the Newton must not think that the backup is complete
+	}
+	if (backup_done_ && backup_->idle()) {
+		delete backup_;
+		backup_ = nullptr;
+	}
+}
+
+/**
+ * \brief Restore all soups of all stores from the SD Card.
+ *
+ * The Newton lists its stores and soups as for a backup. Every soup that
+ * has a backup in `/Backup/<fInternalStoreSig>/<Store>/` is emptied and
+ * filled with the entries of the backup, one `adde` command per entry.
+ *
+ * The Newton confirms every entry before it takes the next one. To keep
+ * the line busy anyway, a BackupReader reads and checks the following
+ * entries while the current one is sent and added. The reader leaves room
+ * for the command header in front of every entry, so an entry goes from
+ * the card to the wire without being copied again.
+ */
+void Dock::handle_RequestToRestore()
+{
+	if (kLogDockProgress) Log.log("Dock: restore requested\r\n");
+	if (backup_ || restore_) {
+		send_cmd_dres(-28027); // kDockErrAlreadyBusy, the previous session is still using the card
+		return;
+	}
+	restore_ = new BackupReader(sdcard_, kRestoreAhead, 8);
+	restore_done_ = false;
+	restore_state_ = RestoreState::NONE;
+	restore_stats_ = { };
+	backup_stores_.clear();
+	backup_soups_.clear();
+	backup_root_ = backup_root(newton_info_.fInternalStoreSig);
+	send_cmd_(kDGetStoreNames);
+}
+
+/**
+ * \brief The Newton switched to the soup, look for its backup.
+ */
+void Dock::start_restore_soup_()
+{
+	backup_soup_path_ = backup_path_;
+	backup_soup_path_.append(u"/");
+	backup_soup_path_.append(fat_name(backup_soups_[backup_soup_pos_ - 1]));
+	restore_state_ = RestoreState::START_SOUP;
+}
+
+/**
+ * \brief Turn an entry from the reader into an 'adde' command and queue it.
+ * The reader left 8 bytes in front of the record 'entr', size, data.
+ */
+void Dock::send_restore_entry_(std::vector<uint8_t> *entry)
+{
+	static const uint8_t header[12] = { 'n', 'e', 'w', 't', 'd', 'o', 'c', 'k', 'a', 'd', 'd', 'e' };
+	memcpy(entry->data(), header, 12); // the size stays as it is
+	restore_stats_.entries_++;
+	restore_stats_.bytes_ += entry->size();
+	dres_next_ = kDAddEntry;
+	data_queue_.push(Dock::Data(entry, true, true, true));
+}
+
+/**
+ * \brief Stop sending entries, and let the reader close its file.
+ */
+void Dock::end_restore_()
+{
+	uint32_t time = std::max(restore_stats_.time_, (uint32_t)1);
+	if (kLogDockProgress) Log.logf("Dock: restore done, %d entries, %d bytes, %d us, %d entries/s, line %d%% busy, waited %d us for the card\r\n",
+		restore_stats_.entries_, restore_stats_.bytes_, restore_stats_.time_,
+		(int)((uint64_t)restore_stats_.entries_ * 1000000 / time),
+		(int)((uint64_t)restore_stats_.bytes_ * 10 * 100 * 1000000 / ((uint64_t)time * kUART_BaudRate)),
+		restore_stats_.stall_);
+	restore_->cancel();
+	restore_done_ = true;
+	restore_state_ = RestoreState::NONE;
+	dres_next_ = 0;
+	backup_stores_.clear();
+	backup_soups_.clear();
+}
+
+/**
+ * \brief Keep the reader going, and send the next entry when the Newton is ready.
+ */
+void Dock::restore_task()
+{
+	restore_->task();
+	uint32_t cycle_time = scheduler().cycle_time();
+	if (!restore_done_) restore_stats_.time_ += cycle_time;
+	switch (restore_state_) {
+		case RestoreState::START_SOUP:
+			if (!restore_->done()) break;
+			restore_->open(backup_soup_path_);
+			restore_state_ = RestoreState::OPEN_SOUP;
+			break;
+		case RestoreState::OPEN_SOUP:
+			if (!restore_->index_read()) break;
+			if (restore_->size() == 0) {
+				if (kLogDockProgress) Log.log("Dock: restore: no backup of this soup\r\n");
+				restore_state_ = RestoreState::NONE;
+				next_backup_soup_();
+			} else if (restore_->too_large()) {
+				// Don't empty a soup that we can't fill again
+				if (kLogDockErrors) Log.logf("Dock: restore: %d entries are too large, soup skipped\r\n", restore_->too_large());
+				restore_->cancel();
+				restore_state_ = RestoreState::NONE;
+				next_backup_soup_();
+			} else {
+				restore_state_ = RestoreState::EMPTY_SOUP;
+				dres_next_ = kDEmptySoup;
+				send_cmd_(kDEmptySoup);
+			}
+			break;
+		case RestoreState::SEND_ENTRY: {
+			std::vector<uint8_t> *entry = restore_->next();
+			if (entry) {
+				send_restore_entry_(entry);
+				restore_state_ = RestoreState::WAIT_FOR_ID;
+			} else if (restore_->done()) {
+				if (restore_->error() && kLogDockErrors) Log.logf("Dock: restore: SD Card error %d\r\n", restore_->error());
+				restore_state_ = RestoreState::NONE;
+				next_backup_soup_();
+			} else {
+				restore_stats_.stall_ += cycle_time; // the Newton waits for the card
+			}
+			break; }
+		default:
+			break;
+	}
+	if (restore_done_ && restore_->done()) {
+		delete restore_;
+		restore_ = nullptr;
 	}
 }
 
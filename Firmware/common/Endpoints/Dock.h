@@ -6,7 +6,14 @@
 #ifndef ND_ENDPOINTS_DOCK_H
 #define ND_ENDPOINTS_DOCK_H
 
+#include "common/Context.h"
+#include "common/Coroutine.h"
 #include "common/Endpoint.h"
+#include "common/Endpoints/SDCardEndpoint.h"
+#include "common/Endpoints/SDCardWriter.h"
+#include "common/Endpoints/BackupReader.h"
+#include "common/Newton/DESKey.h"
+#include "common/Newton/NSOF.h"
 
 #include <queue>
 #include <vector>
@@ -28,6 +35,9 @@ class Dock : public Endpoint
 {
     typedef Endpoint super;
 
+    SDCardEndpoint &sdcard_;
+    StatusDisplay &status_;
+
     constexpr static int32_t kDesktop = 0; // Desktop type
     constexpr static int32_t kDesktopFile = 1; // Desktop file type
     constexpr static int32_t kDesktopFolder = 2; // Desktop folder type
@@ -45,6 +55,8 @@ class Dock : public Endpoint
     constexpr static uint32_t kDNewtonInfo = ND_FOURCC('n', 'i', 'n', 'f'); // Newt -> Dock
     constexpr static uint32_t kDWhichIcons = ND_FOURCC('w', 'i', 'c', 'n'); // Dock -> Newt
     void send_cmd_wicn(uint32_t icon_map);
+    constexpr static uint32_t kBackupIcon = 1 << 0;
+    constexpr static uint32_t kRestoreIcon = 1 << 1;
     constexpr static uint32_t kInstallIcon = 1 << 2;
     constexpr static uint32_t kDResult = ND_FOURCC('d', 'r', 'e', 's'); // Dock <-> Newt
     void send_cmd_dres(uint32_t error_code);
@@ -61,10 +73,17 @@ class Dock : public Endpoint
     constexpr static uint32_t kDPath = ND_FOURCC('p', 'a', 't', 'h'); // Dock -> Newt
     constexpr static uint32_t kDGetFilesAndFolders = ND_FOURCC('g', 'f', 'i', 'l'); // Newt -> Dock
     void send_cmd_file();
+    void list_files_task();
+    void send_file_list_task();
+    void add_file_list_entry_(const std::u16string &name, bool is_dir);
+    void queue_file_list_chunk_(bool last);
+    void send_file_list_(const Array &file_list);
     constexpr static uint32_t kDFilesAndFolders = ND_FOURCC('f', 'i', 'l', 'e'); // Dock -> Newt
     constexpr static uint32_t kDSetPath = ND_FOURCC('s', 'p', 't', 'h'); // Newt -> Dock
 
     constexpr static uint32_t kDLoadPackageFile = ND_FOURCC('l', 'p', 'f', 'l'); // Newt -> Dock
+    constexpr static uint32_t kDLoadPackage = ND_FOURCC('l', 'p', 'k', 'g'); // Dock -> Newt
+    constexpr static char16_t kInstallAllName[] = u"Install All Packages"; // virtual entry in folders with packages
     constexpr static uint32_t kDOperationCanceled = ND_FOURCC('o', 'p', 'c', 'a'); // Newt <-> Dock
     void send_cmd_opca();
     constexpr static uint32_t kDOpCanceledAck = ND_FOURCC('o', 'c', 'a', 'a'); // Dock <-> Newt
@@ -73,12 +92,76 @@ class Dock : public Endpoint
     constexpr static uint32_t kDGetFileInfo = ND_FOURCC('g', 'f', 'i', 'n'); // Dock <- Newt
     constexpr static uint32_t kDFileInfo = ND_FOURCC('f', 'i', 'n', 'f'); // Dock -> Newt
     void handle_GetFileInfo();
+    void file_info_task();
+    void set_path_task();
+
+    constexpr static uint32_t kDRequestToSync = ND_FOURCC('s', 's', 'y', 'n'); // Newt -> Dock
+    constexpr static uint32_t kDGetSyncOptions = ND_FOURCC('g', 's', 'y', 'n'); // Dock -> Newt
+    constexpr static uint32_t kDSyncOptions = ND_FOURCC('s', 'o', 'p', 't'); // Newt -> Dock
+    constexpr static uint32_t kDGetStoreNames = ND_FOURCC('g', 's', 't', 'o'); // Dock -> Newt
+    constexpr static uint32_t kDStoreNames = ND_FOURCC('s', 't', 'o', 'r'); // Newt -> Dock
+    constexpr static uint32_t kDDesktopControl = ND_FOURCC('d', 's', 'n', 'c'); // Dock -> Newt
+    constexpr static uint32_t kDSetCurrentStore = ND_FOURCC('s', 's', 't', 'o'); // Dock -> Newt
+    constexpr static uint32_t kDGetSoupNames = ND_FOURCC('g', 'e', 't', 's'); // Dock -> Newt
+    constexpr static uint32_t kDSoupNames = ND_FOURCC('s', 'o', 'u', 'p'); // Newt -> Dock
+    constexpr static uint32_t kDSetCurrentSoup = ND_FOURCC('s', 's', 'o', 'u'); // Dock -> Newt
+    constexpr static uint32_t kDSendSoup = ND_FOURCC('s', 'n', 'd', 's'); // Dock -> Newt
+    constexpr static uint32_t kDEntry = ND_FOURCC('e', 'n', 't', 'r'); // Newt -> Dock
+    constexpr static uint32_t kDBackupSoupDone = ND_FOURCC('b', 's', 'd', 'n'); // Newt -> Dock
+    constexpr static uint32_t kDLastSyncTime = ND_FOURCC('s', 't', 'm', 'e'); // Dock -> Newt
+    constexpr static uint32_t kDCurrentTime = ND_FOURCC('t', 'i', 'm', 'e'); // Newt -> Dock
+    constexpr static uint32_t kDGetSoupIDs = ND_FOURCC('g', 'i', 'd', 's'); // Dock -> Newt
+    constexpr static uint32_t kDSoupIDs = ND_FOURCC('s', 'i', 'd', 's'); // Newt -> Dock
+    constexpr static uint32_t kDGetChangedIDs = ND_FOURCC('g', 'c', 'i', 'd'); // Dock -> Newt
+    constexpr static uint32_t kDChangedIDs = ND_FOURCC('c', 'i', 'd', 's'); // Newt -> Dock
+    constexpr static uint32_t kDReturnEntry = ND_FOURCC('r', 'e', 't', 'e'); // Dock -> Newt
+    constexpr static uint32_t kDDeleteEntries = ND_FOURCC('d', 'e', 'l', 'e'); // record in the backup
+    constexpr static uint32_t kDOperationDone = ND_FOURCC('o', 'p', 'd', 'n'); // Dock -> Newt
+    constexpr static uint32_t kDRequestToRestore = ND_FOURCC('r', 'r', 's', 't'); // Newt -> Dock
+    constexpr static uint32_t kDEmptySoup = ND_FOURCC('e', 's', 'o', 'u'); // Dock -> Newt
+    constexpr static uint32_t kDAddEntry = ND_FOURCC('a', 'd', 'd', 'e'); // Dock -> Newt
+    constexpr static uint32_t kDAddedID = ND_FOURCC('a', 'd', 'i', 'd'); // Newt -> Dock
+    void send_cmd_(uint32_t cmd, const std::vector<uint8_t> *payload = nullptr);
+    void handle_RequestToSync();
+    void handle_StoreNames();
+    void handle_SoupNames();
+    void handle_CurrentTime();
+    void handle_SoupIDs();
+    void handle_ChangedIDs();
+    void handle_Entry();
+    void handle_BackupSoupDone();
+    void next_backup_store_();
+    void next_backup_soup_();
+    void start_backup_soup_();
+    void read_backup_index_task();
+    void open_backup_soup_(bool append);
+    void next_changed_entry_();
+    void write_backup_index_task();
+    void queue_backup_record_(uint32_t tag, const std::vector<uint8_t> &data);
+    void write_backup_record_();
+    void end_backup_();
+    void backup_task();
+    bool syncing_() const { return (backup_ && !backup_done_) || (restore_ && !restore_done_); }
+    void handle_RequestToRestore();
+    void start_restore_soup_();
+    void send_restore_entry_(std::vector<uint8_t> *entry);
+    void end_restore_();
+    void restore_task();
 
     constexpr static uint32_t kDDisconnect = ND_FOURCC('d', 'i', 's', 'c'); // Dock <-> Newt
 
+    void handle_NewtonName();
+    int32_t get_string_arg_(std::u16string &str);
     void handle_SetPath();
+    bool set_path_from_view_(int32_t &error_code);
     void handle_LoadPackageFile();
     void send_package_task();
+    void queue_package_block_(std::vector<uint8_t> *block, const uint8_t *view, uint32_t size, bool last);
+    void queue_lpkg_header_();
+    void start_batch_task();
+    void prefetch_package_task();
+    void next_batch_package_();
+    void send_prefetched_package_();
 
     struct Data {
         const std::vector<uint8_t> *bytes_;
@@ -86,6 +169,14 @@ class Dock : public Endpoint
         bool start_frame_ = false; // if true, send a start frame marker
         bool end_frame_ = false; // if true, send an end frame marker
         bool free_after_send_ = false; // if true, the data will be freed after sending
+        const uint8_t *view_ = nullptr; // if set, send `view_size_` bytes from here instead of `bytes_`
+        uint32_t view_size_ = 0;
+        Data(const std::vector<uint8_t> *bytes, bool start_frame, bool end_frame, bool free_after_send,
+             const uint8_t *view = nullptr, uint32_t view_size = 0)
+        :   bytes_(bytes), start_frame_(start_frame), end_frame_(end_frame), free_after_send_(free_after_send),
+            view_(view), view_size_(view_size) { }
+        uint32_t size() const { return view_ ? view_size_ : bytes_->size(); }
+        uint8_t at(uint32_t i) const { return view_ ? view_[i] : (*bytes_)[i]; }
     };
     std::queue<Data> data_queue_; // queue of data to be sent
 
@@ -107,6 +198,7 @@ class Dock : public Endpoint
 
     uint32_t newt_challenge_hi = 0;
     uint32_t newt_challenge_lo = 0;
+    DESPasswordKey password_key_; // cached key schedule for the session password
 
     bool package_sent = false;
     bool path_is_desktop_ = false;
@@ -118,19 +210,101 @@ class Dock : public Endpoint
         CANCEL_SEND_PACKAGE,
         PACKAGE_SENT,
         PACKAGE_CANCELED,
+        LIST_FILES,
+        SEND_FILE_LIST,
+        GET_FILE_INFO,
+        SET_PATH,           // change to `cwd_`, then reply with 'file'
+        START_BATCH,        // collect the packages of the current folder
+        PREFETCH_PACKAGE,   // open the next package while the Newton installs the previous one
+        PACKAGE_READY,      // the next package is open, wait for the Newton's 'dres'
+        READ_BACKUP_INDEX,  // read what the last backup of the soup saw
+        WRITE_BACKUP_INDEX, // write what this backup saw, then go on with the next soup
     } current_task_ = Task::NONE;
+    Coroutine send_package_co_; // resume point of send_package_task()
+
+    SDCardRequest sd_request_; // the SD Card request of the current task
+    bool sd_retry_ = false; // `sd_request_` was rejected, submit it again in the next time slice
+    bool sd_file_open_ = false; // `sd_request_` opened a file and did not close it yet
+    SDCardRequest sd_close_request_; // closes the file of a transfer that was cut off
+    void submit_sd_request_();
+    bool sd_busy_() const { return sd_retry_ || sd_request_.pending(); }
+    std::vector<uint8_t> *pkg_block_ = nullptr; // package block that is being read
+    bool pkg_block_last_ = false; // true if `pkg_block_` is the last block
+    constexpr static uint32_t kFileListChunkSize = 256; // encode this many bytes of the file list at a time
+    std::shared_ptr<const SDCardIndex::Dir> list_dir_; // sorted listing, or nullptr if the entries are read from the card again
+    std::vector<uint8_t> *list_chunk_ = nullptr; // the part of the file list that is being encoded
+    uint32_t list_count_ = 0; // number of entries in the file list
+    uint32_t list_pos_ = 0; // number of entries encoded so far
+    uint32_t list_size_ = 0; // size of the NSOF encoded file list
+    uint32_t list_sent_ = 0; // NSOF bytes encoded so far
 
     uint32_t pkg_size_ = 0; // size of the package to be loaded
     uint32_t pkg_size_aligned_; // size of the package to be loaded, aligned to 4 bytes
     uint32_t pkg_crsr_ = 0; // current offset in the package
     std::u16string pkg_filename_; // filename of the package to be loaded
+    std::vector<std::u16string> batch_; // packages to install back to back
+    uint32_t batch_pos_ = 0; // next package in `batch_`
+    bool batch_go_ = false; // the Newton is ready for the next package
+    uint32_t batch_sent_ = 0; // number of packages of the batch that were sent
+    uint32_t list_extra_ = 0; // 1 if the file list starts with kInstallAllName
     std::u16string cwd_;
+    std::u16string file_info_name_; // scratch buffer for the file name in `gfin`
+    PackageInfo pkg_info_; // header of the package for `gfin` and `lpfl`
+
+    struct BackupStore {
+        std::u16string name_;
+        std::u16string kind_;
+        int32_t signature_ = 0;
+    };
+    struct BackupEntry {
+        uint32_t id_; // _uniqueID of the entry
+        uint32_t hash_; // FNV-1a of the NSOF data
+        uint32_t size_; // size of the NSOF data
+    };
+    SDCardWriter *backup_ = nullptr; // the backup session, alive until all data is on the card
+    std::vector<BackupStore> backup_stores_; // stores of the Newton
+    std::vector<std::u16string> backup_soups_; // soups of the current store
+    uint32_t backup_store_pos_ = 0; // next store in `backup_stores_`
+    uint32_t backup_soup_pos_ = 0; // next soup in `backup_soups_`
+    std::u16string backup_root_; // folder of this Newton
+    std::u16string backup_path_; // folder of the current store
+    std::u16string backup_soup_path_; // soup file without the extension
+    std::vector<BackupEntry> backup_index_; // entries of the current soup, sorted by ID
+    bool backup_incremental_ = false; // the index is valid, only ask for changed entries
+    uint32_t backup_last_time_ = 0; // Newton time of the last backup of this soup
+    uint32_t backup_time_ = 0; // Newton time when this soup was started
+    std::vector<uint32_t> backup_changed_; // IDs of the entries that changed since the last backup
+    uint32_t backup_changed_pos_ = 0; // next ID in `backup_changed_`
+    std::vector<uint8_t> backup_scratch_; // the index or list of deleted IDs that is being written
+    const std::vector<uint8_t> *backup_record_ = nullptr; // data of the record that is being written
+    uint32_t backup_record_tag_ = 0;
+    uint32_t backup_crsr_ = 0; // bytes of the current record that the writer took
+    bool backup_hold_ = false; // the writer is full, don't take any more data from the Newton
+    bool backup_open_ = false; // a soup file is open
+    bool backup_done_ = false; // no more data will come, wait for the writer and end the session
+    bool backup_index_queued_ = false; // the index of the soup is going to the writer
+
+    enum class RestoreState : uint8_t {
+        NONE,           // between soups
+        START_SOUP,     // wait for the reader to close the previous soup
+        OPEN_SOUP,      // wait for the reader to find the backup of the soup
+        EMPTY_SOUP,     // wait for the Newton to empty the soup
+        SEND_ENTRY,     // send the next entry as soon as the reader has it
+        WAIT_FOR_ID,    // wait for the Newton to add the entry
+    };
+    BackupReader *restore_ = nullptr; // the restore session, alive until the last file is closed
+    RestoreState restore_state_ = RestoreState::NONE;
+    bool restore_done_ = false; // no more data will be sent, wait for the reader and end the session
 
     void clear_data_queue_();
     void reset_();
 
 public:
-    Dock(Scheduler &scheduler) : Endpoint(scheduler) { 
+    Dock(Context &context)
+    :   Endpoint(context.scheduler_),
+        sdcard_(context.sdcard_),
+        status_(context.status_)
+    {
         reset_();
     }
     ~Dock() override = default;
@@ -180,7 +354,33 @@ private:
         uint32_t	fSerialNumber[2];
         uint32_t	fTargetProtocol;
     } NewtonInfo;
+    NewtonInfo newton_info_ = { };
+    std::u16string newton_name_;
 
+public:
+    struct BackupStats {
+        uint32_t entries_ = 0; // entries received from the Newton
+        uint32_t unchanged_ = 0; // entries that were received, but did not change
+        uint32_t deleted_ = 0; // entries that were deleted on the Newton
+        uint32_t too_large_ = 0; // entries that were not kept, because the restore can't hold them
+        uint32_t bytes_ = 0; // NSOF bytes received
+        uint32_t full_bytes_ = 0; // NSOF bytes of all entries, as a full backup would receive them
+        uint32_t time_ = 0; // duration of the session in microseconds
+    };
+    struct RestoreStats {
+        uint32_t entries_ = 0; // entries sent to the Newton
+        uint32_t bytes_ = 0; // bytes of the 'adde' commands, including the headers
+        uint32_t time_ = 0; // duration of the session in microseconds
+        uint32_t stall_ = 0; // microseconds that the Newton waited for the card
+    };
+private:
+    BackupStats backup_stats_;
+    RestoreStats restore_stats_;
+public:
+    const BackupStats &backup_stats() const { return backup_stats_; }
+    const RestoreStats &restore_stats() const { return restore_stats_; }
+    const NewtonInfo &newton_info() const { return newton_info_; }
+    const std::u16string &newton_name() const { return newton_name_; }
 };
 
 #if 0
@@ -5,10 +5,58 @@
 
 #include "SDCardEndpoint.h"
 
+#include "main.h"
+
+#include <algorithm>
+
 using namespace nd; 
 
+/**
+ * \class nd::SDCardEndpoint
+ * \brief Base class for the SD Card on all platforms.
+ *
+ * The synchronous calls like readfile() wait until the card is done, which
+ * can take many milliseconds. Meanwhile, no other task gets a time slice.
+ *
+ * Requests are the non-blocking alternative. The caller fills in an
+ * SDCardRequest and calls submit(). When the request is done, its state
+ * changes to DONE and the scheduler sends the signal SDCARD_REQUEST_DONE to
+ * all tasks. Callers that run a task() anyway can simply poll `done()`.
+ *
+ * By default, requests are run from task(), one step per time slice. Reads
+ * are split into sectors, so the time spent in a single slice stays short.
+ * Platforms with threads can override submit() and run requests in the
+ * background instead.
+ *
+ * The LISTDIR request returns the listing of the current directory from
+ * the SDCardIndex. Only the first visit to a directory reads the card.
+ * PKGINFO returns the header of a package file. It is read only once as
+ * long as the file is listed in the index with the same date and size.
+ *
+ * MKDIR, CREATEFILE, APPENDFILE and WRITEFILE change the card. They drop the affected
+ * directories and package headers from the index.
+ *
+ * After init(), the card is brought up in the background: MOUNT powers it
+ * up and mounts it, LISTDIR indexes the root directory, and PKGINFO reads
+ * the header of every package in it. Only one of these requests is queued
+ * at a time, so a request from a client waits for one step at most. When
+ * the Newton asks for its first listing, the answer is in the index
+ * already. first_listing_time() tells how long it took until then.
+ *
+ * \note Don't use the synchronous calls while requests are pending.
+ */
+
 SDCardEndpoint::SDCardEndpoint(Scheduler &scheduler) 
-:   Endpoint(scheduler)
+:   SDCardEndpoint(scheduler, kSDCardIndexBytes)
+{
+}
+
+/**
+ * \brief Create an SD Card endpoint with `index_bytes` of RAM for directory listings.
+ */
+SDCardEndpoint::SDCardEndpoint(Scheduler &scheduler, uint32_t index_bytes)
+:   Endpoint(scheduler),
+    index_(kSDCardIndexDirs, index_bytes, kSDCardPackageInfos)
 {
     // Constructor implementation
 }
@@ -22,6 +70,393 @@ Result SDCardEndpoint::init() {
     return Endpoint::init();
 }
 
+/**
+ * \brief Run one step of the oldest request.
+ */
+Result SDCardEndpoint::task() {
+    prewarm_task_();
+    if (!requests_.empty()) {
+        scheduler().busy();
+        SDCardRequest *req = requests_.front();
+        if (step_(*req)) {
+            requests_.pop_front();
+            complete_(*req);
+        }
+    }
+    return Endpoint::task();
+}
+
+/**
+ * \brief Queue a request.
+ * The request must not be changed or destroyed until it is done or canceled.
+ * \return Result::REJECTED if the queue is full or the request is already pending.
+ */
+Result SDCardEndpoint::submit(SDCardRequest &req) {
+    if (req.pending() || requests_.size() >= kMaxRequests) return Result::REJECTED;
+    req.state_ = SDCardRequest::State::PENDING;
+    req.pos_ = 0;
+    requests_.push_back(&req);
+    return Result::OK;
+}
+
+/**
+ * \brief Remove a request from the queue if it is still pending.
+ * A partially read buffer is left as it is.
+ */
+void SDCardEndpoint::cancel(SDCardRequest &req) {
+    auto it = std::find(requests_.begin(), requests_.end(), &req);
+    if (it != requests_.end()) requests_.erase(it);
+    req.reset();
+}
+
+/**
+ * \brief Bring up the card and index the root directory, one request at a time.
+ * Must be called from the task() of every platform.
+ */
+void SDCardEndpoint::prewarm_task_() {
+    uptime_ += scheduler().cycle_time();
+    if (prewarm_ == Prewarm::DONE || prewarm_req_.pending()) return;
+    if (prewarm_req_.done()) {
+        uint32_t ret = prewarm_req_.result_;
+        switch (prewarm_) {
+            case Prewarm::MOUNT:
+                if (ret == FR_OK) {
+                    prewarm_ = Prewarm::LIST_ROOT;
+                } else {
+                    // No card, or not readable. Mounting is tried again when a client needs the card.
+                    if (kLogSDCard) Log.logf("SDCard: prewarm: mount error %d\n", ret);
+                    prewarm_ = Prewarm::DONE;
+                }
+                break;
+            case Prewarm::LIST_ROOT:
+                if (ret == FR_OK && prewarm_req_.dir_) {
+                    const SDCardIndex::Dir *dir = prewarm_req_.dir_.get();
+                    for (uint32_t i = 0; i < dir->size() && prewarm_packages_.size() < kSDCardPackageInfos; ++i)
+                        if (!dir->is_dir(i)) prewarm_packages_.push_back(dir->name(i));
+                }
+                prewarm_ = Prewarm::PACKAGES;
+                break;
+            case Prewarm::PACKAGES:
+                // Packages that were skipped because a file was open are indexed when a client asks
+                prewarm_packages_.pop_back();
+                break;
+            default:
+                break;
+        }
+        prewarm_req_.reset();
+        if (prewarm_ == Prewarm::PACKAGES && prewarm_packages_.empty()) {
+            if (kLogSDCard) Log.logf("SDCard: prewarm: done after %u us\n", uptime_);
+            prewarm_packages_.shrink_to_fit();
+            prewarm_ = Prewarm::DONE;
+        }
+        if (prewarm_ == Prewarm::DONE) return;
+    }
+    switch (prewarm_) {
+        case Prewarm::MOUNT:
+            prewarm_req_.op_ = SDCardRequest::Op::MOUNT;
+            break;
+        case Prewarm::LIST_ROOT:
+            // Absolute paths, so a client can change the current directory in between
+            prewarm_req_.op_ = SDCardRequest::Op::LISTDIR;
+            prewarm_req_.name_ = u"/";
+            break;
+        default:
+            prewarm_req_.op_ = SDCardRequest::Op::PKGINFO;
+            prewarm_req_.name_ = u"/" + prewarm_packages_.back();
+            prewarm_req_.info_ = &prewarm_info_;
+            break;
+    }
+    if (submit(prewarm_req_).rejected()) prewarm_req_.reset(); // try again in the next time slice
+}
+
+/**
+ * \brief Run a request, or a part of it, using the synchronous calls.
+ * \return true if the request is complete.
+ */
+bool SDCardEndpoint::step_(SDCardRequest &req) {
+    switch (req.op_) {
+        case SDCardRequest::Op::OPENFILE:
+            req.result_ = openfile(req.name_);
+            req.size_ = (req.result_ == FR_OK) ? filesize() : 0;
+            file_open_ = (req.result_ == FR_OK);
+            return true;
+        case SDCardRequest::Op::READFILE:
+            return read_step_(req);
+        case SDCardRequest::Op::VIEWFILE:
+            if (req.pos_ == 0) {
+                uint32_t n = viewfile(req.data_, req.size_);
+                if (req.data_) {
+                    req.result_ = n;
+                    return true;
+                }
+                req.data_ = req.buffer_; // the card can't lend the data, read it
+            }
+            return read_step_(req);
+        case SDCardRequest::Op::CLOSEFILE:
+            req.result_ = closefile();
+            file_open_ = false;
+            return true;
+        case SDCardRequest::Op::OPENDIR:
+            req.result_ = opendir();
+            return true;
+        case SDCardRequest::Op::READDIR:
+            req.result_ = readdir(req.name_);
+            return true;
+        case SDCardRequest::Op::CLOSEDIR:
+            req.result_ = closedir();
+            return true;
+        case SDCardRequest::Op::CHDIR:
+            req.result_ = chdir(req.name_);
+            return true;
+        case SDCardRequest::Op::GETCWD:
+            req.result_ = getcwd(req.name_);
+            return true;
+        case SDCardRequest::Op::LISTDIR:
+            return list_step_(req);
+        case SDCardRequest::Op::PKGINFO:
+            if (&req == &prewarm_req_ && file_open_) {
+                // Reading the header would close the file that a client is using
+                req.result_ = FR_TOO_MANY_OPEN_FILES;
+                return true;
+            }
+            package_info_(req);
+            return true;
+        case SDCardRequest::Op::MOUNT:
+            // Three steps, so powering up, mounting, and reading the label get a time slice each
+            if (req.pos_ == 0) {
+                req.result_ = init_card();
+            } else if (req.pos_ == 1) {
+                req.result_ = mount();
+            } else {
+                req.name_ = get_label();
+                return true;
+            }
+            req.pos_++;
+            return (req.result_ != FR_OK);
+        case SDCardRequest::Op::MKDIR:
+            req.result_ = mkdir(req.name_);
+            if (req.result_ == FR_EXIST) req.result_ = FR_OK;
+            written_(req.name_);
+            return true;
+        case SDCardRequest::Op::CREATEFILE:
+            req.result_ = createfile(req.name_, req.size_);
+            file_open_ = (req.result_ == FR_OK);
+            written_(req.name_);
+            return true;
+        case SDCardRequest::Op::APPENDFILE:
+            req.result_ = appendfile(req.name_, req.size_);
+            file_open_ = (req.result_ == FR_OK);
+            written_(req.name_);
+            return true;
+        case SDCardRequest::Op::WRITEFILE: {
+            uint32_t n = std::min(req.size_ - req.pos_, kReadStepSize);
+            uint32_t bytes_written = (n > 0) ? writefile(req.buffer_ + req.pos_, n) : 0;
+            if (bytes_written == 0xffffffff) {
+                req.result_ = 0xffffffff;
+                return true;
+            }
+            req.pos_ += bytes_written;
+            req.result_ = req.pos_;
+            return (bytes_written < n) || (req.pos_ == req.size_);
+        }
+        default:
+            req.result_ = FR_INVALID_PARAMETER;
+            return true;
+    }
+}
+
+/**
+ * \brief Read the next sector of a READFILE or VIEWFILE request into `buffer_`.
+ * \return true if the request is complete.
+ */
+bool SDCardEndpoint::read_step_(SDCardRequest &req) {
+    uint32_t n = std::min(req.size_ - req.pos_, kReadStepSize);
+    uint32_t bytes_read = (n > 0) ? readfile(req.buffer_ + req.pos_, n) : 0;
+    if (bytes_read == 0xffffffff) {
+        req.result_ = 0xffffffff;
+        return true;
+    }
+    req.pos_ += bytes_read;
+    req.result_ = req.pos_;
+    return (bytes_read < n) || (req.pos_ == req.size_);
+}
+
+/**
+ * \brief Read one entry of the directory into the index.
+ * If the directory is in the index already, this is done on the first call.
+ * \return true if the request is complete.
+ */
+bool SDCardEndpoint::list_step_(SDCardRequest &req) {
+    if (req.pos_ == 0) {
+        std::u16string cwd;
+        if (!req.name_.empty()) {
+            // Open another directory, and leave the current one as it was
+            req.result_ = getcwd(cwd);
+            if (req.result_ == FR_OK) req.result_ = chdir(req.name_);
+            if (req.result_ != FR_OK) return true;
+        }
+        bool done = open_listing_(req);
+        if (!cwd.empty()) chdir(cwd); // an open directory stays open
+        return done;
+    }
+    SDCardDirEntry entry;
+    uint32_t ret = readentry(entry);
+    if (ret == FR_IS_DIRECTORY || ret == FR_IS_PACKAGE) {
+        index_.add(entry);
+        req.pos_++;
+        return false;
+    }
+    closedir();
+    req.dir_ = index_.commit();
+    req.result_ = (ret == FR_NO_FILE) ? FR_OK : ret;
+    return true;
+}
+
+/**
+ * \brief Find the current directory in the index, or open it to read it into the index.
+ * \return true if the request is complete.
+ */
+bool SDCardEndpoint::open_listing_(SDCardRequest &req) {
+    req.dir_ = nullptr;
+    req.result_ = getcwd(req.name_);
+    if (req.result_ != FR_OK) return true;
+    req.dir_ = index_.find(req.name_);
+    if (req.dir_) return true;
+    req.result_ = opendir();
+    if (req.result_ != FR_OK) return true;
+    index_.begin(req.name_);
+    req.pos_ = 1;
+    return false;
+}
+
+/**
+ * \brief Get the header of a package file.
+ * A file in another directory is read from there, and the current directory is left as it was.
+ */
+void SDCardEndpoint::package_info_(SDCardRequest &req) {
+    auto sep = req.name_.find_last_of(u'/');
+    if (sep == std::u16string::npos) {
+        package_info_(req, req.name_);
+        return;
+    }
+    std::u16string cwd;
+    req.result_ = getcwd(cwd);
+    if (req.result_ == FR_OK) req.result_ = chdir((sep == 0) ? std::u16string(u"/") : req.name_.substr(0, sep));
+    if (req.result_ != FR_OK) return;
+    package_info_(req, req.name_.substr(sep + 1));
+    chdir(cwd);
+}
+
+/**
+ * \brief Get the header of the package file `name` in the current directory.
+ * `result_` is FR_OK if the file could be read, even if it is not a valid package.
+ */
+void SDCardEndpoint::package_info_(SDCardRequest &req, const std::u16string &name) {
+    uint8_t header[kReadStepSize];
+    std::u16string path;
+    std::shared_ptr<const SDCardIndex::Dir> dir;
+    int32_t ix = -1;
+    if (getcwd(path) == FR_OK) {
+        dir = index_.find(path);
+        if (path.empty() || path.back() != u'/') path.push_back(u'/');
+        path.append(name);
+    }
+    if (dir) ix = dir->find(name);
+    if (ix >= 0 && !dir->is_dir(ix)) {
+        const PackageInfo *info = index_.find_package(path, dir->mtime(ix), dir->file_size(ix));
+        if (info) {
+            *req.info_ = *info;
+            req.result_ = FR_OK;
+            return;
+        }
+    }
+    req.result_ = openfile(name);
+    if (req.result_ != FR_OK) return;
+    req.size_ = filesize();
+    uint32_t n = readfile(header, std::min(req.size_, kReadStepSize));
+    closefile();
+    if (n == 0xffffffff) {
+        req.result_ = FR_DISK_ERR;
+        return;
+    }
+    req.info_->parse(header, n, req.size_);
+    // Only files that are in the index have a known date
+    if (ix >= 0 && !dir->is_dir(ix) && dir->file_size(ix) == req.size_)
+        index_.add_package(path, dir->mtime(ix), *req.info_);
+}
+
+/**
+ * \brief Read the next directory entry, including its size and date.
+ * The default implementation only knows the name and type.
+ */
+uint32_t SDCardEndpoint::readentry(SDCardDirEntry &entry) {
+    uint32_t ret = readdir(entry.name_);
+    entry.type_ = ret;
+    entry.size_ = 0;
+    entry.mtime_ = 0;
+    return ret;
+}
+
+uint32_t SDCardEndpoint::init_card() {
+    return FR_OK;
+}
+
+/**
+ * \brief Create a file for writing. Cards that are read-only refuse.
+ */
+uint32_t SDCardEndpoint::createfile(const std::u16string & /*name*/, uint32_t /*reserve*/) {
+    return FR_DENIED;
+}
+
+uint32_t SDCardEndpoint::appendfile(const std::u16string & /*name*/, uint32_t /*reserve*/) {
+    return FR_DENIED;
+}
+
+uint32_t SDCardEndpoint::writefile(const uint8_t * /*buffer*/, uint32_t /*size*/) {
+    return 0xffffffff;
+}
+
+uint32_t SDCardEndpoint::mkdir(const std::u16string & /*name*/) {
+    return FR_DENIED;
+}
+
+/**
+ * \brief Forget what the index knows about `name` and the directory that holds it.
+ */
+void SDCardEndpoint::written_(const std::u16string &name) {
+    std::u16string path;
+    if (getcwd(path) != FR_OK) {
+        index_.invalidate();
+        return;
+    }
+    // Keep a drive prefix like `0:` so the path looks like the ones from getcwd()
+    size_t root = (path.size() >= 2 && path[1] == u':') ? 2 : 0;
+    if (!name.empty() && name[0] == u'/') {
+        path.erase(root);
+    } else if (path.empty() || path.back() != u'/') {
+        path.push_back(u'/');
+    }
+    path.append(name);
+    index_.invalidate(path);
+    size_t sep = path.find_last_of(u'/');
+    if (sep == std::u16string::npos) return;
+    path.erase((sep > root) ? sep : root + 1);
+    index_.invalidate(path);
+}
+
+/**
+ * \brief Mark a request done and tell everyone about it.
+ * Must be called from the scheduler thread.
+ */
+void SDCardEndpoint::complete_(SDCardRequest &req) {
+    req.state_ = SDCardRequest::State::DONE;
+    if (req.op_ == SDCardRequest::Op::LISTDIR && &req != &prewarm_req_ && first_listing_time_ == 0) {
+        first_listing_time_ = std::max(uptime_, (uint32_t)1);
+        if (kLogSDCard) Log.logf("SDCard: first listing after %u us\n", first_listing_time_);
+    }
+    scheduler().signal_all(Event(Event::Type::SIGNAL, Event::Subtype::SDCARD_REQUEST_DONE, req.id_));
+}
+
 /**
  * \brief Handle events that were send via the `in` pipe.
  */
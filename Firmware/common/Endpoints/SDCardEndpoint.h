@@ -8,32 +8,136 @@
 #define ND_ENDPOINTS_SDCARD_H
 
 #include "common/Endpoint.h" // Adjusted the path to ensure the Endpoint header is correctly included
+#include "common/Endpoints/SDCardIndex.h"
 
 #include <string>
+#include <deque>
+#include <vector>
 
 namespace nd {
 
+/**
+ * \brief An SD Card operation that runs while the scheduler keeps spinning.
+ */
+struct SDCardRequest {
+    enum class Op : uint8_t {
+        NONE = 0,
+        OPENFILE,   // name_: file name; size_ returns the file size
+        READFILE,   // read size_ bytes into buffer_; result_ is the number of bytes read
+        VIEWFILE,   // like READFILE, but data_ returns the bytes, lent by the card if it can (see viewfile())
+        CLOSEFILE,
+        OPENDIR,
+        READDIR,    // name_ returns the entry; result_ is FR_IS_DIRECTORY, FR_IS_PACKAGE, or an error
+        CLOSEDIR,
+        CHDIR,      // name_: new directory
+        GETCWD,     // name_ returns the current directory
+        LISTDIR,    // name_: directory, or empty for the current one; dir_ returns the listing
+        PKGINFO,    // name_: package file, absolute or in the current directory; info_ returns its header
+        MKDIR,      // name_: new directory; result_ is FR_OK if it exists already
+        CREATEFILE, // name_: file name; reserve size_ bytes on the card
+        WRITEFILE,  // write size_ bytes from buffer_; result_ is the number of bytes written
+        APPENDFILE, // name_: file name, created if missing; reserve size_ more bytes if possible
+        MOUNT,      // power up and mount the card; name_ returns the volume label
+    };
+    enum class State : uint8_t { IDLE = 0, PENDING, DONE };
+    Op op_ = Op::NONE;
+    State state_ = State::IDLE;
+    uint16_t id_ = 0; // sent as data with the SDCARD_REQUEST_DONE signal
+    uint32_t result_ = 0; // FR_* code, or the number of bytes read (0xffffffff on error)
+    std::u16string name_;
+    uint8_t *buffer_ = nullptr; // must stay valid until the request is done or canceled
+    const uint8_t *data_ = nullptr; // VIEWFILE returns buffer_, or data that stays valid until the file is closed
+    uint32_t size_ = 0;
+    uint32_t pos_ = 0; // bytes read or written so far
+    std::shared_ptr<const SDCardIndex::Dir> dir_; // keeps the listing alive, even if the index drops it
+    PackageInfo *info_ = nullptr; // must stay valid until the request is done or canceled
+
+    bool pending() const { return state_ == State::PENDING; }
+    bool done() const { return state_ == State::DONE; }
+    void reset() { op_ = Op::NONE; state_ = State::IDLE; dir_.reset(); }
+};
+
 class SDCardEndpoint : public Endpoint {
+protected:
+    constexpr static uint32_t kMaxRequests = 8;
+    constexpr static uint32_t kReadStepSize = 512; // one sector per time slice, also for writing
+    std::deque<SDCardRequest*> requests_;
+    SDCardIndex index_;
+    enum class Prewarm : uint8_t { MOUNT, LIST_ROOT, PACKAGES, DONE };
+    Prewarm prewarm_ = Prewarm::MOUNT;
+    SDCardRequest prewarm_req_;
+    PackageInfo prewarm_info_;
+    std::vector<std::u16string> prewarm_packages_; // packages in the root directory
+    uint32_t uptime_ = 0; // microseconds since init(), see Scheduler::cycle_time()
+    uint32_t first_listing_time_ = 0; // uptime when the first listing was sent
+    bool file_open_ = false; // a client opened a file, only used in step_()
+    void prewarm_task_();
+    bool step_(SDCardRequest &req);
+    bool read_step_(SDCardRequest &req);
+    bool list_step_(SDCardRequest &req);
+    bool open_listing_(SDCardRequest &req);
+    void package_info_(SDCardRequest &req);
+    void package_info_(SDCardRequest &req, const std::u16string &name);
+    void complete_(SDCardRequest &req);
+    void written_(const std::u16string &name);
 public:
     SDCardEndpoint(Scheduler &scheduler);
+    SDCardEndpoint(Scheduler &scheduler, uint32_t index_bytes);
     ~SDCardEndpoint();
 
     Result init() override;
+    Result task() override;
     Result send(Event) override;
 
+    virtual Result submit(SDCardRequest &req);
+    virtual void cancel(SDCardRequest &req);
+
     virtual const char *strerr(uint32_t err) = 0;
     virtual uint32_t status() = 0;
     virtual const std::u16string &get_label() = 0;
+    /// Time from init() until the first directory listing for a client, 0 if there was none yet.
+    uint32_t first_listing_time() const { return first_listing_time_; }
+
+    /**
+     * \brief Power up the card, without mounting it.
+     * This is the slow part of the first access and can be done on its own.
+     */
+    virtual uint32_t init_card();
+    /**
+     * \brief Mount the card if it is not mounted yet.
+     */
+    virtual uint32_t mount() { return status(); }
 
     virtual uint32_t opendir() = 0;
     virtual uint32_t readdir(std::u16string &name) = 0;
+    virtual uint32_t readentry(SDCardDirEntry &entry);
     virtual uint32_t closedir() = 0;
 
     virtual uint32_t openfile(const std::u16string &name) = 0;
     virtual uint32_t filesize() = 0;
     virtual uint32_t readfile(uint8_t *buffer, uint32_t size) = 0;
+    /**
+     * \brief Borrow the next `size` bytes of the open file without copying them.
+     * The data stays valid until the file is closed. Returns the number of bytes
+     * at `data`, or 0 if the card can't do that. Use readfile() instead then.
+     */
+    virtual uint32_t viewfile(const uint8_t *&data, uint32_t /*size*/) { data = nullptr; return 0; }
     virtual uint32_t closefile() = 0;
 
+    /**
+     * \brief Create a file for writing, replacing an existing one.
+     * `reserve` bytes are allocated up front if the card can do that, so
+     * appending does not have to search for free clusters. closefile()
+     * gives back what was not written.
+     */
+    virtual uint32_t createfile(const std::u16string &name, uint32_t reserve);
+    /**
+     * \brief Open a file for writing at its end, creating it if needed.
+     */
+    virtual uint32_t appendfile(const std::u16string &name, uint32_t reserve);
+    virtual uint32_t writefile(const uint8_t *buffer, uint32_t size);
+    virtual uint32_t mkdir(const std::u16string &name);
+
     virtual uint32_t chdir(const std::u16string &path) = 0;
     virtual uint32_t getcwd(std::u16string &path) = 0; 
 };
@@ -0,0 +1,229 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "SDCardIndex.h"
+
+#include "main.h"
+
+#include <algorithm>
+
+using namespace nd;
+
+
+/**
+ * \class nd::SDCardIndex
+ * \brief Remember the filtered and sorted content of recently visited directories.
+ *
+ * Reading a directory from a FAT formatted card walks every directory entry,
+ * including long file name fragments, hidden and system files, and files
+ * that are not packages. On a large package library, that takes seconds.
+ *
+ * The index keeps the result of that walk: folders first, then packages,
+ * each sorted by name, with their size and modification time. The names of
+ * one directory are stored in a single string to avoid an allocation per
+ * entry.
+ *
+ * The number of directories and the total memory are limited by the
+ * constructor arguments. The least recently used directories are dropped
+ * first. Listings are handed out as shared pointers, so a caller can keep
+ * using one after the index dropped it. A directory that is larger than the entire budget is not kept at
+ * all. Its entries are only counted, so the caller can compute the size of
+ * the listing and then read the entries from the card a second time.
+ *
+ * The index also keeps the parsed headers of recently used package files.
+ * They are looked up by path and modification time, so a changed file is
+ * read again.
+ *
+ * The SD Card endpoint must call invalidate() whenever the card is mounted
+ * or written to.
+ */
+
+static char16_t fold_(char16_t c) {
+    return (c >= 'a' && c <= 'z') ? (char16_t)(c - 'a' + 'A') : c;
+}
+
+/**
+ * \brief Compare the name of an entry, ignoring the case of ASCII letters like FatFS.
+ */
+bool SDCardIndex::Dir::name_is(uint32_t i, const std::u16string &name) const {
+    const Entry &e = entries_[i];
+    if (e.name_size_ != name.size()) return false;
+    for (uint32_t j = 0; j < e.name_size_; ++j) {
+        if (fold_(names_[e.name_ + j]) != fold_(name[j])) return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Find an entry by name.
+ * Entries are sorted, so this is a binary search for a package, then for a folder.
+ * \return the index of the entry, or -1 if there is no such entry.
+ */
+int32_t SDCardIndex::Dir::find(const std::u16string &name) const {
+    for (uint8_t is_dir = 0; is_dir < 2; ++is_dir) {
+        auto it = std::lower_bound(entries_.begin(), entries_.end(), name, [this, is_dir](const Entry &e, const std::u16string &name) {
+            if (e.is_dir_ != is_dir) return e.is_dir_ > is_dir;
+            uint32_t n = std::min<uint32_t>(e.name_size_, name.size());
+            for (uint32_t i = 0; i < n; ++i) {
+                char16_t ca = fold_(names_[e.name_ + i]), cb = fold_(name[i]);
+                if (ca != cb) return ca < cb;
+            }
+            return e.name_size_ < name.size();
+        });
+        if (it != entries_.end() && it->is_dir_ == is_dir && name_is(it - entries_.begin(), name))
+            return (int32_t)(it - entries_.begin());
+    }
+    return -1;
+}
+
+void SDCardIndex::erase_(std::list<std::shared_ptr<Dir>>::iterator it) {
+    dir_bytes_ -= (*it)->bytes_();
+    dirs_.erase(it);
+}
+
+/**
+ * \brief Drop the least recently used directories until a new one fits.
+ */
+void SDCardIndex::evict_(uint32_t bytes_needed) {
+    while (!dirs_.empty() && ((dirs_.size() >= max_dirs_) || (dir_bytes_ + bytes_needed > max_bytes_))) {
+        if (kLogSDCard) Log.log("SDCardIndex: dropping a directory\n");
+        erase_(std::prev(dirs_.end()));
+    }
+}
+
+/**
+ * \brief Return the listing of a directory if it is in the index.
+ */
+std::shared_ptr<const SDCardIndex::Dir> SDCardIndex::find(const std::u16string &path) {
+    for (auto it = dirs_.begin(); it != dirs_.end(); ++it) {
+        if ((*it)->path_ == path) {
+            dirs_.splice(dirs_.begin(), dirs_, it); // most recently used
+            return dirs_.front();
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * \brief Start a new listing. Call add() for every entry, then commit().
+ */
+void SDCardIndex::begin(const std::u16string &path) {
+    building_ = std::make_shared<Dir>();
+    building_->path_ = path;
+}
+
+void SDCardIndex::add(const SDCardDirEntry &entry) {
+    if (!building_) return;
+    Dir &dir = *building_;
+    uint32_t name_size = entry.name_.size();
+    dir.count_++;
+    dir.name_units_ += name_size;
+    if (name_size >= Dir::kLongName) dir.long_names_++;
+    if (dir.overflow_) return;
+    if (dir.bytes_() + name_size * sizeof(char16_t) + sizeof(Dir::Entry) > max_bytes_) {
+        // Too large for the index. Free the entries and only count from now on.
+        if (kLogSDCard) Log.log("SDCardIndex: directory is too large to keep\n");
+        dir.overflow_ = true;
+        std::vector<Dir::Entry>().swap(dir.entries_);
+        std::u16string().swap(dir.names_);
+        return;
+    }
+    dir.entries_.push_back(Dir::Entry {
+        (uint32_t)dir.names_.size(),
+        (uint16_t)entry.name_.size(),
+        (uint8_t)(entry.type_ == FR_IS_DIRECTORY),
+        0, // reserved
+        entry.size_,
+        entry.mtime_,
+    });
+    dir.names_.append(entry.name_);
+}
+
+/**
+ * \brief Sort the new listing and add it to the index.
+ * \return the listing. If it is not complete(), it only has the entry count.
+ */
+std::shared_ptr<const SDCardIndex::Dir> SDCardIndex::commit() {
+    if (!building_) return nullptr;
+    Dir &dir = *building_;
+    if (dir.overflow_) return std::move(building_);
+    const std::u16string &names = dir.names_;
+    std::sort(dir.entries_.begin(), dir.entries_.end(), [&names](const Dir::Entry &a, const Dir::Entry &b) {
+        if (a.is_dir_ != b.is_dir_) return a.is_dir_ > b.is_dir_;
+        uint32_t n = std::min(a.name_size_, b.name_size_);
+        for (uint32_t i = 0; i < n; ++i) {
+            char16_t ca = fold_(names[a.name_ + i]), cb = fold_(names[b.name_ + i]);
+            if (ca != cb) return ca < cb;
+        }
+        return a.name_size_ < b.name_size_;
+    });
+    dir.entries_.shrink_to_fit();
+    dir.names_.shrink_to_fit();
+    dir.complete_ = true;
+    if (max_dirs_ == 0) return std::move(building_);
+    invalidate(dir.path_);
+    evict_(dir.bytes_());
+    dir_bytes_ += dir.bytes_();
+    dirs_.push_front(std::move(building_));
+    return dirs_.front();
+}
+
+/**
+ * \brief Forget all directories, for example when a new card was inserted.
+ */
+void SDCardIndex::invalidate() {
+    dirs_.clear();
+    dir_bytes_ = 0;
+    building_.reset();
+    packages_.clear();
+    package_paths_.clear();
+}
+
+/**
+ * \brief Forget the listing or the package header at `path`.
+ * After writing a file, call this for the file and for its directory.
+ */
+void SDCardIndex::invalidate(const std::u16string &path) {
+    for (auto it = dirs_.begin(); it != dirs_.end(); ++it) {
+        if ((*it)->path_ == path) {
+            erase_(it);
+            break;
+        }
+    }
+    auto pkg = package_paths_.find(path);
+    if (pkg != package_paths_.end()) {
+        packages_.erase(pkg->second);
+        package_paths_.erase(pkg);
+    }
+}
+
+/**
+ * \brief Return the package header for a file, if it was not modified since it was parsed.
+ */
+const PackageInfo *SDCardIndex::find_package(const std::u16string &path, uint32_t mtime, uint32_t file_size) {
+    auto it = package_paths_.find(path);
+    if (it == package_paths_.end()) return nullptr;
+    Package &pkg = *it->second;
+    if (pkg.mtime_ != mtime || pkg.info_.file_size_ != file_size) return nullptr;
+    packages_.splice(packages_.begin(), packages_, it->second); // most recently used
+    return &pkg.info_;
+}
+
+/**
+ * \brief Remember a parsed package header, dropping the least recently used one if needed.
+ */
+void SDCardIndex::add_package(const std::u16string &path, uint32_t mtime, const PackageInfo &info) {
+    if (max_packages_ == 0) return;
+    auto it = package_paths_.find(path);
+    if (it != package_paths_.end()) {
+        packages_.erase(it->second);
+        package_paths_.erase(it);
+    } else if (packages_.size() >= max_packages_) {
+        package_paths_.erase(packages_.back().path_);
+        packages_.pop_back();
+    }
+    packages_.push_front(Package { path, mtime, info });
+    package_paths_[path] = packages_.begin();
+}
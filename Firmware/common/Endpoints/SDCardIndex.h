@@ -0,0 +1,108 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_ENDPOINTS_SDCARD_INDEX_H
+#define ND_ENDPOINTS_SDCARD_INDEX_H
+
+#include "common/Newton/PackageInfo.h"
+
+#include <vector>
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+namespace nd {
+
+/**
+ * \brief A directory entry as returned by SDCardEndpoint::readentry().
+ */
+struct SDCardDirEntry {
+    std::u16string name_;
+    uint32_t type_ = 0;  // FR_IS_DIRECTORY or FR_IS_PACKAGE
+    uint32_t size_ = 0;  // file size in bytes, 0 for directories
+    uint32_t mtime_ = 0; // modification time in the platform format, only compared for equality
+};
+
+/**
+ * \brief Filtered and sorted directory listings, kept in RAM.
+ */
+class SDCardIndex {
+public:
+    /** \brief One listing. All names are stored back to back in a single string. */
+    class Dir {
+        friend class SDCardIndex;
+        struct Entry {
+            uint32_t name_;      // offset into `names_`
+            uint16_t name_size_;
+            uint8_t is_dir_;
+            uint8_t reserved_;
+            uint32_t size_;
+            uint32_t mtime_;
+        };
+        std::u16string path_;
+        std::u16string names_;
+        std::vector<Entry> entries_;
+        uint32_t count_ = 0;      // number of entries, even if they were not kept
+        uint32_t name_units_ = 0; // length of all names in UTF-16 units
+        uint32_t long_names_ = 0; // number of names with kLongName or more units
+        bool complete_ = false;   // `entries_` holds the entire sorted listing
+        bool overflow_ = false;   // too large for the index, entries are only counted
+        uint32_t bytes_() const { return (names_.size() + path_.size()) * sizeof(char16_t) + entries_.size() * sizeof(Entry); }
+    public:
+        /// Names this long need a 5 byte size field when sent as NSOF strings.
+        constexpr static uint32_t kLongName = 127;
+        bool complete() const { return complete_; }
+        uint32_t count() const { return count_; }
+        uint32_t name_units() const { return name_units_; }
+        uint32_t long_names() const { return long_names_; }
+        uint32_t size() const { return entries_.size(); }
+        const std::u16string &path() const { return path_; }
+        bool is_dir(uint32_t i) const { return entries_[i].is_dir_; }
+        uint32_t file_size(uint32_t i) const { return entries_[i].size_; }
+        uint32_t mtime(uint32_t i) const { return entries_[i].mtime_; }
+        std::u16string name(uint32_t i) const { return names_.substr(entries_[i].name_, entries_[i].name_size_); }
+        bool name_is(uint32_t i, const std::u16string &name) const;
+        int32_t find(const std::u16string &name) const;
+    };
+private:
+    struct Package {
+        std::u16string path_;
+        uint32_t mtime_;
+        PackageInfo info_;
+    };
+    std::list<Package> packages_; // most recently used first
+    std::unordered_map<std::u16string, std::list<Package>::iterator> package_paths_;
+    uint32_t max_packages_;
+    std::list<std::shared_ptr<Dir>> dirs_; // most recently used first
+    std::shared_ptr<Dir> building_;
+    uint32_t dir_bytes_ = 0; // memory used by all listings in `dirs_`
+    uint32_t max_dirs_;
+    uint32_t max_bytes_;
+    void evict_(uint32_t bytes_needed);
+    void erase_(std::list<std::shared_ptr<Dir>>::iterator it);
+public:
+    SDCardIndex(uint32_t max_dirs, uint32_t max_bytes, uint32_t max_packages)
+    :   max_packages_(max_packages), max_dirs_(max_dirs), max_bytes_(max_bytes) { }
+    SDCardIndex(const SDCardIndex&) = delete;
+    SDCardIndex& operator=(const SDCardIndex&) = delete;
+    SDCardIndex(SDCardIndex&&) = delete;
+    SDCardIndex& operator=(SDCardIndex&&) = delete;
+
+    std::shared_ptr<const Dir> find(const std::u16string &path);
+    void begin(const std::u16string &path);
+    void add(const SDCardDirEntry &entry);
+    std::shared_ptr<const Dir> commit();
+    void invalidate();
+    void invalidate(const std::u16string &path);
+
+    const PackageInfo *find_package(const std::u16string &path, uint32_t mtime, uint32_t file_size);
+    void add_package(const std::u16string &path, uint32_t mtime, const PackageInfo &info);
+};
+
+} // namespace nd
+
+#endif // ND_ENDPOINTS_SDCARD_INDEX_H
@@ -0,0 +1,142 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "SDCardWriter.h"
+
+#include "main.h"
+
+#include <algorithm>
+
+using namespace nd;
+
+/**
+ * \class nd::SDCardWriter
+ * \brief Write-behind buffer for the SD Card.
+ *
+ * Data from the Newton arrives in pieces of a few dozen bytes to a few
+ * kilobytes. Writing each piece to the card right away would cost a
+ * read-modify-write of a sector every time, and the serial stream would wait
+ * for the card.
+ *
+ * write() copies data into one of two blocks of `block_size` bytes and
+ * returns at once. A full block is handed to the SD Card as a WRITEFILE
+ * request, while write() continues to fill the other block. Only if both
+ * blocks are full, write() takes less than it was offered. The caller must
+ * then hold the rest until task() has written a block.
+ *
+ * mkdir(), create(), append() and close() are queued in the same order as the data.
+ * If an operation fails, error() is set and all following data is dropped.
+ * Files that are open are still closed.
+ */
+
+SDCardWriter::SDCardWriter(SDCardEndpoint &sdcard, uint32_t block_size)
+:   sdcard_(sdcard),
+    block_size_(block_size)
+{
+    for (auto &block: block_) block.reserve(block_size_);
+}
+
+SDCardWriter::~SDCardWriter() {
+    sdcard_.cancel(req_);
+}
+
+/**
+ * \brief Queue the creation of a directory. Existing directories are fine.
+ */
+void SDCardWriter::mkdir(const std::u16string &path) {
+    steps_.push_back(Step { SDCardRequest::Op::MKDIR, path });
+}
+
+/**
+ * \brief Queue the creation of a file and reserve `reserve` bytes for it.
+ */
+void SDCardWriter::create(const std::u16string &path, uint32_t reserve) {
+    steps_.push_back(Step { SDCardRequest::Op::CREATEFILE, path, reserve });
+}
+
+/**
+ * \brief Queue opening a file at its end, and reserve `reserve` more bytes if the card can.
+ */
+void SDCardWriter::append(const std::u16string &path, uint32_t reserve) {
+    steps_.push_back(Step { SDCardRequest::Op::APPENDFILE, path, reserve });
+}
+
+/**
+ * \brief Append data to the file.
+ * \return the number of bytes taken, which is less than `size` if all blocks are full.
+ */
+uint32_t SDCardWriter::write(const uint8_t *data, uint32_t size) {
+    uint32_t done = 0;
+    while (done < size && !queued_[fill_]) {
+        std::vector<uint8_t> &block = block_[fill_];
+        uint32_t n = std::min(size - done, block_size_ - (uint32_t)block.size());
+        block.insert(block.end(), data + done, data + done + n);
+        done += n;
+        if (block.size() == block_size_) flush_();
+    }
+    return done;
+}
+
+/**
+ * \brief Queue the rest of the data and the closing of the file.
+ */
+void SDCardWriter::close() {
+    flush_();
+    steps_.push_back(Step { SDCardRequest::Op::CLOSEFILE, std::u16string(), 0, 0 });
+}
+
+/**
+ * \brief Hand the block that is being filled to the card.
+ */
+void SDCardWriter::flush_() {
+    if (block_[fill_].empty() || queued_[fill_]) return;
+    queued_[fill_] = true;
+    steps_.push_back(Step { SDCardRequest::Op::WRITEFILE, std::u16string(), 0, fill_ });
+    fill_ = (fill_ + 1) % kNumBlocks;
+}
+
+/**
+ * \brief Collect the result of the last request and submit the next one.
+ */
+void SDCardWriter::task() {
+    if (req_.pending()) return;
+    if (req_.done()) {
+        uint32_t err = req_.result_;
+        if (req_.op_ == SDCardRequest::Op::WRITEFILE) {
+            err = (req_.result_ == req_.size_) ? FR_OK : FR_DISK_ERR;
+            block_[req_block_].clear();
+            queued_[req_block_] = false;
+        }
+        if (err != FR_OK && !error_) {
+            if (kLogSDCard) Log.logf("SDCardWriter: error %d\n", err);
+            error_ = err;
+        }
+        req_.reset();
+    }
+    if (steps_.empty()) return;
+    Step &step = steps_.front();
+    if (error_ && step.op_ != SDCardRequest::Op::CLOSEFILE) {
+        if (step.op_ == SDCardRequest::Op::WRITEFILE) {
+            block_[step.block_].clear();
+            queued_[step.block_] = false;
+        }
+        steps_.pop_front();
+        return;
+    }
+    req_.op_ = step.op_;
+    req_.name_.swap(step.name_);
+    req_.size_ = step.size_;
+    if (step.op_ == SDCardRequest::Op::WRITEFILE) {
+        req_block_ = step.block_;
+        req_.buffer_ = block_[req_block_].data();
+        req_.size_ = block_[req_block_].size();
+    }
+    if (sdcard_.submit(req_).rejected()) {
+        req_.name_.swap(step.name_); // try again later
+        req_.reset();
+        return;
+    }
+    steps_.pop_front();
+}
@@ -0,0 +1,62 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_ENDPOINTS_SDCARD_WRITER_H
+#define ND_ENDPOINTS_SDCARD_WRITER_H
+
+#include "common/Endpoints/SDCardEndpoint.h"
+
+#include <string>
+#include <deque>
+#include <vector>
+
+namespace nd {
+
+/**
+ * \brief Collect small writes into large blocks and write them to the SD Card in the background.
+ */
+class SDCardWriter {
+public:
+    constexpr static uint32_t kNumBlocks = 2;
+private:
+    struct Step {
+        SDCardRequest::Op op_;
+        std::u16string name_;
+        uint32_t size_ = 0; // bytes to reserve for CREATEFILE and APPENDFILE
+        uint32_t block_ = 0; // block to write for WRITEFILE
+    };
+    SDCardEndpoint &sdcard_;
+    uint32_t block_size_;
+    std::vector<uint8_t> block_[kNumBlocks];
+    bool queued_[kNumBlocks] = { }; // the block is waiting for the card or being written
+    uint32_t fill_ = 0; // the block that write() fills
+    std::deque<Step> steps_; // operations that were not submitted yet
+    SDCardRequest req_;
+    uint32_t req_block_ = 0; // block of the running WRITEFILE request
+    uint32_t error_ = 0; // the first error, FR_* code
+    void flush_();
+public:
+    SDCardWriter(SDCardEndpoint &sdcard, uint32_t block_size);
+    ~SDCardWriter();
+    SDCardWriter(const SDCardWriter&) = delete;
+    SDCardWriter& operator=(const SDCardWriter&) = delete;
+    SDCardWriter(SDCardWriter&&) = delete;
+    SDCardWriter& operator=(SDCardWriter&&) = delete;
+
+    void mkdir(const std::u16string &path);
+    void create(const std::u16string &path, uint32_t reserve);
+    void append(const std::u16string &path, uint32_t reserve);
+    uint32_t write(const uint8_t *data, uint32_t size);
+    void close();
+    void task();
+
+    /// True if everything was written and the card is not busy anymore.
+    bool idle() const { return steps_.empty() && !req_.pending() && !req_.done(); }
+    uint32_t error() const { return error_; }
+};
+
+} // namespace nd
+
+#endif // ND_ENDPOINTS_SDCARD_WRITER_H
@@ -36,6 +36,9 @@ public:
         CHARS,              // DELAY: Delay in characters at the current bitrate 
         UART_DTR,           // UART: DTR signal changed, value is 0 or 1
         USER_SETTINGS_CHANGED = 128, // SIGNAL: User settings changed
+        SDCARD_REQUEST_DONE,  // SIGNAL: An SDCardRequest completed (request id)
+        TIMER,              // SIGNAL: A Timer of this task expired (timer id)
+        SWITCH_ROUTE,       // SIGNAL: Connect two SwitchMatrix ports (from << 8 | to)
         MNP_SEND_LA = 128,  // MNP: Send Link Acknowledgement (sequence number)
         MNP_SEND_LD,        // MNP: Send Link Disconnect (reason)
         MNP_SEND_LR,        // MNP: Send Link Request (in buffer index)
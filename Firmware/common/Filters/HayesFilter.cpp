@@ -9,6 +9,7 @@
 
 #include "common/Scheduler.h"
 #include "common/Endpoints/SDCardEndpoint.h"
+#include "common/Filters/SwitchMatrix.h"
 #include "common/Pipes/MNPThrottle.h"
 
 //#include <pico/unique_id.h>
@@ -38,14 +39,16 @@ using namespace nd;
  *       characters until the timeout expires. This is not a standard Hayes
  *       implementation and may vary between devices.
  * 
- * \param scheduler The scheduler to use for this filter.
+ * \param context The scheduler and the user settings for this filter.
  */
-HayesFilter::HayesFilter(Scheduler &scheduler, uint8_t ix)
-:   Task(scheduler, Scheduler::TASKS | Scheduler::SIGNALS),
+HayesFilter::HayesFilter(Context &context, uint8_t ix)
+:   Task(context.scheduler_, Scheduler::SIGNALS),
     upstream(*this),
     downstream(*this),
-    index_(ix)
+    index_(ix),
+    settings_(context.settings_)
 {
+    restart_guard_time_();
 }
 
 HayesFilter::~HayesFilter() {
@@ -53,7 +56,8 @@ HayesFilter::~HayesFilter() {
 
 void HayesFilter::switch_to_command_mode() {
     data_mode_ = false;
-    command_mode_timeout_ = 0;
+    splice_();
+    guard_timer_.cancel();
     command_mode_progress_ = 0;
     send_OK();
 }
@@ -61,7 +65,8 @@ void HayesFilter::switch_to_command_mode() {
 void HayesFilter::switch_to_data_mode() {
     send_CONNECT();
     data_mode_ = true;
-    command_mode_timeout_ = 0;
+    splice_();
+    restart_guard_time_();
     command_mode_progress_ = 0;
 }
 
@@ -72,64 +77,95 @@ Result HayesFilter::signal(Event event) {
     switch (event.subtype()) {
         case Event::Subtype::USER_SETTINGS_CHANGED:
             if (index_ == 0) {
-                value = user_settings.data.hayes0_esc_code_guard_time;
+                value = settings_.data.hayes0_esc_code_guard_time;
             } else {
-                value = user_settings.data.hayes1_esc_code_guard_time;
+                value = settings_.data.hayes1_esc_code_guard_time;
             }
             esc_code_guard_timeout_ = value * 20'000; // 20ms
             break;
+        case Event::Subtype::TIMER:
+            guard_time_over_();
+            break;
     }
     return Result::OK;
 }
 
 
 /**
- * \brief Called regularly by the scheduler to take care of the filter.
+ * \brief Start the guard time over, because a character was just received.
+ *
+ * The timer keeps running while characters come in, and guard_time_over_()
+ * checks the time of the last one. This keeps the timer out of the data path.
+ */
+void HayesFilter::restart_guard_time_() {
+    guard_start_ = scheduler().now();
+    if (!guard_timer_.armed())
+        guard_timer_.arm(esc_code_guard_timeout_ + 1);
+}
+
+/**
+ * \brief Take the upstream pipe out of the event flow while it only forwards events.
+ *
+ * In data mode, everything that comes from upstream goes unchanged to the
+ * pipe behind `downstream`, so the sender can skip this hop (see
+ * Pipe::splice_out()). The downstream direction stays in the flow, because
+ * every byte restarts the guard time of the pause-"+++"-pause sequence.
  */
-Result HayesFilter::task() {
+void HayesFilter::splice_() {
+    if (data_mode_)
+        upstream.splice_out(downstream.wired_out());
+    else
+        upstream.splice_in();
+}
+
+/**
+ * \brief Called by the guard timer to take care of the pause-"+++"-pause sequence.
+ */
+void HayesFilter::guard_time_over_() {
     // Filter out the pause-"+++"-pause sequence."
     // This works only in cooperation with downstream_send(Event).
-    command_mode_timeout_ += scheduler().cycle_time();
+    uint64_t command_mode_timeout = scheduler().now() - guard_start_;
+    if (data_mode_ && command_mode_progress_ != 1 && command_mode_timeout <= esc_code_guard_timeout_) {
+        // A character came in since the timer was armed
+        guard_timer_.arm((uint32_t)(esc_code_guard_timeout_ - command_mode_timeout) + 1);
+        return;
+    }
     if (data_mode_) {
         switch (command_mode_progress_) {
             case 0: // waiting for the first pause
-                if (command_mode_timeout_ > esc_code_guard_timeout_) {
+                if (command_mode_timeout > esc_code_guard_timeout_) {
                     command_mode_progress_ = 1;
-                    command_mode_timeout_ = 0;
-                    if (kDebugHayes) printf("**** HayesFilter task: 0 -> 1 (Good: no character for a while)\n");
+                    if (kDebugHayes) printf("**** HayesFilter timer: 0 -> 1 (Good: no character for a while)\n");
                 }
                 break;
             case 1: // waiting for the first '+'
                 break;
             case 2: // waiting for the second '+'
-                if (command_mode_timeout_ > esc_code_guard_timeout_) {
-                    if (kDebugHayes) printf("**** HayesFilter task: %d -> 0 (Bad: no + in time)\n", command_mode_progress_);
-                    command_mode_timeout_ = 0;
+                if (command_mode_timeout > esc_code_guard_timeout_) {
+                    if (kDebugHayes) printf("**** HayesFilter timer: %d -> 0 (Bad: no + in time)\n", command_mode_progress_);
+                    restart_guard_time_();
                     command_mode_progress_ = 0;
                     upstream.out()->send(Event('+')); // Make up for the '+' we withheld.
                 }
                 break;
             case 3: // waiting for the third '+'
-                if (command_mode_timeout_ > esc_code_guard_timeout_) {
-                    if (kDebugHayes) printf("**** HayesFilter task: %d -> 0 (Bad: no + in time)\n", command_mode_progress_);
-                    command_mode_timeout_ = 0;
+                if (command_mode_timeout > esc_code_guard_timeout_) {
+                    if (kDebugHayes) printf("**** HayesFilter timer: %d -> 0 (Bad: no + in time)\n", command_mode_progress_);
+                    restart_guard_time_();
                     command_mode_progress_ = 0;
                     upstream.out()->send(Event('+')); // Make up for the two '+'s we withheld.
                     upstream.out()->send(Event('+'));
                 }
                 break;
             case 4: // waiting for the last pause
-                if (command_mode_timeout_ > esc_code_guard_timeout_) {
+                if (command_mode_timeout > esc_code_guard_timeout_) {
                     command_mode_progress_ = 0;
-                    if (kDebugHayes) printf("**** HayesFilter task: COMMAND MODE (Good: no character for a while)\n");
+                    if (kDebugHayes) printf("**** HayesFilter timer: COMMAND MODE (Good: no character for a while)\n");
                     switch_to_command_mode();
-                    return Result::OK;        
                 }
                 break;
         }
     }
-    
-    return Result::OK;
 }
 
 /**
@@ -188,49 +224,49 @@ Result HayesFilter::downstream_send(Event event)
     Pipe *down = downstream.out();
 
     // Filter out the pause-"+++"-pause sequence."
-    // This works only in cooperation with task() and the scheduler.
+    // This works only in cooperation with guard_time_over_() and the guard timer.
     if (data_mode_ && event.is_data()) {
         switch (command_mode_progress_) {
             case 0: // waiting for the first pause
-                command_mode_timeout_ = 0;
+                restart_guard_time_();
                 break;
             case 1: // waiting for the first '+'
                 if (event.data() == '+') {
                     command_mode_progress_ = 2;
-                    command_mode_timeout_ = 0;
+                    restart_guard_time_();
                     if (kDebugHayes) printf("**** HayesFilter send: 1 -> 2 (Good: received first +)\n");
                     return Result::OK; // Don't send the '+' just yet.
                 } else {
                     if (kDebugHayes) printf("**** HayesFilter send: 1 -> 0 (Bad: received unexpected character)\n");
                     command_mode_progress_ = 0;
-                    command_mode_timeout_ = 0;
+                    restart_guard_time_();
                 }
                 break; // Continue and send the latest event.
             case 2: // waiting for the second '+'
                 if (event.data() == '+') {
                     command_mode_progress_ = 3;
-                    command_mode_timeout_ = 0;
+                    restart_guard_time_();
                     if (kDebugHayes) printf("**** HayesFilter send: 2 -> 3 (Good: received second +)\n");
                     return Result::OK; // Don't send the '+' just yet.
                 } else {
                     upstream.out()->send(Event ('+')); // Make up for the '+' we withheld.
                     if (kDebugHayes) printf("**** HayesFilter send: 2 -> 0 (Bad: received unexpected character)\n");
                     command_mode_progress_ = 0;
-                    command_mode_timeout_ = 0;
+                    restart_guard_time_();
                 }
                 break; // Continue and send the latest event.
             case 3: // waiting for the third '+'
                 if (event.data() == '+') {
                     if (kDebugHayes) printf("**** HayesFilter send: 3 -> 4 (Good: received third +)\n");
                     command_mode_progress_ = 4;
-                    command_mode_timeout_ = 0;
+                    restart_guard_time_();
                     return Result::OK; // Don't send the '+' just yet.
                 } else {
                     upstream.out()->send(Event ('+')); // Make up for the two '+'s we withheld.
                     upstream.out()->send(Event ('+'));
                     if (kDebugHayes) printf("**** HayesFilter send: 3 -> 0 (Bad: received unexpected character)\n");
                     command_mode_progress_ = 0;
-                    command_mode_timeout_ = 0;
+                    restart_guard_time_();
                 }
                 break; // Continue and send the latest event. 
             case 4: // waiting for the last pause
@@ -239,7 +275,7 @@ Result HayesFilter::downstream_send(Event event)
                 upstream.out()->send(Event ('+'));
                 upstream.out()->send(Event ('+'));
                 command_mode_progress_ = 0;
-                command_mode_timeout_ = 0;
+                restart_guard_time_();
                 break; // Continue and send the latest event.
         }
     }
@@ -461,7 +497,7 @@ const char *HayesFilter::run_ampersand_cmd(const char *cmd) {
         case 0:  // End of command line.
         case 'W': // write current settings to NVRAM
             read_int(&cmd);
-            user_settings.write();
+            settings_.write();
             break;
         default: // Unknown command AT&...
             send_ERROR();
@@ -518,7 +554,7 @@ const char *HayesFilter::run_sdcard_cmd(const char *cmd) {
         uint16_t version = read_int(&cmd);
         if (*cmd != '.') { send_ERROR(); return nullptr; } else cmd++;
         uint16_t revision = read_int(&cmd);
-        Result res = user_settings.write_serial(serial, id, version, revision);
+        Result res = settings_.write_serial(serial, id, version, revision);
         if (res.rejected()) {
             send_string("Rejected\r\n");
             send_ERROR();
@@ -550,17 +586,23 @@ bool HayesFilter::set_register(uint32_t reg, uint32_t value) {
         // S37: Desired DCE Line Speed (http://www.messagestick.net/modem/Hayes_Ch1-3.html)
         case 12: // S12: escape code guard time (1/50th of a second)
             if (index_ == 0) {
-                user_settings.data.hayes0_esc_code_guard_time = value;
+                settings_.data.hayes0_esc_code_guard_time = value;
             } else {
-                user_settings.data.hayes1_esc_code_guard_time = value;
+                settings_.data.hayes1_esc_code_guard_time = value;
             }
             break;
         case 300: // ATS300: absolute throttle delay in microseconds
-            user_settings.data.mnpt_absolute_delay = value;
+            settings_.data.mnpt_absolute_delay = value;
             break;
         case 301: // ATS301: relative MNP throttle delay in characters
-            user_settings.data.mnpt_num_char_delay = value;
+            settings_.data.mnpt_num_char_delay = value;
             break;
+        case 310: // ATS310=ab: connect SwitchMatrix ports a and b, b=9 disconnects port a
+            if (value / 10 >= SwitchMatrix::kPorts || (value % 10 >= SwitchMatrix::kPorts && value % 10 != 9))
+                return false;
+            scheduler().signal_all(Event {Event::Type::SIGNAL, Event::Subtype::SWITCH_ROUTE,
+                ((value / 10) << 8) | ((value % 10 == 9) ? SwitchMatrix::kNone : value % 10)});
+            return true; // not a user setting
         default:
             return false;
     }
@@ -572,16 +614,16 @@ uint32_t HayesFilter::get_register(uint32_t reg) const {
     switch (reg) {
         case 12: // S12: escape code guard time (1/50th of a second)
             if (index_ == 0) {
-                return user_settings.data.hayes0_esc_code_guard_time;
+                return settings_.data.hayes0_esc_code_guard_time;
             } else {
-                return user_settings.data.hayes1_esc_code_guard_time;
+                return settings_.data.hayes1_esc_code_guard_time;
             }
         case 13: // S13: escape code guard time (1/50th of a second)
-            return user_settings.data.hayes0_esc_code_guard_time;
+            return settings_.data.hayes0_esc_code_guard_time;
         case 300: // ATS300: absolute throttle delay in microseconds
-            return user_settings.data.mnpt_absolute_delay;
+            return settings_.data.mnpt_absolute_delay;
         case 301: // ATS301: relative MNP throttle delay in characters
-            return user_settings.data.mnpt_num_char_delay;
+            return settings_.data.mnpt_num_char_delay;
     }
     return 0;
 }
@@ -593,17 +635,17 @@ bool HayesFilter::send_info(uint32_t ix) {
             send_string("NewtDongle V0.6a\r\n");
             break;
         case 1:
-            itoa10(user_settings.serial(), buf);
+            itoa10(settings_.serial(), buf);
             send_string("Serial No.: ");
             send_string(buf);
             send_string("\r\n");
             break;
         case 2:
             send_string("Hardware: V");
-            itoa10(user_settings.hardware_version(), buf);
+            itoa10(settings_.hardware_version(), buf);
             send_string(buf);
             send_string(".");
-            itoa10(user_settings.hardware_revision(), buf);
+            itoa10(settings_.hardware_revision(), buf);
             send_string(buf);
             send_string("\r\n");
             break;
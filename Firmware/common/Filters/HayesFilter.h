@@ -6,7 +6,9 @@
 #ifndef ND_FILTERS_HAYES_FILTER_H
 #define ND_FILTERS_HAYES_FILTER_H
 
+#include "common/Context.h"
 #include "common/Task.h"
+#include "common/Timer.h"
 
 #include <string>
 
@@ -32,34 +34,39 @@ class HayesFilter: public Task {
         Result send(Event event) override { return filter_.downstream_send(event); }
         Result rush(Event event) override { return filter_.downstream_rush(event); }
         Result rush_back(Event event) override { return filter_.downstream_rush_back(event); }
+        void relinked() override { filter_.splice_(); }
     };
     
     uint8_t index_ = 0;
     bool data_mode_ = true;
     uint8_t command_mode_progress_ = 0;
-    uint32_t command_mode_timeout_ = 0;
+    uint64_t guard_start_ = 0; // time of the last character, see Scheduler::now()
+    Timer guard_timer_ { *this };
     std::string cmd_, prev_cmd_;
     bool cmd_ready_ = false;
     bool cr_rcvd_ = false;
     uint32_t current_register_ = 0;
     uint32_t esc_code_guard_timeout_ = 1'000'000; // 1 second (see Register 12)
 
+    UserSettings &settings_;
     SDCardEndpoint *sdcard_ = nullptr;
 
     void send_string(const char *str);
+    void restart_guard_time_();
+    void guard_time_over_();
+    void splice_();
 
 public:
     UpstreamPipe upstream { *this };
     DownstreamPipe downstream { *this };
     
-    HayesFilter(Scheduler &scheduler, uint8_t ix);
+    HayesFilter(Context &context, uint8_t ix);
     ~HayesFilter() override;
 
     void switch_to_command_mode();
     void switch_to_data_mode();
 
     Result signal(Event event) override;
-    Result task() override;
     Result upstream_send(Event event);
     Result upstream_rush(Event event);
     Result upstream_rush_back(Event event);
@@ -278,11 +278,15 @@ void MNPFrame::prepare_LA(uint8_t seq_no) {
  * This will process the MNP frames and send them to the Dock.
  */
 void NewtToDockPipe::task() {
+    MNPFrame *frame = out_frame_;
+    auto crsr = out_frame_crsr_;
     if (out_frame_) {
         mnp_to_dock_state_machine();
     } else if (!job_list_.empty()) {
         start_next_job();
     }
+    if (frame != out_frame_ || crsr != out_frame_crsr_)
+        filter_.scheduler().busy();
 }
 
 void NewtToDockPipe::start_next_job() 
@@ -617,11 +621,16 @@ void NewtToDockPipe::handle_newt_frame(MNPFrame *frame) {
  */
 void DockToNewtPipe::task() 
 {
+    MNPFrame *frame = active_frame_;
+    OutState state = out_state_;
+    auto crsr = data_crsr_;
     if (active_frame_) {
         mnp_to_newt_state_machine();        
     } else if (!job_list_.empty() || !job_list_lt_.empty()) {
         start_next_job();
     }
+    if (frame != active_frame_ || state != out_state_ || crsr != data_crsr_)
+        filter_.scheduler().busy();
 }
 
 /**
@@ -1081,6 +1090,6 @@ static uint16_t kCRC16Table[256] = {
 static void update_crc16(unsigned short *pCrc16, const char data[], size_t length) {
 	for (size_t i = 0; i < length; i++) {
 		uint16_t in_crc = *pCrc16;
-		*pCrc16 = (uint16_t)(((in_crc >> 8) & 0xFF) ^ kCRC16Table[ (in_crc & 0xFF) ^ data[i] ]);
+		*pCrc16 = (uint16_t)(((in_crc >> 8) & 0xFF) ^ kCRC16Table[ (in_crc & 0xFF) ^ (uint8_t)data[i] ]);
 	}
 }
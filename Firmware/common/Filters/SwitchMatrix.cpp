@@ -0,0 +1,233 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "SwitchMatrix.h"
+
+#include "main.h"
+#include "common/StatusDisplay.h"
+
+using namespace nd;
+
+/**
+ * @class SwitchMatrix
+ * @brief Route events between up to four sides of the dongle, changeable at runtime.
+ *
+ * Every port is a Pipe with two directions.
+ * Events that are sent into port `i` leave the matrix at the output of port
+ * `route_of(i)`. Connect the sides like this:
+ * \code
+ *   uart_hayes.upstream >> matrix.port(kUART);     // into the matrix
+ *   matrix.port(kUART) >> uart_hayes.upstream;     // out of the matrix
+ *   matrix.connect(kUART, kDock);
+ * \endcode
+ *
+ * Forwarding an event is a lookup in the routing table, no matter how many
+ * ports there are. On a buffered route, an event that the destination
+ * rejects is kept in a small ring buffer of the source port and sent again
+ * in task(). When a route changes, the events that are still buffered for
+ * the old route are dropped, so a protocol never receives the tail of
+ * another one. A route without a buffer passes rejections back to the
+ * sender, and its port is spliced out (see Pipe::splice_out()), so it costs
+ * no hop at all.
+ *
+ * Routes change with route(), connect(), and disconnect(), or when DTR
+ * changes on a port (see follow_dtr()). The signal `SWITCH_ROUTE`, which the
+ * Hayes command ATS310 sends, disconnects two ports from everything else
+ * and connects them with a buffered route. Its data is `from << 8 | to`,
+ * and `to` may be kNone to just disconnect `from`.
+ */
+
+/**
+ * \brief Create a matrix with no routes.
+ * \param context The scheduler and the status display.
+ */
+SwitchMatrix::SwitchMatrix(Context &context)
+:   Task(context.scheduler_, Scheduler::TASKS | Scheduler::SIGNALS),
+    status_(context.status_)
+{
+}
+
+/**
+ * \brief Send the events that enter port `from` out through port `to`.
+ *
+ * Events that are still buffered for the previous route are dropped.
+ * \param from Port number.
+ * \param to Port number, or kNone to drop all events that enter `from`.
+ * \param buffered Keep events that `to` rejects and send them later.
+ */
+void SwitchMatrix::route(uint8_t from, uint8_t to, bool buffered) {
+    if (from >= kPorts)
+        return;
+    if (to >= kPorts)
+        to = kNone;
+    uint8_t old = route_[from];
+    if (old == to && buffered_[from] == buffered)
+        return;
+    if (old != kNone && source_[old] == from)
+        source_[old] = kNone;
+    route_[from] = to;
+    buffered_[from] = buffered;
+    if (to != kNone)
+        source_[to] = from;
+    ring_[from].head_ = ring_[from].tail_ = 0;
+    splice_(from);
+    if (kLogSwitchMatrix) Log.logf("SwitchMatrix: port %d -> %d\n", from, to);
+}
+
+/**
+ * \brief Route two ports to each other, in both directions.
+ */
+void SwitchMatrix::connect(uint8_t a, uint8_t b, bool buffered) {
+    route(a, b, buffered);
+    route(b, a, buffered);
+}
+
+/**
+ * \brief Drop all events from and to a port.
+ */
+void SwitchMatrix::disconnect(uint8_t port) {
+    if (port >= kPorts)
+        return;
+    uint8_t peer = route_[port];
+    route(port, kNone);
+    if (peer != kNone && route_[peer] == port)
+        route(peer, kNone);
+    if (source_[port] != kNone)
+        route(source_[port], kNone);
+}
+
+/**
+ * \brief Connect `port` to `peer` while DTR on `port` is set.
+ *
+ * When a terminal opens the USB CDC port, the Newton talks to the terminal,
+ * and when it closes the port, all routes are restored to what they were
+ * before.
+ */
+void SwitchMatrix::follow_dtr(uint8_t port, uint8_t peer) {
+    dtr_port_ = port;
+    dtr_peer_ = peer;
+    splice_all_();
+}
+
+/**
+ * \brief Splice out the port of an unbuffered route.
+ * The DTR port stays in the flow, because it watches for changes of DTR.
+ */
+void SwitchMatrix::splice_(uint8_t from) {
+    uint8_t to = route_[from];
+    if (to != kNone && !buffered_[from] && from != dtr_port_)
+        ports_[from].splice_out(ports_[to].wired_out());
+    else
+        ports_[from].splice_in();
+}
+
+void SwitchMatrix::splice_all_() {
+    for (uint8_t from = 0; from < kPorts; from++)
+        splice_(from);
+}
+
+void SwitchMatrix::dtr_changed_(bool set) {
+    if (set == dtr_set_)
+        return;
+    dtr_set_ = set;
+    if (set) {
+        for (uint8_t i = 0; i < kPorts; i++) {
+            home_[i] = route_[i];
+            home_buffered_[i] = buffered_[i];
+        }
+        bool buffered = (route_[dtr_peer_] != kNone) ? buffered_[dtr_peer_] : true;
+        disconnect(dtr_peer_);
+        connect(dtr_port_, dtr_peer_, buffered);
+        status_.set(AppStatus::USB_CONNECTED);
+    } else {
+        for (uint8_t i = 0; i < kPorts; i++)
+            route(i, home_[i], home_buffered_[i]);
+        status_.set(AppStatus::IDLE);
+    }
+    if (kLogSwitchMatrix) Log.logf("SwitchMatrix: DTR set to %d\n", set);
+}
+
+Result SwitchMatrix::forward_(uint8_t from, Event event) {
+    uint8_t to = route_[from];
+    Pipe *out = (to != kNone) ? ports_[to].out() : nullptr;
+    if (!out)
+        return Result::OK__NOT_CONNECTED;
+    if (!buffered_[from])
+        return out->send(event); // the DTR port is not spliced out, but must not buffer either
+    Ring &ring = ring_[from];
+    if (ring.empty()) {
+        Result r = out->send(event);
+        if (r.ok())
+            return r;
+        // Continue and buffer the current event
+    } else if (out->send(ring.event_[ring.tail_]).ok()) {
+        ring.tail_ = (ring.tail_ + 1) & kRingMask;
+    }
+    if (ring.full())
+        return Result::REJECTED;
+    ring.event_[ring.head_] = event;
+    ring.head_ = (ring.head_ + 1) & kRingMask;
+    return Result::OK;
+}
+
+/**
+ * \brief Rushed events skip the buffer. DTR changes on the DTR port reroute first.
+ */
+Result SwitchMatrix::rush_(uint8_t from, Event event) {
+    if (from == dtr_port_
+        && event.type() == Event::Type::UART
+        && event.subtype() == Event::Subtype::UART_DTR)
+    {
+        dtr_changed_(event.data() != 0);
+    }
+    uint8_t to = route_[from];
+    Pipe *out = (to != kNone) ? ports_[to].out() : nullptr;
+    if (!out)
+        return Result::OK__NOT_CONNECTED;
+    return out->rush(event);
+}
+
+/**
+ * \brief Events rushed back into port `to` go back to the port that routes to it.
+ */
+Result SwitchMatrix::rush_back_(uint8_t to, Event event) {
+    uint8_t from = source_[to];
+    Pipe *in = (from != kNone) ? ports_[from].in() : nullptr;
+    if (!in)
+        return Result::OK__NOT_CONNECTED;
+    return in->rush_back(event);
+}
+
+/**
+ * \brief Send buffered events until their destinations reject one.
+ */
+Result SwitchMatrix::task() {
+    for (uint8_t from = 0; from < kPorts; from++) {
+        Ring &ring = ring_[from];
+        if (ring.empty())
+            continue;
+        uint8_t to = route_[from];
+        Pipe *out = (to != kNone) ? ports_[to].out() : nullptr;
+        if (!out)
+            continue;
+        while (!ring.empty() && out->send(ring.event_[ring.tail_]).ok()) {
+            ring.tail_ = (ring.tail_ + 1) & kRingMask;
+            scheduler().busy();
+        }
+    }
+    return Result::OK;
+}
+
+Result SwitchMatrix::signal(Event event) {
+    if (event.type() == Event::Type::SIGNAL && event.subtype() == Event::Subtype::SWITCH_ROUTE) {
+        uint8_t from = event.data() >> 8, to = event.data() & 0xff;
+        disconnect(from);
+        if (to != kNone) {
+            disconnect(to);
+            connect(from, to);
+        }
+    }
+    return Result::OK;
+}
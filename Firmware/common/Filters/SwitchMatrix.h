@@ -0,0 +1,84 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_FILTERS_SWITCH_MATRIX_H
+#define ND_FILTERS_SWITCH_MATRIX_H
+
+#include "common/Context.h"
+#include "common/Task.h"
+
+#include <array>
+
+namespace nd {
+
+class SwitchMatrix: public Task {
+public:
+    constexpr static uint8_t kPorts = 4;
+    constexpr static uint8_t kNone = 0xff;
+
+private:
+    constexpr static uint32_t kRingSize = 128; // per port, must be a power of 2
+    constexpr static uint32_t kRingMask = kRingSize - 1;
+
+    class Port: public Pipe {
+        SwitchMatrix &matrix_;
+        uint8_t index_;
+    public:
+        Port(SwitchMatrix &matrix, uint8_t index) : matrix_(matrix), index_(index) { }
+        Result send(Event event) override { return matrix_.forward_(index_, event); }
+        Result rush(Event event) override { return matrix_.rush_(index_, event); }
+        Result rush_back(Event event) override { return matrix_.rush_back_(index_, event); }
+    protected:
+        void relinked() override { matrix_.splice_all_(); }
+    };
+
+    // Events that the destination of a port rejected, in the order they came in.
+    struct Ring {
+        std::array<Event, kRingSize> event_;
+        uint32_t head_ = 0;
+        uint32_t tail_ = 0;
+        bool empty() const { return head_ == tail_; }
+        bool full() const { return ((head_ + 1) & kRingMask) == tail_; }
+    };
+
+    Port ports_[kPorts] { { *this, 0 }, { *this, 1 }, { *this, 2 }, { *this, 3 } };
+    uint8_t route_[kPorts] = { kNone, kNone, kNone, kNone };   // events that enter port i leave at route_[i]
+    uint8_t source_[kPorts] = { kNone, kNone, kNone, kNone };  // the port that routes to port i
+    bool buffered_[kPorts] = { };
+    uint8_t home_[kPorts] = { kNone, kNone, kNone, kNone };    // routes to restore when DTR drops
+    bool home_buffered_[kPorts] = { };
+    Ring ring_[kPorts];
+    uint8_t dtr_port_ = kNone;
+    uint8_t dtr_peer_ = kNone;
+    bool dtr_set_ = false;
+    StatusDisplay &status_;
+
+    Result forward_(uint8_t from, Event event);
+    Result rush_(uint8_t from, Event event);
+    Result rush_back_(uint8_t to, Event event);
+    void dtr_changed_(bool set);
+    void splice_(uint8_t from);
+    void splice_all_();
+
+public:
+    SwitchMatrix(Context &context);
+    ~SwitchMatrix() override = default;
+
+    Pipe &port(uint8_t ix) { return ports_[ix]; }
+
+    void route(uint8_t from, uint8_t to, bool buffered = true);
+    void connect(uint8_t a, uint8_t b, bool buffered = true);
+    void disconnect(uint8_t port);
+    void follow_dtr(uint8_t port, uint8_t peer);
+    uint8_t route_of(uint8_t port) const { return (port < kPorts) ? route_[port] : kNone; }
+
+    // -- Task stuff
+    Result task() override;
+    Result signal(Event event) override;
+};
+
+} // namespace nd
+
+#endif // ND_FILTERS_SWITCH_MATRIX_H
@@ -7,8 +7,10 @@
 
 #include "common/Newton/DESKey.h"
 
+#include <algorithm>
+
 /* Permuted Choice 1 */
-const unsigned char DESPC1Tbl[] =
+constexpr unsigned char DESPC1Tbl[] =
 {
 	 7, 15, 23, 31, 39, 47, 55,
 	63,  6, 14, 22, 30, 38, 46,
@@ -23,7 +25,7 @@ const unsigned char DESPC1Tbl[] =
 };
 
 /* Permuted Choice 2 */
-const unsigned char DESPC2Tbl[] =
+constexpr unsigned char DESPC2Tbl[] =
 {
 	50, 47, 53, 40, 63, 59, 61, 36,
 	49, 58, 43, 54, 41, 45, 52, 60,
@@ -35,7 +37,7 @@ const unsigned char DESPC2Tbl[] =
 	128
 };
 
-const unsigned char DESIPInvTbl[] =
+constexpr unsigned char DESIPInvTbl[] =
 {
 	24, 56, 16, 48,  8, 40,  0, 32,
 	25, 57, 17, 49,  9, 41,  1, 33,
@@ -49,7 +51,7 @@ const unsigned char DESIPInvTbl[] =
 	128
 };
 
-const unsigned char DESPTbl[] = {
+constexpr unsigned char DESPTbl[] = {
 	16, 25, 12, 11,
 	 3, 20,  4, 15,
 	31, 17,  9,  6,
@@ -61,7 +63,7 @@ const unsigned char DESPTbl[] = {
 	128
 };
 
-const unsigned char DESSBoxes[8][64] = {
+constexpr unsigned char DESSBoxes[8][64] = {
 	{	13,  1,  2, 15,  8, 13,  4,  8,  6, 10, 15,  3, 11,  7,  1,  4,
 		10, 12,  9,  5,  3,  6, 14, 11,  5,  0,  0, 14, 12,  9,  7,  2,
 		 7,  2, 11,  1,  4, 14,  1,  7,  9,  4, 12, 10, 14,  8,  2, 13,
@@ -99,7 +101,7 @@ const unsigned char DESSBoxes[8][64] = {
 // --------- Odd Bit Number ---------
 // Table to fix the parity of a byte.
 
-const unsigned char kParitizedByte[256] =
+constexpr unsigned char kParitizedByte[256] =
 {
 	0x01, 0x01, 0x02, 0x03, 0x04, 0x05, 0x07, 0x07, 0x08, 0x09, 0x0B, 0x0B, 0x0D, 0x0D, 0x0E, 0x0F,
 	0x10, 0x11, 0x13, 0x13, 0x15, 0x15, 0x16, 0x17, 0x19, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1F, 0x1F,
@@ -120,14 +122,6 @@ const unsigned char kParitizedByte[256] =
 };
 
 
-/*------------------------------------------------------------------------------
-	P r o t o t y p e s
-------------------------------------------------------------------------------*/
-
-static void DESip(uint32_t inKeyHi, uint32_t inKeyLo, SNewtNonce * outKey);
-static uint32_t DESfrk(uint32_t Khi, uint32_t Klo, uint32_t R);
-
-
 /*------------------------------------------------------------------------------
 	Permute a 64 bit number using the given permute choice table.
 	The number is handled in two 32 bit longs.
@@ -135,7 +129,7 @@ static uint32_t DESfrk(uint32_t Khi, uint32_t Klo, uint32_t R);
 
 void DESPermute(const unsigned char * inPermuteTable, uint32_t inKeyHi, uint32_t inKeyLo, SNewtNonce * outKey)
 {
-	uint32_t permutedHi, permutedLo;
+	uint32_t permutedHi, permutedLo = 0;
 	uint32_t srcBits;
 	unsigned int bitPos;
 
@@ -152,7 +146,7 @@ void DESPermute(const unsigned char * inPermuteTable, uint32_t inKeyHi, uint32_t
 				srcBits = inKeyHi;
 				bitPos -= 32;
 			}
-			if (srcBits & (1 << bitPos))
+			if (srcBits & (1U << bitPos))
 				permutedHi |= 1;
 		}
 		// swap high <-> low	
@@ -166,6 +160,181 @@ void DESPermute(const unsigned char * inPermuteTable, uint32_t inKeyHi, uint32_t
 }
 
 
+/*------------------------------------------------------------------------------
+	Precomputed tables for the table driven engine.
+
+	All permutations in DES only move bits around, so the permutation of a
+	64 bit word is the XOR of the permutations of its 16 nibbles. The initial
+	and final permutations are looked up one nibble at a time.
+
+	The cipher function f(R,K) runs the eight S-Boxes, each one filling its
+	own nibble of a 32 bit word, followed by the permutation P. Since P is a
+	permutation as well, the S-Box outputs are permuted in advance, and the
+	combined SP-Boxes are simply XOR'ed.
+
+	The tables are calculated by the compiler from the bitwise description
+	above, so they are guaranteed to match it.
+------------------------------------------------------------------------------*/
+
+struct DESTables
+{
+	uint32_t sp[8][64];
+	SNewtNonce ip[16][16];
+	SNewtNonce fp[16][16];
+};
+
+static constexpr SNewtNonce DESPermuteC(const unsigned char * inPermuteTable, uint32_t inKeyHi, uint32_t inKeyLo)
+{
+	uint32_t permutedHi = 0, permutedLo = 0;
+	unsigned int bitPos = 0;
+	do {
+		permutedHi = 0;
+		while ((bitPos = *inPermuteTable++) < 64)
+		{
+			permutedHi <<= 1;
+			uint32_t srcBits = inKeyLo;
+			if (bitPos >= 32)
+			{
+				srcBits = inKeyHi;
+				bitPos -= 32;
+			}
+			if (srcBits & (1U << bitPos))
+				permutedHi |= 1;
+		}
+		uint32_t temp = permutedLo;
+		permutedLo = permutedHi;
+		permutedHi = temp;
+	} while (bitPos < 128);
+	return SNewtNonce { permutedHi, permutedLo };
+}
+
+static constexpr SNewtNonce DESipC(uint32_t inKeyHi, uint32_t inKeyLo)
+{
+	uint32_t d6 = inKeyHi;
+	uint32_t d7 = inKeyHi << 16;
+	uint32_t a1 = inKeyLo;
+	uint32_t a3 = inKeyLo << 16;
+	uint32_t resultHi = 0;
+	uint32_t resultLo = 0;
+	uint32_t temp = 0;
+
+	for (int j = 0; j < 2; j++)
+	{
+		resultHi = (resultHi >> 1) | (resultHi << 31);
+		resultLo = (resultLo >> 1) | (resultLo << 31);
+
+		for (int i = 0; i < 8; i++)
+		{
+			resultLo = (a3 >> 31) | (resultLo << 1);
+			a3 <<= 1;
+			resultLo = (resultLo >> 31) | (resultLo << 1);
+
+			resultLo = (a1 >> 31) | (resultLo << 1);
+			a1 <<= 1;
+			resultLo = (resultLo >> 31) | (resultLo << 1);
+
+			resultLo = (d7 >> 31) | (resultLo << 1);
+			d7 <<= 1;
+			resultLo = (resultLo >> 31) | (resultLo << 1);
+
+			resultLo = (d6 >> 31) | (resultLo << 1);
+			d6 <<= 1;
+			resultLo = (resultLo >> 31) | (resultLo << 1);
+
+			temp = resultLo;
+			resultLo = resultHi;
+			resultHi = temp;
+		}
+	}
+	return SNewtNonce { resultHi, resultLo };
+}
+
+static constexpr DESTables DESMakeTables()
+{
+	DESTables t { };
+	for (int i = 0; i < 8; i++)
+		for (int v = 0; v < 64; v++)
+			t.sp[i][v] = DESPermuteC(DESPTbl, 0, (uint32_t)DESSBoxes[i][v] << (4 * i)).lo;
+	for (int n = 0; n < 16; n++)
+	{
+		for (uint32_t v = 0; v < 16; v++)
+		{
+			uint32_t hi = (n >= 8) ? (v << (4 * (n - 8))) : 0;
+			uint32_t lo = (n < 8) ? (v << (4 * n)) : 0;
+			t.ip[n][v] = DESipC(hi, lo);
+			t.fp[n][v] = DESPermuteC(DESIPInvTbl, hi, lo);
+		}
+	}
+	return t;
+}
+
+static constexpr DESTables kDESTables = DESMakeTables();
+
+static inline SNewtNonce DESNibblePermute(const SNewtNonce (&table)[16][16], uint32_t inHi, uint32_t inLo)
+{
+	SNewtNonce result = { 0, 0 };
+	for (int n = 0; n < 8; n++)
+	{
+		const SNewtNonce & a = table[n][(inLo >> (4 * n)) & 0x0F];
+		const SNewtNonce & b = table[n + 8][(inHi >> (4 * n)) & 0x0F];
+		result.hi ^= a.hi ^ b.hi;
+		result.lo ^= a.lo ^ b.lo;
+	}
+	return result;
+}
+
+static inline uint32_t DESRotR(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+/*------------------------------------------------------------------------------
+	The cipher function f(R,K) using the combined SP-Boxes.
+	K holds the eight 6 bit blocks of the subkey.
+------------------------------------------------------------------------------*/
+
+static inline uint32_t DESFastF(const uint8_t * K, uint32_t R)
+{
+	uint32_t r = (R << 1) | (R >> 31);		// rotate left 1 bit initially
+	return kDESTables.sp[0][(r ^ K[0]) & 0x3F]
+		 ^ kDESTables.sp[1][(DESRotR(r,  4) ^ K[1]) & 0x3F]
+		 ^ kDESTables.sp[2][(DESRotR(r,  8) ^ K[2]) & 0x3F]
+		 ^ kDESTables.sp[3][(DESRotR(r, 12) ^ K[3]) & 0x3F]
+		 ^ kDESTables.sp[4][(DESRotR(r, 16) ^ K[4]) & 0x3F]
+		 ^ kDESTables.sp[5][(DESRotR(r, 20) ^ K[5]) & 0x3F]
+		 ^ kDESTables.sp[6][(DESRotR(r, 24) ^ K[6]) & 0x3F]
+		 ^ kDESTables.sp[7][(DESRotR(r, 28) ^ K[7]) & 0x3F];
+}
+
+static inline SNewtNonce DESFastBlock(const DESKeySchedule * inSchedule, uint32_t inHi, uint32_t inLo)
+{
+	SNewtNonce data = DESNibblePermute(kDESTables.ip, inHi, inLo);
+	uint32_t dataHi = data.hi;
+	uint32_t dataLo = data.lo;
+	for (int i = 0; i < 16; i += 2)
+	{
+		dataHi ^= DESFastF(inSchedule->k[i], dataLo);
+		dataLo ^= DESFastF(inSchedule->k[i + 1], dataHi);
+	}
+	return DESNibblePermute(kDESTables.fp, dataLo, dataHi);
+}
+
+
+/*------------------------------------------------------------------------------
+	Split the subkeys of a key schedule into 6 bit blocks.
+------------------------------------------------------------------------------*/
+
+static void DESSplitKeys(const SNewtNonce * inKeys, DESKeySchedule * outSchedule)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		uint64_t k = ((uint64_t)inKeys[i].hi << 32) | inKeys[i].lo;
+		for (int j = 0; j < 8; j++)
+			outSchedule->k[i][j] = (k >> (6 * j)) & 0x3F;
+	}
+}
+
+
 /*------------------------------------------------------------------------------
 	Calculate the Key Schedule.
 ------------------------------------------------------------------------------*/
@@ -257,79 +426,82 @@ void DESCharToKey(UniChar * inString, SNewtNonce * outKey)
 
 
 /*------------------------------------------------------------------------------
-	DESip
+	Calculate the key schedule for the table driven engine.
 ------------------------------------------------------------------------------*/
 
-static void DESip(uint32_t inKeyHi, uint32_t inKeyLo, SNewtNonce * outKey)
+void DESFastKeySched(const SNewtNonce * inKey, DESKeySchedule * outSchedule)
 {
-	uint32_t d6 = inKeyHi;
-	uint32_t d7 = inKeyHi << 16;
-	uint32_t a1 = inKeyLo;
-	uint32_t a3 = inKeyLo << 16;
-	uint32_t resultHi = 0;
-	uint32_t resultLo = 0;
-	uint32_t temp;
-	int i, j;
-
-	for (j = 0; j < 2; j++)
-	{
-		resultHi = (resultHi >> 1) | (resultHi << 31);
-		resultLo = (resultLo >> 1) | (resultLo << 31);
-
-		for (i = 0; i < 8; i++)
-		{
-			resultLo = (a3 >> 31) | (resultLo << 1);
-			a3 <<= 1;
-			resultLo = (resultLo >> 31) | (resultLo << 1);
+	SNewtNonce key = *inKey;
+	SNewtNonce keysArray[16];
 
-			resultLo = (a1 >> 31) | (resultLo << 1);
-			a1 <<= 1;
-			resultLo = (resultLo >> 31) | (resultLo << 1);
+	DESKeySched(&key, keysArray);
+	DESSplitKeys(keysArray, outSchedule);
+}
 
-			resultLo = (d7 >> 31) | (resultLo << 1);
-			d7 <<= 1;
-			resultLo = (resultLo >> 31) | (resultLo << 1);
 
-			resultLo = (d6 >> 31) | (resultLo << 1);
-			d6 <<= 1;
-			resultLo = (resultLo >> 31) | (resultLo << 1);
+/*------------------------------------------------------------------------------
+	Return the key schedule for a password.
+	The schedule is only recalculated if the password changed since the
+	last call with the same cache.
+------------------------------------------------------------------------------*/
 
-			temp = resultLo;
-			resultLo = resultHi;
-			resultHi = temp;
-		}
-	}
-	outKey->hi = resultHi;
-	outKey->lo = resultLo;
+const DESKeySchedule * DESPasswordSchedule(DESPasswordKey * ioCache, const UniChar * inPassword)
+{
+	int len = 0;
+	while (inPassword[len] != 0)
+		len++;
+	if (ioCache->valid
+	 && (ioCache->password.size() == (size_t)len)
+	 && std::equal(ioCache->password.begin(), ioCache->password.end(), inPassword))
+		return &ioCache->schedule;
+
+	SNewtNonce key;
+	ioCache->password.assign(inPassword, inPassword + len);
+	ioCache->password.push_back(0);
+	DESCharToKey(ioCache->password.data(), &key);
+	ioCache->password.pop_back();
+	DESFastKeySched(&key, &ioCache->schedule);
+	ioCache->valid = true;
+	return &ioCache->schedule;
 }
 
 
 /*------------------------------------------------------------------------------
-	The cipher function f(R,K)
-	Define 8 blocks of 6 bits each from the 32 bit input R.
+	Batch encode and decode a number of 8 byte blocks in place.
 ------------------------------------------------------------------------------*/
 
-static uint32_t DESfrk(uint32_t Khi, uint32_t Klo, uint32_t R)
+void DESFastEncode(const DESKeySchedule * inSchedule, SNewtNonce * ioBlocks, int inCount)
 {
-	uint32_t L;
-	SNewtNonce permutedR;
-	int i;
+	for (int i = 0; i < inCount; i++)
+		ioBlocks[i] = DESFastBlock(inSchedule, ioBlocks[i].hi, ioBlocks[i].lo);
+}
+
+void DESFastDecode(const DESKeySchedule * inSchedule, SNewtNonce * ioBlocks, int inCount)
+{
+	// The Newton applies the subkeys in the same order for both directions.
+	DESFastEncode(inSchedule, ioBlocks, inCount);
+}
 
-	L = 0;
-	R = (R >> 31) + (R << 1);			// rotate left 1 bit initially
-	for (i = 0; i < 8; i++)
+void DESFastCBCEncode(const DESKeySchedule * inSchedule, SNewtNonce * ioBlocks, int inCount, SNewtNonce * ioVector)
+{
+	for (int i = 0; i < inCount; i++)
 	{
-		L |= DESSBoxes[i][(R ^ Klo) & 0x3F];
-		L = (L << 28) | (L >> 4);		// rotate LR right 4 bits for next iter
-		R = (R << 28) | (R >> 4);
-		Klo = (Khi << 26) + (Klo >> 6);	// rotate K right 6 bits
-		Khi = Khi >> 6;
+		ioVector->hi ^= ioBlocks[i].hi;
+		ioVector->lo ^= ioBlocks[i].lo;
+		ioBlocks[i] = DESFastBlock(inSchedule, ioVector->hi, ioVector->lo);
 	}
-	// apply permutation function P(L)
-	DESPermute(DESPTbl, 0, L, &permutedR);
+}
 
-	// return 32 bit result
-	return permutedR.lo;
+void DESFastCBCDecode(const DESKeySchedule * inSchedule, SNewtNonce * ioBlocks, int inCount, SNewtNonce * ioVector)
+{
+	for (int i = 0; i < inCount; i++)
+	{
+		SNewtNonce cipher = ioBlocks[i];
+		SNewtNonce plain = DESFastBlock(inSchedule, cipher.hi, cipher.lo);
+		ioBlocks[i].hi = plain.hi ^ ioVector->hi;
+		ioBlocks[i].lo = plain.lo ^ ioVector->lo;
+		*ioVector = cipher;
+	}
 }
 
 
@@ -339,70 +511,32 @@ static uint32_t DESfrk(uint32_t Khi, uint32_t Klo, uint32_t R)
 
 void DESEncode(SNewtNonce * keys, int byteCount, SNewtNonce ** memPtr)
 {
-	int i;
-	SNewtNonce permutedData;
-	SNewtNonce * keyPtr = *memPtr;
-	SNewtNonce * kPtr;
-	uint32_t keyHi, keyLo;
+	DESKeySchedule schedule;
+	int count = byteCount / (int)sizeof(SNewtNonce);
 
-	while ((byteCount -= sizeof(SNewtNonce)) >= 0)
-	{
-		kPtr = keys;
-		keyHi = keyPtr->hi;
-		keyLo = keyPtr->lo;
-		DESip(keyHi, keyLo, &permutedData);
-		keyHi = permutedData.hi;
-		keyLo = permutedData.lo;
-		for (i = 0; i < 8; i++)
-		{
-			keyHi ^= DESfrk(kPtr->hi, kPtr->lo, keyLo);	kPtr++;
-			keyLo ^= DESfrk(kPtr->hi, kPtr->lo, keyHi);	kPtr++;
-		}
-		DESPermute(DESIPInvTbl, keyLo, keyHi, &permutedData);
-		*keyPtr++ = permutedData;
-	}
-	*memPtr = keyPtr;
+	DESSplitKeys(keys, &schedule);
+	DESFastEncode(&schedule, *memPtr, count);
+	*memPtr += count;
 }
 
 
 void DESCBCEncode(SNewtNonce * keys, int byteCount, SNewtNonce ** memPtr, SNewtNonce * a4)
 {
-	int i;
-	SNewtNonce permutedData;
-	SNewtNonce * keyPtr = *memPtr;
-	SNewtNonce * kPtr;
-	uint32_t keyHi, keyLo;
+	DESKeySchedule schedule;
+	int count = byteCount / (int)sizeof(SNewtNonce);
 
-	while ((byteCount -= sizeof(SNewtNonce)) >= 0)
-	{
-		kPtr = keys;
-		keyHi = keyPtr->hi;
-		keyLo = keyPtr->lo;
-		keyHi = (a4->hi ^= keyHi);
-		keyLo = (a4->lo ^= keyLo);
-		DESip(keyHi, keyLo, &permutedData);
-		keyHi = permutedData.hi;
-		keyLo = permutedData.lo;
-		for (i = 0; i < 8; i++)
-		{
-			keyHi ^= DESfrk(kPtr->hi, kPtr->lo, keyLo);	kPtr++;
-			keyLo ^= DESfrk(kPtr->hi, kPtr->lo, keyHi);	kPtr++;
-		}
-		DESPermute(DESIPInvTbl, keyLo, keyHi, &permutedData);
-		*keyPtr++ = permutedData;
-	}
-	*memPtr = keyPtr;
+	DESSplitKeys(keys, &schedule);
+	DESFastCBCEncode(&schedule, *memPtr, count, a4);
+	*memPtr += count;
 }
 
 
 void DESEncodeNonce(SNewtNonce * initVect, SNewtNonce * outNonce)
 {
-	SNewtNonce * pNonce;
-	SNewtNonce   keysArray[16];
+	DESKeySchedule schedule;
 
-	DESKeySched(initVect, keysArray);
-	pNonce = outNonce;
-	DESEncode(keysArray, sizeof(SNewtNonce), &pNonce);
+	DESFastKeySched(initVect, &schedule);
+	DESFastEncode(&schedule, outNonce, 1);
 }
 
 
@@ -412,68 +546,30 @@ void DESEncodeNonce(SNewtNonce * initVect, SNewtNonce * outNonce)
 
 void DESDecode(SNewtNonce * keys, int byteCount, SNewtNonce ** memPtr)
 {
-	int i;
-	SNewtNonce permutedData;
-	SNewtNonce * keyPtr = *memPtr;
-	SNewtNonce * kPtr;
-	uint32_t keyHi, keyLo;
+	DESKeySchedule schedule;
+	int count = byteCount / (int)sizeof(SNewtNonce);
 
-	while ((byteCount -= sizeof(SNewtNonce)) >= 0)
-	{
-		kPtr = keys;
-		DESip(keyPtr->hi, keyPtr->lo, &permutedData);
-		keyHi = permutedData.hi;
-		keyLo = permutedData.lo;
-		for (i = 0; i < 8; i++)
-		{
-			keyHi ^= DESfrk(kPtr->hi, kPtr->lo, keyLo);	kPtr++;
-			keyLo ^= DESfrk(kPtr->hi, kPtr->lo, keyHi);	kPtr++;
-		}
-		DESPermute(DESIPInvTbl, keyLo, keyHi, keyPtr++);
-	}
-	*memPtr = keyPtr;
+	DESSplitKeys(keys, &schedule);
+	DESFastDecode(&schedule, *memPtr, count);
+	*memPtr += count;
 }
 
 
 void DESCBCDecode(SNewtNonce * keys, int byteCount, SNewtNonce ** memPtr, SNewtNonce * a4)
 {
-	int i;
-	SNewtNonce permutedData, huh;
-	SNewtNonce * keyPtr = *memPtr;
-	SNewtNonce * kPtr;
-	uint32_t dataHi, dataLo;
+	DESKeySchedule schedule;
+	int count = byteCount / (int)sizeof(SNewtNonce);
 
-	while ((byteCount -= sizeof(SNewtNonce)) >= 0)
-	{
-		kPtr = keys;
-		huh = **memPtr;
-		DESip(huh.hi, huh.lo, &permutedData);
-		dataHi = permutedData.hi;
-		dataLo = permutedData.lo;
-		for (i = 0; i < 8; i++)
-		{
-			dataHi ^= DESfrk(kPtr->hi, kPtr->lo, dataLo);	kPtr++;
-			dataLo ^= DESfrk(kPtr->hi, kPtr->lo, dataHi);	kPtr++;
-		}
-		DESPermute(DESIPInvTbl, dataLo, dataHi, &permutedData);
-		dataHi = permutedData.hi ^ a4->hi;
-		dataLo = permutedData.lo ^ a4->lo;
-		*a4 = huh;
-		keyPtr->hi = dataHi;
-		keyPtr->lo = dataLo;
-		keyPtr++;
-	}
-	*memPtr = keyPtr;
+	DESSplitKeys(keys, &schedule);
+	DESFastCBCDecode(&schedule, *memPtr, count, a4);
+	*memPtr += count;
 }
 
 
 void DESDecodeNonce(SNewtNonce * initVect, SNewtNonce * outNonce)
 {
-	SNewtNonce *	pNonce;
-	SNewtNonce		keysArray[16];
+	DESKeySchedule schedule;
 
-	DESKeySched(initVect, keysArray);
-	pNonce = outNonce;
-	DESDecode(keysArray, sizeof(SNewtNonce), &pNonce);
+	DESFastKeySched(initVect, &schedule);
+	DESFastDecode(&schedule, outNonce, 1);
 }
-
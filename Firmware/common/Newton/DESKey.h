@@ -7,6 +7,7 @@
 #define ND_NEWTON_DES_KEY_H
 
 #include <cstdint>
+#include <vector>
 
 typedef unsigned short UniChar;
 
@@ -16,6 +17,20 @@ typedef struct
 	uint32_t lo;
 } SNewtNonce;
 
+// The subkeys of a key schedule, split into the eight 6 bit S-Box inputs.
+typedef struct
+{
+	uint8_t k[16][8];
+} DESKeySchedule;
+
+// The key schedule for the most recently used password.
+typedef struct
+{
+	std::vector<UniChar> password;
+	DESKeySchedule schedule;
+	bool valid = false;
+} DESPasswordKey;
+
 void DESCharToKey(UniChar * inString, SNewtNonce * outKey);
 void DESKeySched(SNewtNonce * inKey, SNewtNonce * outKeys);
 void DESPermute(const unsigned char * inPermuteTable, uint32_t inHi, uint32_t inLo, SNewtNonce * outKey);
@@ -27,4 +42,12 @@ void DESDecode(SNewtNonce * keys, int byteCount, SNewtNonce ** memPtr);
 void DESCBCDecode(SNewtNonce * keys, int byteCount, SNewtNonce ** memPtr, SNewtNonce * a4);
 void DESDecodeNonce(SNewtNonce * initVect, SNewtNonce * outNonce);
 
+// Table driven engine
+void DESFastKeySched(const SNewtNonce * inKey, DESKeySchedule * outSchedule);
+const DESKeySchedule * DESPasswordSchedule(DESPasswordKey * ioCache, const UniChar * inPassword);
+void DESFastEncode(const DESKeySchedule * inSchedule, SNewtNonce * ioBlocks, int inCount);
+void DESFastDecode(const DESKeySchedule * inSchedule, SNewtNonce * ioBlocks, int inCount);
+void DESFastCBCEncode(const DESKeySchedule * inSchedule, SNewtNonce * ioBlocks, int inCount, SNewtNonce * ioVector);
+void DESFastCBCDecode(const DESKeySchedule * inSchedule, SNewtNonce * ioBlocks, int inCount, SNewtNonce * ioVector);
+
 #endif // ND_NEWTON_DES_KEY_H
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #include "main.h"
 
+#include <cstring>
 #include <typeinfo>
 
 using namespace nd;
@@ -22,46 +23,19 @@ const Symbol nd::symCreated { "created" };
 const Symbol nd::symModified { "modified" };
 const Symbol nd::symPath { "path" };
 const Symbol nd::symIcon { "icon" };
+const Symbol nd::symSignature { "signature" };
 
 
-Ref::Ref(const Ref &other) : type_(other.type_) {
-    switch (type_) {
-        case Type::INT: int_ = other.int_; break;
-        case Type::BOOL: bool_ = other.bool_; break;
-        case Type::CHAR16: char_ = other.char_; break;
-        case Type::REAL: real_ = other.real_; break;
-        case Type::OBJECT: 
-            object_ = other.object_; 
-            if (object_->ref_count_) object_->ref_count_++;
-            break;
-    }
-}
+const Ref Frame::nil_ { };
 
-Ref::Ref(Ref &&other) noexcept : type_(other.type_) {
-    switch (type_) {
-        case Type::INT: int_ = other.int_; break;
-        case Type::BOOL: bool_ = other.bool_; break;
-        case Type::CHAR16: char_ = other.char_; break;
-        case Type::REAL: real_ = other.real_; break;
-        case Type::OBJECT: object_ = other.object_; break;
-    }
-    other.type_ = Type::INT; // Reset the moved-from object
+Ref::Ref(real d) : Ref(Real::New(d)) {
 }
 
 Ref &Ref::operator=(const Ref &other) {
     if (this != &other) {
+        other.retain_();
         clear_();
-        type_ = other.type_;
-        switch (type_) {
-            case Type::INT: int_ = other.int_; break;
-            case Type::BOOL: bool_ = other.bool_; break;
-            case Type::CHAR16: char_ = other.char_; break;
-            case Type::REAL: real_ = other.real_; break;
-            case Type::OBJECT: 
-                object_ = other.object_; 
-                if (object_->ref_count_) object_->ref_count_++;
-                break;
-        }
+        ref_ = other.ref_;
     }
     return *this;
 }
@@ -69,53 +43,83 @@ Ref &Ref::operator=(const Ref &other) {
 Ref &Ref::operator=(Ref &&other) noexcept {
     if (this != &other) {
         clear_();
-        type_ = other.type_;
-        switch (type_) {
-            case Type::INT: int_ = other.int_; break;
-            case Type::BOOL: bool_ = other.bool_; break;
-            case Type::CHAR16: char_ = other.char_; break;
-            case Type::REAL: real_ = other.real_; break;
-            case Type::OBJECT: object_ = other.object_; break;
-        }
-        other.type_ = Type::INT; // Reset the moved-from object
+        ref_ = other.ref_;
+        other.ref_ = kNIL; // Reset the moved-from object
     }
     return *this;
 }
 
+/**
+ * \brief Compare two Refs by value.
+ * Immediates are equal if their tagged values are equal. Objects are compared
+ * by their contents.
+ */
+bool Ref::equals(const Ref &other) const {
+    if (ref_ == other.ref_) return true;
+    Object *a = as_object(), *b = other.as_object();
+    if (!a || !b || (a->type() != b->type())) return false;
+    return a->equals(*b);
+}
+
+/**
+ * \brief Hash a Ref by value, so that equal values create equal hashes.
+ */
+uint32_t Ref::hash() const {
+    Object *obj = as_object();
+    if (obj) return obj->hash();
+    return (uint32_t)ref_ * 2654435761u;
+}
+
+/**
+ * \brief Create a Ref from an immediate as it appears in an NSOF stream.
+ * Integers, characters, NIL, and TRUE are stored verbatim. Pointer tags and
+ * magic pointers are not valid outside of the Newton and are rejected.
+ */
 Ref Ref::Raw(uint32_t v) {
-    if (v == 0x0000001A) return Ref(true);
-    if (v == 0x00000002) return Ref(false);
-    if ((v & 0x00000003) == 0x00000000) return Ref( ((int32_t)(v)) >> 2 );
+    Ref ref;
+    if (   ((v & kTagMask) == kIntTag)
+        || ((v & kCharMask) == kCharTag)
+        || (v == kNIL) || (v == kTRUE))
+    {
+        ref.ref_ = v;
+        return ref;
+    }
     //if ((v & 0x00000003) == 0x00000003) return Ref( ((int32_t)(v)) >> 2 ); // Magic Pointer
-    if ((v & 0x0000000F) == 0x00000006) return Ref( (char16_t)(v >> 4) ); // UniChar
     if (kLogNSOF) Log.log("NSOF: Ref::Raw: unknown type\n");
-    return Ref(false);
+    return ref;
 }
 
-Ref::~Ref()  // Destructor
-{
-    clear_();
+/**
+ * \brief Create a Ref to an Object that is owned by someone else.
+ * The ref count of dynamic objects is incremented, static objects are shared.
+ */
+Ref Ref::Retain(const Object *obj) {
+    Ref ref(const_cast<Object*>(obj));
+    ref.retain_();
+    return ref;
 }
 
-void Ref::clear_() {
-    if (type_ == Type::OBJECT && object_->ref_count_) {
-        object_->ref_count_--; // Decrement ref count of the old object
-        if (object_->ref_count_ == 0) {
-            // Log.log("\n\nGC delete ");
-            // object_->log(1, 0);
-            // Log.log("\n");
-            delete object_;
-        }
+Ref::Type Ref::type() const {
+    switch (ref_ & kTagMask) {
+        case kIntTag: return Type::INT;
+        case kPointerTag: return as_object()->is_real() ? Type::REAL : Type::OBJECT;
+        default: return is_char16() ? Type::CHAR16 : Type::BOOL;
     }
-    type_ = Type::INT; // Reset to default type
-    int_ = 0; // Reset the integer value
 }
 
+bool Ref::is_real() const {
+    return is_object() && as_object()->is_real();
+}
+
+real Ref::as_real() const {
+    if (is_real()) return static_cast<Real*>(as_object())->value();
+    return 0.0f;
+}
 
 void Ref::log(uint32_t depth, uint32_t indent) const
 {
     if (depth == 0) return; // No logging if depth is zero
-    switch (type_) {
+    switch (type()) {
         case Type::INT: // int32_t
             Log.indent(indent);
             Log.logf("%d", as_int());
@@ -132,10 +136,7 @@ void Ref::log(uint32_t depth, uint32_t indent) const
             Log.indent(indent);
             Log.logf("%c", as_char16());
             break;
-        case Type::REAL: // float
-            Log.indent(indent);
-            Log.logf("%f", as_real());
-            break;
+        case Type::REAL: // boxed float
         case Type::OBJECT: // call virtual function Object::log()
             as_object()->log(depth, indent);
             break;
@@ -155,32 +156,36 @@ void Ref::logcomma(uint32_t depth, uint32_t indent) const {
 
 String *Ref::as_string() const
 {
-    if (type_ == Type::OBJECT && object_->is_string()) {
-        return static_cast<String*>(object_);
+    Object *obj = as_object();
+    if (obj && obj->is_string()) {
+        return static_cast<String*>(obj);
     }
     return nullptr; // Not a string
 }
 
 Array *Ref::as_array() const
 {
-    if (type_ == Type::OBJECT && object_->is_array()) {
-        return static_cast<Array*>(object_);
+    Object *obj = as_object();
+    if (obj && obj->is_array()) {
+        return static_cast<Array*>(obj);
     }
     return nullptr; // Not an array
 }
 
 Frame *Ref::as_frame() const
 {
-    if (type_ == Type::OBJECT && object_->is_frame()) {
-        return static_cast<Frame*>(object_);
+    Object *obj = as_object();
+    if (obj && obj->is_frame()) {
+        return static_cast<Frame*>(obj);
     }
     return nullptr; // Not a frame
 }
 
 Symbol *Ref::as_symbol() const
 {
-    if (type_ == Type::OBJECT && object_->is_symbol()) {
-        return static_cast<Symbol*>(object_);
+    Object *obj = as_object();
+    if (obj && obj->is_symbol()) {
+        return static_cast<Symbol*>(obj);
     }
     return nullptr; // Not a symbol
 }
@@ -189,25 +194,121 @@ Symbol *Ref::as_symbol() const
 
 // This array will be filled by the Symbol constructor
 // and contains all known symbols. It is used to find symbols by name.
-std::vector<Symbol*> Symbol::known_symbols_;
+// It is created on first use, because the static Symbols above are
+// constructed before any static array in this file would be.
+std::vector<Symbol*> &Symbol::known_symbols_() {
+    static std::vector<Symbol*> known_symbols;
+    return known_symbols;
+}
 
 Symbol::Symbol(const char *name) : sym_(name) { 
     type_ = Type::SYMBOL; 
-    known_symbols_.push_back(this); // Add to known symbols
+    known_symbols_().push_back(this); // Add to known symbols
 }
 
 Symbol::Symbol(const std::string &name) : sym_(name) { 
     type_ = Type::SYMBOL; 
-    known_symbols_.push_back(this); // Add to known symbols
+    known_symbols_().push_back(this); // Add to known symbols
 }
 
 const Symbol *Symbol::find(const std::string &name) {
-    for (auto &sym : known_symbols_) {
+    for (auto &sym : known_symbols_()) {
         if (sym->sym_ == name) return sym;
     }
     return &symUnknown;
 }
 
+// FNV-1a, good enough to find candidates for precedents
+static uint32_t fnv1a(uint32_t h, uint32_t v) {
+    return (h ^ v) * 16777619u;
+}
+
+static constexpr uint32_t kFNVBasis = 2166136261u;
+
+// NewtonScript symbols are not case sensitive
+static char to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (c + 32) : c;
+}
+
+uint32_t Symbol::hash() const {
+    uint32_t h = fnv1a(kFNVBasis, (uint32_t)Type::SYMBOL);
+    for (char c: sym_) h = fnv1a(h, (uint8_t)to_lower(c));
+    return h;
+}
+
+bool Symbol::equals(const Object &other) const {
+    if (this == &other) return true;
+    if (!other.is_symbol()) return false;
+    const std::string &o = static_cast<const Symbol&>(other).sym_;
+    if (o.size() != sym_.size()) return false;
+    for (size_t i = 0; i < sym_.size(); ++i) {
+        if (to_lower(o[i]) != to_lower(sym_[i])) return false;
+    }
+    return true;
+}
+
+uint32_t String::hash() const {
+    uint32_t h = fnv1a(kFNVBasis, (uint32_t)Type::STRING);
+    for (char16_t c: str_) h = fnv1a(h, c);
+    return h;
+}
+
+bool String::equals(const Object &other) const {
+    return (this == &other) || (other.is_string() && static_cast<const String&>(other).str_ == str_);
+}
+
+// Hash the bit pattern. Converting to an integer is undefined for large
+// values, infinity, and NaN. 0.0 and -0.0 are equal, so they hash the same.
+uint32_t Real::hash() const {
+    real value = (value_ == 0) ? 0 : value_;
+    uint8_t bits[sizeof(real)];
+    memcpy(bits, &value, sizeof(real));
+    uint32_t h = fnv1a(kFNVBasis, (uint32_t)Type::REAL);
+    for (uint8_t b: bits) h = fnv1a(h, b);
+    return h;
+}
+
+bool Real::equals(const Object &other) const {
+    return (this == &other) || (other.is_real() && static_cast<const Real&>(other).value_ == value_);
+}
+
+uint32_t Array::hash() const {
+    uint32_t h = fnv1a(kFNVBasis, (uint32_t)Type::ARRAY);
+    for (auto &ref: elements_) h = fnv1a(h, ref.hash());
+    return h;
+}
+
+bool Array::equals(const Object &other) const {
+    if (this == &other) return true;
+    if (!other.is_array()) return false;
+    const Array &o = static_cast<const Array&>(other);
+    if (o.elements_.size() != elements_.size()) return false;
+    for (size_t i = 0; i < elements_.size(); ++i) {
+        if (!elements_[i].equals(o.elements_[i])) return false;
+    }
+    return true;
+}
+
+// Two frames are equal if they have the same map (keys in the same order)
+// and equal values.
+uint32_t Frame::hash() const {
+    uint32_t h = fnv1a(kFNVBasis, (uint32_t)Type::FRAME);
+    for (auto &slot: frame_) h = fnv1a(fnv1a(h, slot.first->hash()), slot.second.hash());
+    return h;
+}
+
+bool Frame::equals(const Object &other) const {
+    if (this == &other) return true;
+    if (!other.is_frame()) return false;
+    const Frame &o = static_cast<const Frame&>(other);
+    if (o.frame_.size() != frame_.size()) return false;
+    for (size_t i = 0; i < frame_.size(); ++i) {
+        if (!frame_[i].first->equals(*o.frame_[i].first)) return false;
+        if (!frame_[i].second.equals(o.frame_[i].second)) return false;
+    }
+    return true;
+}
+
 void Symbol::log(uint32_t depth, uint32_t indent) const {
     if (depth == 0) return; // No logging if depth is zero
     Log.indent(indent);
@@ -232,6 +333,12 @@ void String::log(uint32_t depth, uint32_t indent) const {
     Log.log("\"");
 }
 
+void Real::log(uint32_t depth, uint32_t indent) const {
+    if (depth == 0) return; // No logging if depth is zero
+    Log.indent(indent);
+    Log.logf("%f", (double)value_);
+}
+
 void Array::log(uint32_t depth, uint32_t indent) const {
     if (depth == 0) return; // No logging if depth is zero
     Log.indent(indent);
@@ -271,7 +378,7 @@ void Frame::log(uint32_t depth, uint32_t indent) const {
 // -----------------------------------------------------------------------------
 
 
-void push_xlong(std::vector<uint8_t> &vec, int32_t value) {
+void nd::push_xlong(std::vector<uint8_t> &vec, int32_t value) {
     if ((value >= 0) && (value < 255)) {
         vec.push_back((uint8_t)value); // 1-byte integer
     } else {
@@ -285,11 +392,10 @@ void push_xlong(std::vector<uint8_t> &vec, int32_t value) {
 
 void Ref::to_nsof(NSOF &nsof) const
 {
-    int32_t v;
-    switch (type_) {
-        case Type::INT: // int
+    switch (type()) {
+        case Type::INT: // int, already in NewtonScript format
             nsof.data().push_back(0);
-            push_xlong(nsof.data(), as_int() << 2);
+            push_xlong(nsof.data(), (int32_t)ref_);
             break;
         case Type::BOOL: // bool
             if (as_bool()) {
@@ -310,11 +416,7 @@ void Ref::to_nsof(NSOF &nsof) const
                 nsof.data().push_back(c & 0xFF); // low byte
             }
             break; }
-        case Type::REAL: // float
-            // TODO: later
-            nsof.data().push_back(0);
-            nsof.data().push_back(0x02);
-            break;
+        case Type::REAL: // boxed float
         case Type::OBJECT: // SymbolRef
             as_object()->to_nsof(nsof);
             break;
@@ -325,9 +427,29 @@ void Ref::to_nsof(NSOF &nsof) const
  * \brief Write a precedent marker if the object was previously written.
  * If it was not, add the object to the precedent list and return false, so the
  * caller will write the object.
+ *
+ * By default, objects are identified by their address. If `dedup_values()` is
+ * set, objects with equal contents are written only once, and all later
+ * copies become precedents. The Newton decodes those as the same object,
+ * so this is only used for replies that the Newton does not modify.
  */
 bool NSOF::write_precedent(const Object *obj) {
     if (!obj) return false;
+    if (dedup_values_) {
+        uint32_t h = obj->hash();
+        auto range = value_index_.equal_range(h);
+        for (auto it = range.first; it != range.second; ++it) {
+            uint32_t i = it->second;
+            if (precedent_[i]->equals(*obj)) {
+                data().push_back(0x09);
+                push_xlong(data(), i);
+                return true; // Indicate that an equal object was already written
+            }
+        }
+        value_index_.emplace(h, precedent_.size());
+        precedent_.push_back(obj);
+        return false;
+    }
     int i = 0;
     for (i = 0; i<precedent_.size(); i++) {
         if (precedent_[i] == obj) {
@@ -341,6 +463,12 @@ bool NSOF::write_precedent(const Object *obj) {
     return false;
 }
 
+void Real::to_nsof(NSOF &nsof) const {
+    // TODO: later
+    nsof.data().push_back(0);
+    nsof.data().push_back(0x02);
+}
+
 void Symbol::to_nsof(NSOF &nsof) const {
     if (nsof.write_precedent(this)) return; // If already written, just return
     nsof.data().push_back(7);
@@ -491,8 +619,8 @@ Ref NSOF::to_ref_(int32_t &error_code)
             if (error_code) return Ref(false);
             std::string str;
             if (kLogNSOF) Log.log("\n\nSYMBOL:\n");
-            while (size > 1) {
-                if (crsr_ + 1 >= data_.size()) {
+            while (size > 0) {
+                if (crsr_ >= data_.size()) {
                     if (kLogNSOF) Log.log("NSOF: to_ref: Symbol too short\n");
                     error_code = -54002; // Zero Length data
                     return Ref(false);
@@ -511,7 +639,7 @@ Ref NSOF::to_ref_(int32_t &error_code)
             if (kLogNSOF) Log.log("\nDONE\n");
             const Symbol *sym = Symbol::find(str); // -> existing symbols only!
             precedent_.push_back(sym); // Add to precedent list
-            return Ref(sym); }
+            return Ref::Retain(sym); }
         case 8: { // String
             uint32_t size = get_xlong(error_code);
             if (error_code) return Ref(false);
@@ -549,7 +677,7 @@ Ref NSOF::to_ref_(int32_t &error_code)
                 error_code = -28210; // Invalid Type
                 return Ref(false);
             }
-            return Ref(precedent_[index]); }
+            return Ref::Retain(precedent_[index]); }
         case 10: // NIL
             if (kLogNSOF) Log.log("NSOF: to_ref: NIL\n");
             return Ref(false); // Return a Ref with false, indicating NIL
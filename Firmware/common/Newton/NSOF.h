@@ -26,6 +26,23 @@ class NSOF;
 
 using real = float;
 
+void push_xlong(std::vector<uint8_t> &vec, int32_t value);
+/// Number of bytes that push_xlong() writes for `value`.
+inline uint32_t xlong_size(int32_t value) { return ((value >= 0) && (value < 255)) ? 1 : 5; }
+
+/**
+ * \brief A NewtonScript reference packed into a single machine word.
+ *
+ * Refs use the NewtonScript tagging scheme. Integers are stored shifted left
+ * by two bits with the tag 00. Pointers to Objects are aligned and carry the
+ * tag 01. Immediates carry the tag 10: characters are stored as `c<<4 | 0x6`,
+ * NIL is 0x02, and TRUE is 0x1A. This makes a Ref exactly 32 bits wide on the
+ * RP2040 and the size of a pointer on 64 bit hosts. Copying an immediate
+ * Ref never touches memory outside the Ref itself.
+ *
+ * Integers are 30 bits wide, just like in NewtonScript. Reals don't fit into
+ * the tagged word and are boxed into a Real object.
+ */
 class Ref
 {
 public:
@@ -33,46 +50,54 @@ public:
         INT, BOOL, CHAR16, REAL, OBJECT
     };
 private:
-    union {
-        int32_t     int_ = 0;
-        bool        bool_;
-        char16_t    char_;
-        real        real_;
-        Object      *object_;
-    };
-    Type type_ = Type::INT;
+    static constexpr uintptr_t kTagMask = 0x03;
+    static constexpr uintptr_t kIntTag = 0x00;
+    static constexpr uintptr_t kPointerTag = 0x01;
+    static constexpr uintptr_t kCharMask = 0x0F;
+    static constexpr uintptr_t kCharTag = 0x06;
+    static constexpr uintptr_t kNIL = 0x02;
+    static constexpr uintptr_t kTRUE = 0x1A;
+    uintptr_t ref_ = kNIL;
+    void retain_() const;
     void clear_();
 public:
-    Ref() : bool_(false), type_(Type::BOOL) {}
+    Ref() = default;
 #ifdef ND_TARGET_PICO
-    explicit Ref(int32_t i) : int_(i), type_(Type::INT) {}
-    Ref(int i) : int_(i), type_(Type::INT) {}
+    explicit Ref(int32_t i) : ref_((uint32_t)i << 2) {}
+    Ref(int i) : ref_((uint32_t)i << 2) {}
 #else
-    Ref(int32_t i) : int_(i), type_(Type::INT) {}
+    Ref(int32_t i) : ref_((uint32_t)i << 2) {}
 #endif
-    Ref(bool b) : bool_(b), type_(Type::BOOL) {}
-    Ref(char16_t c) : char_(c), type_(Type::CHAR16) {}
-    Ref(real d) : real_(d), type_(Type::REAL) {}
-    Ref(Object *obj) : object_(obj), type_(Type::OBJECT) {}
-    Ref(Object &obj) : object_(&obj), type_(Type::OBJECT) {}
-    Ref(const Ref &other);
-    Ref(Ref &&other) noexcept;
+    Ref(bool b) : ref_(b ? kTRUE : kNIL) {}
+    Ref(char16_t c) : ref_(((uintptr_t)c << 4) | kCharTag) {}
+    Ref(real d);
+    Ref(Object *obj) : ref_(obj ? (reinterpret_cast<uintptr_t>(obj) | kPointerTag) : kNIL) {}
+    Ref(Object &obj) : ref_(reinterpret_cast<uintptr_t>(&obj) | kPointerTag) {}
+    // Use Ref::Retain() for shared objects. Without this, a const pointer would silently convert to bool.
+    Ref(const Object *obj) = delete;
+    Ref(const Ref &other) : ref_(other.ref_) { retain_(); }
+    Ref(Ref &&other) noexcept : ref_(other.ref_) { other.ref_ = kNIL; }
     Ref &operator=(const Ref &other);
     Ref &operator=(Ref &&other) noexcept;
     static Ref Raw(uint32_t v);
-    ~Ref();
+    static Ref Retain(const Object *obj);
+    ~Ref() { clear_(); }
 
-    Type type() const { return type_; }
-    bool is_int() const { return type_ == Type::INT; }
-    bool is_bool() const { return type_ == Type::BOOL; }
-    bool is_char16() const { return type_ == Type::CHAR16; }
-    bool is_real() const { return type_ == Type::REAL; }
-    bool is_object() const { return type_ == Type::OBJECT; }
-    int32_t as_int() const { return int_; }
-    bool as_bool() const { return bool_; }
-    char16_t as_char16() const { return char_; }
-    real as_real() const { return real_; }
-    Object *as_object() const { return object_; }
+    Type type() const;
+    uintptr_t raw() const { return ref_; }
+    bool is_int() const { return (ref_ & kTagMask) == kIntTag; }
+    bool is_bool() const { return (ref_ == kNIL) || (ref_ == kTRUE); }
+    bool is_nil() const { return ref_ == kNIL; }
+    bool is_char16() const { return (ref_ & kCharMask) == kCharTag; }
+    bool is_real() const;
+    bool is_object() const { return (ref_ & kTagMask) == kPointerTag; }
+    bool equals(const Ref &other) const;
+    uint32_t hash() const;
+    int32_t as_int() const { return ((int32_t)(uint32_t)ref_) >> 2; }
+    bool as_bool() const { return ref_ != kNIL; }
+    char16_t as_char16() const { return (char16_t)(ref_ >> 4); }
+    real as_real() const;
+    Object *as_object() const { return is_object() ? reinterpret_cast<Object*>(ref_ & ~kTagMask) : nullptr; }
     String *as_string() const;
     Array *as_array() const;
     Frame *as_frame() const;
@@ -88,7 +113,7 @@ class Object {
     friend class Ref;
 public:
     enum class Type {
-        UNKNOWN, SYMBOL, STRING, ARRAY, FRAME
+        UNKNOWN, SYMBOL, STRING, ARRAY, FRAME, REAL
     };
 protected:
     Type type_ = Type::UNKNOWN;
@@ -98,16 +123,37 @@ public:
     virtual ~Object() = default;
     virtual void log(uint32_t depth=999, uint32_t indent=0) const = 0;
     virtual void to_nsof(NSOF &nsof) const = 0;
+    virtual uint32_t hash() const { return 0; }
+    virtual bool equals(const Object &other) const { return this == &other; }
     Type type() const { return type_; }
     bool is_symbol() const { return type_ == Type::SYMBOL; }
     bool is_string() const { return type_ == Type::STRING; }
     bool is_array() const { return type_ == Type::ARRAY; }
     bool is_frame() const { return type_ == Type::FRAME; }
+    bool is_real() const { return type_ == Type::REAL; }
 };
 
+// Objects with a ref count of 0 are static and never counted or deleted.
+inline void Ref::retain_() const {
+    if (is_object()) {
+        Object *obj = as_object();
+        if (obj->ref_count_) obj->ref_count_++;
+    }
+}
+
+inline void Ref::clear_() {
+    if (is_object()) {
+        Object *obj = as_object();
+        if (obj->ref_count_ && --obj->ref_count_ == 0) {
+            delete obj;
+        }
+    }
+    ref_ = kNIL;
+}
+
 class Symbol : public Object {
 protected:
-    static std::vector<Symbol*> known_symbols_;
+    static std::vector<Symbol*> &known_symbols_();
     std::string sym_;
 public:
     Symbol(const char *name);
@@ -115,6 +161,8 @@ public:
     static const Symbol *find(const std::string &name);
     void log(uint32_t depth=999, uint32_t indent=0) const override;
     void to_nsof(NSOF &nsof) const override;
+    uint32_t hash() const override;
+    bool equals(const Object &other) const override;
 };
 
 extern const Symbol symName;
@@ -127,6 +175,7 @@ extern const Symbol symCreated;
 extern const Symbol symModified;
 extern const Symbol symPath;
 extern const Symbol symIcon;
+extern const Symbol symSignature;
 extern const Symbol symUnknown;
 
 class String : public Object {
@@ -139,9 +188,24 @@ public:
     static String *New(const std::u16string &name) { return new String(name, 1); }
     void log(uint32_t depth=999, uint32_t indent=0) const override;
     void to_nsof(NSOF &nsof) const override;
+    uint32_t hash() const override;
+    bool equals(const Object &other) const override;
     const std::u16string &str() const { return str_; }
 };
 
+class Real : public Object {
+protected:
+    real value_;
+public:
+    Real(real value, int32_t refcount=0) : value_(value) { type_ = Type::REAL; ref_count_ = refcount; }
+    static Real *New(real value) { return new Real(value, 1); }
+    void log(uint32_t depth=999, uint32_t indent=0) const override;
+    void to_nsof(NSOF &nsof) const override;
+    uint32_t hash() const override;
+    bool equals(const Object &other) const override;
+    real value() const { return value_; }
+};
+
 class Array : public Object {
 protected:
     std::vector<Ref> elements_;
@@ -151,14 +215,19 @@ public:
     static Array *New() { return new Array(1); }
     static Array *New(std::initializer_list<Ref> init) { return new Array(init, 1); }
     void add(const Ref &ref) { elements_.push_back(ref); }
+    void add(Ref &&ref) { elements_.push_back(std::move(ref)); }
     void log(uint32_t depth=999, uint32_t indent=0) const override;
     void to_nsof(NSOF &nsof) const override;
+    uint32_t hash() const override;
+    bool equals(const Object &other) const override;
     uint32_t size() const { return elements_.size(); }
-    Ref at(uint32_t index) const { return elements_[index]; }
+    /// Borrow an element without touching its ref count. Copy the Ref to keep it.
+    const Ref &at(uint32_t index) const { return elements_[index]; }
 };
 
 class Frame : public Object {
     std::vector<std::pair<const Symbol*, Ref>> frame_;
+    static const Ref nil_;
 public:
     Frame(int32_t refcount=0) { type_ = Type::FRAME; ref_count_ = refcount; }
     static Frame *New() { return new Frame(1); }
@@ -168,13 +237,23 @@ public:
     void set(int ix, const Ref &value) {
         frame_[ix].second = value;
     }
+    uint32_t size() const { return frame_.size(); }
+    /// Borrow the slot value for a key, or NIL if the frame has no such slot.
+    const Ref &at(const Symbol &key) const {
+        for (auto &slot: frame_) if (slot.first == &key) return slot.second;
+        return nil_;
+    }
     void log(uint32_t depth=999, uint32_t indent=0) const override;
     void to_nsof(NSOF &nsof) const override;
+    uint32_t hash() const override;
+    bool equals(const Object &other) const override;
 };
 
 class NSOF {
     std::vector<uint8_t> data_;
     std::vector<const Object*> precedent_;
+    std::unordered_multimap<uint32_t, uint32_t> value_index_; // hash -> index in precedent_
+    bool dedup_values_ = false;
     uint32_t crsr_ = 0;
     Ref to_ref_(int32_t &error_code);
     int32_t get_xlong(int32_t &error_code);
@@ -183,12 +262,14 @@ public:
     NSOF(const std::vector<uint8_t> &data, uint32_t crsr=0) : data_(data), crsr_(crsr) {}
     bool append(uint8_t byte); // return true when the stream reached its end
     void assign(const std::vector<uint8_t> &vec) { data_ = vec; }
-    void clear() { data_.clear(); precedent_.clear(); }
+    void clear() { data_.clear(); precedent_.clear(); value_index_.clear(); }
     int size() const { return data_.size(); }
     //Ref to_ref() { return Ref(false); }
     std::vector<uint8_t> &to_nsof(Ref ref) { data_.push_back(0x02); ref.to_nsof(*this); return data_; }
     std::vector<uint8_t> &data() { return data_; }
     void log();
+    /// Write equal values only once and refer to them by precedent. Use for read-only replies.
+    void dedup_values(bool dedup) { dedup_values_ = dedup; }
     bool write_precedent(const Object *obj);
     Ref to_ref(int32_t &error_code);
 };
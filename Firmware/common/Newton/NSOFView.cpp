@@ -0,0 +1,291 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "NSOFView.h"
+
+#include "main.h"
+
+using namespace nd;
+
+
+/**
+ * \class nd::NSOFView
+ * \brief Typed, allocation free access to small NSOF payloads.
+ *
+ * Most Dock commands that the Newton sends us have a fixed shape: a file
+ * name is a single String, a path is an Array of Frames and Strings.
+ * Converting those into a tree of Refs allocates an Object for every item,
+ * only to copy a few characters out of it again. NSOFView instead walks the
+ * received bytes in place and hands out NSOFStringViews that point right
+ * into the command buffer.
+ *
+ * Precedents are remembered by their offset in the stream. Only the first
+ * `kMaxPrecedents` are tracked. Anything beyond that, or any unexpected type,
+ * makes the view `unsupported()`, and the caller decodes the payload with
+ * NSOF::to_ref() instead.
+ */
+
+void NSOFStringView::copy_to(std::u16string &str) const {
+    str.clear();
+    append_to(str);
+}
+
+void NSOFStringView::append_to(std::u16string &str) const {
+    str.reserve(str.size() + size_);
+    for (uint32_t i = 0; i < size_; ++i) {
+        str.push_back((*this)[i]);
+    }
+}
+
+bool NSOFStringView::operator==(const std::u16string &str) const {
+    if (str.size() != size_) return false;
+    for (uint32_t i = 0; i < size_; ++i) {
+        if ((*this)[i] != str[i]) return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+bool NSOFView::fail_(int32_t error_code) {
+    if (error_code_ == 0) error_code_ = error_code;
+    return false;
+}
+
+// All bounds checks compare a length to `size_ - crsr_`, because `crsr_ + length`
+// may wrap for the lengths that a corrupt stream contains. `crsr_ <= size_`
+// is always true.
+
+bool NSOFView::get_xlong_(uint32_t &value) {
+    if (crsr_ >= size_) return fail_(-54002); // Zero Length data
+    value = data_[crsr_++];
+    if (value == 0xFF) {
+        if (4 > size_ - crsr_) return fail_(-54002); // Zero Length data
+        value = (data_[crsr_] << 24) | (data_[crsr_ + 1] << 16) |
+                (data_[crsr_ + 2] << 8) | data_[crsr_ + 3];
+        crsr_ += 4;
+    }
+    return true;
+}
+
+/**
+ * \brief Remember the position of an object that may be referenced by a precedent later.
+ */
+void NSOFView::add_precedent_(uint32_t pos) {
+    if (num_precedents_ < kMaxPrecedents) precedent_[num_precedents_] = pos;
+    num_precedents_++;
+}
+
+/**
+ * \brief Read the NSOF version byte.
+ */
+bool NSOFView::begin() {
+    if (crsr_ >= size_) return fail_(-54002); // Zero Length data
+    if (data_[crsr_++] != 0x02) {
+        if (kLogNSOF) Log.log("NSOFView: expected 0x02 at cursor\n");
+        return fail_(-28210); // Invalid Type
+    }
+    num_precedents_ = 0;
+    return true;
+}
+
+/**
+ * \brief Decode a String at the given position.
+ * On success, `end` is set to the position right after the String. The cursor
+ * is not changed.
+ */
+bool NSOFView::read_string_at_(uint32_t pos, NSOFStringView &str, uint32_t &end) {
+    uint32_t saved_crsr = crsr_;
+    if (pos >= size_) return fail_(-54002); // Zero Length data
+    crsr_ = pos;
+    if (data_[crsr_++] != 8) {
+        unsupported_ = true;
+        return false;
+    }
+    uint32_t size = 0;
+    if (!get_xlong_(size)) { crsr_ = saved_crsr; return false; }
+    if (size > size_ - crsr_) { crsr_ = saved_crsr; return fail_(-54002); } // Zero Length data
+    str = NSOFStringView(data_ + crsr_, (size >= 2) ? (size - 2) / 2 : 0);
+    end = crsr_ + size;
+    crsr_ = saved_crsr;
+    return true;
+}
+
+/**
+ * \brief Read a String or a precedent to a String.
+ */
+bool NSOFView::string(NSOFStringView &str) {
+    if (crsr_ >= size_) return fail_(-54002); // Zero Length data
+    uint32_t pos = crsr_;
+    uint8_t type = data_[crsr_];
+    uint32_t end = 0;
+    if (type == 8) {
+        if (!read_string_at_(pos, str, end)) return false;
+        add_precedent_(pos);
+        crsr_ = end;
+        return true;
+    } else if (type == 9) {
+        crsr_++;
+        uint32_t index = 0;
+        if (!get_xlong_(index)) return false;
+        if (index >= num_precedents_) return fail_(-28210); // Invalid Type
+        if (index >= kMaxPrecedents) {
+            unsupported_ = true;
+            return false;
+        }
+        return read_string_at_(precedent_[index], str, end);
+    }
+    unsupported_ = true;
+    return false;
+}
+
+/**
+ * \brief Read the header of a plain Array.
+ * The caller must then read or skip exactly `num_slots` values.
+ */
+bool NSOFView::array(uint32_t &num_slots) {
+    if (crsr_ >= size_) return fail_(-54002); // Zero Length data
+    if (data_[crsr_] != 5) {
+        unsupported_ = true;
+        return false;
+    }
+    add_precedent_(crsr_++);
+    return get_xlong_(num_slots);
+}
+
+/**
+ * \brief Compare the Symbol at `pos` to `name`. Symbols are not case sensitive.
+ */
+bool NSOFView::symbol_is_(uint32_t pos, const char *name) {
+    if (pos >= size_) return false;
+    uint32_t saved_crsr = crsr_;
+    crsr_ = pos + 1;
+    uint32_t size = 0;
+    bool ret = get_xlong_(size) && (size <= size_ - crsr_);
+    for (uint32_t i = 0; ret && i < size; ++i) {
+        char a = (char)data_[crsr_ + i], b = name[i];
+        if (b == 0 || (a | 0x20) != (b | 0x20)) ret = false;
+    }
+    ret = ret && (name[size] == 0);
+    crsr_ = saved_crsr;
+    return ret;
+}
+
+/**
+ * \brief Read an integer slot of a Frame without decoding the other slots.
+ * The cursor must be at the Frame. Afterwards, it points somewhere inside
+ * the Frame, so this must be the last call for this view.
+ * \return false if there is no such slot, or it is not an integer.
+ */
+bool NSOFView::frame_int(const char *slot, int32_t &value) {
+    if (crsr_ >= size_) return fail_(-54002); // Zero Length data
+    if (data_[crsr_] != 6) {
+        unsupported_ = true;
+        return false;
+    }
+    add_precedent_(crsr_++);
+    uint32_t n = 0;
+    if (!get_xlong_(n)) return false;
+    uint32_t match = n;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (crsr_ >= size_) return fail_(-54002); // Zero Length data
+        uint32_t pos = crsr_;
+        if (data_[crsr_] == 9) {
+            // A precedent to a Symbol that was used before
+            crsr_++;
+            uint32_t index = 0;
+            if (!get_xlong_(index)) return false;
+            if (index >= num_precedents_ || index >= kMaxPrecedents) {
+                unsupported_ = true;
+                return false;
+            }
+            pos = precedent_[index];
+        } else if (data_[crsr_] != 7 || !skip_(1)) {
+            unsupported_ = true;
+            return false;
+        }
+        if (data_[pos] == 7 && symbol_is_(pos, slot)) match = i;
+    }
+    for (uint32_t i = 0; i < match; ++i) {
+        if (!skip_(1)) return false;
+    }
+    if (match == n || crsr_ >= size_ || data_[crsr_] != 0) return false;
+    crsr_++;
+    uint32_t raw = 0;
+    if (!get_xlong_(raw)) return false;
+    if (raw & 3) return false; // an immediate, but not an integer
+    value = ((int32_t)raw) >> 2;
+    return true;
+}
+
+/**
+ * \brief Skip over the next value, including all values it contains.
+ */
+bool NSOFView::skip_(uint32_t depth) {
+    if (depth > kMaxDepth) {
+        unsupported_ = true;
+        return false;
+    }
+    if (crsr_ >= size_) return fail_(-54002); // Zero Length data
+    uint32_t pos = crsr_;
+    uint8_t type = data_[crsr_++];
+    uint32_t n = 0;
+    switch (type) {
+        case 0: // immediate
+        case 9: // precedent
+            return get_xlong_(n);
+        case 1: // character
+            n = 1;
+            break;
+        case 2: // unichar
+            n = 2;
+            break;
+        case 3: // binary [size, class, data]
+            add_precedent_(pos);
+            if (!get_xlong_(n)) return false;
+            if (!skip_(depth + 1)) return false;
+            break;
+        case 4: // array [#slots, class, values...]
+            add_precedent_(pos);
+            if (!get_xlong_(n)) return false;
+            if (!skip_(depth + 1)) return false;
+            for (uint32_t i = 0; i < n; i++)
+                if (!skip_(depth + 1)) return false;
+            n = 0;
+            break;
+        case 5: // plain array [#slots, values...]
+            add_precedent_(pos);
+            if (!get_xlong_(n)) return false;
+            for (uint32_t i = 0; i < n; i++)
+                if (!skip_(depth + 1)) return false;
+            n = 0;
+            break;
+        case 6: // frame [#slots, keys..., values...]
+            add_precedent_(pos);
+            if (!get_xlong_(n)) return false;
+            for (uint32_t i = 0; i < n; i++)
+                if (!skip_(depth + 1) || !skip_(depth + 1)) return false;
+            n = 0;
+            break;
+        case 7: // symbol [#characters, characters]
+        case 8: // string [#bytes, characters]
+            add_precedent_(pos);
+            if (!get_xlong_(n)) return false;
+            break;
+        case 10: // NIL
+            break;
+        case 11: // small rect [top, left, bottom, right]
+            add_precedent_(pos);
+            n = 4;
+            break;
+        default: // large binaries and unknown types
+            unsupported_ = true;
+            return false;
+    }
+    // `n` is the number of bytes that follow, check it before skipping them
+    if (n > size_ - crsr_) return fail_(-54002); // Zero Length data
+    crsr_ += n;
+    return true;
+}
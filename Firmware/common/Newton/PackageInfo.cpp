@@ -0,0 +1,78 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "PackageInfo.h"
+
+#include "main.h"
+
+#include <cstring>
+
+using namespace nd;
+
+
+/**
+ * \struct nd::PackageInfo
+ * \brief Read the package directory at the start of a Newton package file.
+ *
+ * A package starts with the signature "package0" or "package1", followed by
+ * big endian header fields, one entry per part, and a block of variable
+ * length data that holds the copyright and the name of the package. The
+ * first sector of the file is usually enough to read all of it.
+ *
+ * The header is checked well enough to reject files that are not packages,
+ * or that are obviously truncated, before we send them to the Newton.
+ */
+
+static uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/**
+ * \brief Parse the beginning of a package file.
+ * \param data the first bytes of the file
+ * \param size number of bytes in `data`
+ * \param file_size size of the entire file
+ * \return true if this looks like a valid package, `valid_` is set accordingly.
+ */
+bool PackageInfo::parse(const uint8_t *data, uint32_t size, uint32_t file_size)
+{
+    clear();
+    file_size_ = file_size;
+    if (size < kHeaderSize) return false;
+    if (memcmp(data, "package", 7) != 0 || (data[7] != '0' && data[7] != '1')) {
+        if (kLogSDCard) Log.log("PackageInfo: not a package\n");
+        return false;
+    }
+    id_ = get_u32(data + 8);
+    flags_ = get_u32(data + 12);
+    version_ = get_u32(data + 16);
+    size_ = get_u32(data + 28);
+    creation_date_ = get_u32(data + 32);
+    uint32_t directory_size = get_u32(data + 44);
+    part_count_ = get_u32(data + 48);
+    if (part_count_ == 0 || part_count_ > kMaxParts) return false;
+    uint32_t var_data = kHeaderSize + part_count_ * kPartEntrySize;
+    if (directory_size < var_data || directory_size > size_ || size_ > file_size) {
+        if (kLogSDCard) Log.logf("PackageInfo: bad header, package size %u, file size %u\n", size_, file_size);
+        return false;
+    }
+    valid_ = true;
+
+    // The name is optional for us. Skip it if it is not in the data that was read.
+    uint32_t name_offset = var_data + get_u16(data + 24);
+    uint32_t name_size = get_u16(data + 26);
+    if (name_offset + name_size <= size && name_offset + name_size <= directory_size) {
+        for (uint32_t i = 0; i + 1 < name_size; i += 2) {
+            char16_t c = get_u16(data + name_offset + i);
+            if (c == 0) break;
+            name_.push_back(c);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_NEWTON_PACKAGE_INFO_H
+#define ND_NEWTON_PACKAGE_INFO_H
+
+#include <string>
+#include <cstdint>
+
+
+namespace nd {
+
+/**
+ * \brief The interesting parts of a Newton package header.
+ */
+struct PackageInfo {
+    constexpr static uint32_t kHeaderSize = 52;     // fixed part of the package directory
+    constexpr static uint32_t kPartEntrySize = 32;
+    constexpr static uint32_t kMaxParts = 32;       // more than any real package has
+
+    std::u16string name_;           // package name, may be empty if it is not in the data that was read
+    uint32_t id_ = 0;               // four character ID, usually 'xxxx'
+    uint32_t flags_ = 0;
+    uint32_t version_ = 0;
+    uint32_t size_ = 0;             // size of the package according to its header
+    uint32_t creation_date_ = 0;    // seconds since January 1st, 1904
+    uint32_t part_count_ = 0;
+    uint32_t file_size_ = 0;        // size of the file on the card
+    bool valid_ = false;            // true if the header looks like a package that we can send
+
+    bool parse(const uint8_t *data, uint32_t size, uint32_t file_size);
+    void clear() { *this = PackageInfo(); }
+};
+
+} // namespace nd
+
+#endif // ND_NEWTON_PACKAGE_INFO_H
@@ -35,10 +35,57 @@ using namespace nd;
 Pipe &Pipe::operator>>(Pipe &pipe) {
     assert(active_); // The output of this pipe is not active. You can't connect a pipe to it.
     out_ = &pipe;
+    next_ = pipe.bypass_ ? pipe.bypass_ : &pipe;
     pipe.in_ = this;
+    relinked();
     return pipe;
 }
 
+/**
+ * @brief Take this pipe out of the event flow while it would only pass events on.
+ *
+ * A pipe that forwards `send()` and `rush()` unchanged to another pipe in
+ * its current mode can declare itself transparent. The pipe that is
+ * connected to its input then sends straight to `to`, and the hop through
+ * this pipe costs nothing. `rush_back()` still goes through this pipe.
+ *
+ * The pipe must call splice_in() before it handles events again, for
+ * example when it changes mode. Splicing rebinds only the pipe that was
+ * connected to this pipe last, so it must not be used on pipes with more
+ * than one input, and both pipes must run in the same partition.
+ *
+ * If `to` depends on other connections, override relinked() and splice
+ * again when they change.
+ *
+ * @param to Where this pipe would pass events. `nullptr` is the same as splice_in().
+ */
+void Pipe::splice_out(Pipe *to) {
+    if (to == this)
+        to = nullptr;
+    if (bypass_ == to)
+        return;
+    bypass_ = to;
+    rebind_();
+}
+
+/**
+ * @brief Put a pipe that was spliced out back into the event flow.
+ */
+void Pipe::splice_in() {
+    if (bypass_ == nullptr)
+        return;
+    bypass_ = nullptr;
+    rebind_();
+}
+
+/**
+ * @brief Point the pipe on the input side to this pipe or past it.
+ */
+void Pipe::rebind_() {
+    if (in_ && in_->out_ == this)
+        in_->next_ = bypass_ ? bypass_ : this;
+}
+
 /**
  * @brief Gets the pipe connected to this pipe on the input side.
  * 
@@ -51,10 +98,13 @@ Pipe *Pipe::in() const {
 /**
  * @brief Gets the output pipe connected to this pipe
  * 
+ * If the connected pipe is spliced out, this is the pipe that it would
+ * pass events to. Use wired_out() to get the pipe that was connected.
+ *
  * @return Pipe* Pointer to the output pipe, or nullptr if no output is connected
  */
 Pipe *Pipe::out() const {
-    return out_;
+    return next_;
 }
 
 /**
@@ -72,8 +122,8 @@ Pipe *Pipe::out() const {
  *         return Result::OK with the Subtype NOT_CONNECTED.
 */
 Result Pipe::send(Event event) {
-    if (out_) {
-        return out_->send(event);
+    if (next_) {
+        return next_->send(event);
     } else {
         return Result::OK__NOT_CONNECTED;
     }
@@ -90,8 +140,8 @@ Result Pipe::send(Event event) {
  * @return the result from the output's `rush()` method or `OK__NOT_CONNECTED`.
  */
 Result Pipe::rush(Event event) {
-    if (out_) {
-        return out_->rush(event);
+    if (next_) {
+        return next_->rush(event);
     } else {
         return Result::OK__NOT_CONNECTED;
     }
@@ -120,7 +170,7 @@ Result Pipe::rush_back(Event event) {
  * @param str The string to be sent
  */
 Result Pipe::send_text(const char* str) {
-    if (!out_) 
+    if (!next_) 
         return Result::OK__NOT_CONNECTED;
     if (!str || !*str) 
         return Result::OK;
@@ -13,9 +13,13 @@ namespace nd {
 class Pipe {
     Pipe *in_ = nullptr;
     Pipe *out_ = nullptr;
+    Pipe *next_ = nullptr;      // out_, or where out_ passes events while it is spliced out
+    Pipe *bypass_ = nullptr;    // set while this pipe is spliced out
     bool active_ = true;
+    void rebind_();
 protected:
     void deactivate() { active_ = false; }
+    virtual void relinked() { }
 public:
     Pipe() = default;
     virtual ~Pipe() = default;
@@ -29,6 +33,12 @@ public:
     void disconnect();
     Pipe *in() const;
     Pipe *out() const;
+    Pipe *wired_out() const { return out_; }
+
+    // -- Fast path splicing
+    void splice_out(Pipe *to);
+    void splice_in();
+    bool spliced_out() const { return bypass_ != nullptr; }
 
     // -- Writing to the next pipe
     virtual Result send(Event event);
@@ -0,0 +1,199 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "BridgePipe.h"
+
+using namespace nd;
+
+/**
+ * @brief A pipe between two schedulers.
+ *
+ * A pipe graph can be split into partitions, each with its own Scheduler
+ * running on its own core or thread. For example, the serial ports can run
+ * on one core while MNP, the Dock, and the SD Card run on the other.
+ *
+ * Every edge that crosses from one partition to another must be a
+ * BridgePipe. Within a partition, everything works as before. Across the
+ * bridge:
+ *  - `send()` queues the event and returns REJECTED only if the ring is full,
+ *  - `rush()` queues the event behind the ones already sent, so the reply
+ *    is just the confirmation that it was queued. The output side rushes
+ *    it on when its turn comes,
+ *  - `rush_back()` from the output side is queued and delivered upstream
+ *    within the next cycle of the input side's scheduler,
+ *  - HIGH_WATER is rushed back upstream when the ring fills up, just like
+ *    BufferedPipe does.
+ *
+ * Cut the graph where plain bytes flow, for example between a UART and its
+ * HayesFilter. MNP frame indices and SD Card requests refer to objects that
+ * are owned by one partition and must not cross a bridge.
+ *
+ * A bridge is allocated like any other pipe, and the caller owns it:
+ * \code
+ *   BridgePipe uart_to_hayes { io, protocol };
+ *   uart >> uart_to_hayes >> hayes.downstream;
+ * \endcode
+ */
+
+// ==== SPSCRing ===============================================================
+
+SPSCRing::SPSCRing(uint8_t buffer_size_pow2)
+:   ring_mask_ { static_cast<uint32_t>((1 << buffer_size_pow2) - 1) }
+{
+    buffer_.resize(ring_mask_ + 1);
+    rush_.resize(ring_mask_ + 1);
+}
+
+/**
+ * \brief Add an event to the ring. Call this from the producer thread only.
+ * \param rush Mark the event as rushed, so the consumer can rush it on.
+ * \return false if the ring is full.
+ */
+bool SPSCRing::push(Event event, bool rush) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t next = (head + 1) & ring_mask_;
+    if (next == tail_cache_) {
+        tail_cache_ = tail_.load(std::memory_order_acquire);
+        if (next == tail_cache_)
+            return false;
+    }
+    buffer_[head] = event.raw();
+    rush_[head] = rush;
+    head_.store(next, std::memory_order_release);
+    return true;
+}
+
+/**
+ * \brief Get the oldest event without removing it. Call this from the consumer thread only.
+ * \return false if the ring is empty.
+ */
+bool SPSCRing::peek(Event &event) {
+    bool rush;
+    return peek(event, rush);
+}
+
+/**
+ * \brief Get the oldest event and whether it was rushed, without removing it.
+ * \return false if the ring is empty.
+ */
+bool SPSCRing::peek(Event &event, bool &rush) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_cache_) {
+        head_cache_ = head_.load(std::memory_order_acquire);
+        if (tail == head_cache_)
+            return false;
+    }
+    event.raw(buffer_[tail]);
+    rush = rush_[tail];
+    return true;
+}
+
+/**
+ * \brief Remove the event returned by the last successful `peek()`.
+ */
+void SPSCRing::pop() {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    tail_.store((tail + 1) & ring_mask_, std::memory_order_release);
+}
+
+uint32_t SPSCRing::used() const {
+    return (head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire)) & ring_mask_;
+}
+
+// ==== BridgePipe =============================================================
+
+/**
+ * \brief Create a bridge from the partition of `from` to the partition of `to`.
+ *
+ * \param from Scheduler of the pipe that sends into the bridge.
+ * \param to Scheduler of the pipe that the bridge sends to.
+ * \param buffer_size_pow2 Size of the ring as a power of two.
+ */
+BridgePipe::BridgePipe(Scheduler &from, Scheduler &to, uint8_t buffer_size_pow2)
+:   Task { to },
+    ring_ { buffer_size_pow2 },
+    back_ring_ { 6 },   // HIGH_WATER and friends, 64 are plenty
+    upstream_ { from, *this },
+    high_water_on_mark_ { ring_.size() - ring_.size()/16 },   // 15/16 full
+    high_water_off_mark_ { ring_.size()/2 }
+{
+}
+
+/**
+ * \brief Forward queued events on the output side until the out pipe rejects one.
+ */
+Result BridgePipe::task() {
+    Event event;
+    bool rush;
+    while (ring_.peek(event, rush)) {
+        if (out() && (rush ? out()->rush(event) : out()->send(event)).rejected())
+            break;
+        ring_.pop();
+        scheduler().busy();
+    }
+    return Result::OK;
+}
+
+/**
+ * \brief Queue an event for the input side, called from the output side.
+ */
+Result BridgePipe::rush_back(Event event) {
+    return back_ring_.push(event) ? Result::OK : Result::REJECTED;
+}
+
+/**
+ * \brief Queue an event for the output side, called from the input side.
+ */
+Result BridgePipe::send(Event event) {
+    return queue_(event, false);
+}
+
+/**
+ * \brief Rushed events can't overtake the queue on another core, so they are
+ * queued, too, and rushed on by the output side.
+ */
+Result BridgePipe::rush(Event event) {
+    return queue_(event, true);
+}
+
+/**
+ * \brief Push an event into the ring and raise HIGH_WATER when it is almost full.
+ */
+Result BridgePipe::queue_(Event event, bool rush) {
+    if (out() == nullptr)
+        return Result::OK__NOT_CONNECTED;
+    if (!ring_.push(event, rush))
+        return Result::REJECTED;
+    if (!high_water_mark_set_ && ring_.used() > high_water_on_mark_) {
+        high_water_mark_set_ = true;
+        Pipe::rush_back(Event { Event::Type::HIGH_WATER, Event::Subtype::ON });
+    }
+    return Result::OK;
+}
+
+// ==== BridgePipe::Upstream ===================================================
+
+BridgePipe::Upstream::Upstream(Scheduler &scheduler, BridgePipe &bridge)
+:   Task { scheduler },
+    bridge_ { bridge }
+{
+}
+
+/**
+ * \brief Forward events that were rushed back, and clear HIGH_WATER on the input side.
+ */
+Result BridgePipe::Upstream::task() {
+    Event event;
+    while (bridge_.back_ring_.peek(event)) {
+        bridge_.Pipe::rush_back(event);
+        bridge_.back_ring_.pop();
+        scheduler().busy();
+    }
+    if (bridge_.high_water_mark_set_ && bridge_.ring_.used() < bridge_.high_water_off_mark_) {
+        bridge_.high_water_mark_set_ = false;
+        bridge_.Pipe::rush_back(Event { Event::Type::HIGH_WATER, Event::Subtype::OFF });
+    }
+    return Result::OK;
+}
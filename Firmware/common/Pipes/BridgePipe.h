@@ -0,0 +1,81 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_PIPES_BRIDGE_PIPE_H
+#define ND_PIPES_BRIDGE_PIPE_H
+
+#include "../Pipe.h"
+#include "../Task.h"
+
+#include <atomic>
+#include <vector>
+
+namespace nd {
+
+/**
+ * \brief Lock-free ring of Events between exactly one producer and one consumer thread.
+ */
+class SPSCRing {
+    std::vector<uint32_t> buffer_;
+    std::vector<uint8_t> rush_; // the event in the same slot of `buffer_` was rushed
+    uint32_t ring_mask_ = 0;
+    alignas(64) std::atomic<uint32_t> head_ { 0 }; // written by the producer only
+    uint32_t tail_cache_ = 0;                       // producer's last view of `tail_`
+    alignas(64) std::atomic<uint32_t> tail_ { 0 }; // written by the consumer only
+    uint32_t head_cache_ = 0;                       // consumer's last view of `head_`
+public:
+    SPSCRing(uint8_t buffer_size_pow2);
+
+    // -- Producer side
+    bool push(Event event, bool rush = false);
+
+    // -- Consumer side
+    bool peek(Event &event);
+    bool peek(Event &event, bool &rush);
+    void pop();
+
+    // -- Either side, the result may be outdated by the time it returns
+    uint32_t used() const;
+    uint32_t size() const { return ring_mask_ + 1; }
+};
+
+/**
+ * \brief Connect two pipe graph partitions that run on different schedulers.
+ *
+ * The bridge belongs to the scheduler `to` on the output side. Events sent
+ * on the input side are queued and forwarded by the task of the output side.
+ * Events rushed back from the output side are queued as well and forwarded
+ * upstream by a helper task on the scheduler `from`.
+ */
+class BridgePipe : public Task {
+    class Upstream : public Task {
+        BridgePipe &bridge_;
+    public:
+        Upstream(Scheduler &scheduler, BridgePipe &bridge);
+        Result task() override;
+    };
+    SPSCRing ring_;
+    SPSCRing back_ring_;
+    Upstream upstream_;
+    uint32_t high_water_on_mark_ = 0;
+    uint32_t high_water_off_mark_ = 0;
+    bool high_water_mark_set_ = false; // only used on the input side
+    Result queue_(Event event, bool rush);
+public:
+    BridgePipe(Scheduler &from, Scheduler &to, uint8_t buffer_size_pow2 = 11);
+    ~BridgePipe() override = default;
+
+    // -- Output side
+    Result task() override;
+    Result rush_back(Event event) override;
+
+    // -- Input side
+    Result send(Event event) override;
+    Result rush(Event event) override;
+};
+
+} // namespace nd
+
+#endif // ND_PIPES_BRIDGE_PIPE_H
@@ -41,18 +41,20 @@ Result BufferedPipe::task() {
 
     Event buffered_event = peek_front();
     Result r = out()->send(buffered_event);
-    if (r.ok())
+    if (r.ok()) {
         pop_front();
+        scheduler().busy();
+    }
 
     if (high_water_mark_set_) {
         if (space() > high_water_off_mark_) {
-            Event event { Event::Type::HIGH_WATER, 0 };
+            Event event { Event::Type::HIGH_WATER, Event::Subtype::OFF };
             r = out()->rush_back(event);
             high_water_mark_set_ = false;
         }
     } else {
         if (space() < high_water_on_mark) {
-            Event event { Event::Type::HIGH_WATER, 1 };
+            Event event { Event::Type::HIGH_WATER, Event::Subtype::ON };
             r = out()->rush_back(event);
             high_water_mark_set_ = true;
         }
@@ -67,7 +69,7 @@ void BufferedPipe::push_back(Event event) {
     head_ = (head_ + 1) & ring_mask_;
     if (!high_water_mark_set_) {
         if (space() < high_water_on_mark) {
-            Event event { Event::Type::HIGH_WATER, 1 };
+            Event event { Event::Type::HIGH_WATER, Event::Subtype::ON };
             out()->rush_back(event);
             high_water_mark_set_ = true;
         }
@@ -80,7 +82,7 @@ Event BufferedPipe::pop_front() {
     tail_ = (tail_ + 1) & ring_mask_;
     if (high_water_mark_set_) {
         if (space() > high_water_off_mark_) {
-            Event event { Event::Type::HIGH_WATER, 0 };
+            Event event { Event::Type::HIGH_WATER, Event::Subtype::OFF };
             out()->rush_back(event);
             high_water_mark_set_ = false;
         }
@@ -0,0 +1,190 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "FanOut.h"
+
+using namespace nd;
+
+/**
+ * @class FanOut
+ * @brief Send every event to the main output and to up to four branches.
+ *
+ * FanOut is a Tee with more branches, where every branch decides how it
+ * handles backpressure:
+ *  - A LOSSLESS branch receives every event exactly once, like `out`. If
+ *    `out` or a lossless branch rejects an event, FanOut keeps it for the
+ *    outputs that rejected it and rejects further events until all of them
+ *    took it.
+ *  - A BEST_EFFORT branch has its own ring buffer. If the ring is full, the
+ *    oldest event is dropped and counted (see dropped()). It never holds
+ *    back the main output, so logging, tracing, or sniffing taps can stay
+ *    connected to the Newton data path.
+ *
+ * \code
+ *   FanOut fan_out(scheduler);
+ *   newt_in >> fan_out >> mnp_filter.newt;
+ *   fan_out.branch(0) >> logger;
+ *   fan_out.set_mode(0, FanOut::Mode::BEST_EFFORT);
+ * \endcode
+ *
+ * Rushed events go to all outputs. Only the result of `out` is returned.
+ * Events that a lossless branch rushes back go upstream, events from a
+ * best-effort branch stop here.
+ *
+ * A FanOut with no branch connected is spliced out of the event flow.
+ */
+
+/**
+ * \brief Create a FanOut with all branches lossless.
+ */
+FanOut::FanOut(Scheduler &scheduler)
+:   Task(scheduler)
+{
+}
+
+/**
+ * \brief Set how a branch handles events that it rejects.
+ *
+ * Events in the ring of a best-effort branch are dropped when the branch
+ * becomes lossless.
+ */
+void FanOut::set_mode(uint8_t ix, Mode mode) {
+    if (ix >= kBranches)
+        return;
+    mode_[ix] = mode;
+    ring_[ix].head_ = ring_[ix].tail_ = 0;
+    pending_ &= ~(1 << ix);
+}
+
+/**
+ * \brief With no branch connected, FanOut is a plain hop.
+ */
+void FanOut::splice_() {
+    for (auto &branch: branches_) {
+        if (branch.wired_out()) {
+            splice_in();
+            return;
+        }
+    }
+    if (pending_ == 0)
+        splice_out(wired_out());
+}
+
+/**
+ * \brief Send the pending event to the outputs that rejected it.
+ * \return true if all outputs have the pending event now.
+ */
+bool FanOut::retry_() {
+    if ((pending_ & kMainOut) && (!out() || out()->send(pending_event_).ok()))
+        pending_ &= ~kMainOut;
+    for (uint8_t i = 0; i < kBranches; i++) {
+        if ((pending_ & (1 << i)) == 0)
+            continue;
+        Pipe *out = branches_[i].out();
+        if (!out || out->send(pending_event_).ok())
+            pending_ &= ~(1 << i);
+    }
+    return pending_ == 0;
+}
+
+/**
+ * \brief Send an event to a best-effort branch, or keep it for later.
+ */
+void FanOut::send_best_effort_(uint8_t ix, Event event) {
+    Ring &ring = ring_[ix];
+    Pipe *out = branches_[ix].out();
+    if (ring.empty()) {
+        if (out->send(event).ok())
+            return;
+        // Continue and buffer the current event
+    } else if (out->send(ring.event_[ring.tail_]).ok()) {
+        ring.tail_ = (ring.tail_ + 1) & kRingMask;
+    }
+    if (ring.full()) {
+        ring.tail_ = (ring.tail_ + 1) & kRingMask;
+        dropped_[ix]++;
+    }
+    ring.event_[ring.head_] = event;
+    ring.head_ = (ring.head_ + 1) & kRingMask;
+}
+
+/**
+ * \brief Events rushed back by lossless branches go upstream.
+ */
+Result FanOut::rush_back_(uint8_t ix, Event event) {
+    if (mode_[ix] == Mode::BEST_EFFORT)
+        return Result::OK__NOT_CONNECTED;
+    return Pipe::rush_back(event);
+}
+
+/**
+ * \brief Send the events that outputs rejected earlier.
+ */
+Result FanOut::task() {
+    if (pending_ && retry_())
+        scheduler().busy();
+    for (uint8_t i = 0; i < kBranches; i++) {
+        Ring &ring = ring_[i];
+        Pipe *out = branches_[i].out();
+        if (!out)
+            continue;
+        while (!ring.empty() && out->send(ring.event_[ring.tail_]).ok()) {
+            ring.tail_ = (ring.tail_ + 1) & kRingMask;
+            scheduler().busy();
+        }
+    }
+    return Result::OK;
+}
+
+/**
+ * \brief Send an event to the main output and all branches.
+ *
+ * \return REJECTED if an earlier event is still waiting for a lossless
+ *         output, else the result of `out`, or OK if `out` will get the
+ *         event later.
+ */
+Result FanOut::send(Event event) {
+    if (pending_ && !retry_())
+        return Result::REJECTED;
+    Result r = Result::OK__NOT_CONNECTED;
+    uint8_t missed = 0;
+    if (out()) {
+        r = out()->send(event);
+        if (!r.ok()) {
+            missed |= kMainOut;
+            r = Result::OK;
+        }
+    }
+    for (uint8_t i = 0; i < kBranches; i++) {
+        Pipe *out = branches_[i].out();
+        if (!out)
+            continue;
+        if (mode_[i] == Mode::BEST_EFFORT)
+            send_best_effort_(i, event);
+        else if (!out->send(event).ok())
+            missed |= (1 << i);
+    }
+    if (missed) {
+        pending_event_ = event;
+        pending_ = missed;
+    }
+    return r;
+}
+
+/**
+ * \brief Rush an event to the main output and all branches.
+ *
+ * @return Result The result of rushing the event to `out`
+ */
+Result FanOut::rush(Event event) {
+    Result r = Result::OK__NOT_CONNECTED;
+    if (out())
+        r = out()->rush(event);
+    for (auto &branch: branches_) {
+        if (branch.out())
+            branch.out()->rush(event);
+    }
+    return r;
+}
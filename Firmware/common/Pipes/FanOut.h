@@ -0,0 +1,80 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_PIPES_FAN_OUT_H
+#define ND_PIPES_FAN_OUT_H
+
+#include "../Pipe.h"
+#include "../Task.h"
+
+#include <array>
+
+namespace nd {
+
+class FanOut: public Task {
+public:
+    constexpr static uint8_t kBranches = 4;
+
+    enum class Mode : uint8_t {
+        LOSSLESS,       // Rejections hold back the main output, nothing is lost
+        BEST_EFFORT     // Own ring buffer, the oldest event is dropped when full
+    };
+
+private:
+    constexpr static uint32_t kRingSize = 64; // per branch, must be a power of 2
+    constexpr static uint32_t kRingMask = kRingSize - 1;
+    constexpr static uint8_t kMainOut = 0x80; // bit in pending_ for out()
+
+    class Branch: public Pipe {
+        FanOut &fan_out_;
+        uint8_t index_;
+    protected:
+        void relinked() override { fan_out_.splice_(); }
+    public:
+        Branch(FanOut &fan_out, uint8_t index) : fan_out_(fan_out), index_(index) { }
+        Result rush_back(Event event) override { return fan_out_.rush_back_(index_, event); }
+    };
+
+    // Events for a best-effort branch that it did not take yet.
+    struct Ring {
+        std::array<Event, kRingSize> event_;
+        uint32_t head_ = 0;
+        uint32_t tail_ = 0;
+        bool empty() const { return head_ == tail_; }
+        bool full() const { return ((head_ + 1) & kRingMask) == tail_; }
+    };
+
+    Branch branches_[kBranches] { { *this, 0 }, { *this, 1 }, { *this, 2 }, { *this, 3 } };
+    Mode mode_[kBranches] = { };
+    Ring ring_[kBranches];
+    uint32_t dropped_[kBranches] = { };
+    Event pending_event_;       // the event that lossless outputs rejected
+    uint8_t pending_ = 0;       // outputs that still need pending_event_
+
+    void splice_();
+    bool retry_();
+    void send_best_effort_(uint8_t ix, Event event);
+    Result rush_back_(uint8_t ix, Event event);
+protected:
+    void relinked() override { splice_(); }
+public:
+    FanOut(Scheduler &scheduler);
+    ~FanOut() override = default;
+
+    Pipe &branch(uint8_t ix) { return branches_[ix]; }
+    void set_mode(uint8_t ix, Mode mode);
+    uint32_t dropped(uint8_t ix) const { return (ix < kBranches) ? dropped_[ix] : 0; }
+
+    // -- Task stuff
+    Result task() override;
+
+    // -- Pipe Stuff
+    Result send(Event event) override;
+    Result rush(Event event) override;
+};
+
+} // namespace nd
+
+#endif // ND_PIPES_FAN_OUT_H
@@ -42,8 +42,9 @@ using namespace nd;
 constexpr uint8_t kDLE = 0x10;
 constexpr uint8_t kETX = 0x03;
 
-MNPThrottle::MNPThrottle(Scheduler &scheduler)
-:   Task(scheduler, Scheduler::TASKS | Scheduler::SIGNALS)
+MNPThrottle::MNPThrottle(Context &context)
+:   Task(context.scheduler_, Scheduler::TASKS | Scheduler::SIGNALS),
+    settings_(context.settings_)
 {
 }
 
@@ -115,8 +116,8 @@ Result MNPThrottle::signal(Event event) {
         return Result::OK;
     switch (event.subtype()) {
         case Event::Subtype::USER_SETTINGS_CHANGED:
-            reg_absolute_delay_ = user_settings.data.mnpt_absolute_delay;
-            reg_num_char_delay_ = user_settings.data.mnpt_num_char_delay;
+            reg_absolute_delay_ = settings_.data.mnpt_absolute_delay;
+            reg_num_char_delay_ = settings_.data.mnpt_num_char_delay;
             break;
         default:
             break;
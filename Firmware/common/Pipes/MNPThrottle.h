@@ -6,6 +6,7 @@
 #ifndef ND_PIPES_MNP_THROTTLE_H
 #define ND_PIPES_MNP_THROTTLE_H
 
+#include "../Context.h"
 #include "../Task.h"
 
 #include <vector>
@@ -25,9 +26,10 @@ class MNPThrottle: public Task {
     uint32_t bitrate_ = 38400;
     uint32_t reg_absolute_delay_ = 400;
     uint32_t reg_num_char_delay_ = 8;
+    UserSettings &settings_;
 
 public:
-    MNPThrottle(Scheduler &scheduler);
+    MNPThrottle(Context &context);
     ~MNPThrottle() override = default;
 
     Result send(Event event) override;
@@ -0,0 +1,195 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_PIPES_STATIC_PIPELINE_H
+#define ND_PIPES_STATIC_PIPELINE_H
+
+#include "../Pipe.h"
+#include "../Task.h"
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+
+namespace nd {
+
+/**
+ * \brief Base class of the stages of a StaticPipeline.
+ *
+ * A stage is not a Pipe. It receives the next hop as a template argument,
+ * so the compiler sees the whole chain and can inline it. A stage overrides
+ * what it needs by hiding these methods:
+ *  - `send(event, next)` is called for every event, `next.send()` passes
+ *    it on, and `next.rush_back()` sends an event upstream,
+ *  - `task(next)` is called once per scheduler cycle,
+ *  - `signal(event)` receives the scheduler signals.
+ *
+ * `rush()` and events rushed back from the output side pass the stages
+ * without stopping.
+ */
+class PipeStage {
+public:
+    template<class Next> Result send(Event event, Next &next) { return next.send(event); }
+    template<class Next> Result task(Next &next) { (void)next; return Result::OK; }
+    Result signal(Event event) { (void)event; return Result::OK; }
+};
+
+/**
+ * \brief A chain of stages that is fixed at compile time and looks like a single Pipe.
+ *
+ * Inside the pipeline, every hop is a direct call that the compiler can
+ * inline, instead of a virtual `send()` and a test for a connected pipe.
+ * On both edges, the pipeline is a regular Pipe and Task, so it connects
+ * to the dynamic graph with `>>`:
+ * \code
+ *   StaticPipeline<StaticBuffer<11>> buffer_to_uart(scheduler);
+ *   ...
+ *   hayes.downstream >> buffer_to_uart >> uart;
+ * \endcode
+ */
+template<class... Stages>
+class StaticPipeline : public Task {
+    constexpr static std::size_t kStages = sizeof...(Stages);
+    std::tuple<Stages...> stages_;
+
+    // The hop into stage I, or into the output pipe if I is kStages.
+    template<std::size_t I>
+    class Next {
+        StaticPipeline &pipeline_;
+    public:
+        explicit Next(StaticPipeline &pipeline) : pipeline_ { pipeline } { }
+        Result send(Event event) { return pipeline_.template send_<I>(event); }
+        Result rush_back(Event event) { return pipeline_.template rush_back_<I>(event); }
+        bool connected() const { return pipeline_.out() != nullptr; }
+        Scheduler &scheduler() const { return pipeline_.scheduler(); }
+    };
+
+    template<std::size_t I>
+    Result send_(Event event) {
+        if constexpr (I == kStages) {
+            return Pipe::send(event);
+        } else {
+            Next<I + 1> next { *this };
+            return std::get<I>(stages_).send(event, next);
+        }
+    }
+
+    // Rushing back into the output pipe may be answered there (see
+    // Endpoint::rush_back()). Anywhere else, the event goes upstream.
+    template<std::size_t I>
+    Result rush_back_(Event event) {
+        if constexpr (I == kStages) {
+            return out() ? out()->rush_back(event) : Result::OK__NOT_CONNECTED;
+        } else {
+            return Pipe::rush_back(event);
+        }
+    }
+
+    template<std::size_t I>
+    Result task_() {
+        if constexpr (I == kStages) {
+            return Result::OK;
+        } else {
+            Next<I + 1> next { *this };
+            Result r = std::get<I>(stages_).task(next);
+            Result rest = task_<I + 1>();
+            return r.ok() ? rest : r;
+        }
+    }
+
+public:
+    StaticPipeline(Scheduler &scheduler)
+    :   Task(scheduler, Scheduler::TASKS | Scheduler::SIGNALS) { }
+    ~StaticPipeline() override = default;
+
+    /// Access a stage, for example to configure it.
+    template<std::size_t I>
+    auto &stage() { return std::get<I>(stages_); }
+
+    // -- Task stuff
+    Result task() override { return task_<0>(); }
+    Result signal(Event event) override {
+        std::apply([event](auto &...stage) { (stage.signal(event), ...); }, stages_);
+        return Result::OK;
+    }
+
+    // -- Writing to the next pipe
+    Result send(Event event) override { return send_<0>(event); }
+};
+
+/**
+ * \brief A ring buffer stage with a size that is fixed at compile time.
+ *
+ * This works like BufferedPipe, but the ring is a std::array inside the
+ * stage, and the size and mask are constants. HIGH_WATER is rushed back
+ * into the next hop when fewer than 1/16 of the slots are free, and cleared
+ * when more than 3/32 are free again.
+ *
+ * \tparam kSizePow2 The ring holds 2^kSizePow2 - 1 events.
+ */
+template<uint8_t kSizePow2 = 11>
+class StaticBuffer : public PipeStage {
+    constexpr static uint32_t kSize = 1U << kSizePow2;
+    constexpr static uint32_t kMask = kSize - 1;
+    constexpr static uint32_t kHighWaterOnMark = kSize / 16;
+    constexpr static uint32_t kHighWaterOffMark = kSize / 32 * 3;
+    std::array<Event, kSize> ring_ { };
+    uint32_t head_ = 0;
+    uint32_t tail_ = 0;
+    bool high_water_mark_set_ = false;
+
+    uint32_t free_() const { return kMask - ((head_ - tail_) & kMask); }
+
+    template<class Next>
+    void update_high_water_(Next &next) {
+        if (high_water_mark_set_) {
+            if (free_() > kHighWaterOffMark) {
+                high_water_mark_set_ = false;
+                next.rush_back(Event { Event::Type::HIGH_WATER, Event::Subtype::OFF });
+            }
+        } else if (free_() < kHighWaterOnMark) {
+            high_water_mark_set_ = true;
+            next.rush_back(Event { Event::Type::HIGH_WATER, Event::Subtype::ON });
+        }
+    }
+
+public:
+    template<class Next>
+    Result send(Event event, Next &next) {
+        if (!next.connected())
+            return Result::OK__NOT_CONNECTED;
+        if (head_ == tail_) {
+            Result r = next.send(event);
+            if (r.ok())
+                return r;
+            // Continue and buffer the current event
+        } else if (next.send(ring_[tail_]).ok()) {
+            tail_ = (tail_ + 1) & kMask;
+        }
+        if (((head_ + 1) & kMask) == tail_)
+            return Result::REJECTED;
+        ring_[head_] = event;
+        head_ = (head_ + 1) & kMask;
+        update_high_water_(next);
+        return Result::OK;
+    }
+
+    template<class Next>
+    Result task(Next &next) {
+        if (head_ == tail_)
+            return Result::OK;
+        Result r = next.send(ring_[tail_]);
+        if (r.ok()) {
+            tail_ = (tail_ + 1) & kMask;
+            next.scheduler().busy();
+            update_high_water_(next);
+        }
+        return r;
+    }
+};
+
+} // namespace nd
+
+#endif // ND_PIPES_STATIC_PIPELINE_H
@@ -22,6 +22,16 @@ using namespace nd;
  * @see Pipe The parent class that defines the basic pipe interface
  */
 
+/**
+ * @brief A Tee with nothing connected to 'b' is a plain hop, so it is spliced out.
+ */
+void Tee::splice_() {
+    if (b.wired_out())
+        splice_in();
+    else
+        splice_out(wired_out());
+}
+
 /**
  * @brief Sends an event to both destinations in the tee.
  *
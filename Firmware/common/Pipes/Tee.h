@@ -11,11 +11,21 @@
 namespace nd {
 
 class Tee: public Pipe {
+    class Branch: public Pipe {
+        Tee &tee_;
+    protected:
+        void relinked() override { tee_.splice_(); }
+    public:
+        Branch(Tee &tee) : tee_(tee) { }
+    };
+    void splice_();
+protected:
+    void relinked() override { splice_(); }
 public:
     Tee() = default;
     ~Tee() override = default;
 
-    Pipe b;
+    Branch b { *this };
 
     // -- Pipe Stuff
     Result send(Event event) override;
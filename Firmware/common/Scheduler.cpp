@@ -11,6 +11,14 @@ using namespace nd;
 
 /** \class Scheduler 
  * 
+ * Tasks that wait for time to pass tell the scheduler with wake_in(), and
+ * tasks that moved data or changed state tell it with busy(). If no task
+ * was busy in a cycle, the scheduler calls idle() with the shortest wait,
+ * which lets a virtual clock jump ahead (see VirtualClock).
+ *
+ * Tasks that only need to run at a deadline arm a Timer instead of polling.
+ * Expired timers are handled at the start of every cycle, before the tasks
+ * are called, and count as work done.
  */
 
 Scheduler &Scheduler::add(Task &task, uint8_t job_map) {
@@ -30,11 +38,16 @@ void Scheduler::init() {
 void Scheduler::run(int n) {
     for (; (n == -1) || (n > 0); ) {
         update_time();
+        // -- Send the TIMER signal to the owners of all expired timers
+        if (timers_.advance(now_))
+            busy_ = true;
         // -- Call all registered tasks
         for (auto &task : task_list_) {
             task->task();
         }
         // -- Forward all signals to registered tasks
+        if (!signal_queue_.empty())
+            busy_ = true;
         while (!signal_queue_.empty()) {
             Event event = signal_queue_.front();
             signal_queue_.pop();
@@ -42,6 +55,13 @@ void Scheduler::run(int n) {
                 task->signal(event);
             }
         }
+        // -- Let the clock skip ahead if all tasks are waiting for time to pass
+        if (!busy_)
+            wake_in(timers_.next_in());
+        if (!busy_ && wake_in_ != kNever)
+            idle(wake_in_);
+        busy_ = false;
+        wake_in_ = kNever;
         // -- Update the time and the ticks
         ticks_++;
         if (n > 0) --n;
@@ -7,6 +7,7 @@
 #define ND_SCHEDULER_H
 
 #include "Event.h"
+#include "Timer.h"
 
 #include <forward_list>
 #include <queue>
@@ -19,18 +20,25 @@ class Task;
 /** \brief Call the tasks of all registered Endpoints in an endless loop. */
 class Scheduler 
 {
+    friend class Timer;
     std::forward_list<Task*> task_list_;
     std::forward_list<Task*> signal_list_;
     std::queue<Event> signal_queue_;
+    TimerWheel timers_;
 
 protected:
     uint32_t ticks_ = 0;
     uint32_t cycle_time_ = 1;
+    uint64_t now_ = 0;
+    bool busy_ = false;
+    uint32_t wake_in_ = kNever;
     virtual void update_time() = 0;
+    virtual void idle(uint32_t /*usec*/) { }
     
 public:
     constexpr static uint8_t TASKS = 0x01;
     constexpr static uint8_t SIGNALS = 0x02;
+    constexpr static uint32_t kNever = 0xffffffff;
 
     Scheduler() = default;
     virtual ~Scheduler() = default;
@@ -52,6 +60,12 @@ public:
     // -- Additional scheduler features
     uint32_t ticks() const { return ticks_; }
     uint32_t cycle_time() const;
+    /// Microseconds since the scheduler started.
+    uint64_t now() const { return now_; }
+    /// A task did some work in this cycle.
+    void busy() { busy_ = true; }
+    /// A task waits for time to pass, and wants to run again in `usec` microseconds.
+    void wake_in(uint32_t usec) { if (usec < wake_in_) wake_in_ = usec; }
 };
 
 } // namespace nd
@@ -63,6 +63,10 @@ Task::Task(Scheduler &scheduler, uint8_t job_map)
  * The scheduler provides the time in usec since the last call to task()
  * in Scheduler::cycle_time().
  * 
+ * A task that moved data or changed its state should call Scheduler::busy().
+ * A task that waits for a timeout should call Scheduler::wake_in() with the
+ * remaining time, so that a virtual clock can skip the wait.
+ * 
  * \return Result::OK, the value is currently not used.
  */
 
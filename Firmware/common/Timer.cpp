@@ -0,0 +1,217 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#include "Timer.h"
+
+#include "Scheduler.h"
+#include "Task.h"
+
+using namespace nd;
+
+/**
+ * @class Timer
+ * @brief Wake a task up after some time, without polling.
+ *
+ * A task that has to wait, for example for the end of a guard time or a
+ * transmission delay, arms a Timer instead of adding up cycle_time() in
+ * every call to task(). When the time is up, the scheduler calls
+ * `signal(Event(Event::Type::SIGNAL, Event::Subtype::TIMER, id))` of the
+ * owning task, and only of that task.
+ *
+ * Arming, rearming, and canceling a timer take constant time. A timer fires
+ * in the first scheduler cycle at or after its deadline, so the precision is
+ * the cycle time of the scheduler. Timers that expire in the same cycle fire
+ * in no particular order.
+ *
+ * \code
+ *   Timer guard_timer_ { *this, kGuardTimer };
+ *   ...
+ *   guard_timer_.arm(1'000'000); // in one second
+ * \endcode
+ */
+
+/**
+ * \brief Create a timer that is not armed yet.
+ * \param task The task that receives the TIMER signal.
+ * \param id Sent with the signal, so a task can tell its timers apart.
+ */
+Timer::Timer(Task &task, uint32_t id)
+:   task_ { task },
+    id_ { id }
+{
+}
+
+Timer::~Timer() {
+    cancel();
+}
+
+/**
+ * \brief Fire `usec` microseconds from now, even if the timer was already armed.
+ * A delay of 0 fires in the next scheduler cycle.
+ */
+void Timer::arm(uint32_t usec) {
+    TimerWheel &wheel = task_.scheduler().timers_;
+    wheel.arm(*this, wheel.now() + (usec ? usec : 1));
+}
+
+/**
+ * \brief Move the deadline of an armed timer back by `usec`, or arm it.
+ */
+void Timer::extend(uint32_t usec) {
+    if (armed())
+        task_.scheduler().timers_.arm(*this, deadline_ + usec);
+    else
+        arm(usec);
+}
+
+/**
+ * \brief Stop the timer. Nothing happens if the timer is not armed.
+ */
+void Timer::cancel() {
+    if (armed())
+        task_.scheduler().timers_.cancel(*this);
+}
+
+// ==== TimerWheel =============================================================
+
+/**
+ * @class TimerWheel
+ * @brief Keep any number of timers sorted by deadline in constant time.
+ *
+ * The wheel has six levels of 64 slots. A slot on level 0 is 1 usec wide, a
+ * slot on level 1 is 64 usec wide, and so on. A timer goes into the lowest
+ * level that can hold its deadline. When the time reaches a slot on a
+ * higher level, its timers are sorted into the lower levels again, or fire.
+ *
+ * A bitmap per level marks the slots that hold timers, so a scheduler cycle
+ * without a deadline costs a few shifts and compares, no matter how much
+ * time has passed or how many timers are armed. The same bitmaps give the
+ * time to the next deadline (see Scheduler::wake_in()).
+ */
+
+static inline uint64_t rotl64(uint64_t x, unsigned n) {
+    n &= 63;
+    return n ? (x << n) | (x >> (64 - n)) : x;
+}
+
+static inline uint64_t rotr64(uint64_t x, unsigned n) {
+    n &= 63;
+    return n ? (x >> n) | (x << (64 - n)) : x;
+}
+
+/**
+ * \brief Add a timer to the slot for its deadline. The deadline must be after now_.
+ */
+void TimerWheel::insert_(Timer &timer) {
+    int level = 0;
+    unsigned shift = 0;
+    for ( ; level < kLevels - 1; level++, shift += kSlotBits) {
+        if ((timer.deadline_ >> shift) - (now_ >> shift) < kSlots)
+            break;
+    }
+    uint32_t slot = (timer.deadline_ >> shift) & (kSlots - 1);
+    uint16_t index = level * kSlots + slot;
+    timer.slot_ = index;
+    timer.next_ = slot_[index];
+    if (timer.next_) timer.next_->prev_ = &timer.next_;
+    timer.prev_ = &slot_[index];
+    slot_[index] = &timer;
+    occupied_[level] |= 1ULL << slot;
+}
+
+/**
+ * \brief Remove a timer from its slot or from the list of expired timers.
+ */
+void TimerWheel::unlink_(Timer &timer) {
+    *timer.prev_ = timer.next_;
+    if (timer.next_) timer.next_->prev_ = timer.prev_;
+    if (timer.slot_ != kExpired && slot_[timer.slot_] == nullptr)
+        occupied_[timer.slot_ / kSlots] &= ~(1ULL << (timer.slot_ % kSlots));
+    timer.next_ = nullptr;
+    timer.prev_ = nullptr;
+}
+
+/**
+ * \brief Arm or rearm a timer for an absolute time.
+ * Deadlines in the past fire in the next cycle.
+ */
+void TimerWheel::arm(Timer &timer, uint64_t deadline) {
+    if (timer.armed())
+        unlink_(timer);
+    timer.deadline_ = (deadline > now_) ? deadline : now_ + 1;
+    insert_(timer);
+}
+
+void TimerWheel::cancel(Timer &timer) {
+    unlink_(timer);
+}
+
+/**
+ * \brief Move the time forward and send the TIMER signal for all timers that expired.
+ * \return true if at least one timer fired.
+ */
+bool TimerWheel::advance(uint64_t now) {
+    if (now <= now_)
+        return false;
+    // -- Collect the timers in all slots that the time passed, on every level
+    unsigned shift = 0;
+    for (int level = 0; level < kLevels; level++, shift += kSlotBits) {
+        uint64_t from = now_ >> shift, to = now >> shift;
+        if (from == to)
+            break; // no higher level moves either
+        uint64_t passed = (to - from >= kSlots) ? ~0ULL : rotl64((1ULL << (to - from)) - 1, from + 1);
+        uint64_t due = passed & occupied_[level];
+        while (due) {
+            unsigned slot = __builtin_ctzll(due);
+            due &= due - 1;
+            Timer **head = &slot_[level * kSlots + slot];
+            while (*head) {
+                Timer *timer = *head;
+                unlink_(*timer);
+                timer->slot_ = kExpired;
+                timer->next_ = expired_;
+                if (expired_) expired_->prev_ = &timer->next_;
+                timer->prev_ = &expired_;
+                expired_ = timer;
+            }
+        }
+    }
+    now_ = now;
+    // -- Fire what is due and sort the rest into the lower levels
+    bool fired = false;
+    while (expired_) {
+        Timer *timer = expired_;
+        unlink_(*timer);
+        if (timer->deadline_ <= now_) {
+            fired = true;
+            timer->task_.signal(Event(Event::Type::SIGNAL, Event::Subtype::TIMER, timer->id_));
+        } else {
+            insert_(*timer);
+        }
+    }
+    return fired;
+}
+
+/**
+ * \brief Time until the wheel needs to advance again.
+ * This is exact for timers within 64 usec, and a lower bound for the others.
+ * \return Microseconds, or Scheduler::kNever if no timer is armed.
+ */
+uint32_t TimerWheel::next_in() const {
+    uint64_t next = UINT64_MAX;
+    unsigned shift = 0;
+    for (int level = 0; level < kLevels; level++, shift += kSlotBits) {
+        if (!occupied_[level])
+            continue;
+        uint64_t from = now_ >> shift;
+        uint64_t slot = from + 1 + __builtin_ctzll(rotr64(occupied_[level], from + 1));
+        if ((slot << shift) < next)
+            next = slot << shift;
+    }
+    if (next == UINT64_MAX)
+        return Scheduler::kNever;
+    uint64_t usec = next - now_;
+    return (usec < Scheduler::kNever) ? (uint32_t)usec : Scheduler::kNever - 1;
+}
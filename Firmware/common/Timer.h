@@ -0,0 +1,73 @@
+//
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Matthias Melcher, robowerk.de
+//
+
+#ifndef ND_TIMER_H
+#define ND_TIMER_H
+
+#include <cstdint>
+
+namespace nd {
+
+class Task;
+class TimerWheel;
+
+/**
+ * \brief A one-shot timer that sends the TIMER signal to the task that owns it.
+ */
+class Timer {
+    friend class TimerWheel;
+    Task &task_;
+    uint32_t id_ = 0;           // sent as data with the TIMER signal
+    uint64_t deadline_ = 0;     // see Scheduler::now()
+    Timer *next_ = nullptr;
+    Timer **prev_ = nullptr;    // nullptr if the timer is not armed
+    uint16_t slot_ = 0;
+public:
+    Timer(Task &task, uint32_t id = 0);
+    ~Timer();
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+    Timer(Timer&&) = delete;
+    Timer& operator=(Timer&&) = delete;
+
+    void arm(uint32_t usec);
+    void extend(uint32_t usec);
+    void cancel();
+    bool armed() const { return prev_ != nullptr; }
+    uint32_t id() const { return id_; }
+    uint64_t deadline() const { return deadline_; }
+};
+
+/**
+ * \brief Hierarchical timer wheel, one per Scheduler.
+ */
+class TimerWheel {
+    constexpr static int kLevels = 6;   // 64^6 usec covers any 32 bit delay
+    constexpr static int kSlotBits = 6;
+    constexpr static int kSlots = 1 << kSlotBits;
+    constexpr static uint16_t kExpired = kLevels * kSlots;
+    Timer *slot_[kLevels * kSlots] = { };
+    uint64_t occupied_[kLevels] = { }; // one bit for every slot that holds a timer
+    Timer *expired_ = nullptr;
+    uint64_t now_ = 0;
+    void insert_(Timer &timer);
+    void unlink_(Timer &timer);
+public:
+    TimerWheel() = default;
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+    TimerWheel(TimerWheel&&) = delete;
+    TimerWheel& operator=(TimerWheel&&) = delete;
+
+    void arm(Timer &timer, uint64_t deadline);
+    void cancel(Timer &timer);
+    bool advance(uint64_t now);
+    uint32_t next_in() const;
+    uint64_t now() const { return now_; }
+};
+
+} // namespace nd
+
+#endif // ND_TIMER_H